@@ -0,0 +1,162 @@
+/**
+ * backpressure_bench.cpp
+ * Behaviour of a bounded queue in front of a slow downstream listener under
+ * each overflow policy.
+ *
+ * A PricingService publishes prices for seven Treasuries as fast as it can into
+ * a QueuedListener whose worker thread feeds a listener that spends a fixed
+ * time on every update. For each policy the producer throughput and the queue
+ * metrics are reported, and the run is checked:
+ *
+ *   block        every price is delivered and the depth never exceeds capacity
+ *   drop_oldest  delivered plus dropped prices account for every price
+ *   conflate     delivered plus conflated prices account for every price, and
+ *                the last price delivered per product is the last one published
+ *
+ * Any violation makes the process exit non-zero.
+ *
+ * Usage: backpressure_bench [--events N] [--capacity C] [--work-ns W] [--out results.json]
+ */
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "benchutil.hpp"
+#include "products.hpp"
+#include "pricingservice.hpp"
+#include "boundedqueue.hpp"
+#include "tickgenerator.hpp"
+
+namespace {
+
+// Spends a fixed time per update and remembers the last mid per product
+class SlowListener : public ServiceListener<Price<Bond>>
+{
+
+public:
+
+  explicit SlowListener(uint64_t _workNanos) : workNanos(_workNanos), delivered(0) {}
+
+  void ProcessAdd(Price<Bond> &data) override {
+    uint64_t until = NowNanos() + workNanos;
+    while (NowNanos() < until) {}
+    lastMid[data.GetProduct().GetProductId()] = data.GetMid();
+    ++delivered;
+  }
+
+  void ProcessRemove(Price<Bond> &data) override {}
+  void ProcessUpdate(Price<Bond> &data) override { ProcessAdd(data); }
+
+  uint64_t workNanos;
+  uint64_t delivered;
+  std::map<std::string, double> lastMid;
+};
+
+// Counts watermark crossings
+class PressureCounter : public QueuePressureListener
+{
+
+public:
+
+  void OnHighWatermark(const std::string &queue, size_t depth) override { ++highs; }
+  void OnLowWatermark(const std::string &queue, size_t depth) override { ++lows; }
+
+  uint64_t highs = 0;
+  uint64_t lows = 0;
+};
+
+std::string PriceKey(const Price<Bond> &price) { return price.GetProduct().GetProductId(); }
+
+struct PolicyRun
+{
+  StageResult stage;
+  QueueMetrics metrics;
+  uint64_t delivered;
+  uint64_t highs;
+  bool consistent;
+};
+
+PolicyRun Run(const std::string &name, OverflowPolicy policy, std::vector<Price<Bond>> &prices, size_t capacity, uint64_t workNanos) {
+  PricingService<Bond> pricing;
+  SlowListener slow(workNanos);
+  PressureCounter pressure;
+  QueueOptions options;
+  options.capacity = capacity;
+  options.policy = policy;
+  QueuedListener<Price<Bond>> queued(slow, name, options, &PriceKey);
+  queued.GetQueue().SetPressureListener(&pressure);
+  pricing.AddListener(&queued);
+  queued.Start();
+
+  PolicyRun run;
+  uint64_t start = NowNanos();
+  for (Price<Bond> &price : prices) pricing.OnMessage(price);
+  run.stage.name = name;
+  run.stage.events = prices.size();
+  run.stage.seconds = (NowNanos() - start) / 1e9;
+  run.stage.mean = run.stage.seconds * 1e9 / prices.size();
+  queued.Stop();
+
+  run.metrics = queued.GetMetrics();
+  run.delivered = slow.delivered;
+  run.highs = pressure.highs;
+  const uint64_t published = prices.size();
+  run.consistent = run.metrics.maxDepth <= capacity && run.metrics.dequeued == run.delivered;
+  if (policy == OVERFLOW_BLOCK) run.consistent = run.consistent && run.delivered == published && run.metrics.dropped == 0;
+  if (policy == OVERFLOW_DROP_OLDEST) run.consistent = run.consistent && run.delivered + run.metrics.dropped == published;
+  if (policy == OVERFLOW_CONFLATE) {
+    run.consistent = run.consistent && run.delivered + run.metrics.conflated == published;
+    std::map<std::string, double> lastPublished;
+    for (Price<Bond> &price : prices) lastPublished[PriceKey(price)] = price.GetMid();
+    run.consistent = run.consistent && lastPublished == slow.lastMid;
+  }
+  return run;
+}
+
+}
+
+int main(int argc, char **argv) {
+  const size_t events = static_cast<size_t>(ArgValue(argc, argv, "--events", 200000));
+  const size_t capacity = static_cast<size_t>(ArgValue(argc, argv, "--capacity", 256));
+  const uint64_t workNanos = static_cast<uint64_t>(ArgValue(argc, argv, "--work-ns", 2000));
+  const std::string outPath = ArgString(argc, argv, "--out", "");
+
+  const std::vector<Bond> bonds = OnTheRunTreasuries();
+  std::vector<Price<Bond>> prices;
+  prices.reserve(events);
+  for (size_t i = 0; i < events; ++i) prices.push_back(Price<Bond>(bonds[i % bonds.size()], 99.0 + (i % 256) / 256.0, 1 / 128.0));
+
+  const std::string names[] = { "block", "drop_oldest", "conflate" };
+  const OverflowPolicy policies[] = { OVERFLOW_BLOCK, OVERFLOW_DROP_OLDEST, OVERFLOW_CONFLATE };
+  std::vector<StageResult> results;
+  std::vector<std::pair<std::string, double>> parameters = {
+    { "events", static_cast<double>(events) },
+    { "capacity", static_cast<double>(capacity) },
+    { "work_ns", static_cast<double>(workNanos) }
+  };
+  int failures = 0;
+  for (int i = 0; i < 3; ++i) {
+    PolicyRun run = Run(names[i], policies[i], prices, capacity, workNanos);
+    results.push_back(run.stage);
+    parameters.push_back({ names[i] + ".delivered", static_cast<double>(run.delivered) });
+    parameters.push_back({ names[i] + ".dropped", static_cast<double>(run.metrics.dropped) });
+    parameters.push_back({ names[i] + ".conflated", static_cast<double>(run.metrics.conflated) });
+    parameters.push_back({ names[i] + ".blocked_ms", run.metrics.blockedNanos / 1e6 });
+    parameters.push_back({ names[i] + ".max_depth", static_cast<double>(run.metrics.maxDepth) });
+    parameters.push_back({ names[i] + ".high_watermarks", static_cast<double>(run.highs) });
+    if (!run.consistent) {
+      std::cerr << "Inconsistent delivery under policy " << names[i] << std::endl;
+      ++failures;
+    }
+  }
+
+  if (outPath.empty()) {
+    WriteJson(std::cout, "backpressure", parameters, results);
+  } else {
+    std::ofstream out(outPath);
+    WriteJson(out, "backpressure", parameters, results);
+  }
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,188 @@
+/**
+ * batch_bench.cpp
+ * Loading an end of day trade file into PositionService one trade at a time
+ * and in batches.
+ *
+ * Stages, reported as trades per second:
+ *
+ *   AddTrade.loop       AddTrade once per trade
+ *   AddTrades.all       the whole file as one batch
+ *   AddTrades.chunked   the file in batches of --chunk trades, as a streaming
+ *                       loader would pass it
+ *   SumQuantities.simd    the vectorized reduction over every signed quantity
+ *   SumQuantities.scalar  the same reduction one element at a time
+ *
+ * Every service must end with the same position in every product and book as
+ * the one-at-a-time load, and the batch loads must notify listeners once per
+ * position touched rather than once per trade. A desk / book rollup fed in
+ * batches must match one fed trade by trade, as must a batch read through an
+ * iterator that yields trades by value, and the two reductions must agree.
+ * Any violation makes the process exit non-zero.
+ *
+ * Usage: batch_bench [--trades N] [--products P] [--books B] [--chunk C] [--out results.json]
+ */
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "boost/iterator/transform_iterator.hpp"
+#include "benchdata.hpp"
+#include "benchutil.hpp"
+#include "products.hpp"
+#include "positionservice.hpp"
+
+namespace {
+
+// Counts the position updates it hears about
+class CountingPositionListener : public ServiceListener<Position<Bond>>
+{
+
+public:
+
+  void ProcessAdd(Position<Bond>&) override {}
+  void ProcessRemove(Position<Bond>&) override {}
+  void ProcessUpdate(Position<Bond>&) override { ++updates; }
+
+  size_t updates = 0;
+};
+
+// Distinct products among the trades in [begin, end)
+size_t DistinctProducts(const std::vector<Trade<Bond>> &trades, size_t begin, size_t end) {
+  std::unordered_set<std::string> products;
+  for (size_t t = begin; t < end; ++t) products.insert(trades[t].GetProduct().GetProductId());
+  return products.size();
+}
+
+}
+
+int main(int argc, char **argv) {
+  const size_t tradeCount = static_cast<size_t>(ArgValue(argc, argv, "--trades", 10000000));
+  const size_t productCount = static_cast<size_t>(ArgValue(argc, argv, "--products", 10000));
+  const size_t bookCount = static_cast<size_t>(ArgValue(argc, argv, "--books", 50));
+  const size_t chunk = static_cast<size_t>(ArgValue(argc, argv, "--chunk", 65536));
+  const std::string outPath = ArgString(argc, argv, "--out", "");
+
+  const std::vector<Bond> bonds = MakeUniverse(productCount);
+  std::vector<std::string> books;
+  for (size_t book = 0; book < bookCount; ++book) books.push_back("BOOK" + std::to_string(book));
+  std::vector<Trade<Bond>> trades;
+  trades.reserve(tradeCount);
+  std::vector<int64_t> quantities;
+  quantities.reserve(tradeCount);
+  uint64_t state = 88172645463325252ULL;
+  for (size_t t = 0; t < tradeCount; ++t) {
+    state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+    long quantity = static_cast<long>(1 + (state >> 32) % 10) * 1000000L;
+    Side side = (state >> 40) & 1 ? BUY : SELL;
+    trades.push_back(Trade<Bond>(bonds[state % productCount], std::to_string(t), 99.5, books[(state >> 20) % bookCount], quantity, side));
+    quantities.push_back(side == BUY ? quantity : -quantity);
+  }
+
+  ServiceCapacity capacity;
+  capacity.products = productCount;
+  PositionService<Bond> loop(capacity), all(capacity), chunked(capacity);
+  CountingPositionListener loopListener, allListener, chunkedListener;
+  loop.AddListener(&loopListener);
+  all.AddListener(&allListener);
+  chunked.AddListener(&chunkedListener);
+
+  std::vector<StageResult> results;
+  results.push_back(TimeBlock("AddTrade.loop", tradeCount, [&]() { for (const Trade<Bond> &trade : trades) loop.AddTrade(trade); }));
+  results.push_back(TimeBlock("AddTrades.all", tradeCount, [&]() { all.AddTrades(trades); }));
+  results.push_back(TimeBlock("AddTrades.chunked", tradeCount, [&]() {
+    for (size_t begin = 0; begin < tradeCount; begin += chunk) {
+      chunked.AddTrades(trades.begin() + begin, trades.begin() + std::min(begin + chunk, tradeCount));
+    }
+  }));
+  int64_t simd = 0, scalar = 0;
+  const size_t reductions = 20;
+  results.push_back(TimeBlock("SumQuantities.simd", tradeCount * reductions, [&]() {
+    for (size_t r = 0; r < reductions; ++r) simd += SumQuantities(quantities.data() + r % 2, tradeCount - r % 2);
+  }));
+  results.push_back(TimeBlock("SumQuantities.scalar", tradeCount * reductions, [&]() {
+    for (size_t r = 0; r < reductions; ++r) scalar += SumQuantitiesScalar(quantities.data() + r % 2, tradeCount - r % 2);
+  }));
+
+  int failures = 0;
+  size_t different = 0;
+  for (const Bond &bond : bonds) {
+    const Position<Bond> *reference = loop.TryGetData(bond.GetProductId());
+    if (!reference) continue;
+    const Position<Bond> *batched = all.TryGetData(bond.GetProductId());
+    const Position<Bond> *streamed = chunked.TryGetData(bond.GetProductId());
+    if (!batched || !streamed) {
+      ++different;
+      continue;
+    }
+    different += (batched->GetPositions() != reference->GetPositions()) + (streamed->GetPositions() != reference->GetPositions());
+  }
+  if (different) {
+    std::cerr << different << " positions differ from the one-at-a-time load" << std::endl;
+    ++failures;
+  }
+  size_t chunkedTouched = 0;
+  for (size_t begin = 0; begin < tradeCount; begin += chunk) chunkedTouched += DistinctProducts(trades, begin, std::min(begin + chunk, tradeCount));
+  if (loopListener.updates != tradeCount || allListener.updates != DistinctProducts(trades, 0, tradeCount) || chunkedListener.updates != chunkedTouched) {
+    std::cerr << "Listeners heard " << loopListener.updates << ", " << allListener.updates << " and " << chunkedListener.updates << " updates" << std::endl;
+    ++failures;
+  }
+
+  // Rollups follow batches the same as single trades
+  std::map<std::string, std::string> desks;
+  for (size_t book = 0; book < bookCount; ++book) desks[books[book]] = "DESK" + std::to_string(book / 10);
+  PositionService<Bond> single(capacity), batched(capacity);
+  PositionRollup<Bond> singleRollup({ DeskLevel<Bond>(desks), BookLevel<Bond>() }), batchedRollup({ DeskLevel<Bond>(desks), BookLevel<Bond>() });
+  single.AddRollup(singleRollup);
+  batched.AddRollup(batchedRollup);
+  const size_t rolled = std::min(tradeCount, chunk * 4);
+  for (size_t t = 0; t < rolled; ++t) single.AddTrade(trades[t]);
+  for (size_t begin = 0; begin < rolled; begin += chunk) batched.AddTrades(trades.begin() + begin, trades.begin() + std::min(begin + chunk, rolled));
+  size_t differentNodes = singleRollup.Size() != batchedRollup.Size();
+  for (size_t handle = 0; handle < singleRollup.Size(); ++handle) {
+    const RollupNode &node = singleRollup.GetNode(static_cast<uint32_t>(handle));
+    uint32_t other = batchedRollup.Find(node.path);
+    if (other == PositionRollup<Bond>::NO_NODE || batchedRollup.GetPosition(other) != node.position) ++differentNodes;
+  }
+  if (differentNodes) {
+    std::cerr << differentNodes << " rollup nodes fed in batches differ from those fed trade by trade" << std::endl;
+    ++failures;
+  }
+  // Iterators that hand out trades by value load the same positions
+  PositionService<Bond> copied(capacity);
+  auto copy = [](const Trade<Bond> &trade) { return trade; };
+  copied.AddTrades(boost::make_transform_iterator(trades.begin(), copy), boost::make_transform_iterator(trades.begin() + rolled, copy));
+  size_t differentCopied = 0;
+  for (const Bond &bond : bonds) {
+    const Position<Bond> *reference = single.TryGetData(bond.GetProductId());
+    const Position<Bond> *loaded = copied.TryGetData(bond.GetProductId());
+    if (!reference != !loaded || (reference && loaded->GetPositions() != reference->GetPositions())) ++differentCopied;
+  }
+  if (differentCopied) {
+    std::cerr << differentCopied << " positions loaded through a by-value iterator differ" << std::endl;
+    ++failures;
+  }
+  if (simd != scalar) {
+    std::cerr << "Vectorized quantity sum " << simd << " differs from the scalar sum " << scalar << std::endl;
+    ++failures;
+  }
+
+  std::vector<std::pair<std::string, double>> parameters = {
+    { "trades", static_cast<double>(tradeCount) },
+    { "products", static_cast<double>(productCount) },
+    { "books", static_cast<double>(bookCount) },
+    { "chunk", static_cast<double>(chunk) },
+    { "loop_notifications", static_cast<double>(loopListener.updates) },
+    { "batch_notifications", static_cast<double>(allListener.updates) },
+    { "chunked_notifications", static_cast<double>(chunkedListener.updates) }
+  };
+  if (outPath.empty()) {
+    WriteJson(std::cout, "batch", parameters, results);
+  } else {
+    std::ofstream out(outPath);
+    WriteJson(out, "batch", parameters, results);
+  }
+  return failures ? 1 : 0;
+}
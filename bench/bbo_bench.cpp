@@ -0,0 +1,154 @@
+/**
+ * bbo_bench.cpp
+ * GetBestBidOffer throughput from the cached top of book, alone and while a
+ * market data thread keeps storing order books.
+ *
+ * Stages, reported as calls per second:
+ *
+ *   scan             recomputing the best bid and offer from the stored book
+ *                    on every call, the cost the cache removes
+ *   product_id       cached lookup by product identifier
+ *   handle           cached lookup by product handle
+ *   handle.concurrent  reader threads looking up by handle while a writer
+ *                    thread stores a new book for some product on every step
+ *
+ * Books are built with scrambled stacks, and the cached best bid and offer are
+ * checked against the true best by price. Every book the writer stores carries
+ * its generation in its sizes, which fixes its top of book, so a reader that
+ * saw half of an update would see the two sides disagree. Any mismatch or torn read makes the process
+ * exit non-zero.
+ *
+ * Usage: bbo_bench [--calls N] [--products P] [--updates U] [--readers R] [--out results.json]
+ */
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "benchdata.hpp"
+#include "benchutil.hpp"
+#include "products.hpp"
+#include "marketdataservice.hpp"
+
+namespace {
+
+// Whether a cached top of book is one the writer could have stored: both
+// sides from the same MakeOrderBook generation, read back from the bid size
+bool Consistent(const BidOffer &bidOffer) {
+  const Order &bid = bidOffer.GetBidOrder();
+  const Order &offer = bidOffer.GetOfferOrder();
+  const long g = (bid.GetQuantity() - 1000000) / 1000;
+  const double mid = 99.0 + (g % 256) / 256.0;
+  const double spread = (1 + g % 4) / 128.0;
+  return offer.GetQuantity() == bid.GetQuantity() + 500 && bid.GetPrice() == mid - spread / 2 && offer.GetPrice() == mid + spread / 2;
+}
+
+// Best bid and offer by scanning the stored book, as computed before the cache
+BidOffer Scan(const OrderBook<Bond> &book) {
+  Order bestBid = book.GetBidStack().front();
+  for (const Order &order : book.GetBidStack()) if (order.GetPrice() > bestBid.GetPrice()) bestBid = order;
+  Order bestOffer = book.GetOfferStack().front();
+  for (const Order &order : book.GetOfferStack()) if (order.GetPrice() < bestOffer.GetPrice()) bestOffer = order;
+  return BidOffer(bestBid, bestOffer);
+}
+
+}
+
+int main(int argc, char **argv) {
+  const size_t calls = static_cast<size_t>(ArgValue(argc, argv, "--calls", 10000000));
+  const size_t productCount = static_cast<size_t>(ArgValue(argc, argv, "--products", 64));
+  const size_t updates = static_cast<size_t>(ArgValue(argc, argv, "--updates", 1000000));
+  const size_t readerCount = static_cast<size_t>(ArgValue(argc, argv, "--readers", 2));
+  const std::string outPath = ArgString(argc, argv, "--out", "");
+
+  const std::vector<Bond> bonds = MakeUniverse(productCount);
+  std::vector<std::string> productIds;
+  for (const Bond &bond : bonds) productIds.push_back(bond.GetProductId());
+
+  ServiceCapacity capacity;
+  capacity.products = productCount;
+  MarketDataService<Bond> service(capacity);
+  service.WarmUp();
+  std::vector<MarketDataService<Bond>::ProductHandle> handles;
+  int failures = 0;
+  for (size_t i = 0; i < productCount; ++i) {
+    OrderBook<Bond> book = MakeOrderBook(bonds[i], i, 5, 1 / 256.0, true);
+    service.OnMessage(book);
+    handles.push_back(service.GetProductHandle(productIds[i]));
+    const BidOffer cached = service.GetBestBidOffer(handles[i]);
+    const BidOffer scanned = Scan(book);
+    if (cached.GetBidOrder().GetPrice() != scanned.GetBidOrder().GetPrice() || cached.GetOfferOrder().GetPrice() != scanned.GetOfferOrder().GetPrice() ||
+        cached.GetBidOrder().GetQuantity() != scanned.GetBidOrder().GetQuantity() || !Consistent(cached)) {
+      std::cerr << "Cached top of book for " << productIds[i] << " is not the best by price" << std::endl;
+      ++failures;
+    }
+  }
+
+  std::vector<StageResult> results;
+  double sink = 0.0;
+  results.push_back(TimeBlock("scan", calls, [&]() {
+    for (size_t i = 0; i < calls; ++i) sink += Scan(service.GetData(productIds[i % productCount])).GetBidOrder().GetPrice();
+  }));
+  results.push_back(TimeBlock("product_id", calls, [&]() {
+    for (size_t i = 0; i < calls; ++i) sink += service.GetBestBidOffer(productIds[i % productCount]).GetBidOrder().GetPrice();
+  }));
+  results.push_back(TimeBlock("handle", calls, [&]() {
+    for (size_t i = 0; i < calls; ++i) sink += service.GetBestBidOffer(handles[i % productCount]).GetBidOrder().GetPrice();
+  }));
+
+  // Readers spin on handles until the writer has stored every update
+  std::vector<OrderBook<Bond>> books;
+  books.reserve(updates);
+  for (size_t u = 0; u < updates; ++u) books.push_back(MakeOrderBook(bonds[u % productCount], productCount + u, 5, 1 / 256.0, true));
+  std::atomic<bool> done(false);
+  std::atomic<uint64_t> reads(0), torn(0);
+  std::vector<std::thread> readers;
+  uint64_t start = NowNanos();
+  for (size_t r = 0; r < readerCount; ++r) {
+    readers.emplace_back([&, r]() {
+      uint64_t count = 0, bad = 0;
+      size_t i = r;
+      while (!done.load(std::memory_order_relaxed)) {
+        if (!Consistent(service.GetBestBidOffer(handles[i++ % productCount]))) ++bad;
+        ++count;
+      }
+      reads.fetch_add(count);
+      torn.fetch_add(bad);
+    });
+  }
+  std::thread writer([&]() {
+    for (OrderBook<Bond> &book : books) service.OnMessage(book);
+    done.store(true);
+  });
+  writer.join();
+  for (std::thread &reader : readers) reader.join();
+  StageResult concurrent;
+  concurrent.name = "handle.concurrent";
+  concurrent.events = reads.load();
+  concurrent.seconds = (NowNanos() - start) / 1e9;
+  concurrent.mean = concurrent.events ? concurrent.seconds * 1e9 * readerCount / concurrent.events : 0.0;
+  results.push_back(concurrent);
+  if (torn.load()) {
+    std::cerr << torn.load() << " torn top of book reads under concurrent updates" << std::endl;
+    ++failures;
+  }
+
+  std::vector<std::pair<std::string, double>> parameters = {
+    { "calls", static_cast<double>(calls) },
+    { "products", static_cast<double>(productCount) },
+    { "updates", static_cast<double>(updates) },
+    { "readers", static_cast<double>(readerCount) },
+    { "writer_updates_per_sec", updates / concurrent.seconds },
+    { "cpus", static_cast<double>(std::thread::hardware_concurrency()) },
+    { "checksum", sink }
+  };
+  if (outPath.empty()) {
+    WriteJson(std::cout, "bbo", parameters, results);
+  } else {
+    std::ofstream out(outPath);
+    WriteJson(out, "bbo", parameters, results);
+  }
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,58 @@
+/**
+ * benchdata.hpp
+ * Synthetic bonds and order books shared by the benchmarks.
+ */
+#ifndef BENCH_DATA_HPP
+#define BENCH_DATA_HPP
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "products.hpp"
+#include "marketdataservice.hpp"
+
+/**
+ * Synthetic bond number n, identified as "SYN<n>" and its own ticker unless
+ * one is given.
+ */
+inline Bond SyntheticBond(size_t n, const std::string &ticker = "", date maturity = date(2030, Jun, 30)) {
+  const std::string id = "SYN" + std::to_string(n);
+  return Bond(id, CUSIP, ticker.empty() ? id : ticker, 0.02f, maturity);
+}
+
+/**
+ * A universe of count synthetic bonds numbered from base.
+ */
+inline std::vector<Bond> MakeUniverse(size_t count, size_t base = 100000) {
+  std::vector<Bond> bonds;
+  bonds.reserve(count);
+  for (size_t i = 0; i < count; ++i) bonds.push_back(SyntheticBond(base + i));
+  return bonds;
+}
+
+/**
+ * Order book of depth levels a side around a mid that drifts with the event
+ * index i, the spread cycling through one to four 128ths. Level n sits n ticks
+ * behind the touch and holds n + 1 million plus i % 1024 thousand on the bid
+ * and 500 more on the offer, so a book's generation can be read back from its
+ * sizes. scrambled rotates both stacks so the touch is not their first entry.
+ */
+template<typename T>
+OrderBook<T> MakeOrderBook(const T &product, size_t i, int depth = 5, double tick = 1 / 256.0, bool scrambled = false) {
+  const double mid = 99.0 + (i % 256) / 256.0;
+  const double spread = (1 + i % 4) / 128.0;
+  std::vector<Order> bids, offers;
+  bids.reserve(depth);
+  offers.reserve(depth);
+  for (int k = 0; k < depth; ++k) {
+    const int level = scrambled ? (k + depth / 2) % depth : k;
+    const long quantity = (level + 1) * 1000000L + static_cast<long>(i % 1024) * 1000;
+    bids.push_back(Order(mid - spread / 2 - level * tick, quantity, BID));
+    offers.push_back(Order(mid + spread / 2 + level * tick, quantity + 500, OFFER));
+  }
+  return OrderBook<T>(product, std::move(bids), std::move(offers));
+}
+
+#endif // BENCH_DATA_HPP
@@ -0,0 +1,213 @@
+/**
+ * benchutil.hpp
+ * Timing, latency percentile and JSON reporting helpers shared by the benchmarks.
+ */
+#ifndef BENCH_UTIL_HPP
+#define BENCH_UTIL_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+/**
+ * Monotonic nanosecond clock used for all benchmark timings.
+ */
+inline uint64_t NowNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Throughput and latency percentiles for one benchmark stage.
+ */
+struct StageResult
+{
+  std::string name;
+  uint64_t events = 0;
+  double seconds = 0.0;
+  double p50 = 0.0;
+  double p99 = 0.0;
+  double p999 = 0.0;
+  double max = 0.0;
+  double mean = 0.0;
+
+  // Events processed per second
+  double Throughput() const { return seconds > 0.0 ? events / seconds : 0.0; }
+};
+
+/**
+ * Collects one latency sample per event and reduces them into a StageResult.
+ */
+class LatencyRecorder
+{
+
+public:
+
+  // ctor reserving room for the expected number of samples
+  explicit LatencyRecorder(size_t expectedSamples) { samples.reserve(expectedSamples); }
+
+  // Record one latency sample in nanoseconds
+  void Record(uint64_t nanos) { samples.push_back(nanos); }
+
+  // Reduce the samples into percentiles for a stage that ran for the given wall time
+  StageResult Summarize(const std::string &name, double seconds) {
+    StageResult result;
+    result.name = name;
+    result.events = samples.size();
+    result.seconds = seconds;
+    if (samples.empty()) return result;
+
+    std::sort(samples.begin(), samples.end());
+    double total = 0.0;
+    for (uint64_t sample : samples) total += sample;
+    result.p50 = Percentile(0.50);
+    result.p99 = Percentile(0.99);
+    result.p999 = Percentile(0.999);
+    result.max = samples.back();
+    result.mean = total / samples.size();
+    return result;
+  }
+
+private:
+  std::vector<uint64_t> samples;
+
+  // Nearest-rank percentile on the sorted samples
+  double Percentile(double quantile) const {
+    size_t rank = static_cast<size_t>(quantile * (samples.size() - 1) + 0.5);
+    return samples[std::min(rank, samples.size() - 1)];
+  }
+};
+
+/**
+ * Runs fn once per event index, timing each call and the stage as a whole.
+ */
+template<typename F>
+StageResult TimeStage(const std::string &name, size_t events, F fn) {
+  LatencyRecorder recorder(events);
+  uint64_t start = NowNanos();
+  for (size_t i = 0; i < events; ++i) {
+    uint64_t before = NowNanos();
+    fn(i);
+    recorder.Record(NowNanos() - before);
+  }
+  double seconds = (NowNanos() - start) / 1e9;
+  return recorder.Summarize(name, seconds);
+}
+
+/**
+ * Runs fn() once and times it as one block, reporting the mean over events.
+ * For stages whose events are too short for a timer read around each one.
+ */
+template<typename F>
+StageResult TimeBlock(const std::string &name, size_t events, F fn) {
+  StageResult stage;
+  stage.name = name;
+  stage.events = events;
+  uint64_t start = NowNanos();
+  fn();
+  stage.seconds = (NowNanos() - start) / 1e9;
+  stage.mean = events ? stage.seconds * 1e9 / events : 0.0;
+  return stage;
+}
+
+/**
+ * Stage result for events counted and timed by the caller, typically across
+ * threads, reporting the mean over events.
+ */
+inline StageResult Stage(const std::string &name, uint64_t events, double seconds) {
+  StageResult stage;
+  stage.name = name;
+  stage.events = events;
+  stage.seconds = seconds;
+  stage.mean = events ? seconds * 1e9 / events : 0.0;
+  return stage;
+}
+
+/**
+ * Average cost of one NowNanos() call, reported alongside the results since
+ * every per-event latency sample includes one timer read.
+ */
+inline double TimerOverheadNanos() {
+  const int reads = 100000;
+  volatile uint64_t sink = 0;
+  uint64_t start = NowNanos();
+  for (int i = 0; i < reads; ++i) sink = NowNanos();
+  (void)sink;
+  return static_cast<double>(NowNanos() - start) / reads;
+}
+
+/**
+ * Write results as a single JSON document so runs can be diffed and tracked.
+ */
+inline void WriteJson(std::ostream &out, const std::string &benchmark, const std::vector<std::pair<std::string, double>> &parameters, const std::vector<StageResult> &results) {
+  out << "{\n  \"benchmark\": \"" << benchmark << "\",\n  \"parameters\": {";
+  for (size_t i = 0; i < parameters.size(); ++i) {
+    out << (i ? ", " : "") << "\"" << parameters[i].first << "\": " << parameters[i].second;
+  }
+  out << "},\n  \"stages\": [\n";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const StageResult &r = results[i];
+    out << "    {\"name\": \"" << r.name << "\", \"events\": " << r.events << ", \"seconds\": " << r.seconds
+        << ", \"throughput_per_sec\": " << r.Throughput() << ", \"latency_ns\": {\"p50\": " << r.p50
+        << ", \"p99\": " << r.p99 << ", \"p99.9\": " << r.p999 << ", \"max\": " << r.max << ", \"mean\": " << r.mean << "}}"
+        << (i + 1 < results.size() ? ",\n" : "\n");
+  }
+  out << "  ]\n}\n";
+}
+
+/**
+ * Stream buffer that discards everything written to it, used to silence
+ * services that log every event to std::cout while they are being timed.
+ */
+class NullBuffer : public std::streambuf
+{
+
+protected:
+
+  int overflow(int c) override { return c; }
+
+  std::streamsize xsputn(const char *, std::streamsize count) override { return count; }
+};
+
+/**
+ * Redirects std::cout into a NullBuffer for the lifetime of the object.
+ */
+class ScopedSilence
+{
+
+public:
+
+  ScopedSilence() : previous(std::cout.rdbuf(&sink)) {}
+
+  ~ScopedSilence() { std::cout.rdbuf(previous); }
+
+private:
+  NullBuffer sink;
+  std::streambuf *previous;
+};
+
+/**
+ * Parse "--name value" style numeric options, falling back to a default.
+ */
+inline double ArgValue(int argc, char **argv, const std::string &name, double fallback) {
+  for (int i = 1; i + 1 < argc; ++i) {
+    if (name == argv[i]) return std::atof(argv[i + 1]);
+  }
+  return fallback;
+}
+
+/**
+ * Parse "--name value" style string options, falling back to a default.
+ */
+inline std::string ArgString(int argc, char **argv, const std::string &name, const std::string &fallback) {
+  for (int i = 1; i + 1 < argc; ++i) {
+    if (name == argv[i]) return argv[i + 1];
+  }
+  return fallback;
+}
+
+#endif // BENCH_UTIL_HPP
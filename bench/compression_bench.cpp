@@ -0,0 +1,280 @@
+/**
+ * compression_bench.cpp
+ * Compression ratio and speed of block-compressed journals, and the cost of
+ * replaying from them.
+ *
+ * A synthetic session is written to --dir both as text journals and as block
+ * journals. For each journal the text is cut into the same line-aligned
+ * blocks a BlockJournalWriter makes, and stages report per line:
+ *
+ *   Compress.<journal>    BlockCompressor over every block
+ *   Decompress.<journal>  BlockDecompress of every block back
+ *   Replay.text           the whole session read through ReplayEngine from text
+ *   Replay.blocks         the same from the block journals
+ *   Seek.<journal>        Seek to a random timestamp and read the line there
+ *
+ * Ratios and MB/s of raw text are reported in the parameters. Every block
+ * must decompress to its original bytes and every block journal must read
+ * back line for line as its text journal. A seek must land on the first line
+ * at or after its timestamp having decompressed at most two blocks, replay
+ * must see the same events from either format, from the start and from the
+ * middle of the session, and a truncated block must be refused, as must a
+ * block journal whose index or blocks are damaged, a line appended to a
+ * closed block journal and an order book line with an impossible depth. Any
+ * violation makes the process exit non-zero. The journals are removed
+ * afterwards.
+ *
+ * Usage: compression_bench [--events N] [--seeks S] [--seed S] [--dir D] [--out results.json]
+ */
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "benchutil.hpp"
+#include "blockcompression.hpp"
+#include "replayengine.hpp"
+#include "tickgenerator.hpp"
+
+namespace {
+
+// Cut text into blocks of whole lines of at least blockBytes, as BlockJournalWriter does
+std::vector<std::string> SplitBlocks(const std::string &text, size_t blockBytes) {
+  std::vector<std::string> blocks;
+  size_t start = 0;
+  while (start < text.size()) {
+    size_t end = text.find('\n', std::min(start + blockBytes, text.size()) - 1);
+    end = end == std::string::npos ? text.size() : end + 1;
+    blocks.push_back(text.substr(start, end - start));
+    start = end;
+  }
+  return blocks;
+}
+
+}
+
+int main(int argc, char **argv) {
+  const uint64_t eventCount = static_cast<uint64_t>(ArgValue(argc, argv, "--events", 1000000));
+  const size_t seeks = static_cast<size_t>(ArgValue(argc, argv, "--seeks", 1000));
+  const std::string dir = ArgString(argc, argv, "--dir", ".");
+  const std::string outPath = ArgString(argc, argv, "--out", "");
+  TickGeneratorConfig config;
+  config.seed = static_cast<uint64_t>(ArgValue(argc, argv, "--seed", 9815));
+  const std::vector<Bond> bonds = OnTheRunTreasuries();
+  {
+    TickGenerator generator(bonds, config);
+    WriteTickJournals(generator, eventCount, dir, JOURNAL_TEXT);
+  }
+  {
+    TickGenerator generator(bonds, config);
+    WriteTickJournals(generator, eventCount, dir, JOURNAL_BLOCKS);
+  }
+
+  int failures = 0;
+  std::vector<StageResult> results;
+  std::vector<std::pair<std::string, double>> parameters = {
+    { "events", static_cast<double>(eventCount) },
+    { "block_bytes", static_cast<double>(BLOCK_JOURNAL_BLOCK_BYTES) }
+  };
+  const char* const names[] = { MARKET_DATA_JOURNAL, PRICE_JOURNAL, TRADE_JOURNAL, INQUIRY_JOURNAL };
+  const char* const labels[] = { "marketdata", "prices", "trades", "inquiries" };
+  BlockCompressor compressor;
+  uint64_t seekState = 88172645463325252ULL;
+  uint64_t middle = 0;
+  for (int j = 0; j < 4; ++j) {
+    const std::string label = labels[j];
+    std::ifstream textFile(JournalPath(dir, names[j], JOURNAL_TEXT));
+    std::stringstream contents;
+    contents << textFile.rdbuf();
+    const std::string text = contents.str();
+    std::vector<std::string> lines;
+    for (size_t start = 0; start < text.size();) {
+      const size_t end = text.find('\n', start);
+      lines.push_back(text.substr(start, end - start));
+      start = end + 1;
+    }
+    if (lines.empty()) continue;
+    if (j == 0) middle = JournalParser::Timestamp(lines[lines.size() / 2]);
+
+    const std::vector<std::string> blocks = SplitBlocks(text, BLOCK_JOURNAL_BLOCK_BYTES);
+    std::vector<std::vector<char>> compressed(blocks.size());
+    size_t compressedBytes = 0;
+    StageResult compress = TimeBlock("Compress." + label, lines.size(), [&]() {
+      for (size_t b = 0; b < blocks.size(); ++b) compressedBytes += compressor.Compress(blocks[b].data(), blocks[b].size(), compressed[b]);
+    });
+    std::vector<std::string> restored(blocks.size());
+    for (size_t b = 0; b < blocks.size(); ++b) restored[b].resize(blocks[b].size());
+    StageResult decompress = TimeBlock("Decompress." + label, lines.size(), [&]() {
+      for (size_t b = 0; b < blocks.size(); ++b) BlockDecompress(compressed[b].data(), compressed[b].size(), &restored[b][0], restored[b].size());
+    });
+    results.push_back(compress);
+    results.push_back(decompress);
+    if (restored != blocks) {
+      std::cerr << label << " blocks did not decompress to their original bytes" << std::endl;
+      ++failures;
+    }
+
+    // The block journal written alongside must hold the same lines
+    const std::string blockPath = JournalPath(dir, names[j], JOURNAL_BLOCKS);
+    size_t fileBytes = 0;
+    {
+      std::ifstream blockFile(blockPath, std::ios::binary | std::ios::ate);
+      fileBytes = static_cast<size_t>(blockFile.tellg());
+    }
+    BlockJournalReader reader(blockPath);
+    std::string line;
+    size_t matched = 0;
+    while (reader.NextLine(line) && matched < lines.size() && line == lines[matched]) ++matched;
+    if (matched != lines.size() || reader.NextLine(line)) {
+      std::cerr << label << " block journal differs from the text journal at line " << matched << std::endl;
+      ++failures;
+    }
+
+    // Seeks read from the block holding the timestamp
+    size_t wrongSeeks = 0, maxBlocks = 0;
+    const size_t seekCount = std::min(seeks, lines.size());
+    BlockJournalReader seeker(blockPath);
+    results.push_back(TimeStage("Seek." + label, seekCount, [&](size_t) {
+      seekState ^= seekState << 13; seekState ^= seekState >> 7; seekState ^= seekState << 17;
+      const size_t target = seekState % lines.size();
+      const uint64_t timestamp = JournalParser::Timestamp(lines[target]);
+      const uint64_t before = seeker.BlocksDecompressed();
+      seeker.Seek(timestamp);
+      size_t first = target;
+      while (first > 0 && JournalParser::Timestamp(lines[first - 1]) >= timestamp) --first;
+      if (!seeker.NextLine(line) || line != lines[first]) ++wrongSeeks;
+      maxBlocks = std::max<size_t>(maxBlocks, seeker.BlocksDecompressed() - before);
+    }));
+    if (wrongSeeks || maxBlocks > 2) {
+      std::cerr << label << ": " << wrongSeeks << " seeks landed on the wrong line, up to " << maxBlocks << " blocks read per seek" << std::endl;
+      ++failures;
+    }
+
+    parameters.push_back({ label + "_raw_bytes", static_cast<double>(text.size()) });
+    parameters.push_back({ label + "_ratio", static_cast<double>(text.size()) / compressedBytes });
+    parameters.push_back({ label + "_file_ratio", static_cast<double>(text.size()) / fileBytes });
+    parameters.push_back({ label + "_compress_mb_per_sec", text.size() / compress.seconds / 1e6 });
+    parameters.push_back({ label + "_decompress_mb_per_sec", text.size() / decompress.seconds / 1e6 });
+    parameters.push_back({ label + "_blocks", static_cast<double>(reader.GetIndex().size()) });
+  }
+
+  // Replay counts events alike from either format, with and without a start time
+  TickSinks sinks;
+  ReplayStats fromText[2], fromBlocks[2];
+  for (int pass = 0; pass < 2; ++pass) {
+    const uint64_t start = pass ? middle : 0;
+    ReplayEngine textEngine(bonds, sinks);
+    ReplayEngine blockEngine(bonds, sinks);
+    for (int j = 0; j < 4; ++j) {
+      textEngine.AddJournal(static_cast<TickType>(j), JournalPath(dir, names[j], JOURNAL_TEXT));
+      blockEngine.AddJournal(static_cast<TickType>(j), JournalPath(dir, names[j], JOURNAL_BLOCKS));
+    }
+    textEngine.SetStart(start);
+    blockEngine.SetStart(start);
+    StageResult text = TimeBlock("Replay.text", eventCount, [&]() { fromText[pass] = textEngine.Run(REPLAY_MAX_SPEED); });
+    StageResult blocks = TimeBlock("Replay.blocks", eventCount, [&]() { fromBlocks[pass] = blockEngine.Run(REPLAY_MAX_SPEED); });
+    if (!pass) {
+      results.push_back(text);
+      results.push_back(blocks);
+    }
+    bool same = fromText[pass].events == fromBlocks[pass].events && fromText[pass].recordedNanos == fromBlocks[pass].recordedNanos;
+    for (int j = 0; j < 4; ++j) same = same && fromText[pass].eventsByType[j] == fromBlocks[pass].eventsByType[j];
+    if (!same || (pass == 0 && fromText[pass].events != eventCount) || (pass == 1 && fromText[pass].events >= eventCount)) {
+      std::cerr << "Replay from " << start << " saw " << fromText[pass].events << " text and " << fromBlocks[pass].events << " block events" << std::endl;
+      ++failures;
+    }
+  }
+  parameters.push_back({ "replay_from_middle_events", static_cast<double>(fromBlocks[1].events) });
+
+  // A truncated block must be refused rather than read past
+  std::vector<char> sample;
+  const std::string prices = "1000,SYN100000,99.50000000,0.00781250\n1001,SYN100000,99.50390625,0.00781250\n";
+  compressor.Compress(prices.data(), prices.size(), sample);
+  std::string output(prices.size(), '\0');
+  bool refused = false;
+  try {
+    BlockDecompress(sample.data(), sample.size() - 3, &output[0], output.size());
+  } catch (const std::runtime_error&) {
+    refused = true;
+  }
+  if (!refused) {
+    std::cerr << "A truncated block was decompressed without error" << std::endl;
+    ++failures;
+  }
+
+  // Damaged block journals must be refused with an error, not read or sized from
+  const std::string damagedPath = dir + "/damaged" + BLOCK_JOURNAL_SUFFIX;
+  std::string journal;
+  {
+    BlockJournalWriter writer(damagedPath);
+    writer.AppendLine(1000, "1000,x", 6);
+    writer.Close();
+    bool refusedAppend = false;
+    try {
+      writer.AppendLine(1001, "1001,y", 6);
+    } catch (const std::runtime_error&) {
+      refusedAppend = true;
+    }
+    if (!refusedAppend) {
+      std::cerr << "A line appended to a closed block journal was accepted" << std::endl;
+      ++failures;
+    }
+  }
+  {
+    std::ifstream in(damagedPath, std::ios::binary);
+    std::stringstream bytes;
+    bytes << in.rdbuf();
+    journal = bytes.str();
+  }
+  auto refuses = [&](const std::string &damaged) {
+    std::ofstream(damagedPath, std::ios::binary | std::ios::trunc) << damaged;
+    try {
+      BlockJournalReader damagedReader(damagedPath);
+      std::string damagedLine;
+      while (damagedReader.NextLine(damagedLine)) {}
+    } catch (const std::runtime_error&) {
+      return true;
+    }
+    return false;
+  };
+  std::string hugeIndex = journal, unterminated = journal;
+  const uint64_t blockCount = uint64_t(1) << 40;
+  std::memcpy(&hugeIndex[hugeIndex.size() - sizeof(BlockJournalWriter::Trailer) + sizeof(uint64_t)], &blockCount, sizeof(blockCount));
+  unterminated[sizeof(BlockJournalWriter::FILE_MAGIC) + 6] = 'x';  // the stored block's newline
+  const bool refusedIndex = refuses(hugeIndex), refusedLine = refuses(unterminated), readIntact = !refuses(journal);
+  if (!refusedIndex || !refusedLine || !readIntact) {
+    std::cerr << "Damaged block journals: oversized index " << (refusedIndex ? "refused" : "accepted") << ", unterminated block "
+              << (refusedLine ? "refused" : "accepted") << ", intact copy " << (readIntact ? "read" : "refused") << std::endl;
+    ++failures;
+  }
+  std::remove(damagedPath.c_str());
+
+  // An order book line whose depth it cannot hold is refused before any allocation
+  const JournalParser parser(bonds);
+  const std::string productId = bonds.front().GetProductId();
+  for (const std::string &depth : { "-1", "4000000000000" }) {
+    try {
+      parser.ParseOrderBook("1000," + productId + "," + depth + ",99.5,1000000,99.6,1000000");
+      std::cerr << "An order book line of depth " << depth << " was parsed" << std::endl;
+      ++failures;
+    } catch (const std::runtime_error&) {
+    }
+  }
+
+  for (const char *name : names) {
+    std::remove(JournalPath(dir, name, JOURNAL_TEXT).c_str());
+    std::remove(JournalPath(dir, name, JOURNAL_BLOCKS).c_str());
+  }
+  parameters.push_back({ "timer_overhead_ns", TimerOverheadNanos() });
+  if (outPath.empty()) {
+    WriteJson(std::cout, "compression", parameters, results);
+  } else {
+    std::ofstream out(outPath);
+    WriteJson(out, "compression", parameters, results);
+  }
+  return failures ? 1 : 0;
+}
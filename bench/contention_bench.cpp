@@ -0,0 +1,147 @@
+/**
+ * contention_bench.cpp
+ * Trade booking throughput into positions from 1 to 16 threads, comparing a
+ * PositionService behind one global mutex with the lock-striped
+ * ConcurrentPositionService.
+ *
+ * In the disjoint scenario each thread trades its own products; in the shared
+ * scenario every thread trades the same seven Treasuries.
+ *
+ * Finally threads trade the shared products with a listener attached, and the
+ * last position each product was notified with must equal the stored one, so
+ * notifications of a key follow the order of its stores; otherwise the
+ * process exits non-zero.
+ *
+ * Usage: contention_bench [--trades N] [--out results.json]
+ */
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "benchdata.hpp"
+#include "benchutil.hpp"
+#include "concurrentservice.hpp"
+#include "tickgenerator.hpp"
+
+namespace {
+
+const int MAX_THREADS = 16;
+const int PRODUCTS_PER_THREAD = 8;
+
+// Trades for one thread, drawn from its own products or from the shared set
+std::vector<Trade<Bond>> ThreadTrades(const std::vector<Bond> &bonds, int thread, bool shared, size_t count) {
+  std::vector<Trade<Bond>> trades;
+  trades.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    const Bond &bond = shared ? bonds[i % 7] : bonds[thread * PRODUCTS_PER_THREAD + i % PRODUCTS_PER_THREAD];
+    trades.push_back(Trade<Bond>(bond, std::to_string(i), 100.0, TRADING_BOOKS[i % 3], 1000000, i % 2 ? SELL : BUY));
+  }
+  return trades;
+}
+
+template<typename F>
+double RunThreads(int threads, F work) {
+  std::vector<std::thread> workers;
+  uint64_t start = NowNanos();
+  for (int t = 0; t < threads; ++t) workers.emplace_back(work, t);
+  for (std::thread &worker : workers) worker.join();
+  return (NowNanos() - start) / 1e9;
+}
+
+// Remembers the last aggregate position notified for each product
+class LastPositionListener : public ServiceListener<Position<Bond>>
+{
+
+public:
+
+  void ProcessAdd(Position<Bond> &data) override { ProcessUpdate(data); }
+  void ProcessRemove(Position<Bond> &) override {}
+  void ProcessUpdate(Position<Bond> &data) override {
+    std::lock_guard<std::mutex> lock(mutex);
+    last[data.GetProduct().GetProductId()] = data.GetAggregatePosition();
+  }
+
+  std::mutex mutex;
+  std::map<std::string, long> last;
+};
+
+}
+
+int main(int argc, char **argv) {
+  const size_t tradesPerThread = static_cast<size_t>(ArgValue(argc, argv, "--trades", 200000));
+  const std::string outPath = ArgString(argc, argv, "--out", "");
+  const std::vector<Bond> bonds = MakeUniverse(MAX_THREADS * PRODUCTS_PER_THREAD);
+
+  std::vector<StageResult> results;
+  for (bool shared : { false, true }) {
+    std::vector<std::vector<Trade<Bond>>> trades;
+    for (int t = 0; t < MAX_THREADS; ++t) trades.push_back(ThreadTrades(bonds, t, shared, tradesPerThread));
+    const std::string scenario = shared ? "shared" : "disjoint";
+
+    for (int threads = 1; threads <= MAX_THREADS; threads *= 2) {
+      const uint64_t total = static_cast<uint64_t>(threads) * tradesPerThread;
+      const std::string suffix = "." + scenario + "." + std::to_string(threads) + "t";
+      {
+        PositionService<Bond> service;
+        std::mutex mutex;
+        double seconds = RunThreads(threads, [&](int t) {
+          for (const Trade<Bond> &trade : trades[t]) {
+            std::lock_guard<std::mutex> lock(mutex);
+            service.AddTrade(trade);
+          }
+        });
+        results.push_back(Stage("global_mutex" + suffix, total, seconds));
+      }
+      {
+        ConcurrentPositionService<Bond> service;
+        double seconds = RunThreads(threads, [&](int t) {
+          for (const Trade<Bond> &trade : trades[t]) service.AddTrade(trade);
+        });
+        results.push_back(Stage("striped" + suffix, total, seconds));
+      }
+    }
+  }
+
+  int failures = 0;
+  {
+    ConcurrentPositionService<Bond> service;
+    LastPositionListener listener;
+    service.AddListener(&listener);
+    std::vector<std::vector<Trade<Bond>>> trades;
+    for (int t = 0; t < 4; ++t) {
+      trades.push_back(ThreadTrades(bonds, t, true, tradesPerThread / 4));
+      for (size_t i = 0; i < trades.back().size(); ++i) {
+        const Trade<Bond> &trade = trades.back()[i];
+        trades.back()[i] = Trade<Bond>(trade.GetProduct(), trade.GetTradeId(), trade.GetPrice(), trade.GetBook(), 1000000 * (1 + (i * 7 + t) % 5), trade.GetSide());
+      }
+    }
+    RunThreads(4, [&](int t) {
+      for (const Trade<Bond> &trade : trades[t]) service.AddTrade(trade);
+    });
+    size_t stale = 0;
+    for (const auto &entry : listener.last) {
+      Position<Bond> stored(bonds[0]);
+      if (!service.Read(entry.first, stored) || stored.GetAggregatePosition() != entry.second) ++stale;
+    }
+    if (stale || listener.last.size() != 7) {
+      std::cerr << stale << " products were last notified with a position other than the stored one" << std::endl;
+      ++failures;
+    }
+  }
+
+  std::vector<std::pair<std::string, double>> parameters = {
+    { "trades_per_thread", static_cast<double>(tradesPerThread) },
+    { "hardware_threads", static_cast<double>(std::thread::hardware_concurrency()) }
+  };
+  if (outPath.empty()) {
+    WriteJson(std::cout, "contention", parameters, results);
+  } else {
+    std::ofstream out(outPath);
+    WriteJson(out, "contention", parameters, results);
+  }
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,177 @@
+/**
+ * copy_bench.cpp
+ * Copies of each value on its way from a connector into a service store.
+ *
+ * Services are instantiated on CountingBond, a Bond that counts how often it
+ * is copied. Every value type holds its product by value, so one product copy
+ * is one copy of the whole value. Each entry point is driven with inputs built
+ * up front, and the copies counted while it runs are reported per event. The
+ * run is checked:
+ *
+ *   lvalue        one copy per event, into the store
+ *   rvalue        no copies: the value is moved into the store
+ *   emplace       one copy per event, made by the value's own constructor
+ *   connector     no copies from QueuedConnector::Publish through the queue
+ *                 into MarketDataService
+ *
+ * Any violation makes the process exit non-zero.
+ *
+ * Usage: copy_bench [--events N] [--out results.json]
+ */
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "benchdata.hpp"
+#include "benchutil.hpp"
+#include "products.hpp"
+#include "marketdataservice.hpp"
+#include "pricingservice.hpp"
+#include "executionservice.hpp"
+#include "tradebookingservice.hpp"
+#include "inquiryservice.hpp"
+#include "historicaldataservice.hpp"
+#include "boundedqueue.hpp"
+#include "tickgenerator.hpp"
+
+namespace {
+
+// A Bond counting its copies; moves are free
+class CountingBond : public Bond
+{
+
+public:
+
+  CountingBond() = default;
+  explicit CountingBond(const Bond &bond) : Bond(bond) {}
+  CountingBond(const CountingBond &other) : Bond(other) { ++copies; }
+  CountingBond(CountingBond &&other) = default;
+  CountingBond& operator=(const CountingBond &other) { Bond::operator=(other); ++copies; return *this; }
+  CountingBond& operator=(CountingBond &&other) = default;
+
+  static uint64_t copies;
+};
+
+uint64_t CountingBond::copies = 0;
+
+std::vector<CountingBond> CountingTreasuries() {
+  std::vector<CountingBond> bonds;
+  for (const Bond &bond : OnTheRunTreasuries()) bonds.push_back(CountingBond(bond));
+  return bonds;
+}
+
+struct CopyRun
+{
+  StageResult stage;
+  double copiesPerEvent;
+  double expected;
+};
+
+// Build inputs with make(i), then time fn(input) per event while counting copies
+template<typename V, typename Make, typename F>
+CopyRun Count(const std::string &name, size_t events, double expected, Make make, F fn) {
+  std::vector<V> inputs;
+  inputs.reserve(events);
+  for (size_t i = 0; i < events; ++i) inputs.push_back(make(i));
+  CountingBond::copies = 0;
+  CopyRun run;
+  run.stage = TimeStage(name, events, [&](size_t i) { fn(inputs[i], i); });
+  run.copiesPerEvent = static_cast<double>(CountingBond::copies) / events;
+  run.expected = expected;
+  return run;
+}
+
+}
+
+int main(int argc, char **argv) {
+  const size_t events = static_cast<size_t>(ArgValue(argc, argv, "--events", 100000));
+  const std::string outPath = ArgString(argc, argv, "--out", "");
+  const std::vector<CountingBond> bonds = CountingTreasuries();
+  auto bond = [&](size_t i) -> const CountingBond& { return bonds[i % bonds.size()]; };
+  auto orderBook = [&](size_t i) { return MakeOrderBook(bond(i), i); };
+  auto price = [&](size_t i) { return Price<CountingBond>(bond(i), 99.0 + (i % 256) / 256.0, 1 / 128.0); };
+  auto order = [&](size_t i) { return ExecutionOrder<CountingBond>(bond(i), BID, "EXEC" + std::to_string(i), MARKET, 99.5, 1000000, 0, "", false); };
+  auto trade = [&](size_t i) { return Trade<CountingBond>(bond(i), "TRADE" + std::to_string(i), 99.5, "TRSY1", 1000000, BUY); };
+  auto inquiry = [&](size_t i) { return Inquiry<CountingBond>("INQ" + std::to_string(i), bond(i), BUY, 1000000, 0.0, RECEIVED); };
+
+  std::vector<CopyRun> runs;
+  {
+    ScopedSilence silence;
+    {
+      MarketDataService<CountingBond> service;
+      runs.push_back(Count<OrderBook<CountingBond>>("MarketDataService.OnMessage.lvalue", events, 1, orderBook,
+        [&](OrderBook<CountingBond> &data, size_t) { service.OnMessage(data); }));
+      runs.push_back(Count<OrderBook<CountingBond>>("MarketDataService.OnMessage.rvalue", events, 0, orderBook,
+        [&](OrderBook<CountingBond> &data, size_t) { service.OnMessage(std::move(data)); }));
+      runs.push_back(Count<int>("MarketDataService.EmplaceData", events, 1, [](size_t) { return 0; },
+        [&](int, size_t i) {
+          std::vector<Order> bids(1, Order(99.0, 1000000, BID)), offers(1, Order(99.1, 1000000, OFFER));
+          service.EmplaceData(bond(i), std::move(bids), std::move(offers));
+        }));
+    }
+    {
+      PricingService<CountingBond> service;
+      runs.push_back(Count<Price<CountingBond>>("PricingService.PublishPrice.rvalue", events, 0, price,
+        [&](Price<CountingBond> &data, size_t) { service.PublishPrice(std::move(data)); }));
+      runs.push_back(Count<int>("PricingService.EmplaceData", events, 1, [](size_t) { return 0; },
+        [&](int, size_t i) { service.EmplaceData(bond(i), 99.5, 1 / 128.0); }));
+    }
+    {
+      ExecutionService<CountingBond> service;
+      runs.push_back(Count<ExecutionOrder<CountingBond>>("ExecutionService.ExecuteOrder.rvalue", events, 0, order,
+        [&](ExecutionOrder<CountingBond> &data, size_t) { service.ExecuteOrder(std::move(data), BROKERTEC); }));
+    }
+    {
+      TradeBookingService<CountingBond> service;
+      runs.push_back(Count<Trade<CountingBond>>("TradeBookingService.BookTrade.rvalue", events, 0, trade,
+        [&](Trade<CountingBond> &data, size_t) { service.BookTrade(std::move(data)); }));
+    }
+    {
+      InquiryService<CountingBond> service;
+      runs.push_back(Count<Inquiry<CountingBond>>("InquiryService.OnMessage.rvalue", events, 0, inquiry,
+        [&](Inquiry<CountingBond> &data, size_t) { service.OnMessage(std::move(data)); }));
+    }
+    {
+      HistoricalDataService<Trade<CountingBond>> service;
+      runs.push_back(Count<Trade<CountingBond>>("HistoricalDataService.PersistData.rvalue", events, 0, trade,
+        [&](Trade<CountingBond> &data, size_t) { std::string key = data.GetTradeId(); service.PersistData(key, std::move(data)); }));
+    }
+    {
+      MarketDataService<CountingBond> service;
+      QueueOptions options;
+      options.capacity = 64;
+      QueuedConnector<string, OrderBook<CountingBond>> connector(service, "copy", options);
+      runs.push_back(Count<OrderBook<CountingBond>>("QueuedConnector.MarketDataService", events, 0, orderBook,
+        [&](OrderBook<CountingBond> &data, size_t) {
+          connector.Publish(std::move(data));
+          connector.Drain();
+        }));
+    }
+  }
+
+  int failures = 0;
+  std::vector<StageResult> results;
+  std::vector<std::pair<std::string, double>> parameters = {
+    { "events", static_cast<double>(events) },
+    { "timer_overhead_ns", TimerOverheadNanos() }
+  };
+  for (const CopyRun &run : runs) {
+    results.push_back(run.stage);
+    parameters.push_back({ run.stage.name + ".copies_per_event", run.copiesPerEvent });
+    if (run.copiesPerEvent != run.expected) {
+      std::cerr << run.stage.name << ": " << run.copiesPerEvent << " copies per event, expected " << run.expected << std::endl;
+      ++failures;
+    }
+  }
+
+  if (outPath.empty()) {
+    WriteJson(std::cout, "copy", parameters, results);
+  } else {
+    std::ofstream out(outPath);
+    WriteJson(out, "copy", parameters, results);
+  }
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,166 @@
+/**
+ * gui_bench.cpp
+ * Cost on the pricing thread of feeding the throttled GUI price file.
+ *
+ * Prices over a universe of products are published to a PricingService as
+ * fast as it takes them. Stages:
+ *
+ *   PublishPrice.none        no GUI publisher
+ *   PublishPrice.gui.all     a GuiPublisher with no throttle or cap, so every
+ *                            price goes into the ring and the flusher thread
+ *                            has to keep up; prices finding the ring full are
+ *                            dropped
+ *   PublishPrice.gui.throttled  a GuiPublisher throttled to one price every
+ *                            --throttle-ms and capped at --max-updates
+ *
+ * Each publisher must account for every price it heard as published,
+ * throttled, capped or dropped, and must have written one line per published
+ * price once stopped. The throttled file must hold no more than --max-updates
+ * lines, spaced at least the throttle interval apart, and a price whose
+ * product ID does not fit a record must be dropped rather than written under
+ * a truncated ID. Any violation makes the process exit non-zero. The GUI
+ * files are written to --dir and removed afterwards.
+ *
+ * Usage: gui_bench [--prices N] [--products P] [--throttle-ms T] [--max-updates K] [--buffer R] [--dir D] [--out results.json]
+ */
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "benchdata.hpp"
+#include "benchutil.hpp"
+#include "products.hpp"
+#include "guipublisher.hpp"
+
+namespace {
+
+// Whether a publisher's counters add up and its file holds its published prices;
+// returns the timestamps of the file's lines
+bool Consistent(const std::string &name, const GuiPublisherStats &stats, const std::string &path, std::vector<uint64_t> &timestamps) {
+  std::ifstream in(path);
+  std::string line;
+  while (std::getline(in, line)) timestamps.push_back(std::stoull(line.substr(0, line.find(','))));
+  bool consistent = stats.received == stats.published + stats.throttled + stats.capped + stats.dropped &&
+                    stats.written == stats.published && timestamps.size() == stats.written;
+  if (!consistent) {
+    std::cerr << name << ": heard " << stats.received << " prices, published " << stats.published << ", throttled " << stats.throttled
+              << ", capped " << stats.capped << ", dropped " << stats.dropped << ", wrote " << stats.written << " and the file holds "
+              << timestamps.size() << " lines" << std::endl;
+  }
+  return consistent;
+}
+
+}
+
+int main(int argc, char **argv) {
+  const size_t priceCount = static_cast<size_t>(ArgValue(argc, argv, "--prices", 2000000));
+  const size_t productCount = static_cast<size_t>(ArgValue(argc, argv, "--products", 1000));
+  GuiPublisherOptions throttledOptions;
+  throttledOptions.throttleMillis = static_cast<uint64_t>(ArgValue(argc, argv, "--throttle-ms", 1));
+  throttledOptions.maxUpdates = static_cast<uint64_t>(ArgValue(argc, argv, "--max-updates", 100));
+  GuiPublisherOptions allOptions;
+  allOptions.throttleMillis = 0;
+  allOptions.maxUpdates = 0;
+  allOptions.bufferRecords = throttledOptions.bufferRecords = static_cast<size_t>(ArgValue(argc, argv, "--buffer", 4096));
+  const std::string dir = ArgString(argc, argv, "--dir", ".");
+  const std::string outPath = ArgString(argc, argv, "--out", "");
+
+  std::vector<Price<Bond>> prices;
+  prices.reserve(priceCount);
+  uint64_t state = 88172645463325252ULL;
+  for (size_t i = 0; i < priceCount; ++i) {
+    state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+    prices.push_back(Price<Bond>(SyntheticBond(100000 + state % productCount), 99.0 + (state >> 32) % 512 / 256.0, 1.0 / 128));
+  }
+
+  ServiceCapacity capacity;
+  capacity.products = productCount;
+  std::vector<StageResult> results;
+  int failures = 0;
+
+  PricingService<Bond> plain(capacity);
+  results.push_back(TimeStage("PublishPrice.none", priceCount, [&](size_t i) { plain.PublishPrice(prices[i]); }));
+
+  const std::string allPath = dir + "/gui_all.txt";
+  PricingService<Bond> all(capacity);
+  GuiPublisherStats allStats;
+  {
+    GuiPublisher<Bond> publisher(allPath, allOptions);
+    all.AddListener(&publisher);
+    publisher.Start();
+    results.push_back(TimeStage("PublishPrice.gui.all", priceCount, [&](size_t i) { all.PublishPrice(prices[i]); }));
+    publisher.Stop();
+    allStats = publisher.GetStats();
+  }
+  std::vector<uint64_t> allTimestamps;
+  if (!Consistent("gui.all", allStats, allPath, allTimestamps)) ++failures;
+
+  const std::string throttledPath = dir + "/gui_throttled.txt";
+  PricingService<Bond> throttled(capacity);
+  GuiPublisherStats throttledStats;
+  {
+    GuiPublisher<Bond> publisher(throttledPath, throttledOptions);
+    throttled.AddListener(&publisher);
+    publisher.Start();
+    results.push_back(TimeStage("PublishPrice.gui.throttled", priceCount, [&](size_t i) { throttled.PublishPrice(prices[i]); }));
+    publisher.Stop();
+    throttledStats = publisher.GetStats();
+  }
+  std::vector<uint64_t> throttledTimestamps;
+  if (!Consistent("gui.throttled", throttledStats, throttledPath, throttledTimestamps)) ++failures;
+  size_t early = 0;
+  // TSC calibration is good to well under a percent
+  const uint64_t interval = throttledOptions.throttleMillis * 1000000 * 99 / 100;
+  for (size_t i = 1; i < throttledTimestamps.size(); ++i) {
+    if (throttledTimestamps[i] - throttledTimestamps[i - 1] < interval) ++early;
+  }
+  if (throttledTimestamps.size() > throttledOptions.maxUpdates || early) {
+    std::cerr << "gui.throttled: " << throttledTimestamps.size() << " lines, " << early << " inside the throttle interval" << std::endl;
+    ++failures;
+  }
+  // A product ID too long for a record is refused whole, never truncated
+  const std::string longPath = dir + "/gui_long.txt";
+  const std::string fitting(GUI_MAX_PRODUCT_ID, 'F'), tooLong(GUI_MAX_PRODUCT_ID + 4, 'L');
+  PricingService<Bond> longIds;
+  GuiPublisherStats longStats;
+  {
+    GuiPublisher<Bond> publisher(longPath, allOptions);
+    longIds.AddListener(&publisher);
+    longIds.PublishPrice(Price<Bond>(Bond(tooLong, CUSIP, tooLong, 0.02f, date(2030, Jun, 30)), 99.0, 1.0 / 128));
+    longIds.PublishPrice(Price<Bond>(Bond(fitting, CUSIP, fitting, 0.02f, date(2030, Jun, 30)), 99.0, 1.0 / 128));
+    publisher.Stop();
+    longStats = publisher.GetStats();
+  }
+  std::string longLine;
+  std::getline(std::ifstream(longPath), longLine);
+  if (longStats.dropped != 1 || longStats.written != 1 || longLine.find("," + fitting + ",") == std::string::npos) {
+    std::cerr << "gui.long_ids: dropped " << longStats.dropped << ", wrote " << longStats.written << ", first line " << longLine << std::endl;
+    ++failures;
+  }
+  std::remove(allPath.c_str());
+  std::remove(throttledPath.c_str());
+  std::remove(longPath.c_str());
+
+  std::vector<std::pair<std::string, double>> parameters = {
+    { "prices", static_cast<double>(priceCount) },
+    { "products", static_cast<double>(productCount) },
+    { "throttle_ms", static_cast<double>(throttledOptions.throttleMillis) },
+    { "max_updates", static_cast<double>(throttledOptions.maxUpdates) },
+    { "buffer_records", static_cast<double>(allOptions.bufferRecords) },
+    { "all_published", static_cast<double>(allStats.published) },
+    { "all_dropped", static_cast<double>(allStats.dropped) },
+    { "throttled_published", static_cast<double>(throttledStats.published) },
+    { "throttled_throttled", static_cast<double>(throttledStats.throttled) },
+    { "throttled_capped", static_cast<double>(throttledStats.capped) },
+    { "timer_overhead_ns", TimerOverheadNanos() }
+  };
+  if (outPath.empty()) {
+    WriteJson(std::cout, "gui", parameters, results);
+  } else {
+    std::ofstream out(outPath);
+    WriteJson(out, "gui", parameters, results);
+  }
+  return failures ? 1 : 0;
+}
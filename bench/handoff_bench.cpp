@@ -0,0 +1,118 @@
+/**
+ * handoff_bench.cpp
+ * Round-trip latency of handing a price from a producer thread to a service
+ * thread and back, with both threads pinned to the same core or to different
+ * cores.
+ *
+ * The producer publishes a price into a QueuedConnector whose worker thread
+ * feeds a PricingService; a listener on the service acknowledges the price and
+ * the producer waits for that acknowledgement before sending the next one. The
+ * service and its queue are constructed on the worker's core so that their
+ * memory is first-touched there. Placement is reported on stderr.
+ *
+ * The cross-core run needs at least two CPUs and is skipped otherwise.
+ *
+ * Usage: handoff_bench [--events N] [--producer-cpu P] [--consumer-cpu C] [--out results.json]
+ */
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "benchutil.hpp"
+#include "products.hpp"
+#include "pricingservice.hpp"
+#include "boundedqueue.hpp"
+#include "threadtopology.hpp"
+#include "tickgenerator.hpp"
+
+namespace {
+
+// Acknowledges every price it sees
+class AckListener : public ServiceListener<Price<Bond>>
+{
+
+public:
+
+  void ProcessAdd(Price<Bond> &data) override { acked.fetch_add(1, std::memory_order_release); }
+  void ProcessRemove(Price<Bond> &data) override {}
+  void ProcessUpdate(Price<Bond> &data) override {}
+
+  std::atomic<uint64_t> acked{0};
+};
+
+StageResult RoundTrips(const std::string &name, ThreadTopology &topology, std::vector<Price<Bond>> &prices) {
+  std::unique_ptr<PricingService<Bond>> pricing = topology.ConstructOn<PricingService<Bond>>("pricing");
+  AckListener ack;
+  pricing->AddListener(&ack);
+  QueueOptions options;
+  options.capacity = 64;
+  std::unique_ptr<QueuedConnector<string, Price<Bond>>> connector =
+    topology.ConstructOn<QueuedConnector<string, Price<Bond>>>("pricing", *pricing, name, options);
+  connector->Start(1, [&]() { topology.PinCurrentThread("pricing"); });
+
+  StageResult result;
+  std::thread producer = topology.Launch("producer", [&]() {
+    LatencyRecorder recorder(prices.size());
+    uint64_t start = NowNanos();
+    for (size_t i = 0; i < prices.size(); ++i) {
+      uint64_t before = NowNanos();
+      connector->Publish(prices[i]);
+      // Yield while waiting so a consumer sharing this core can run
+      while (ack.acked.load(std::memory_order_acquire) <= i) std::this_thread::yield();
+      recorder.Record(NowNanos() - before);
+    }
+    result = recorder.Summarize(name, (NowNanos() - start) / 1e9);
+  });
+  producer.join();
+  connector->Stop();
+  return result;
+}
+
+}
+
+int main(int argc, char **argv) {
+  const size_t events = static_cast<size_t>(ArgValue(argc, argv, "--events", 20000));
+  const int producerCpu = static_cast<int>(ArgValue(argc, argv, "--producer-cpu", 0));
+  const int consumerCpu = static_cast<int>(ArgValue(argc, argv, "--consumer-cpu", 1));
+  const std::string outPath = ArgString(argc, argv, "--out", "");
+
+  const std::vector<Bond> bonds = OnTheRunTreasuries();
+  std::vector<Price<Bond>> prices;
+  for (size_t i = 0; i < events; ++i) prices.push_back(Price<Bond>(bonds[i % bonds.size()], 99.0 + (i % 256) / 256.0, 1 / 128.0));
+
+  std::vector<StageResult> results;
+  {
+    ThreadTopology topology;
+    topology.Assign("producer", { producerCpu });
+    topology.Assign("pricing", { producerCpu });
+    results.push_back(RoundTrips("same_core", topology, prices));
+    topology.Report(std::cerr);
+  }
+  const bool crossCore = ThreadTopology::CpuCount() >= 2 && producerCpu != consumerCpu;
+  if (crossCore) {
+    ThreadTopology topology;
+    topology.Assign("producer", { producerCpu });
+    topology.Assign("pricing", { consumerCpu });
+    results.push_back(RoundTrips("cross_core", topology, prices));
+    topology.Report(std::cerr);
+  } else {
+    std::cerr << "Skipping cross_core: needs two distinct CPUs" << std::endl;
+  }
+
+  std::vector<std::pair<std::string, double>> parameters = {
+    { "cpus", static_cast<double>(ThreadTopology::CpuCount()) },
+    { "producer_cpu", static_cast<double>(producerCpu) },
+    { "consumer_cpu", static_cast<double>(consumerCpu) },
+    { "timer_overhead_ns", TimerOverheadNanos() }
+  };
+  if (outPath.empty()) {
+    WriteJson(std::cout, "handoff", parameters, results);
+  } else {
+    std::ofstream out(outPath);
+    WriteJson(out, "handoff", parameters, results);
+  }
+  return 0;
+}
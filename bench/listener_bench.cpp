@@ -0,0 +1,137 @@
+/**
+ * listener_bench.cpp
+ * Dispatch cost of price updates to many listeners that each care about a few
+ * products.
+ *
+ * 50 listeners are attached to a PricingService over 100 products, each
+ * interested in 5 of them (5%). Two registrations are compared:
+ *
+ *   broadcast  every listener is registered unfiltered and discards updates
+ *              for products it does not follow
+ *   filtered   every listener is registered with its products as filter keys
+ *
+ * Both runs must deliver the same number of updates to each listener, and
+ * removing a filtered listener must stop its deliveries; otherwise the process
+ * exits non-zero.
+ *
+ * Usage: listener_bench [--events N] [--out results.json]
+ */
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "benchdata.hpp"
+#include "benchutil.hpp"
+#include "products.hpp"
+#include "pricingservice.hpp"
+
+namespace {
+
+const int PRODUCTS = 100;
+const int LISTENERS = 50;
+const int PRODUCTS_PER_LISTENER = 5;
+
+// Counts the updates for the products it follows
+class FollowingListener : public ServiceListener<Price<Bond>>
+{
+
+public:
+
+  explicit FollowingListener(const std::vector<std::string> &_products) : products(_products.begin(), _products.end()), delivered(0) {}
+
+  void ProcessAdd(Price<Bond> &data) override {
+    if (products.count(data.GetProduct().GetProductId())) ++delivered;
+  }
+
+  void ProcessRemove(Price<Bond> &data) override {}
+  void ProcessUpdate(Price<Bond> &data) override {}
+
+  uint64_t Delivered() const { return delivered; }
+
+private:
+  std::unordered_set<std::string> products;
+  uint64_t delivered;
+};
+
+// Products followed by listener l, spread over the universe
+std::vector<std::string> Followed(const std::vector<Bond> &bonds, int l) {
+  std::vector<std::string> ids;
+  for (int k = 0; k < PRODUCTS_PER_LISTENER; ++k) ids.push_back(bonds[(l * 7 + k * 20) % PRODUCTS].GetProductId());
+  return ids;
+}
+
+struct Run
+{
+  StageResult stage;
+  std::vector<uint64_t> delivered;
+};
+
+Run Dispatch(const std::string &name, const std::vector<Bond> &bonds, std::vector<Price<Bond>> &prices, bool filtered) {
+  PricingService<Bond> service;
+  std::vector<FollowingListener> listeners;
+  listeners.reserve(LISTENERS);
+  for (int l = 0; l < LISTENERS; ++l) {
+    listeners.emplace_back(Followed(bonds, l));
+    ListenerOptions options;
+    if (filtered) options.keys = Followed(bonds, l);
+    service.AddListener(&listeners.back(), options);
+  }
+
+  Run run;
+  run.stage = TimeStage(name, prices.size(), [&](size_t i) { service.OnMessage(prices[i]); });
+  for (const FollowingListener &listener : listeners) run.delivered.push_back(listener.Delivered());
+  return run;
+}
+
+}
+
+int main(int argc, char **argv) {
+  const size_t events = static_cast<size_t>(ArgValue(argc, argv, "--events", 200000));
+  const std::string outPath = ArgString(argc, argv, "--out", "");
+
+  const std::vector<Bond> bonds = MakeUniverse(PRODUCTS);
+  std::vector<Price<Bond>> prices;
+  prices.reserve(events);
+  for (size_t i = 0; i < events; ++i) prices.push_back(Price<Bond>(bonds[i % PRODUCTS], 99.0 + (i % 256) / 256.0, 1 / 128.0));
+
+  Run broadcast = Dispatch("broadcast", bonds, prices, false);
+  Run filtered = Dispatch("filtered", bonds, prices, true);
+  int failures = 0;
+  if (broadcast.delivered != filtered.delivered) {
+    std::cerr << "Filtered dispatch delivered a different set of updates" << std::endl;
+    ++failures;
+  }
+
+  // A removed listener receives nothing further
+  {
+    PricingService<Bond> service;
+    FollowingListener kept(Followed(bonds, 0)), removed(Followed(bonds, 0));
+    ListenerOptions options;
+    options.keys = Followed(bonds, 0);
+    service.AddListener(&kept, options);
+    ListenerHandle handle = service.AddListener(&removed, options);
+    if (!service.RemoveListener(handle) || service.RemoveListener(handle)) ++failures;
+    for (Price<Bond> &price : prices) service.OnMessage(price);
+    if (removed.Delivered() != 0 || kept.Delivered() != broadcast.delivered[0]) {
+      std::cerr << "Removed listener still notified" << std::endl;
+      ++failures;
+    }
+  }
+
+  std::vector<std::pair<std::string, double>> parameters = {
+    { "products", PRODUCTS },
+    { "listeners", LISTENERS },
+    { "products_per_listener", PRODUCTS_PER_LISTENER },
+    { "timer_overhead_ns", TimerOverheadNanos() }
+  };
+  std::vector<StageResult> results = { broadcast.stage, filtered.stage };
+  if (outPath.empty()) {
+    WriteJson(std::cout, "listener", parameters, results);
+  } else {
+    std::ofstream out(outPath);
+    WriteJson(out, "listener", parameters, results);
+  }
+  return failures ? 1 : 0;
+}
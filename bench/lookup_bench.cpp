@@ -0,0 +1,145 @@
+/**
+ * lookup_bench.cpp
+ * Cost of service lookups that hit and that miss, through each lookup API.
+ *
+ * Stages, for PositionService keyed on product and TradeBookingService keyed
+ * on trade ID:
+ *
+ *   GetData.hit         legacy lookup of a stored key
+ *   GetData.miss        legacy lookup of a missing key, which builds the error
+ *                       message, throws and is caught by the caller
+ *   TryGetData.hit      non-throwing lookup of a stored key
+ *   TryGetData.miss     non-throwing lookup of a missing key
+ *   GetData.handle      lookup by a handle resolved up front
+ *
+ * plus Service.TryGetData.miss, the base class fallback that goes through
+ * GetData, called on a service that does not override it.
+ *
+ * Every key is checked first: hits through all three APIs must return the
+ * same object and misses nullptr; every timed miss must throw or return
+ * nullptr and every timed hit must find its value. Any violation makes the
+ * process exit non-zero.
+ *
+ * Usage: lookup_bench [--lookups N] [--keys K] [--out results.json]
+ */
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "benchdata.hpp"
+#include "benchutil.hpp"
+#include "products.hpp"
+#include "positionservice.hpp"
+#include "tradebookingservice.hpp"
+
+namespace {
+
+// A Service keeping only the legacy GetData, to time the base TryGetData fallback
+class LegacyPositionService : public Service<std::string, Position<Bond>>
+{
+
+public:
+
+  explicit LegacyPositionService(PositionService<Bond> &_service) : service(_service) {}
+
+  Position<Bond>& GetData(std::string productId) override { return service.GetData(productId); }
+  void OnMessage(Position<Bond> &data) override { service.OnMessage(data); }
+  void AddListener(ServiceListener<Position<Bond>> *listener) override { service.AddListener(listener); }
+  ListenerHandle AddListener(ServiceListener<Position<Bond>> *listener, const ListenerOptions &options) override { return service.AddListener(listener, options); }
+  bool RemoveListener(ListenerHandle handle) override { return service.RemoveListener(handle); }
+  const std::vector<ServiceListener<Position<Bond>>*>& GetListeners() const override { return service.GetListeners(); }
+
+private:
+  PositionService<Bond> &service;
+};
+
+// Time every lookup API of a service over stored keys and missing keys,
+// resolving handles up front with handleOf(key)
+template<typename S, typename HandleOf>
+void TimeLookups(const std::string &prefix, S &service, HandleOf handleOf, const std::vector<std::string> &stored, const std::vector<std::string> &missing,
+                 size_t lookups, std::vector<StageResult> &results, int &failures) {
+  std::vector<decltype(handleOf(stored[0]))> handles;
+  for (const std::string &key : stored) handles.push_back(handleOf(key));
+  size_t wrong = 0;
+  for (size_t k = 0; k < stored.size(); ++k) {
+    auto *found = service.TryGetData(stored[k]);
+    if (!found || &service.GetData(stored[k]) != found || &service.GetData(handles[k]) != found || service.TryGetData(missing[k % missing.size()])) ++wrong;
+  }
+  size_t misses = 0, hits = 0;
+  results.push_back(TimeStage(prefix + "GetData.hit", lookups, [&](size_t i) { hits += &service.GetData(stored[i % stored.size()]) != nullptr; }));
+  results.push_back(TimeStage(prefix + "GetData.miss", lookups, [&](size_t i) {
+    try {
+      service.GetData(missing[i % missing.size()]);
+    } catch (const std::runtime_error&) {
+      ++misses;
+    }
+  }));
+  results.push_back(TimeStage(prefix + "TryGetData.hit", lookups, [&](size_t i) { hits += service.TryGetData(stored[i % stored.size()]) != nullptr; }));
+  results.push_back(TimeStage(prefix + "TryGetData.miss", lookups, [&](size_t i) { misses += service.TryGetData(missing[i % missing.size()]) == nullptr; }));
+  results.push_back(TimeStage(prefix + "GetData.handle", lookups, [&](size_t i) { hits += &service.GetData(handles[i % handles.size()]) != nullptr; }));
+  wrong += 3 * lookups - hits + 2 * lookups - misses;
+  if (wrong) {
+    std::cerr << prefix << ": " << wrong << " lookups returned the wrong result" << std::endl;
+    ++failures;
+  }
+}
+
+}
+
+int main(int argc, char **argv) {
+  const size_t lookups = static_cast<size_t>(ArgValue(argc, argv, "--lookups", 1000000));
+  const size_t keyCount = static_cast<size_t>(ArgValue(argc, argv, "--keys", 1000));
+  const std::string outPath = ArgString(argc, argv, "--out", "");
+
+  ServiceCapacity capacity;
+  capacity.products = keyCount;
+  capacity.trades = keyCount;
+  PositionService<Bond> positions(capacity);
+  TradeBookingService<Bond> trades(capacity);
+  std::vector<std::string> products, missingProducts, tradeIds, missingTrades;
+  {
+    ScopedSilence silence;
+    for (size_t i = 0; i < keyCount; ++i) {
+      const Bond bond = SyntheticBond(100000 + i);
+      const std::string &id = bond.GetProductId();
+      Trade<Bond> trade(bond, "TRADE" + std::to_string(i), 99.5, "TRSY1", 1000000, BUY);
+      positions.AddTrade(trade);
+      trades.BookTrade(trade);
+      products.push_back(id);
+      missingProducts.push_back("MISSING" + std::to_string(100000 + i));
+      tradeIds.push_back(trade.GetTradeId());
+      missingTrades.push_back("NOTRADE" + std::to_string(i));
+    }
+  }
+
+  int failures = 0;
+  std::vector<StageResult> results;
+  TimeLookups("PositionService.", positions, [&](const std::string &key) { return positions.GetProductHandle(key); },
+              products, missingProducts, lookups, results, failures);
+  TimeLookups("TradeBookingService.", trades, [&](const std::string &key) { return trades.GetHandle(key); },
+              tradeIds, missingTrades, lookups, results, failures);
+
+  LegacyPositionService legacy(positions);
+  Service<std::string, Position<Bond>> &base = legacy;
+  size_t found = 0;
+  results.push_back(TimeStage("Service.TryGetData.miss", lookups, [&](size_t i) { if (base.TryGetData(missingProducts[i % keyCount])) ++found; }));
+  if (found || base.TryGetData(products[0]) != positions.TryGetData(products[0])) {
+    std::cerr << "Base TryGetData fallback returned the wrong result" << std::endl;
+    ++failures;
+  }
+
+  std::vector<std::pair<std::string, double>> parameters = {
+    { "lookups", static_cast<double>(lookups) },
+    { "keys", static_cast<double>(keyCount) },
+    { "timer_overhead_ns", TimerOverheadNanos() }
+  };
+  if (outPath.empty()) {
+    WriteJson(std::cout, "lookup", parameters, results);
+  } else {
+    std::ofstream out(outPath);
+    WriteJson(out, "lookup", parameters, results);
+  }
+  return failures ? 1 : 0;
+}
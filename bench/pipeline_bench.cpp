@@ -0,0 +1,132 @@
+/**
+ * pipeline_bench.cpp
+ * End-to-end benchmark of the trading service graph.
+ *
+ * Each service is first driven in isolation to measure the cost of its own
+ * hop, then the full TradingPipeline is driven through its three entry points
+ * (market data, prices and inquiries). Results are written as JSON.
+ *
+ * When built with SOA_INSTRUMENTATION the per-service and per-listener probe
+ * histograms for the end-to-end runs are written to the --probes file.
+ *
+ * Usage: pipeline_bench [--events N] [--out results.json] [--probes probes.json]
+ */
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "benchdata.hpp"
+#include "benchutil.hpp"
+#include "products.hpp"
+#include "pipeline.hpp"
+#include "tickgenerator.hpp"
+
+int main(int argc, char **argv) {
+  const size_t events = static_cast<size_t>(ArgValue(argc, argv, "--events", 100000));
+  const std::string outPath = ArgString(argc, argv, "--out", "");
+  const std::string probesPath = ArgString(argc, argv, "--probes", "probes.json");
+  const std::vector<Bond> bonds = OnTheRunTreasuries();
+  const std::string books[] = { "TRSY1", "TRSY2", "TRSY3" };
+
+  // Inputs are generated up front so that only service work is timed
+  std::vector<OrderBook<Bond>> orderBooks;
+  std::vector<Price<Bond>> prices;
+  std::vector<PriceStream<Bond>> priceStreams;
+  std::vector<ExecutionOrder<Bond>> executionOrders;
+  std::vector<Trade<Bond>> trades;
+  std::vector<Inquiry<Bond>> inquiries;
+  std::vector<Position<Bond>> positions;
+  for (size_t i = 0; i < events; ++i) {
+    const Bond &bond = bonds[i % bonds.size()];
+    std::string id = std::to_string(i);
+    orderBooks.push_back(MakeOrderBook(bond, i));
+    double mid = 99.0 + (i % 256) / 256.0;
+    prices.push_back(Price<Bond>(bond, mid, (1 + i % 4) / 128.0));
+    priceStreams.push_back(PriceStream<Bond>(bond, PriceStreamOrder(mid - 1 / 256.0, 1000000, 2000000, BID), PriceStreamOrder(mid + 1 / 256.0, 1000000, 2000000, OFFER)));
+    executionOrders.push_back(ExecutionOrder<Bond>(bond, i % 2 ? OFFER : BID, "EXEC" + id, MARKET, mid, 1000000, 0, "", false));
+    trades.push_back(Trade<Bond>(bond, "TRADE" + id, mid, books[i % 3], 1000000, i % 2 ? SELL : BUY));
+    inquiries.push_back(Inquiry<Bond>("INQ" + id, bond, i % 2 ? SELL : BUY, 1000000, 0.0, RECEIVED));
+  }
+  {
+    PositionService<Bond> seed;
+    for (size_t i = 0; i < events; ++i) {
+      seed.AddTrade(trades[i]);
+      positions.push_back(seed.GetData(trades[i].GetProduct().GetProductId()));
+    }
+  }
+
+  std::vector<StageResult> results;
+  {
+    ScopedSilence silence;
+
+    // Isolated hops: each service with no listeners attached
+    {
+      MarketDataService<Bond> service;
+      results.push_back(TimeStage("MarketDataService.OnMessage", events, [&](size_t i) { service.OnMessage(orderBooks[i]); }));
+    }
+    {
+      PricingService<Bond> service;
+      results.push_back(TimeStage("PricingService.PublishPrice", events, [&](size_t i) { service.PublishPrice(prices[i]); }));
+    }
+    {
+      StreamingService<Bond> service;
+      results.push_back(TimeStage("StreamingService.PublishPrice", events, [&](size_t i) { service.PublishPrice(priceStreams[i]); }));
+    }
+    {
+      ExecutionService<Bond> service;
+      results.push_back(TimeStage("ExecutionService.ExecuteOrder", events, [&](size_t i) { service.ExecuteOrder(executionOrders[i], BROKERTEC); }));
+    }
+    {
+      TradeBookingService<Bond> service;
+      results.push_back(TimeStage("TradeBookingService.BookTrade", events, [&](size_t i) { service.BookTrade(trades[i]); }));
+    }
+    {
+      PositionService<Bond> service;
+      results.push_back(TimeStage("PositionService.AddTrade", events, [&](size_t i) { service.AddTrade(trades[i]); }));
+    }
+    {
+      RiskService<Bond> service;
+      results.push_back(TimeStage("RiskService.AddPosition", events, [&](size_t i) { service.AddPosition(positions[i]); }));
+    }
+    {
+      InquiryService<Bond> service;
+      results.push_back(TimeStage("InquiryService.OnMessage", events, [&](size_t i) { service.OnMessage(inquiries[i]); }));
+    }
+    {
+      HistoricalDataService<Position<Bond>> service;
+      results.push_back(TimeStage("HistoricalDataService.PersistData", events, [&](size_t i) {
+        service.PersistData(positions[i].GetProduct().GetProductId(), positions[i]);
+      }));
+    }
+
+    // End to end: each entry point with every downstream hop attached
+    {
+#ifdef SOA_INSTRUMENTATION
+      ProbeRegistry::Instance().Reset();
+#endif
+      TradingPipeline<Bond> pipeline;
+      results.push_back(TimeStage("Pipeline.MarketData", events, [&](size_t i) { pipeline.marketData.OnMessage(orderBooks[i]); }));
+      results.push_back(TimeStage("Pipeline.Pricing", events, [&](size_t i) { pipeline.pricing.OnMessage(prices[i]); }));
+      results.push_back(TimeStage("Pipeline.Inquiry", events, [&](size_t i) { pipeline.inquiry.OnMessage(inquiries[i]); }));
+    }
+  }
+
+#ifdef SOA_INSTRUMENTATION
+  std::ofstream probes(probesPath);
+  DumpProbes(probes, ProbeSnapshot());
+#endif
+
+  std::vector<std::pair<std::string, double>> parameters = {
+    { "events", static_cast<double>(events) },
+    { "products", static_cast<double>(bonds.size()) },
+    { "timer_overhead_ns", TimerOverheadNanos() }
+  };
+  if (outPath.empty()) {
+    WriteJson(std::cout, "pipeline", parameters, results);
+  } else {
+    std::ofstream out(outPath);
+    WriteJson(out, "pipeline", parameters, results);
+  }
+  return 0;
+}
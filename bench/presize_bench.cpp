@@ -0,0 +1,157 @@
+/**
+ * presize_bench.cpp
+ * Latency of the first events of a session with and without pre-sized stores.
+ *
+ * A TradingPipeline over a large universe of bonds is driven through the
+ * opening burst: every product's first order book, price and inquiry arrive
+ * in the first events, and every order book books a new execution and trade,
+ * so each store grows throughout the run. The "cold" run starts from default
+ * constructed services; the "presized" run constructs them from capacity
+ * hints covering the whole run and calls WarmUp() before the first event.
+ * Each run is reported in full and for its first tenth, where growth and page
+ * faults concentrate.
+ *
+ * The presized run goes first, so the cold run reuses heap memory the
+ * allocator already holds; the comparison is conservative. Both runs must end
+ * with identical positions and risk, otherwise the process exits non-zero.
+ *
+ * Usage: presize_bench [--events N] [--products P] [--out results.json]
+ */
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "benchdata.hpp"
+#include "benchutil.hpp"
+#include "products.hpp"
+#include "pipeline.hpp"
+#include "tickgenerator.hpp"
+
+namespace {
+
+// Aggregate position of a product, zero if it never traded
+long AggregatePosition(PositionService<Bond> &service, const std::string &productId) {
+  Position<Bond> *position = service.TryGetData(productId);
+  return position ? position->GetAggregatePosition() : 0;
+}
+
+// Risked quantity of a product, zero if it has no position
+long RiskQuantity(RiskService<Bond> &service, const std::string &productId) {
+  const PV01<Bond> *pv01 = service.TryGetData(productId);
+  return pv01 ? pv01->GetQuantity() : 0;
+}
+
+struct SessionInputs
+{
+  std::vector<OrderBook<Bond>> orderBooks;
+  std::vector<Price<Bond>> prices;
+  std::vector<Inquiry<Bond>> inquiries;
+};
+
+struct SessionRun
+{
+  StageResult all;
+  StageResult opening;
+  double warmUpMillis = 0.0;
+  std::vector<long> positions;
+  std::vector<long> risk;
+};
+
+// Drive events round robin through the three entry points, timing each
+SessionRun RunSession(const std::string &name, bool presize, const std::vector<Bond> &bonds, SessionInputs &inputs, size_t events) {
+  ServiceCapacity capacity;
+  if (presize) {
+    capacity.products = bonds.size();
+    capacity.orders = events;
+    capacity.trades = events;
+    capacity.inquiries = events;
+    capacity.listeners = 4;
+  }
+
+  SessionRun run;
+  TradingPipeline<Bond> pipeline(BUS_IMMEDIATE, capacity);
+  if (presize) {
+    uint64_t before = NowNanos();
+    pipeline.WarmUp();
+    run.warmUpMillis = (NowNanos() - before) / 1e6;
+  }
+
+  const size_t opening = std::max<size_t>(events / 10, 1);
+  LatencyRecorder all(events);
+  LatencyRecorder first(opening);
+  uint64_t start = NowNanos();
+  double openingSeconds = 0.0;
+  for (size_t i = 0; i < events; ++i) {
+    size_t n = i / 3;
+    uint64_t before = NowNanos();
+    switch (i % 3) {
+      case 0: pipeline.marketData.OnMessage(inputs.orderBooks[n]); break;
+      case 1: pipeline.pricing.OnMessage(inputs.prices[n]); break;
+      default: pipeline.inquiry.OnMessage(inputs.inquiries[n]); break;
+    }
+    uint64_t elapsed = NowNanos() - before;
+    all.Record(elapsed);
+    if (i < opening) first.Record(elapsed);
+    if (i + 1 == opening) openingSeconds = (NowNanos() - start) / 1e9;
+  }
+  run.all = all.Summarize(name, (NowNanos() - start) / 1e9);
+  run.opening = first.Summarize(name + ".opening", openingSeconds);
+
+  for (const Bond &bond : bonds) {
+    const std::string &productId = bond.GetProductId();
+    run.positions.push_back(AggregatePosition(pipeline.position, productId));
+    run.risk.push_back(RiskQuantity(pipeline.risk, productId));
+  }
+  return run;
+}
+
+}
+
+int main(int argc, char **argv) {
+  const size_t events = static_cast<size_t>(ArgValue(argc, argv, "--events", 300000));
+  const size_t productCount = static_cast<size_t>(ArgValue(argc, argv, "--products", 5000));
+  const std::string outPath = ArgString(argc, argv, "--out", "");
+
+  const std::vector<Bond> bonds = MakeUniverse(productCount);
+  SessionInputs inputs;
+  const size_t perEntry = events / 3 + 1;
+  inputs.orderBooks.reserve(perEntry);
+  inputs.prices.reserve(perEntry);
+  inputs.inquiries.reserve(perEntry);
+  for (size_t n = 0; n < perEntry; ++n) {
+    const Bond &bond = bonds[n % bonds.size()];
+    inputs.orderBooks.push_back(MakeOrderBook(bond, n));
+    inputs.prices.push_back(Price<Bond>(bond, 99.0 + (n % 256) / 256.0, (1 + n % 4) / 128.0));
+    inputs.inquiries.push_back(Inquiry<Bond>("INQ" + std::to_string(n), bond, n % 2 ? SELL : BUY, 1000000, 0.0, RECEIVED));
+  }
+
+  SessionRun presized, cold;
+  {
+    ScopedSilence silence;
+    presized = RunSession("presized", true, bonds, inputs, events);
+    cold = RunSession("cold", false, bonds, inputs, events);
+  }
+
+  int failures = 0;
+  if (presized.positions != cold.positions || presized.risk != cold.risk) {
+    std::cerr << "Presized and cold sessions ended with different positions or risk" << std::endl;
+    ++failures;
+  }
+
+  std::vector<StageResult> results = { cold.all, cold.opening, presized.all, presized.opening };
+  std::vector<std::pair<std::string, double>> parameters = {
+    { "events", static_cast<double>(events) },
+    { "products", static_cast<double>(productCount) },
+    { "warm_up_ms", presized.warmUpMillis },
+    { "timer_overhead_ns", TimerOverheadNanos() }
+  };
+  if (outPath.empty()) {
+    WriteJson(std::cout, "presize", parameters, results);
+  } else {
+    std::ofstream out(outPath);
+    WriteJson(out, "presize", parameters, results);
+  }
+  return failures;
+}
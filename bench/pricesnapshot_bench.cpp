@@ -0,0 +1,157 @@
+/**
+ * pricesnapshot_bench.cpp
+ * Cost of reading the latest mid of every product at once, as risk, P&L and
+ * streaming do, one lookup at a time and as one snapshot copy.
+ *
+ * Stages, each a pass over the whole universe reported per product read:
+ *
+ *   product_id       GetData by product identifier for every product
+ *   handle           GetData by product handle for every product
+ *   snapshot         GetPriceSnapshot into a reused PriceSnapshot, then a
+ *                    vectorizable sum over its mids
+ *   snapshot.concurrent  reader threads copying snapshots while a writer
+ *                    thread keeps updating prices through UpdatePrice
+ *
+ * The snapshot must match GetData for every product. Every price the writer
+ * stores has its mid exactly 99 above its spread, so a copy that tore a mid
+ * from its spread would see them disagree; versions seen by a reader must
+ * never go backwards. Any violation makes the process exit non-zero.
+ *
+ * Usage: pricesnapshot_bench [--passes N] [--products P] [--updates U] [--readers R] [--out results.json]
+ */
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "benchdata.hpp"
+#include "benchutil.hpp"
+#include "products.hpp"
+#include "pricingservice.hpp"
+
+namespace {
+
+// Sum of the mids of a snapshot, a loop the compiler can vectorize
+double SumMids(const PriceSnapshot &snapshot) {
+  double total = 0.0;
+  for (double mid : snapshot.mids) total += mid;
+  return total;
+}
+
+}
+
+int main(int argc, char **argv) {
+  const size_t passes = static_cast<size_t>(ArgValue(argc, argv, "--passes", 1000));
+  const size_t productCount = static_cast<size_t>(ArgValue(argc, argv, "--products", 10000));
+  const size_t updates = static_cast<size_t>(ArgValue(argc, argv, "--updates", 2000000));
+  const size_t readerCount = static_cast<size_t>(ArgValue(argc, argv, "--readers", 2));
+  const std::string outPath = ArgString(argc, argv, "--out", "");
+
+  ServiceCapacity capacity;
+  capacity.products = productCount;
+  PricingService<Bond> service(capacity);
+  service.WarmUp();
+  const std::vector<Bond> bonds = MakeUniverse(productCount);
+  std::vector<std::string> productIds;
+  std::vector<PricingService<Bond>::ProductHandle> handles;
+  for (size_t i = 0; i < productCount; ++i) {
+    productIds.push_back(bonds[i].GetProductId());
+    service.PublishPrice(Price<Bond>(bonds[i], 99.0 + (i % 1024) / 1024.0, (i % 1024) / 1024.0));
+    handles.push_back(service.GetProductHandle(productIds.back()));
+  }
+
+  int failures = 0;
+  PriceSnapshot snapshot;
+  size_t mismatched = service.GetPriceSnapshot(snapshot) ? 0 : 1;
+  mismatched += snapshot.mids.size() != productCount || snapshot.version != productCount;
+  for (size_t i = 0; i < productCount && !mismatched; ++i) {
+    const Price<Bond> &price = service.GetData(handles[i]);
+    if (snapshot.mids[handles[i]] != price.GetMid() || snapshot.bidOfferSpreads[handles[i]] != price.GetBidOfferSpread()) ++mismatched;
+  }
+  if (mismatched) {
+    std::cerr << "Price snapshot differs from the stored prices" << std::endl;
+    ++failures;
+  }
+
+  std::vector<StageResult> results;
+  double sink = 0.0;
+  results.push_back(TimeBlock("product_id", passes * productCount, [&]() {
+    for (size_t pass = 0; pass < passes; ++pass) {
+      for (const std::string &productId : productIds) sink += service.GetData(productId).GetMid();
+    }
+  }));
+  results.push_back(TimeBlock("handle", passes * productCount, [&]() {
+    for (size_t pass = 0; pass < passes; ++pass) {
+      for (PricingService<Bond>::ProductHandle handle : handles) sink += service.GetData(handle).GetMid();
+    }
+  }));
+  results.push_back(TimeBlock("snapshot", passes * productCount, [&]() {
+    for (size_t pass = 0; pass < passes; ++pass) {
+      service.GetPriceSnapshot(snapshot);
+      sink += SumMids(snapshot);
+    }
+  }));
+
+  // Readers copy snapshots until the writer has stored every update
+  std::atomic<bool> done(false);
+  std::atomic<uint64_t> copies(0), consistentCopies(0), torn(0), backwards(0);
+  std::vector<std::thread> readers;
+  uint64_t start = NowNanos();
+  for (size_t r = 0; r < readerCount; ++r) {
+    readers.emplace_back([&]() {
+      PriceSnapshot copy;
+      uint64_t count = 0, consistent = 0, bad = 0, reversed = 0, lastVersion = 0;
+      while (!done.load(std::memory_order_relaxed)) {
+        consistent += service.GetPriceSnapshot(copy);
+        for (size_t i = 0; i < copy.mids.size(); ++i) bad += copy.mids[i] - copy.bidOfferSpreads[i] != 99.0;
+        reversed += copy.version < lastVersion;
+        lastVersion = copy.version;
+        ++count;
+      }
+      copies.fetch_add(count);
+      consistentCopies.fetch_add(consistent);
+      torn.fetch_add(bad);
+      backwards.fetch_add(reversed);
+    });
+  }
+  std::thread writer([&]() {
+    for (size_t u = 0; u < updates; ++u) {
+      const double spread = ((u * 7) % 1024) / 1024.0;
+      service.UpdatePrice(handles[u % productCount], 99.0 + spread, spread);
+    }
+    done.store(true);
+  });
+  writer.join();
+  for (std::thread &reader : readers) reader.join();
+  StageResult concurrent;
+  concurrent.name = "snapshot.concurrent";
+  concurrent.events = copies.load() * productCount;
+  concurrent.seconds = (NowNanos() - start) / 1e9;
+  concurrent.mean = concurrent.events ? concurrent.seconds * 1e9 * readerCount / concurrent.events : 0.0;
+  results.push_back(concurrent);
+  if (torn.load() || backwards.load()) {
+    std::cerr << torn.load() << " torn prices and " << backwards.load() << " backward versions under concurrent updates" << std::endl;
+    ++failures;
+  }
+
+  std::vector<std::pair<std::string, double>> parameters = {
+    { "passes", static_cast<double>(passes) },
+    { "products", static_cast<double>(productCount) },
+    { "updates", static_cast<double>(updates) },
+    { "readers", static_cast<double>(readerCount) },
+    { "concurrent_copies", static_cast<double>(copies.load()) },
+    { "consistent_copies", static_cast<double>(consistentCopies.load()) },
+    { "writer_updates_per_sec", updates / concurrent.seconds },
+    { "cpus", static_cast<double>(std::thread::hardware_concurrency()) },
+    { "checksum", sink }
+  };
+  if (outPath.empty()) {
+    WriteJson(std::cout, "pricesnapshot", parameters, results);
+  } else {
+    std::ofstream out(outPath);
+    WriteJson(out, "pricesnapshot", parameters, results);
+  }
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,215 @@
+/**
+ * pricing_bench.cpp
+ * Ticks per second through market data into the PricingEngine.
+ *
+ * Level updates over a universe of products are applied to a
+ * MarketDataService with OnLevelUpdate. Stages:
+ *
+ *   marketdata       the level updates alone
+ *   marketdata.pricing  the same updates with a PricingEngine deriving and
+ *                    publishing prices from every change in the top levels
+ *
+ * Both services are warmed with a pass over the same updates first, so every
+ * product has a book and a price. The engine must then run without
+ * allocating: a further pass over the updates with pricing must allocate no
+ * more than the same pass without. Every product's final price must be within
+ * a tick of the price derived from its final best bid and offer, pricing
+ * listeners must hear exactly the prices the engine counts as published, and
+ * every tick must be counted as published, unchanged or one-sided. Any violation makes the
+ * process exit non-zero.
+ *
+ * Usage: pricing_bench [--ticks N] [--products P] [--skew S] [--tightening T] [--min-spread M] [--out results.json]
+ */
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "benchdata.hpp"
+#include "benchutil.hpp"
+#include "products.hpp"
+#include "pricingengine.hpp"
+
+namespace {
+
+std::atomic<uint64_t> allocations(0);
+
+// One level update of a product's book
+struct LevelTick
+{
+  uint32_t product;
+  PricingSide side;
+  double price;
+  long quantity;
+};
+
+// Counts the price updates it hears about
+class CountingPriceListener : public ServiceListener<Price<Bond>>
+{
+
+public:
+
+  void ProcessAdd(Price<Bond>&) override { ++prices; }
+  void ProcessRemove(Price<Bond>&) override {}
+  void ProcessUpdate(Price<Bond>&) override { ++prices; }
+
+  uint64_t prices = 0;
+};
+
+// Count an allocation and make it with malloc, or aligned_alloc for over-aligned types
+void* CountedAllocate(std::size_t size, std::size_t alignment) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (!size) size = 1;
+  void *memory = alignment > alignof(std::max_align_t)
+    ? std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment)
+    : std::malloc(size);
+  if (!memory) throw std::bad_alloc();
+  return memory;
+}
+
+}
+
+// The whole replaceable set is defined, so that every form of new is counted
+// and every form of delete matches the allocator it frees from
+void* operator new(std::size_t size) { return CountedAllocate(size, 0); }
+void* operator new[](std::size_t size) { return CountedAllocate(size, 0); }
+void* operator new(std::size_t size, std::align_val_t alignment) { return CountedAllocate(size, static_cast<std::size_t>(alignment)); }
+void* operator new[](std::size_t size, std::align_val_t alignment) { return CountedAllocate(size, static_cast<std::size_t>(alignment)); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  try { return CountedAllocate(size, 0); } catch (const std::bad_alloc&) { return nullptr; }
+}
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+  try { return CountedAllocate(size, 0); } catch (const std::bad_alloc&) { return nullptr; }
+}
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+  try { return CountedAllocate(size, static_cast<std::size_t>(alignment)); } catch (const std::bad_alloc&) { return nullptr; }
+}
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+  try { return CountedAllocate(size, static_cast<std::size_t>(alignment)); } catch (const std::bad_alloc&) { return nullptr; }
+}
+
+void operator delete(void *memory) noexcept { std::free(memory); }
+void operator delete[](void *memory) noexcept { std::free(memory); }
+void operator delete(void *memory, std::size_t) noexcept { std::free(memory); }
+void operator delete[](void *memory, std::size_t) noexcept { std::free(memory); }
+void operator delete(void *memory, std::align_val_t) noexcept { std::free(memory); }
+void operator delete[](void *memory, std::align_val_t) noexcept { std::free(memory); }
+void operator delete(void *memory, std::size_t, std::align_val_t) noexcept { std::free(memory); }
+void operator delete[](void *memory, std::size_t, std::align_val_t) noexcept { std::free(memory); }
+void operator delete(void *memory, const std::nothrow_t&) noexcept { std::free(memory); }
+void operator delete[](void *memory, const std::nothrow_t&) noexcept { std::free(memory); }
+void operator delete(void *memory, std::align_val_t, const std::nothrow_t&) noexcept { std::free(memory); }
+void operator delete[](void *memory, std::align_val_t, const std::nothrow_t&) noexcept { std::free(memory); }
+
+int main(int argc, char **argv) {
+  const size_t tickCount = static_cast<size_t>(ArgValue(argc, argv, "--ticks", 1000000));
+  const size_t productCount = static_cast<size_t>(ArgValue(argc, argv, "--products", 1000));
+  PricingOptions options;
+  options.skew = ArgValue(argc, argv, "--skew", 0.5);
+  options.tightening = ArgValue(argc, argv, "--tightening", 1);
+  options.minimumSpread = ArgValue(argc, argv, "--min-spread", 1);
+  const std::string outPath = ArgString(argc, argv, "--out", "");
+  const int LEVELS = 10;
+
+  const std::vector<Bond> bonds = MakeUniverse(productCount);
+  // Ten levels a side a 256th apart around 99.5; each tick resizes or removes one
+  std::vector<LevelTick> ticks;
+  ticks.reserve(tickCount);
+  uint64_t state = 88172645463325252ULL;
+  for (size_t t = 0; t < tickCount; ++t) {
+    state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+    PricingSide side = (state >> 8) & 1 ? BID : OFFER;
+    int level = 1 + static_cast<int>((state >> 16) % LEVELS);
+    long quantity = static_cast<long>((state >> 32) % 5) * 1000000L;
+    ticks.push_back(LevelTick{ static_cast<uint32_t>(state % productCount), side, 99.5 + (side == BID ? -level : level) / 256.0, quantity });
+  }
+
+  ServiceCapacity capacity;
+  capacity.products = productCount;
+  MarketDataService<Bond> plain(capacity), priced(capacity);
+  PricingService<Bond> pricing(capacity);
+  PricingEngine<Bond> engine(priced, pricing, options, productCount);
+  CountingPriceListener listener;
+  pricing.AddListener(&listener);
+  for (MarketDataService<Bond> *service : { &plain, &priced }) {
+    for (const Bond &bond : bonds) {
+      for (int level = 1; level <= LEVELS; ++level) {
+        service->OnLevelUpdate(bond, BID, 99.5 - level / 256.0, 1000000);
+        service->OnLevelUpdate(bond, OFFER, 99.5 + level / 256.0, 1000000);
+      }
+    }
+    for (const LevelTick &tick : ticks) service->OnLevelUpdate(bonds[tick.product], tick.side, tick.price, tick.quantity);
+  }
+
+  std::vector<StageResult> results;
+  results.push_back(TimeStage("marketdata", tickCount, [&](size_t t) {
+    const LevelTick &tick = ticks[t];
+    plain.OnLevelUpdate(bonds[tick.product], tick.side, tick.price, tick.quantity);
+  }));
+  results.push_back(TimeStage("marketdata.pricing", tickCount, [&](size_t t) {
+    const LevelTick &tick = ticks[t];
+    priced.OnLevelUpdate(bonds[tick.product], tick.side, tick.price, tick.quantity);
+  }));
+
+  // Allocations of one more pass, counted outside the timing harness
+  uint64_t before = allocations.load();
+  for (const LevelTick &tick : ticks) plain.OnLevelUpdate(bonds[tick.product], tick.side, tick.price, tick.quantity);
+  const uint64_t plainAllocations = allocations.load() - before;
+  before = allocations.load();
+  for (const LevelTick &tick : ticks) priced.OnLevelUpdate(bonds[tick.product], tick.side, tick.price, tick.quantity);
+  const uint64_t pricedAllocations = allocations.load() - before;
+
+  int failures = 0;
+  if (pricedAllocations > plainAllocations) {
+    std::cerr << "Pricing allocated " << pricedAllocations - plainAllocations << " times over " << tickCount << " ticks" << std::endl;
+    ++failures;
+  }
+  const PricingStats &stats = engine.GetStats();
+  if (stats.published + stats.unchanged + stats.oneSided != stats.ticks || listener.prices != stats.published) {
+    std::cerr << "Engine counted " << stats.ticks << " ticks as " << stats.published << " published, " << stats.unchanged << " unchanged and "
+              << stats.oneSided << " one-sided; listeners heard " << listener.prices << " prices" << std::endl;
+    ++failures;
+  }
+  size_t stale = 0;
+  for (const Bond &bond : bonds) {
+    const BookSignals signals = priced.GetSignals(bond.GetProductId());
+    const Price<Bond> *price = pricing.TryGetData(bond.GetProductId());
+    if (!signals.bidLevels || !signals.offerLevels) continue;
+    const double mid = signals.mid + options.skew / 256.0;
+    const double spread = std::max(signals.spread - options.tightening / 256.0, options.minimumSpread / 256.0);
+    const double tick = options.tick / 256.0;
+    if (!price || std::fabs(price->GetMid() - mid) >= tick || std::fabs(price->GetBidOfferSpread() - spread) >= tick ||
+        price->GetBidOfferSpread() < options.minimumSpread / 256.0) ++stale;
+  }
+  if (stale) {
+    std::cerr << stale << " products priced more than a tick from their best bid and offer" << std::endl;
+    ++failures;
+  }
+
+  std::vector<std::pair<std::string, double>> parameters = {
+    { "ticks", static_cast<double>(tickCount) },
+    { "products", static_cast<double>(productCount) },
+    { "skew", options.skew },
+    { "tightening", options.tightening },
+    { "minimum_spread", options.minimumSpread },
+    { "signal_updates", static_cast<double>(stats.ticks) },
+    { "published", static_cast<double>(stats.published) },
+    { "unchanged", static_cast<double>(stats.unchanged) },
+    { "one_sided", static_cast<double>(stats.oneSided) },
+    { "marketdata_allocations", static_cast<double>(plainAllocations) },
+    { "pricing_allocations", static_cast<double>(pricedAllocations) },
+    { "timer_overhead_ns", TimerOverheadNanos() }
+  };
+  if (outPath.empty()) {
+    WriteJson(std::cout, "pricing", parameters, results);
+  } else {
+    std::ofstream out(outPath);
+    WriteJson(out, "pricing", parameters, results);
+  }
+  return failures ? 1 : 0;
+}
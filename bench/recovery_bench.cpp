@@ -0,0 +1,347 @@
+/**
+ * recovery_bench.cpp
+ * Fault injection harness for the sequenced incremental market data feed.
+ *
+ * A simulated exchange generates level updates for a set of products and
+ * keeps the true books. The updates go through a faulty channel that drops,
+ * duplicates and reorders them according to each scenario, and arrive at a
+ * MarketDataFeedHandler feeding a MarketDataService. Snapshot requests are
+ * answered from the exchange's books a fixed number of messages later, as if
+ * from a slower recovery channel.
+ *
+ * Scenarios: clean, reorder, duplicate, drop, burst_loss (one run of
+ * consecutive updates lost) and mixed. Each is reported as a stage timing
+ * OnUpdate per delivered message, with the handler's counts as parameters.
+ * The full_book stage times the same service fed a whole order book per
+ * change, the cost incremental updates avoid.
+ *
+ * Every few messages each product's book in the service is compared with the
+ * exchange's book as of the last sequence number the handler applied, so an
+ * update applied out of order or across a gap is caught when it happens. At
+ * the end every product gets a heartbeat, outstanding snapshots are answered,
+ * and every book must equal the exchange's. The clean scenario must not
+ * request snapshots and the lossy ones must. Any violation makes the process
+ * exit non-zero.
+ *
+ * Usage: recovery_bench [--updates N] [--products P] [--window W] [--latency L] [--seed S] [--out results.json]
+ */
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "benchdata.hpp"
+#include "benchutil.hpp"
+#include "products.hpp"
+#include "marketdataservice.hpp"
+#include "marketdatafeed.hpp"
+
+namespace {
+
+// xorshift64* as in the tick generator
+uint64_t NextRandom(uint64_t &state) {
+  state ^= state >> 12;
+  state ^= state << 25;
+  state ^= state >> 27;
+  return state * 2685821657736338717ULL;
+}
+
+double Uniform(uint64_t &state) {
+  return (NextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+struct Faults
+{
+  std::string name;
+  double drop;        // probability an update is lost
+  double duplicate;   // probability an update is sent twice
+  double reorder;     // probability an update is delayed behind up to 8 later ones
+  size_t burst;       // consecutive updates lost half way through
+};
+
+// An update generated by the exchange, with the index of its product
+struct Generated
+{
+  BookUpdate<Bond> update;
+  size_t product;
+};
+
+// An update as delivered, with the number of updates the exchange had sent by then
+struct WireMessage
+{
+  size_t update;
+  size_t sent;
+};
+
+// Levels of one side in price order, for comparing books regardless of stack order
+std::vector<std::pair<double, long>> Levels(const std::vector<Order> &stack) {
+  std::vector<std::pair<double, long>> levels;
+  for (const Order &order : stack) levels.push_back({ order.GetPrice(), order.GetQuantity() });
+  std::sort(levels.begin(), levels.end());
+  return levels;
+}
+
+bool SameBook(const OrderBook<Bond> &a, const OrderBook<Bond> &b) {
+  return Levels(a.GetBidStack()) == Levels(b.GetBidStack()) && Levels(a.GetOfferStack()) == Levels(b.GetOfferStack());
+}
+
+void Apply(OrderBook<Bond> &book, const BookUpdate<Bond> &update) {
+  book.SetLevel(update.GetSide(), update.GetPrice(), update.GetQuantity());
+}
+
+// Books of every product advanced through the generated updates in order,
+// either all of them or per product up to a sequence number
+class Books
+{
+
+public:
+
+  Books(const std::vector<Bond> &bonds, const std::vector<Generated> &_updates) : updates(_updates), applied(0) {
+    for (const Bond &bond : bonds) books.push_back(OrderBook<Bond>(bond, std::vector<Order>(), std::vector<Order>()));
+    sequences.assign(bonds.size(), 0);
+    log.resize(bonds.size());
+    for (size_t u = 0; u < updates.size(); ++u) log[updates[u].product].push_back(u);
+  }
+
+  // Apply the first sent updates
+  void AdvanceTo(size_t sent) {
+    for (; applied < sent; ++applied) {
+      const Generated &generated = updates[applied];
+      Apply(books[generated.product], generated.update);
+      sequences[generated.product] = generated.update.GetSequence();
+    }
+  }
+
+  // Apply one product's updates up to a sequence number
+  void AdvanceProductTo(size_t product, uint64_t sequence) {
+    for (; sequences[product] < sequence; ++sequences[product]) Apply(books[product], updates[log[product][sequences[product]]].update);
+  }
+
+  const OrderBook<Bond>& Book(size_t product) const { return books[product]; }
+  uint64_t Sequence(size_t product) const { return sequences[product]; }
+
+private:
+  const std::vector<Generated> &updates;
+  size_t applied;
+  std::vector<OrderBook<Bond>> books;
+  std::vector<uint64_t> sequences;
+  std::vector<std::vector<size_t>> log;   // update indices by product, in sequence order
+};
+
+// Collects snapshot requests to be answered after a fixed number of messages
+class RecoveryConnector : public Connector<SnapshotRequest>
+{
+
+public:
+
+  explicit RecoveryConnector(size_t _latency) : latency(_latency), now(0) {}
+
+  void Publish(SnapshotRequest &request) override { due.push_back({ now + latency, request }); }
+
+  size_t latency;
+  size_t now;
+  std::deque<std::pair<size_t, SnapshotRequest>> due;
+};
+
+// Updates with per-product sequence numbers over a ten level price grid
+std::vector<Generated> GenerateUpdates(const std::vector<Bond> &bonds, size_t count, uint64_t seed) {
+  std::vector<Generated> updates;
+  updates.reserve(count);
+  std::vector<uint64_t> sequences(bonds.size(), 0);
+  uint64_t state = seed;
+  for (size_t u = 0; u < count; ++u) {
+    uint64_t random = NextRandom(state);
+    size_t product = random % bonds.size();
+    PricingSide side = (random >> 20) & 1 ? OFFER : BID;
+    int level = static_cast<int>((random >> 24) % 10);
+    double price = side == BID ? 99.5 - (level + 1) / 256.0 : 99.5 + (level + 1) / 256.0;
+    long quantity = (random >> 32) % 5 == 0 ? 0 : static_cast<long>(1 + (random >> 40) % 10) * 1000000L;
+    updates.push_back({ BookUpdate<Bond>(bonds[product], ++sequences[product], side, price, quantity), product });
+  }
+  return updates;
+}
+
+// Messages as the faulty channel delivers them
+std::vector<WireMessage> Transmit(size_t count, const Faults &faults, uint64_t seed) {
+  std::vector<WireMessage> wire;
+  std::vector<std::pair<size_t, size_t>> delayed;   // update, released after this update is sent
+  uint64_t state = seed;
+  const size_t burstStart = count / 2;
+  for (size_t u = 0; u < count; ++u) {
+    bool lost = u >= burstStart && u < burstStart + faults.burst;
+    double draw = Uniform(state);
+    if (lost || draw < faults.drop) {
+      // lost
+    } else if (draw < faults.drop + faults.reorder) {
+      delayed.push_back({ u, u + 1 + NextRandom(state) % 8 });
+    } else {
+      wire.push_back({ u, u + 1 });
+    }
+    if (!lost && Uniform(state) < faults.duplicate) wire.push_back({ u, u + 1 });
+    for (size_t d = 0; d < delayed.size();) {
+      if (delayed[d].second <= u) {
+        wire.push_back({ delayed[d].first, u + 1 });
+        delayed.erase(delayed.begin() + d);
+      } else {
+        ++d;
+      }
+    }
+  }
+  for (const std::pair<size_t, size_t> &d : delayed) wire.push_back({ d.first, count });
+  return wire;
+}
+
+struct ScenarioRun
+{
+  StageResult stage;
+  FeedStats stats;
+  size_t delivered = 0;
+  int failures = 0;
+};
+
+ScenarioRun RunScenario(const Faults &faults, const std::vector<Bond> &bonds, const std::vector<Generated> &updates,
+                        const FeedOptions &options, size_t latency, uint64_t seed) {
+  const std::vector<WireMessage> wire = Transmit(updates.size(), faults, seed);
+  std::unordered_map<std::string, size_t> productIndex;
+  for (size_t p = 0; p < bonds.size(); ++p) productIndex[bonds[p].GetProductId()] = p;
+
+  ServiceCapacity capacity;
+  capacity.products = bonds.size();
+  MarketDataService<Bond> service(capacity);
+  RecoveryConnector recovery(latency);
+  MarketDataFeedHandler<Bond> handler(service, recovery, options, bonds.size());
+  Books exchange(bonds, updates);
+  Books replica(bonds, updates);
+
+  ScenarioRun run;
+  run.delivered = wire.size();
+  auto answer = [&](size_t now) {
+    while (!recovery.due.empty() && recovery.due.front().first <= now) {
+      size_t product = productIndex[recovery.due.front().second.productId];
+      recovery.due.pop_front();
+      handler.OnSnapshot(BookSnapshot<Bond>(exchange.Book(product), exchange.Sequence(product)));
+    }
+  };
+  auto check = [&](const char *when) {
+    for (size_t p = 0; p < bonds.size(); ++p) {
+      const std::string &productId = bonds[p].GetProductId();
+      uint64_t sequence = handler.GetSequence(productId);
+      if (sequence == 0) continue;
+      replica.AdvanceProductTo(p, sequence);
+      if (!SameBook(service.GetData(productId), replica.Book(p))) {
+        std::cerr << faults.name << ": " << productId << " book differs from sequence " << sequence << " " << when << std::endl;
+        ++run.failures;
+      }
+    }
+  };
+
+  LatencyRecorder recorder(wire.size());
+  uint64_t start = NowNanos();
+  for (size_t i = 0; i < wire.size(); ++i) {
+    exchange.AdvanceTo(wire[i].sent);
+    recovery.now = i;
+    uint64_t before = NowNanos();
+    handler.OnUpdate(updates[wire[i].update].update);
+    recorder.Record(NowNanos() - before);
+    answer(i);
+    if (i % 1024 == 0) check("mid-session");
+  }
+  run.stage = recorder.Summarize(faults.name, (NowNanos() - start) / 1e9);
+
+  // End of session: heartbeats reveal trailing losses, then recovery completes
+  exchange.AdvanceTo(updates.size());
+  for (int round = 0; round < 3; ++round) {
+    for (size_t p = 0; p < bonds.size(); ++p) handler.OnHeartbeat(bonds[p].GetProductId(), exchange.Sequence(p));
+    answer(static_cast<size_t>(-1));
+  }
+  check("after recovery");
+  for (size_t p = 0; p < bonds.size(); ++p) {
+    const std::string &productId = bonds[p].GetProductId();
+    if (handler.GetSequence(productId) != exchange.Sequence(p) || handler.IsRecovering(productId) ||
+        !SameBook(service.GetData(productId), exchange.Book(p))) {
+      std::cerr << faults.name << ": " << productId << " did not recover to sequence " << exchange.Sequence(p) << std::endl;
+      ++run.failures;
+    }
+  }
+  run.stats = handler.GetStats();
+  bool lossy = faults.drop > 0 || faults.burst > 0;
+  if (lossy != (run.stats.snapshotRequests > 0)) {
+    std::cerr << faults.name << ": " << run.stats.snapshotRequests << " snapshot requests" << std::endl;
+    ++run.failures;
+  }
+  return run;
+}
+
+}
+
+int main(int argc, char **argv) {
+  const size_t updateCount = static_cast<size_t>(ArgValue(argc, argv, "--updates", 200000));
+  const size_t productCount = static_cast<size_t>(ArgValue(argc, argv, "--products", 16));
+  const size_t latency = static_cast<size_t>(ArgValue(argc, argv, "--latency", 32));
+  const uint64_t seed = static_cast<uint64_t>(ArgValue(argc, argv, "--seed", 20181201));
+  const std::string outPath = ArgString(argc, argv, "--out", "");
+  FeedOptions options;
+  options.reorderWindow = static_cast<size_t>(ArgValue(argc, argv, "--window", 16));
+
+  const std::vector<Bond> bonds = MakeUniverse(productCount);
+  const std::vector<Generated> updates = GenerateUpdates(bonds, updateCount, seed);
+
+  const std::vector<Faults> scenarios = {
+    { "clean", 0.0, 0.0, 0.0, 0 },
+    { "reorder", 0.0, 0.0, 0.05, 0 },
+    { "duplicate", 0.0, 0.02, 0.0, 0 },
+    { "drop", 0.005, 0.0, 0.0, 0 },
+    { "burst_loss", 0.0, 0.0, 0.0, 500 },
+    { "mixed", 0.002, 0.01, 0.02, 200 }
+  };
+
+  int failures = 0;
+  std::vector<StageResult> results;
+  std::vector<std::pair<std::string, double>> parameters = {
+    { "updates", static_cast<double>(updateCount) },
+    { "products", static_cast<double>(productCount) },
+    { "reorder_window", static_cast<double>(options.reorderWindow) },
+    { "snapshot_latency", static_cast<double>(latency) },
+    { "seed", static_cast<double>(seed) },
+    { "timer_overhead_ns", TimerOverheadNanos() }
+  };
+  for (const Faults &faults : scenarios) {
+    ScenarioRun run = RunScenario(faults, bonds, updates, options, latency, seed ^ 0x9e3779b97f4a7c15ULL);
+    failures += run.failures;
+    results.push_back(run.stage);
+    parameters.push_back({ faults.name + ".delivered", static_cast<double>(run.delivered) });
+    parameters.push_back({ faults.name + ".applied", static_cast<double>(run.stats.applied) });
+    parameters.push_back({ faults.name + ".duplicates", static_cast<double>(run.stats.duplicates) });
+    parameters.push_back({ faults.name + ".buffered", static_cast<double>(run.stats.buffered) });
+    parameters.push_back({ faults.name + ".gaps", static_cast<double>(run.stats.gaps) });
+    parameters.push_back({ faults.name + ".snapshot_requests", static_cast<double>(run.stats.snapshotRequests) });
+    parameters.push_back({ faults.name + ".snapshots", static_cast<double>(run.stats.snapshots) });
+    parameters.push_back({ faults.name + ".stale_snapshots", static_cast<double>(run.stats.staleSnapshots) });
+  }
+
+  // The same changes delivered as whole books
+  const size_t bookCount = std::min<size_t>(updateCount, 20000);
+  std::vector<OrderBook<Bond>> books;
+  books.reserve(bookCount);
+  {
+    Books exchange(bonds, updates);
+    for (size_t u = 0; u < bookCount; ++u) {
+      exchange.AdvanceTo(u + 1);
+      books.push_back(exchange.Book(updates[u].product));
+    }
+  }
+  MarketDataService<Bond> service;
+  results.push_back(TimeStage("full_book", bookCount, [&](size_t u) { service.OnMessage(std::move(books[u])); }));
+
+  if (outPath.empty()) {
+    WriteJson(std::cout, "recovery", parameters, results);
+  } else {
+    std::ofstream out(outPath);
+    WriteJson(out, "recovery", parameters, results);
+  }
+  return failures ? 1 : 0;
+}
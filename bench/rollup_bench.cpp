@@ -0,0 +1,219 @@
+/**
+ * rollup_bench.cpp
+ * Cost of maintaining live position rollups by desk, ticker and maturity
+ * bucket, and of reading their totals.
+ *
+ * Trades over a large universe of bonds and books are booked into
+ * PositionServices. Stages:
+ *
+ *   AddTrade.none       positions only, no rollup
+ *   AddTrade.rollup     positions rolled up desk / ticker / maturity bucket
+ *   *.repeat            the same trades booked again, once every product and
+ *                       book has its position and rollup path
+ *   AddTrade.listeners  the same with a listener on every desk node
+ *   read.node           the total of a random rollup node
+ *   read.scan           the total of one desk recomputed from every position,
+ *                       the alternative to reading its node
+ *
+ * The rollups are checked at the end: every node's total must equal the sum
+ * of its children, the root the sum of all positions, and each desk the sum
+ * recomputed from positions. A rollup added after the trades, seeded from the
+ * positions, must match the live one node for node, and so must the live one
+ * after positions are replaced through OnMessage. Any violation makes the
+ * process exit non-zero.
+ *
+ * Usage: rollup_bench [--trades N] [--products P] [--books B] [--out results.json]
+ */
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "benchdata.hpp"
+#include "benchutil.hpp"
+#include "products.hpp"
+#include "positionservice.hpp"
+
+namespace {
+
+const int BOOKS_PER_DESK = 10;
+
+std::string BookName(size_t book) { return "BOOK" + std::to_string(book); }
+std::string DeskName(size_t book) { return "DESK" + std::to_string(book / BOOKS_PER_DESK); }
+
+std::vector<RollupLevel<Bond>> Levels(size_t bookCount) {
+  std::map<std::string, std::string> desks;
+  for (size_t book = 0; book < bookCount; ++book) desks[BookName(book)] = DeskName(book);
+  return { DeskLevel<Bond>(desks), TickerLevel<Bond>(), MaturityBucketLevel<Bond>(date(2018, Dec, 1), { 2, 5, 10, 20 }) };
+}
+
+// Counts the rollup node updates it hears about
+class CountingNodeListener : public ServiceListener<RollupNode>
+{
+
+public:
+
+  void ProcessAdd(RollupNode&) override {}
+  void ProcessRemove(RollupNode&) override {}
+  void ProcessUpdate(RollupNode&) override { ++updates; }
+
+  size_t updates = 0;
+};
+
+// Nodes whose total differs from the sum of their children
+size_t InconsistentNodes(const PositionRollup<Bond> &rollup) {
+  size_t inconsistent = 0;
+  for (size_t handle = 0; handle < rollup.Size(); ++handle) {
+    const RollupNode &node = rollup.GetNode(static_cast<uint32_t>(handle));
+    if (node.children.empty()) continue;
+    long sum = 0;
+    for (uint32_t child : node.children) sum += rollup.GetNode(child).position;
+    if (sum != node.position) ++inconsistent;
+  }
+  return inconsistent;
+}
+
+// Nodes of one rollup whose total differs from the node at the same path in another
+size_t DifferentNodes(const PositionRollup<Bond> &a, const PositionRollup<Bond> &b) {
+  size_t different = 0;
+  for (size_t handle = 0; handle < a.Size(); ++handle) {
+    const RollupNode &node = a.GetNode(static_cast<uint32_t>(handle));
+    uint32_t other = b.Find(node.path);
+    if (node.position != (other == PositionRollup<Bond>::NO_NODE ? 0 : b.GetPosition(other))) ++different;
+  }
+  return different;
+}
+
+// Total of one desk recomputed from every position
+long ScanDesk(PositionService<Bond> &service, size_t productCount, size_t desk) {
+  long total = 0;
+  for (size_t handle = 0; handle < productCount; ++handle) {
+    const Position<Bond> *position = &service.GetData(static_cast<PositionService<Bond>::ProductHandle>(handle));
+    for (const auto &entry : position->GetPositions()) {
+      if (std::stoul(entry.first.substr(4)) / BOOKS_PER_DESK == desk) total += entry.second;
+    }
+  }
+  return total;
+}
+
+}
+
+int main(int argc, char **argv) {
+  const size_t tradeCount = static_cast<size_t>(ArgValue(argc, argv, "--trades", 1000000));
+  const size_t productCount = static_cast<size_t>(ArgValue(argc, argv, "--products", 100000));
+  const size_t bookCount = static_cast<size_t>(ArgValue(argc, argv, "--books", 50));
+  const std::string outPath = ArgString(argc, argv, "--out", "");
+
+  std::vector<Bond> bonds;
+  bonds.reserve(productCount);
+  for (size_t i = 0; i < productCount; ++i) {
+    date maturity = date(2019, Jan, 15) + days(static_cast<long>((i * 7919) % (30 * 365)));
+    bonds.push_back(SyntheticBond(1000000 + i, "TKR" + std::to_string(i % 2000), maturity));
+  }
+  // Every product trades once before any repeats, so every service creates
+  // its positions in the same order and product handles agree
+  std::vector<Trade<Bond>> trades;
+  trades.reserve(tradeCount);
+  uint64_t state = 88172645463325252ULL;
+  for (size_t t = 0; t < tradeCount; ++t) {
+    state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+    size_t product = t < productCount ? t : state % productCount;
+    size_t book = (state >> 20) % bookCount;
+    long quantity = static_cast<long>(1 + (state >> 32) % 10) * 1000000L;
+    trades.push_back(Trade<Bond>(bonds[product], "T" + std::to_string(t), 99.5, BookName(book), quantity, (state >> 40) & 1 ? BUY : SELL));
+  }
+
+  ServiceCapacity capacity;
+  capacity.products = productCount;
+  const size_t expectedNodes = 1 + bookCount / BOOKS_PER_DESK * (1 + 2000 * 6);
+  std::vector<StageResult> results;
+  int failures = 0;
+
+  PositionService<Bond> plain(capacity);
+  results.push_back(TimeStage("AddTrade.none", tradeCount, [&](size_t t) { plain.AddTrade(trades[t]); }));
+  results.push_back(TimeStage("AddTrade.none.repeat", tradeCount, [&](size_t t) { plain.AddTrade(trades[t]); }));
+
+  PositionService<Bond> positions(capacity);
+  PositionRollup<Bond> rollup(Levels(bookCount), expectedNodes, tradeCount);
+  positions.AddRollup(rollup);
+  results.push_back(TimeStage("AddTrade.rollup", tradeCount, [&](size_t t) { positions.AddTrade(trades[t]); }));
+  results.push_back(TimeStage("AddTrade.rollup.repeat", tradeCount, [&](size_t t) { positions.AddTrade(trades[t]); }));
+
+  PositionService<Bond> listened(capacity);
+  PositionRollup<Bond> listenedRollup(Levels(bookCount), expectedNodes, tradeCount);
+  CountingNodeListener listener;
+  ListenerOptions deskNodes;
+  for (size_t book = 0; book < bookCount; book += BOOKS_PER_DESK) deskNodes.keys.push_back(DeskName(book));
+  listenedRollup.AddListener(&listener, deskNodes);
+  listened.AddRollup(listenedRollup);
+  results.push_back(TimeStage("AddTrade.listeners", tradeCount, [&](size_t t) { listened.AddTrade(trades[t]); }));
+  if (listener.updates != tradeCount) {
+    std::cerr << "Desk listener heard " << listener.updates << " updates for " << tradeCount << " trades" << std::endl;
+    ++failures;
+  }
+
+  // Reads
+  long sink = 0;
+  uint64_t readState = 2463534242ULL;
+  results.push_back(TimeStage("read.node", tradeCount, [&](size_t) {
+    readState ^= readState << 13; readState ^= readState >> 7; readState ^= readState << 17;
+    sink += rollup.GetPosition(static_cast<PositionRollup<Bond>::NodeHandle>(readState % rollup.Size()));
+  }));
+  const size_t desks = (bookCount + BOOKS_PER_DESK - 1) / BOOKS_PER_DESK;
+  results.push_back(TimeStage("read.scan", 10, [&](size_t i) { sink += ScanDesk(positions, productCount, i % desks); }));
+
+  // Checks
+  long total = 0;
+  for (size_t handle = 0; handle < productCount; ++handle) {
+    total += positions.GetData(static_cast<PositionService<Bond>::ProductHandle>(handle)).GetAggregatePosition();
+  }
+  if (rollup.GetPosition(PositionRollup<Bond>::ROOT) != total || InconsistentNodes(rollup)) {
+    std::cerr << "Rollup totals do not add up to the positions" << std::endl;
+    ++failures;
+  }
+  for (size_t desk = 0; desk < desks; ++desk) {
+    if (rollup.GetPosition(DeskName(desk * BOOKS_PER_DESK)) != ScanDesk(positions, productCount, desk)) {
+      std::cerr << "Rollup total of " << DeskName(desk * BOOKS_PER_DESK) << " differs from its positions" << std::endl;
+      ++failures;
+    }
+  }
+  PositionRollup<Bond> seeded(Levels(bookCount), expectedNodes, tradeCount);
+  positions.AddRollup(seeded);
+  if (DifferentNodes(rollup, seeded) || DifferentNodes(seeded, rollup)) {
+    std::cerr << "Rollup seeded from positions differs from the live rollup" << std::endl;
+    ++failures;
+  }
+  positions.RemoveRollup(seeded);
+
+  // Replace some positions wholesale and check the rollup follows
+  for (size_t i = 0; i < 1000 && i < productCount; ++i) {
+    Position<Bond> replacement(bonds[i]);
+    replacement.UpdatePosition(BookName(i % bookCount), 5000000);
+    replacement.UpdatePosition(BookName((i + 7) % bookCount), -2000000);
+    positions.OnMessage(replacement);
+  }
+  PositionRollup<Bond> reseeded(Levels(bookCount), expectedNodes, tradeCount);
+  positions.AddRollup(reseeded);
+  if (DifferentNodes(rollup, reseeded) || DifferentNodes(reseeded, rollup) || InconsistentNodes(rollup)) {
+    std::cerr << "Rollup does not follow positions replaced through OnMessage" << std::endl;
+    ++failures;
+  }
+
+  std::vector<std::pair<std::string, double>> parameters = {
+    { "trades", static_cast<double>(tradeCount) },
+    { "products", static_cast<double>(productCount) },
+    { "books", static_cast<double>(bookCount) },
+    { "depth", static_cast<double>(rollup.GetLevels().size()) },
+    { "nodes", static_cast<double>(rollup.Size()) },
+    { "timer_overhead_ns", TimerOverheadNanos() },
+    { "checksum", static_cast<double>(sink) }
+  };
+  if (outPath.empty()) {
+    WriteJson(std::cout, "rollup", parameters, results);
+  } else {
+    std::ofstream out(outPath);
+    WriteJson(out, "rollup", parameters, results);
+  }
+  return failures ? 1 : 0;
+}
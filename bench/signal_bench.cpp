@@ -0,0 +1,167 @@
+/**
+ * signal_bench.cpp
+ * Cost per tick of maintaining order book depth signals in MarketDataService.
+ *
+ * Stages:
+ *
+ *   OnMessage.changing   storing books whose levels change on every tick, so
+ *                        signals are recomputed and published each time
+ *   OnMessage.unchanged  storing the same book again, where change detection
+ *                        skips the recomputation
+ *   CumulativeSizes.simd    the vectorized prefix sum over SIGNAL_LEVELS sizes
+ *   CumulativeSizes.scalar  the same sum one level at a time
+ *   recompute            a consumer deriving the signals itself from the
+ *                        stored book's stacks on every tick
+ *
+ * Every changing tick's published signals are checked against a straight
+ * recomputation from the book's stacks, and the vectorized prefix sums against
+ * the scalar ones. Any mismatch makes the process exit non-zero.
+ *
+ * Usage: signal_bench [--ticks N] [--products P] [--depth D] [--out results.json]
+ */
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "benchdata.hpp"
+#include "benchutil.hpp"
+#include "products.hpp"
+#include "marketdataservice.hpp"
+
+namespace {
+
+// Signals computed directly from a book's stacks, without change detection
+BookSignals Recompute(const OrderBook<Bond> &book) {
+  std::vector<Order> bids = book.GetBidStack(), offers = book.GetOfferStack();
+  std::stable_sort(bids.begin(), bids.end(), [](const Order &a, const Order &b) { return a.GetPrice() > b.GetPrice(); });
+  std::stable_sort(offers.begin(), offers.end(), [](const Order &a, const Order &b) { return a.GetPrice() < b.GetPrice(); });
+  BookSignals signals = {};
+  signals.bidLevels = static_cast<int32_t>(std::min<size_t>(bids.size(), SIGNAL_LEVELS));
+  signals.offerLevels = static_cast<int32_t>(std::min<size_t>(offers.size(), SIGNAL_LEVELS));
+  int64_t bidTotal = 0, offerTotal = 0;
+  for (int i = 0; i < SIGNAL_LEVELS; ++i) {
+    bidTotal += i < signals.bidLevels ? bids[i].GetQuantity() : 0;
+    offerTotal += i < signals.offerLevels ? offers[i].GetQuantity() : 0;
+    signals.cumulativeBidSize[i] = bidTotal;
+    signals.cumulativeOfferSize[i] = offerTotal;
+  }
+  double bidSize = signals.bidLevels ? bids[0].GetQuantity() : 0.0;
+  double offerSize = signals.offerLevels ? offers[0].GetQuantity() : 0.0;
+  signals.imbalance = bidSize + offerSize > 0 ? (bidSize - offerSize) / (bidSize + offerSize) : 0.0;
+  signals.depthImbalance = bidTotal + offerTotal > 0 ? static_cast<double>(bidTotal - offerTotal) / (bidTotal + offerTotal) : 0.0;
+  if (signals.bidLevels && signals.offerLevels) {
+    signals.bestBid = bids[0].GetPrice();
+    signals.bestOffer = offers[0].GetPrice();
+    signals.spread = signals.bestOffer - signals.bestBid;
+    signals.mid = (signals.bestBid + signals.bestOffer) / 2;
+    signals.microprice = (signals.bestBid * offerSize + signals.bestOffer * bidSize) / (bidSize + offerSize);
+  }
+  return signals;
+}
+
+bool Close(double a, double b) { return std::fabs(a - b) <= 1e-9 * std::max(1.0, std::fabs(b)); }
+
+// Whether published signals agree with a recomputation from the stacks
+bool Matches(const BookSignals &published, const BookSignals &expected) {
+  if (published.bidLevels != expected.bidLevels || published.offerLevels != expected.offerLevels) return false;
+  for (int i = 0; i < SIGNAL_LEVELS; ++i) {
+    if (published.cumulativeBidSize[i] != expected.cumulativeBidSize[i] ||
+        published.cumulativeOfferSize[i] != expected.cumulativeOfferSize[i]) return false;
+  }
+  return Close(published.bestBid, expected.bestBid) && Close(published.bestOffer, expected.bestOffer) &&
+    Close(published.spread, expected.spread) && Close(published.mid, expected.mid) &&
+    Close(published.microprice, expected.microprice) && Close(published.imbalance, expected.imbalance) &&
+    Close(published.depthImbalance, expected.depthImbalance);
+}
+
+// Counts the signal updates it hears about
+class CountingSignalListener : public ServiceListener<BookSignals>
+{
+
+public:
+
+  void ProcessAdd(BookSignals&) override {}
+  void ProcessRemove(BookSignals&) override {}
+  void ProcessUpdate(BookSignals &signals) override { ++updates; mid += signals.mid; }
+
+  size_t updates = 0;
+  double mid = 0.0;
+};
+
+}
+
+int main(int argc, char **argv) {
+  const size_t ticks = static_cast<size_t>(ArgValue(argc, argv, "--ticks", 200000));
+  const size_t productCount = static_cast<size_t>(ArgValue(argc, argv, "--products", 64));
+  const int depth = static_cast<int>(ArgValue(argc, argv, "--depth", 10));
+  const std::string outPath = ArgString(argc, argv, "--out", "");
+
+  const std::vector<Bond> bonds = MakeUniverse(productCount);
+  std::vector<OrderBook<Bond>> books;
+  books.reserve(ticks);
+  for (size_t t = 0; t < ticks; ++t) books.push_back(MakeOrderBook(bonds[t % productCount], t, depth, 1 / 256.0, true));
+
+  ServiceCapacity capacity;
+  capacity.products = productCount;
+  MarketDataService<Bond> service(capacity);
+  service.WarmUp();
+  CountingSignalListener listener;
+  service.AddSignalListener(&listener);
+
+  int failures = 0;
+  std::vector<StageResult> results;
+  results.push_back(TimeStage("OnMessage.changing", ticks, [&](size_t t) { service.OnMessage(books[t]); }));
+  if (listener.updates != ticks) {
+    std::cerr << "Signal listener heard " << listener.updates << " updates for " << ticks << " changing books" << std::endl;
+    ++failures;
+  }
+  // The last book stored for each product determines its signals
+  for (size_t t = ticks > productCount ? ticks - productCount : 0; t < ticks; ++t) {
+    const std::string &productId = bonds[t % productCount].GetProductId();
+    if (!Matches(service.GetSignals(productId), Recompute(books[t]))) {
+      std::cerr << "Signals for " << productId << " do not match the book's stacks" << std::endl;
+      ++failures;
+    }
+  }
+
+  // Store each product's last book again: no level changes, nothing published
+  const size_t before = listener.updates;
+  const size_t last = ticks - 1;
+  results.push_back(TimeStage("OnMessage.unchanged", ticks, [&](size_t t) { service.OnMessage(books[last - t % productCount]); }));
+  if (listener.updates != before) {
+    std::cerr << "Unchanged books published " << listener.updates - before << " signal updates" << std::endl;
+    ++failures;
+  }
+
+  std::vector<int64_t> sizes(ticks * SIGNAL_LEVELS);
+  for (size_t i = 0; i < sizes.size(); ++i) sizes[i] = static_cast<int64_t>((i * 2654435761u) % 10000000);
+  std::vector<int64_t> simd(sizes.size()), scalar(sizes.size());
+  results.push_back(TimeStage("CumulativeSizes.simd", ticks, [&](size_t t) { CumulativeSizes(&sizes[t * SIGNAL_LEVELS], &simd[t * SIGNAL_LEVELS]); }));
+  results.push_back(TimeStage("CumulativeSizes.scalar", ticks, [&](size_t t) { CumulativeSizesScalar(&sizes[t * SIGNAL_LEVELS], &scalar[t * SIGNAL_LEVELS]); }));
+  if (simd != scalar) {
+    std::cerr << "Vectorized cumulative sizes differ from the scalar ones" << std::endl;
+    ++failures;
+  }
+
+  double sink = listener.mid;
+  results.push_back(TimeStage("recompute", ticks, [&](size_t t) { sink += Recompute(service.GetData(bonds[t % productCount].GetProductId())).microprice; }));
+
+  std::vector<std::pair<std::string, double>> parameters = {
+    { "ticks", static_cast<double>(ticks) },
+    { "products", static_cast<double>(productCount) },
+    { "depth", static_cast<double>(depth) },
+    { "signal_levels", static_cast<double>(SIGNAL_LEVELS) },
+    { "timer_overhead_ns", TimerOverheadNanos() },
+    { "checksum", sink }
+  };
+  if (outPath.empty()) {
+    WriteJson(std::cout, "signal", parameters, results);
+  } else {
+    std::ofstream out(outPath);
+    WriteJson(out, "signal", parameters, results);
+  }
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,205 @@
+/**
+ * snapshot_bench.cpp
+ * Reader/writer throughput of consistent risk snapshots, and a stress check of
+ * their consistency.
+ *
+ * One writer thread books generated trades and prices through the trade
+ * booking, position, risk and pricing services while reader threads
+ * continuously read positions against PV01 quantities. Two schemes are run:
+ *
+ *   epoch  readers take lock-free RiskSnapshots from a RiskSnapshotPublisher
+ *   mutex  every service call and every read runs under one global mutex
+ *
+ * Every read checks that each product's position equals the quantity its PV01
+ * was computed for and that snapshot versions never go backwards. Any
+ * violation is reported and the process exits non-zero, so running this under
+ * a ThreadSanitizer build doubles as the concurrency stress test.
+ *
+ * Usage: snapshot_bench [--readers N] [--seconds S] [--out results.json]
+ */
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "benchutil.hpp"
+#include "pipeline.hpp"
+#include "snapshotstore.hpp"
+#include "tickgenerator.hpp"
+
+namespace {
+
+// Writer-side service graph: trades -> positions -> risk, plus prices
+struct RiskGraph
+{
+  TradeBookingService<Bond> tradeBooking;
+  PositionService<Bond> position;
+  RiskService<Bond> risk;
+  PricingService<Bond> pricing;
+  TradePositionListener<Bond> tradePosition{position};
+  PositionRiskListener<Bond> positionRisk{risk};
+
+  RiskGraph() {
+    tradeBooking.AddListener(&tradePosition);
+    position.AddListener(&positionRisk);
+  }
+};
+
+TickGeneratorConfig WriterConfig() {
+  TickGeneratorConfig config;
+  config.orderBookWeight = 0;
+  config.inquiryWeight = 0;
+  config.tradeWeight = 1;
+  config.priceWeight = 1;
+  return config;
+}
+
+// Push one generated trade or price into the graph
+void Apply(RiskGraph &graph, TickGenerator &generator) {
+  TickEvent event = generator.Next();
+  if (event.type == TICK_TRADE) {
+    Trade<Bond> trade = generator.ToTrade(event);
+    graph.tradeBooking.OnMessage(trade);
+  } else {
+    Price<Bond> price = generator.ToPrice(event);
+    graph.pricing.OnMessage(price);
+  }
+}
+
+struct RunResult
+{
+  uint64_t writes = 0;
+  uint64_t reads = 0;
+  uint64_t violations = 0;
+  double seconds = 0.0;
+};
+
+RunResult RunEpoch(int readers, double seconds) {
+  RiskGraph graph;
+  RiskSnapshotPublisher<Bond> publisher(graph.position, graph.risk, graph.pricing);
+  std::atomic<bool> stop(false);
+  std::atomic<uint64_t> reads(0), violations(0);
+  RunResult result;
+
+  std::vector<std::thread> threads;
+  for (int r = 0; r < readers; ++r) {
+    threads.emplace_back([&]() {
+      uint64_t localReads = 0, localViolations = 0, lastVersion = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        auto snapshot = publisher.Read();
+        if (snapshot.Version() < lastVersion) ++localViolations;
+        lastVersion = snapshot.Version();
+        for (const ProductRiskRow &row : snapshot->rows) {
+          if (row.position != row.riskQuantity) ++localViolations;
+        }
+        ++localReads;
+      }
+      reads += localReads;
+      violations += localViolations;
+    });
+  }
+
+  TickGenerator generator(OnTheRunTreasuries(), WriterConfig());
+  uint64_t start = NowNanos();
+  uint64_t deadline = start + static_cast<uint64_t>(seconds * 1e9);
+  while (NowNanos() < deadline) {
+    for (int i = 0; i < 64; ++i) {
+      Apply(graph, generator);
+      publisher.Commit();
+      ++result.writes;
+    }
+  }
+  result.seconds = (NowNanos() - start) / 1e9;
+  stop = true;
+  for (std::thread &thread : threads) thread.join();
+  result.reads = reads;
+  result.violations = violations;
+  return result;
+}
+
+RunResult RunMutex(int readers, double seconds) {
+  RiskGraph graph;
+  std::mutex mutex;
+  std::atomic<bool> stop(false);
+  std::atomic<uint64_t> reads(0), violations(0);
+  const std::vector<Bond> bonds = OnTheRunTreasuries();
+  RunResult result;
+
+  std::vector<std::thread> threads;
+  for (int r = 0; r < readers; ++r) {
+    threads.emplace_back([&]() {
+      uint64_t localReads = 0, localViolations = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          for (const Bond &bond : bonds) {
+            try {
+              long position = graph.position.GetData(bond.GetProductId()).GetAggregatePosition();
+              if (position != graph.risk.GetData(bond.GetProductId()).GetQuantity()) ++localViolations;
+            } catch (const std::runtime_error&) {
+              // Product not traded yet
+            }
+          }
+        }
+        ++localReads;
+      }
+      reads += localReads;
+      violations += localViolations;
+    });
+  }
+
+  TickGenerator generator(bonds, WriterConfig());
+  uint64_t start = NowNanos();
+  uint64_t deadline = start + static_cast<uint64_t>(seconds * 1e9);
+  while (NowNanos() < deadline) {
+    for (int i = 0; i < 64; ++i) {
+      std::lock_guard<std::mutex> lock(mutex);
+      Apply(graph, generator);
+      ++result.writes;
+    }
+  }
+  result.seconds = (NowNanos() - start) / 1e9;
+  stop = true;
+  for (std::thread &thread : threads) thread.join();
+  result.reads = reads;
+  result.violations = violations;
+  return result;
+}
+
+}
+
+int main(int argc, char **argv) {
+  const int readers = static_cast<int>(ArgValue(argc, argv, "--readers", 3));
+  const double seconds = ArgValue(argc, argv, "--seconds", 1.0);
+  const std::string outPath = ArgString(argc, argv, "--out", "");
+
+  RunResult epoch = RunEpoch(readers, seconds);
+  RunResult mutex = RunMutex(readers, seconds);
+
+  std::vector<StageResult> results = {
+    Stage("epoch.writer", epoch.writes, epoch.seconds),
+    Stage("epoch.readers", epoch.reads, epoch.seconds),
+    Stage("mutex.writer", mutex.writes, mutex.seconds),
+    Stage("mutex.readers", mutex.reads, mutex.seconds)
+  };
+  std::vector<std::pair<std::string, double>> parameters = {
+    { "readers", static_cast<double>(readers) },
+    { "seconds", seconds },
+    { "epoch_violations", static_cast<double>(epoch.violations) },
+    { "mutex_violations", static_cast<double>(mutex.violations) }
+  };
+  if (outPath.empty()) {
+    WriteJson(std::cout, "snapshot", parameters, results);
+  } else {
+    std::ofstream out(outPath);
+    WriteJson(out, "snapshot", parameters, results);
+  }
+  if (epoch.violations || mutex.violations) {
+    std::cerr << "Consistency violations detected" << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,72 @@
+/**
+ * tickgenerator_bench.cpp
+ * Throughput of the synthetic tick generator: raw events, events materialized
+ * into service objects, and events pushed through the full TradingPipeline.
+ *
+ * Usage: tickgenerator_bench [--events N] [--seed S] [--out results.json]
+ */
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "benchutil.hpp"
+#include "pipeline.hpp"
+#include "tickgenerator.hpp"
+
+int main(int argc, char **argv) {
+  const uint64_t events = static_cast<uint64_t>(ArgValue(argc, argv, "--events", 20000000));
+  TickGeneratorConfig config;
+  config.seed = static_cast<uint64_t>(ArgValue(argc, argv, "--seed", 9815));
+  const std::string outPath = ArgString(argc, argv, "--out", "");
+  const std::vector<Bond> bonds = OnTheRunTreasuries();
+
+  std::vector<StageResult> results;
+  uint64_t checksum = 0;
+  {
+    TickGenerator generator(bonds, config);
+    results.push_back(TimeBlock("TickGenerator.Next", events, [&]() {
+      for (uint64_t i = 0; i < events; ++i) checksum += generator.Next().timestamp;
+    }));
+  }
+  {
+    TickGenerator generator(bonds, config);
+    const uint64_t materialized = events / 10;
+    results.push_back(TimeBlock("TickGenerator.Materialize", materialized, [&]() {
+      for (uint64_t i = 0; i < materialized; ++i) {
+        TickEvent event = generator.Next();
+        switch (event.type) {
+        case TICK_ORDER_BOOK: checksum += generator.ToOrderBook(event).GetBidStack().size(); break;
+        case TICK_PRICE: checksum += static_cast<uint64_t>(generator.ToPrice(event).GetMid()); break;
+        case TICK_TRADE: checksum += generator.ToTrade(event).GetQuantity(); break;
+        case TICK_INQUIRY: checksum += generator.ToInquiry(event).GetQuantity(); break;
+        }
+      }
+    }));
+  }
+  {
+    ScopedSilence silence;
+    TradingPipeline<Bond> pipeline;
+    TickSinks sinks;
+    sinks.marketData = &pipeline.marketData;
+    sinks.pricing = &pipeline.pricing;
+    sinks.tradeBooking = &pipeline.tradeBooking;
+    sinks.inquiry = &pipeline.inquiry;
+    TickGenerator generator(bonds, config);
+    const uint64_t driven = events / 100;
+    results.push_back(TimeBlock("DriveTicks.Pipeline", driven, [&]() { DriveTicks(generator, driven, sinks); }));
+  }
+
+  std::vector<std::pair<std::string, double>> parameters = {
+    { "events", static_cast<double>(events) },
+    { "seed", static_cast<double>(config.seed) },
+    { "checksum", static_cast<double>(checksum % 1000000007ULL) }
+  };
+  if (outPath.empty()) {
+    WriteJson(std::cout, "tickgenerator", parameters, results);
+  } else {
+    std::ofstream out(outPath);
+    WriteJson(out, "tickgenerator", parameters, results);
+  }
+  return 0;
+}
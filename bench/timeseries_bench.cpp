@@ -0,0 +1,213 @@
+/**
+ * timeseries_bench.cpp
+ * Memory per point and scan throughput of the compressed TimeSeriesStore
+ * holding a day of price and risk history.
+ *
+ * Each product gets a price roughly every millisecond, with jitter on some of
+ * the intervals, its mid walking on the 1/256 grid and its spread mostly
+ * steady, and a risk point at the same times with a fixed PV01 and a quantity
+ * that changes now and then. Stages:
+ *
+ *   Append.price       appending price points, mid and spread columns
+ *   Append.risk        appending risk points, pv01 and quantity columns
+ *   Scan.full          decoding every price point of every product
+ *   Scan.raw           the same pass over the uncompressed points, for scale
+ *   Range.second       one second of one product's prices into columns
+ *   Downsample.second  one product's whole day of mids into one bar a second
+ *
+ * Every product's decoded prices must equal the appended ones bit for bit,
+ * random ranges must return exactly the points within them, and bars must
+ * agree with a brute-force bucketing. Prices published through a
+ * PricingService must reach the store through a PriceHistoryListener, and an
+ * out of order point must be refused. Any violation makes the process exit
+ * non-zero.
+ *
+ * Usage: timeseries_bench [--products P] [--points N] [--queries Q] [--out results.json]
+ */
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "benchdata.hpp"
+#include "benchutil.hpp"
+#include "products.hpp"
+#include "timeseries.hpp"
+
+namespace {
+
+// One uncompressed point with two value columns
+struct RawPoint
+{
+  uint64_t timestamp;
+  double values[2];
+};
+
+bool SameBits(double a, double b) { return std::memcmp(&a, &b, sizeof(double)) == 0; }
+
+uint64_t counter = 0;
+uint64_t CountingClock() { return ++counter; }
+
+}
+
+int main(int argc, char **argv) {
+  const size_t productCount = static_cast<size_t>(ArgValue(argc, argv, "--products", 1000));
+  const size_t pointsPerProduct = static_cast<size_t>(ArgValue(argc, argv, "--points", 5000));
+  const size_t queries = static_cast<size_t>(ArgValue(argc, argv, "--queries", 10000));
+  const std::string outPath = ArgString(argc, argv, "--out", "");
+  const size_t pointCount = productCount * pointsPerProduct;
+  const uint64_t SECOND = 1000000000ULL;
+
+  // Points in time order across products, as the services would publish them
+  std::vector<uint32_t> handles(pointCount);
+  std::vector<RawPoint> prices(pointCount), risks(pointCount);
+  std::vector<std::vector<RawPoint>> byProduct(productCount);
+  {
+    std::vector<uint64_t> clock(productCount, 8 * 3600 * SECOND);
+    std::vector<double> mid(productCount, 99.5), spread(productCount, 1 / 128.0), quantity(productCount, 0.0);
+    uint64_t state = 88172645463325252ULL;
+    for (size_t p = 0; p < pointCount; ++p) {
+      state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+      const uint32_t product = static_cast<uint32_t>(p % productCount);
+      clock[product] += 1000000 + ((state >> 8) % 10 < 3 ? (state >> 16) % 50000 : 0);
+      if ((state >> 24) % 4 == 0) mid[product] += ((state >> 28) & 1 ? 1 : -1) / 256.0;
+      if ((state >> 32) % 50 == 0) spread[product] = ((state >> 40) % 3 + 1) / 256.0;
+      if ((state >> 44) % 10 == 0) quantity[product] += static_cast<double>((state >> 48) % 21) * 1000000 - 10000000;
+      handles[p] = product;
+      prices[p] = RawPoint{ clock[product], { mid[product], spread[product] } };
+      risks[p] = RawPoint{ clock[product], { 0.01, quantity[product] } };
+      byProduct[product].push_back(prices[p]);
+    }
+  }
+
+  TimeSeriesStore priceHistory({ "mid", "bidOfferSpread" }, productCount);
+  TimeSeriesStore riskHistory({ "pv01", "quantity" }, productCount);
+  std::vector<StageResult> results;
+  results.push_back(TimeBlock("Append.price", pointCount, [&]() {
+    for (size_t p = 0; p < pointCount; ++p) priceHistory.Append(handles[p], prices[p].timestamp, prices[p].values);
+  }));
+  results.push_back(TimeBlock("Append.risk", pointCount, [&]() {
+    for (size_t p = 0; p < pointCount; ++p) riskHistory.Append(handles[p], risks[p].timestamp, risks[p].values);
+  }));
+
+  double sink = 0.0;
+  results.push_back(TimeBlock("Scan.full", pointCount, [&]() {
+    for (uint32_t product = 0; product < productCount; ++product) {
+      priceHistory.Scan(product, 0, UINT64_MAX, [&](uint64_t, const double *values) { sink += values[0]; });
+    }
+  }));
+  results.push_back(TimeBlock("Scan.raw", pointCount, [&]() {
+    for (const std::vector<RawPoint> &points : byProduct) {
+      for (const RawPoint &point : points) sink += point.values[0];
+    }
+  }));
+
+  uint64_t queryState = 2463534242ULL;
+  TimeSeriesColumns columns;
+  std::vector<TimeSeriesBar> bars;
+  size_t rangePoints = 0;
+  results.push_back(TimeStage("Range.second", queries, [&](size_t) {
+    queryState ^= queryState << 13; queryState ^= queryState >> 7; queryState ^= queryState << 17;
+    const std::vector<RawPoint> &points = byProduct[queryState % productCount];
+    const uint64_t from = points[(queryState >> 20) % points.size()].timestamp;
+    priceHistory.Range(static_cast<uint32_t>(queryState % productCount), from, from + SECOND, columns);
+    rangePoints += columns.timestamps.size();
+  }));
+  const size_t downsamples = std::min(queries, productCount * 10);
+  results.push_back(TimeStage("Downsample.second", downsamples, [&](size_t i) {
+    priceHistory.Downsample(static_cast<uint32_t>(i % productCount), 0, 0, UINT64_MAX, SECOND, bars);
+    sink += bars.size();
+  }));
+
+  // Checks
+  int failures = 0;
+  size_t wrong = 0;
+  for (uint32_t product = 0; product < productCount; ++product) {
+    size_t at = 0;
+    priceHistory.Scan(product, 0, UINT64_MAX, [&](uint64_t timestamp, const double *values) {
+      const RawPoint &expected = byProduct[product][at++];
+      if (timestamp != expected.timestamp || !SameBits(values[0], expected.values[0]) || !SameBits(values[1], expected.values[1])) ++wrong;
+    });
+    if (at != byProduct[product].size()) ++wrong;
+  }
+  if (wrong || priceHistory.Points() != pointCount || riskHistory.Points() != pointCount) {
+    std::cerr << wrong << " price points decoded differently from those appended" << std::endl;
+    ++failures;
+  }
+  size_t wrongRanges = 0, wrongBars = 0;
+  for (size_t q = 0; q < 200; ++q) {
+    queryState ^= queryState << 13; queryState ^= queryState >> 7; queryState ^= queryState << 17;
+    const uint32_t product = static_cast<uint32_t>(queryState % productCount);
+    const std::vector<RawPoint> &points = byProduct[product];
+    const uint64_t from = points[(queryState >> 20) % points.size()].timestamp - (queryState >> 40) % 1000;
+    const uint64_t to = from + (queryState >> 8) % (10 * SECOND);
+    priceHistory.Range(product, from, to, columns);
+    std::vector<uint64_t> expected;
+    for (const RawPoint &point : points) if (point.timestamp >= from && point.timestamp < to) expected.push_back(point.timestamp);
+    if (columns.timestamps != expected) ++wrongRanges;
+
+    priceHistory.Downsample(product, 1, from, to, SECOND / 10, bars);
+    std::vector<TimeSeriesBar> brute;
+    for (const RawPoint &point : points) {
+      if (point.timestamp < from || point.timestamp >= to) continue;
+      const uint64_t start = from + (point.timestamp - from) / (SECOND / 10) * (SECOND / 10);
+      const double value = point.values[1];
+      if (brute.empty() || brute.back().start != start) brute.push_back(TimeSeriesBar{ start, value, value, value, value, 0 });
+      brute.back().high = std::max(brute.back().high, value);
+      brute.back().low = std::min(brute.back().low, value);
+      brute.back().close = value;
+      ++brute.back().count;
+    }
+    bool same = bars.size() == brute.size();
+    for (size_t b = 0; same && b < bars.size(); ++b) {
+      same = bars[b].start == brute[b].start && bars[b].open == brute[b].open && bars[b].high == brute[b].high &&
+             bars[b].low == brute[b].low && bars[b].close == brute[b].close && bars[b].count == brute[b].count;
+    }
+    if (!same) ++wrongBars;
+  }
+  if (wrongRanges || wrongBars) {
+    std::cerr << wrongRanges << " ranges and " << wrongBars << " downsamplings differ from a brute-force pass" << std::endl;
+    ++failures;
+  }
+
+  PricingService<Bond> pricing;
+  TimeSeriesStore listened({ "mid", "bidOfferSpread" });
+  PriceHistoryListener<Bond> listener(pricing, listened, &CountingClock);
+  pricing.AddListener(&listener);
+  const Bond bond = SyntheticBond(100000);
+  for (int i = 0; i < 100; ++i) pricing.PublishPrice(Price<Bond>(bond, 99.0 + i / 256.0, 1 / 128.0));
+  listened.Range(pricing.GetProductHandle(bond.GetProductId()), 0, UINT64_MAX, columns);
+  bool refused = false;
+  try {
+    listened.Append(0, 1, columns.values[0].data());
+  } catch (const std::runtime_error&) {
+    refused = true;
+  }
+  if (columns.timestamps.size() != 100 || columns.values[0].back() != 99.0 + 99 / 256.0 || !refused) {
+    std::cerr << "PriceHistoryListener recorded " << columns.timestamps.size() << " of 100 prices" << (refused ? "" : " and an out of order point was accepted") << std::endl;
+    ++failures;
+  }
+
+  std::vector<std::pair<std::string, double>> parameters = {
+    { "products", static_cast<double>(productCount) },
+    { "points", static_cast<double>(pointCount) },
+    { "raw_bytes_per_point", static_cast<double>(sizeof(RawPoint)) },
+    { "price_encoded_bytes_per_point", static_cast<double>(priceHistory.EncodedBytes()) / pointCount },
+    { "price_memory_bytes_per_point", static_cast<double>(priceHistory.MemoryBytes()) / pointCount },
+    { "risk_encoded_bytes_per_point", static_cast<double>(riskHistory.EncodedBytes()) / pointCount },
+    { "risk_memory_bytes_per_point", static_cast<double>(riskHistory.MemoryBytes()) / pointCount },
+    { "range_points", static_cast<double>(rangePoints) },
+    { "timer_overhead_ns", TimerOverheadNanos() },
+    { "checksum", sink }
+  };
+  if (outPath.empty()) {
+    WriteJson(std::cout, "timeseries", parameters, results);
+  } else {
+    std::ofstream out(outPath);
+    WriteJson(out, "timeseries", parameters, results);
+  }
+  return failures ? 1 : 0;
+}
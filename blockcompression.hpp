@@ -0,0 +1,431 @@
+/**
+ * blockcompression.hpp
+ * LZ4-style block compression and a seekable block-compressed journal file.
+ *
+ * BlockCompressor encodes a buffer in the LZ4 block format: a sequence of
+ * tokens, each a run of literal bytes followed by a match copied from up to
+ * 64KB back, found through a hash table of 4-byte prefixes. BlockDecompress
+ * reverses it and refuses malformed input rather than reading or writing out
+ * of bounds. The codec is self-contained and favours speed over ratio, which
+ * suits journals whose lines repeat product identifiers, prices and field
+ * layouts.
+ *
+ * A block journal holds whole journal lines in independently compressed
+ * blocks of about BLOCK_JOURNAL_BLOCK_BYTES, followed by an index giving each
+ * block's file offset, sizes, line count and first and last line timestamps,
+ * and a fixed trailer pointing at the index:
+ *
+ *   magic | block ... block | index entry ... index entry | trailer
+ *
+ * A BlockJournalReader loads the index on open, so seeking to a timestamp
+ * reads and decompresses only the blocks from the one holding it onwards.
+ * The index and trailer are written in the machine's byte order.
+ */
+#ifndef BLOCK_COMPRESSION_HPP
+#define BLOCK_COMPRESSION_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Raw bytes a block journal collects before compressing a block
+const size_t BLOCK_JOURNAL_BLOCK_BYTES = 64 * 1024;
+
+// Suffix of a block journal written in place of a text journal
+const char* const BLOCK_JOURNAL_SUFFIX = ".blz";
+
+/**
+ * LZ4 block format encoder. Keeps its match table between calls, so one
+ * compressor per writer never allocates after the first block.
+ */
+class BlockCompressor
+{
+
+public:
+
+  BlockCompressor() : table(size_t(1) << HASH_LOG) {}
+
+  // Largest output Compress can produce for size input bytes
+  static size_t Bound(size_t size) { return size + size / 255 + 16; }
+
+  // Compress size bytes of input, replacing the contents of output. Returns the compressed size.
+  size_t Compress(const char *input, size_t size, std::vector<char> &output) {
+    output.resize(Bound(size));
+    const uint8_t *source = reinterpret_cast<const uint8_t*>(input);
+    uint8_t *const start = reinterpret_cast<uint8_t*>(output.data());
+    uint8_t *out = start;
+    size_t anchor = 0;
+    if (size > MATCH_LIMIT) {
+      std::fill(table.begin(), table.end(), 0);
+      const size_t matchStartLimit = size - MATCH_LIMIT;
+      const size_t matchEndLimit = size - LAST_LITERALS;
+      size_t position = 0;
+      while (position < matchStartLimit) {
+        const uint32_t sequence = Read32(source + position);
+        uint32_t &slot = table[Hash(sequence)];
+        size_t reference = slot;
+        slot = static_cast<uint32_t>(position);
+        if (reference >= position || position - reference > MAX_OFFSET || Read32(source + reference) != sequence) {
+          // Skip faster through data that does not compress
+          position += 1 + ((position - anchor) >> SKIP_SHIFT);
+          continue;
+        }
+        while (position > anchor && reference > 0 && source[position - 1] == source[reference - 1]) {
+          --position;
+          --reference;
+        }
+        size_t length = MIN_MATCH;
+        while (position + length < matchEndLimit && source[position + length] == source[reference + length]) ++length;
+        out = WriteSequence(out, source + anchor, position - anchor, position - reference, length);
+        position += length;
+        anchor = position;
+        if (position - 2 < matchStartLimit) table[Hash(Read32(source + position - 2))] = static_cast<uint32_t>(position - 2);
+      }
+    }
+    out = WriteSequence(out, source + anchor, size - anchor, 0, 0);
+    output.resize(out - start);
+    return output.size();
+  }
+
+private:
+
+  static const unsigned HASH_LOG = 14;
+  static const size_t MIN_MATCH = 4;
+  static const size_t LAST_LITERALS = 5;  // the format ends every block with at least this many literals
+  static const size_t MATCH_LIMIT = 12;   // no match starts within this many bytes of the end
+  static const size_t MAX_OFFSET = 65535;
+  static const unsigned SKIP_SHIFT = 6;
+
+  std::vector<uint32_t> table; // last position of each hashed 4-byte prefix
+
+  static uint32_t Read32(const uint8_t *at) {
+    uint32_t value;
+    std::memcpy(&value, at, sizeof(value));
+    return value;
+  }
+
+  static uint32_t Hash(uint32_t sequence) { return (sequence * 2654435761U) >> (32 - HASH_LOG); }
+
+  // Write a length's continuation bytes after its 15 in the token
+  static uint8_t* WriteLength(uint8_t *out, size_t length) {
+    for (; length >= 255; length -= 255) *out++ = 255;
+    *out++ = static_cast<uint8_t>(length);
+    return out;
+  }
+
+  // Write literals and the match that follows them; a zero length writes the final literals alone
+  static uint8_t* WriteSequence(uint8_t *out, const uint8_t *literals, size_t literalLength, size_t offset, size_t matchLength) {
+    uint8_t *token = out++;
+    *token = static_cast<uint8_t>(std::min<size_t>(literalLength, 15) << 4);
+    if (literalLength >= 15) out = WriteLength(out, literalLength - 15);
+    std::memcpy(out, literals, literalLength);
+    out += literalLength;
+    if (!matchLength) return out;
+    *out++ = static_cast<uint8_t>(offset);
+    *out++ = static_cast<uint8_t>(offset >> 8);
+    const size_t extra = matchLength - MIN_MATCH;
+    *token |= static_cast<uint8_t>(std::min<size_t>(extra, 15));
+    if (extra >= 15) out = WriteLength(out, extra - 15);
+    return out;
+  }
+};
+
+// Decompress an LZ4 block of size bytes into exactly outputSize bytes of
+// output. Throws if the block is malformed or does not fill the output.
+inline void BlockDecompress(const char *input, size_t size, char *output, size_t outputSize) {
+  const uint8_t *in = reinterpret_cast<const uint8_t*>(input);
+  const uint8_t *const inEnd = in + size;
+  uint8_t *out = reinterpret_cast<uint8_t*>(output);
+  uint8_t *const outStart = out;
+  uint8_t *const outEnd = out + outputSize;
+  auto corrupt = []() { throw std::runtime_error("Corrupt compressed block"); };
+  auto readLength = [&](size_t length) {
+    if (length != 15) return length;
+    for (;;) {
+      if (in == inEnd) corrupt();
+      const uint8_t byte = *in++;
+      length += byte;
+      if (byte != 255) return length;
+    }
+  };
+  for (;;) {
+    if (in == inEnd) corrupt();
+    const uint8_t token = *in++;
+    const size_t literalLength = readLength(token >> 4);
+    if (literalLength > static_cast<size_t>(inEnd - in) || literalLength > static_cast<size_t>(outEnd - out)) corrupt();
+    std::memcpy(out, in, literalLength);
+    in += literalLength;
+    out += literalLength;
+    if (in == inEnd) break;
+    if (inEnd - in < 2) corrupt();
+    const size_t offset = in[0] | static_cast<size_t>(in[1]) << 8;
+    in += 2;
+    const size_t matchLength = readLength(token & 15) + 4;
+    if (!offset || offset > static_cast<size_t>(out - outStart) || matchLength > static_cast<size_t>(outEnd - out)) corrupt();
+    const uint8_t *match = out - offset;
+    if (offset >= matchLength) {
+      std::memcpy(out, match, matchLength);
+      out += matchLength;
+    } else {
+      // Overlapping copy repeats the last offset bytes
+      for (size_t i = 0; i < matchLength; ++i) *out++ = *match++;
+    }
+  }
+  if (out != outEnd) corrupt();
+}
+
+/**
+ * Index entry of one block of a block journal.
+ */
+struct BlockIndexEntry
+{
+  uint64_t offset;          // file offset of the compressed block
+  uint32_t compressedSize;  // equal to rawSize for a block stored uncompressed
+  uint32_t rawSize;
+  uint64_t firstTimestamp;  // timestamp of the block's first line
+  uint64_t lastTimestamp;   // timestamp of the block's last line
+  uint64_t lines;
+};
+
+/**
+ * Writes journal lines into a block journal file.
+ */
+class BlockJournalWriter
+{
+
+public:
+
+  // ctor opening the journal for writing, truncating any existing file
+  explicit BlockJournalWriter(const std::string &_path, size_t _blockBytes = BLOCK_JOURNAL_BLOCK_BYTES) :
+    path(_path), file(std::fopen(_path.c_str(), "wb")), blockBytes(_blockBytes), offset(sizeof(FILE_MAGIC)), rawBytes(0), closed(false) {
+    if (!file) throw std::runtime_error("Unable to open journal: " + path);
+    raw.reserve(blockBytes + 4096);
+    Put(FILE_MAGIC, sizeof(FILE_MAGIC));
+  }
+
+  // dtor closing the journal; call Close first to see a failed write as an exception
+  ~BlockJournalWriter() {
+    try {
+      Close();
+    } catch (const std::runtime_error&) {
+    }
+    std::fclose(file);
+  }
+
+  BlockJournalWriter(const BlockJournalWriter&) = delete;
+  BlockJournalWriter& operator=(const BlockJournalWriter&) = delete;
+
+  // Append a line of size bytes, without its newline, stamped with timestamp
+  void AppendLine(uint64_t timestamp, const char *line, size_t size) {
+    if (closed) throw std::runtime_error("Block journal already closed");
+    if (raw.empty()) {
+      pending.firstTimestamp = timestamp;
+      pending.lines = 0;
+    }
+    raw.insert(raw.end(), line, line + size);
+    raw.push_back('\n');
+    pending.lastTimestamp = timestamp;
+    ++pending.lines;
+    if (raw.size() >= blockBytes) WriteBlock();
+  }
+
+  // Write the last block, the index and the trailer; later appends are refused
+  void Close() {
+    if (closed) return;
+    closed = true;
+    if (!raw.empty()) WriteBlock();
+    Put(index.data(), index.size() * sizeof(BlockIndexEntry));
+    Trailer trailer = { offset, index.size(), {} };
+    std::memcpy(trailer.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    Put(&trailer, sizeof(trailer));
+    if (std::fflush(file) != 0) throw std::runtime_error("Unable to write journal: " + path);
+  }
+
+  // Bytes of lines appended so far
+  uint64_t RawBytes() const { return rawBytes + raw.size(); }
+
+  // Bytes of compressed blocks written so far
+  uint64_t CompressedBytes() const { return offset - sizeof(FILE_MAGIC); }
+
+  // Get the index of the blocks written so far
+  const std::vector<BlockIndexEntry>& GetIndex() const { return index; }
+
+  static constexpr char FILE_MAGIC[8] = { 'S', 'O', 'A', 'B', 'L', 'Z', '1', '\n' };
+  static constexpr char INDEX_MAGIC[8] = { 'S', 'O', 'A', 'B', 'L', 'Z', 'I', '\n' };
+
+  // Fixed record at the end of the file
+  struct Trailer
+  {
+    uint64_t indexOffset;
+    uint64_t blocks;
+    char magic[8];
+  };
+
+private:
+  std::string path;
+  std::FILE *file;
+  size_t blockBytes;
+  uint64_t offset;
+  uint64_t rawBytes;
+  bool closed;
+  std::vector<char> raw;
+  std::vector<char> compressed;
+  BlockCompressor compressor;
+  BlockIndexEntry pending = {};
+  std::vector<BlockIndexEntry> index;
+
+  // Compress and write the collected lines, storing them uncompressed if that is smaller
+  void WriteBlock() {
+    const size_t size = compressor.Compress(raw.data(), raw.size(), compressed);
+    const bool stored = size >= raw.size();
+    const std::vector<char> &block = stored ? raw : compressed;
+    Put(block.data(), block.size());
+    pending.offset = offset;
+    pending.compressedSize = static_cast<uint32_t>(block.size());
+    pending.rawSize = static_cast<uint32_t>(raw.size());
+    index.push_back(pending);
+    offset += block.size();
+    rawBytes += raw.size();
+    raw.clear();
+  }
+
+  // Write size bytes, throwing if the file takes fewer, as on a full disk
+  void Put(const void *data, size_t size) {
+    if (std::fwrite(data, 1, size, file) != size) throw std::runtime_error("Unable to write journal: " + path);
+  }
+};
+
+/**
+ * Reads the lines of a block journal, in order from the start or from a
+ * timestamp, decompressing one block at a time.
+ */
+class BlockJournalReader
+{
+
+public:
+
+  // ctor opening a block journal and loading its index
+  explicit BlockJournalReader(const std::string &path) : file(std::fopen(path.c_str(), "rb")), block(0), position(0), decompressed(0) {
+    if (!file) throw std::runtime_error("Unable to open journal: " + path);
+    try {
+      LoadIndex(path);
+    } catch (...) {
+      std::fclose(file);
+      throw;
+    }
+  }
+
+  ~BlockJournalReader() { std::fclose(file); }
+
+  BlockJournalReader(const BlockJournalReader&) = delete;
+  BlockJournalReader& operator=(const BlockJournalReader&) = delete;
+
+  // Position before the first line stamped at or after timestamp, reading
+  // only the block that holds it
+  void Seek(uint64_t timestamp) {
+    auto first = std::lower_bound(index.begin(), index.end(), timestamp,
+                                  [](const BlockIndexEntry &entry, uint64_t at) { return entry.lastTimestamp < at; });
+    block = static_cast<size_t>(first - index.begin());
+    raw.clear();
+    position = 0;
+    if (block == index.size()) return;
+    Load(block++);
+    while (position < raw.size() && LineTimestamp() < timestamp) position = LineEnd() + 1;
+  }
+
+  // Read the next line, without its newline; false at the end of the journal
+  bool NextLine(std::string &line) {
+    while (position == raw.size()) {
+      if (block == index.size()) return false;
+      Load(block++);
+    }
+    const size_t end = LineEnd();
+    line.assign(raw.data() + position, raw.data() + end);
+    position = end + 1;
+    return true;
+  }
+
+  // Get the block index
+  const std::vector<BlockIndexEntry>& GetIndex() const { return index; }
+
+  // Blocks decompressed so far
+  uint64_t BlocksDecompressed() const { return decompressed; }
+
+private:
+  std::FILE *file;
+  std::vector<BlockIndexEntry> index;
+  std::vector<char> compressed;
+  std::vector<char> raw;
+  size_t block;     // next block to load
+  size_t position;  // read position within raw
+  uint64_t decompressed;
+
+  // Read the trailer and index, checking that every block they describe lies
+  // within the file before anything is sized from them
+  void LoadIndex(const std::string &path) {
+    const uint64_t headerBytes = sizeof(BlockJournalWriter::FILE_MAGIC);
+    BlockJournalWriter::Trailer trailer;
+    char magic[sizeof(BlockJournalWriter::FILE_MAGIC)];
+    if (std::fseek(file, 0, SEEK_END)) throw std::runtime_error("Not a block journal: " + path);
+    const long end = std::ftell(file);
+    if (end < static_cast<long>(headerBytes + sizeof(trailer)) || std::fseek(file, 0, SEEK_SET) ||
+        std::fread(magic, 1, sizeof(magic), file) != sizeof(magic) || std::memcmp(magic, BlockJournalWriter::FILE_MAGIC, sizeof(magic)) ||
+        std::fseek(file, end - static_cast<long>(sizeof(trailer)), SEEK_SET) || std::fread(&trailer, sizeof(trailer), 1, file) != 1 ||
+        std::memcmp(trailer.magic, BlockJournalWriter::INDEX_MAGIC, sizeof(trailer.magic))) {
+      throw std::runtime_error("Not a block journal: " + path);
+    }
+    const uint64_t indexEnd = static_cast<uint64_t>(end) - sizeof(trailer);
+    if (trailer.indexOffset < headerBytes || trailer.indexOffset > indexEnd ||
+        trailer.blocks != (indexEnd - trailer.indexOffset) / sizeof(BlockIndexEntry) ||
+        trailer.indexOffset + trailer.blocks * sizeof(BlockIndexEntry) != indexEnd) {
+      throw std::runtime_error("Corrupt block journal index: " + path);
+    }
+    index.resize(trailer.blocks);
+    if (std::fseek(file, static_cast<long>(trailer.indexOffset), SEEK_SET) ||
+        std::fread(index.data(), sizeof(BlockIndexEntry), index.size(), file) != index.size()) {
+      throw std::runtime_error("Truncated block journal index: " + path);
+    }
+    uint64_t lastTimestamp = 0;
+    for (const BlockIndexEntry &entry : index) {
+      // A block is stored when compression does not shrink it, and LZ4 expands less than 256 to 1
+      if (entry.offset < headerBytes || entry.offset > trailer.indexOffset || entry.compressedSize > trailer.indexOffset - entry.offset ||
+          entry.compressedSize == 0 || entry.compressedSize > entry.rawSize || entry.rawSize > uint64_t(entry.compressedSize) * 256 ||
+          entry.firstTimestamp > entry.lastTimestamp || entry.firstTimestamp < lastTimestamp || entry.lines == 0) {
+        throw std::runtime_error("Corrupt block journal index: " + path);
+      }
+      lastTimestamp = entry.lastTimestamp;
+    }
+  }
+
+  // Offset of the newline ending the line at position
+  size_t LineEnd() const {
+    const char *end = static_cast<const char*>(std::memchr(raw.data() + position, '\n', raw.size() - position));
+    if (!end) throw std::runtime_error("Corrupt block journal: line without a newline");
+    return end - raw.data();
+  }
+
+  // Read and decompress one block into raw
+  void Load(size_t at) {
+    const BlockIndexEntry &entry = index[at];
+    raw.resize(entry.rawSize);
+    position = 0;
+    const bool stored = entry.compressedSize == entry.rawSize;
+    std::vector<char> &target = stored ? raw : compressed;
+    target.resize(entry.compressedSize);
+    if (std::fseek(file, static_cast<long>(entry.offset), SEEK_SET) || std::fread(target.data(), 1, target.size(), file) != target.size()) {
+      throw std::runtime_error("Truncated block journal block: " + std::to_string(at));
+    }
+    if (!stored) BlockDecompress(compressed.data(), compressed.size(), raw.data(), raw.size());
+    // Blocks hold whole lines, so a timestamp parse never runs off the end
+    if (raw.back() != '\n') throw std::runtime_error("Corrupt block journal: block " + std::to_string(at) + " ends mid-line");
+    ++decompressed;
+  }
+
+  uint64_t LineTimestamp() const { return std::strtoull(raw.data() + position, nullptr, 10); }
+};
+
+#endif // BLOCK_COMPRESSION_HPP
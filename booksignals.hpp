@@ -0,0 +1,122 @@
+/**
+ * booksignals.hpp
+ * Depth statistics and microstructure signals of an order book.
+ *
+ * MarketDataService sorts the top SIGNAL_LEVELS levels of each side of every
+ * book it stores into a BookLevels and derives a BookSignals from them: spread,
+ * mid, microprice, top of book and depth imbalance, and the cumulative size at
+ * each level. A side whose levels are unchanged since the previous book keeps
+ * its cumulative sizes; a changed side has them recomputed with one vectorized
+ * prefix sum.
+ */
+#ifndef BOOK_SIGNALS_HPP
+#define BOOK_SIGNALS_HPP
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Levels per side that signals cover; even, so the prefix sum works in pairs
+const int SIGNAL_LEVELS = 8;
+
+/**
+ * The best SIGNAL_LEVELS levels of each side of a book, best first. Levels
+ * past the depth of a side are zero.
+ */
+struct BookLevels
+{
+  double bidPrice[SIGNAL_LEVELS];
+  double offerPrice[SIGNAL_LEVELS];
+  int64_t bidSize[SIGNAL_LEVELS];
+  int64_t offerSize[SIGNAL_LEVELS];
+  int bidLevels;
+  int offerLevels;
+};
+
+/**
+ * Signals of one product's book. Prices are zero while either side is empty.
+ * Trivially copyable so that it can be read from other threads through a
+ * SeqLockArray.
+ */
+struct BookSignals
+{
+  uint32_t product;        // product handle in the MarketDataService
+  int32_t bidLevels;
+  int32_t offerLevels;
+  uint32_t updates;        // books stored for the product that changed its signals
+  double bestBid;
+  double bestOffer;
+  double spread;
+  double mid;
+  double microprice;       // mid weighted towards the side with less size at the top
+  double imbalance;        // (bid - offer) / (bid + offer) size at the top level
+  double depthImbalance;   // the same over all SIGNAL_LEVELS levels
+  int64_t cumulativeBidSize[SIGNAL_LEVELS];
+  int64_t cumulativeOfferSize[SIGNAL_LEVELS];
+};
+
+// Running sums of sizes over SIGNAL_LEVELS levels, one element at a time
+inline void CumulativeSizesScalar(const int64_t *sizes, int64_t *cumulative) {
+  int64_t total = 0;
+  for (int i = 0; i < SIGNAL_LEVELS; ++i) cumulative[i] = total += sizes[i];
+}
+
+// Running sums of sizes over SIGNAL_LEVELS levels, two levels per step where SSE2 is available
+inline void CumulativeSizes(const int64_t *sizes, int64_t *cumulative) {
+#if defined(__SSE2__)
+  __m128i carry = _mm_setzero_si128();
+  for (int i = 0; i < SIGNAL_LEVELS; i += 2) {
+    __m128i pair = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sizes + i));
+    pair = _mm_add_epi64(pair, _mm_slli_si128(pair, 8));
+    pair = _mm_add_epi64(pair, carry);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(cumulative + i), pair);
+    carry = _mm_shuffle_epi32(pair, _MM_SHUFFLE(3, 2, 3, 2));
+  }
+#else
+  CumulativeSizesScalar(sizes, cumulative);
+#endif
+}
+
+// Whether one side's levels are the same in two snapshots
+inline bool SameSide(const double *price, const int64_t *size, const double *previousPrice, const int64_t *previousSize) {
+  return std::memcmp(price, previousPrice, sizeof(double) * SIGNAL_LEVELS) == 0 &&
+    std::memcmp(size, previousSize, sizeof(int64_t) * SIGNAL_LEVELS) == 0;
+}
+
+// Update signals from new levels, given the levels they were last computed
+// from. Returns false, leaving signals untouched, if no level changed.
+inline bool UpdateBookSignals(const BookLevels &levels, const BookLevels &previous, BookSignals &signals) {
+  bool bidsChanged = !SameSide(levels.bidPrice, levels.bidSize, previous.bidPrice, previous.bidSize);
+  bool offersChanged = !SameSide(levels.offerPrice, levels.offerSize, previous.offerPrice, previous.offerSize);
+  if (!bidsChanged && !offersChanged && signals.updates) return false;
+
+  if (bidsChanged || !signals.updates) CumulativeSizes(levels.bidSize, signals.cumulativeBidSize);
+  if (offersChanged || !signals.updates) CumulativeSizes(levels.offerSize, signals.cumulativeOfferSize);
+  signals.bidLevels = levels.bidLevels;
+  signals.offerLevels = levels.offerLevels;
+  ++signals.updates;
+
+  const double bidSize = static_cast<double>(levels.bidSize[0]);
+  const double offerSize = static_cast<double>(levels.offerSize[0]);
+  const double topSize = bidSize + offerSize;
+  signals.imbalance = topSize > 0 ? (bidSize - offerSize) / topSize : 0.0;
+  const double depthBid = static_cast<double>(signals.cumulativeBidSize[SIGNAL_LEVELS - 1]);
+  const double depthOffer = static_cast<double>(signals.cumulativeOfferSize[SIGNAL_LEVELS - 1]);
+  signals.depthImbalance = depthBid + depthOffer > 0 ? (depthBid - depthOffer) / (depthBid + depthOffer) : 0.0;
+
+  if (levels.bidLevels && levels.offerLevels) {
+    signals.bestBid = levels.bidPrice[0];
+    signals.bestOffer = levels.offerPrice[0];
+    signals.spread = signals.bestOffer - signals.bestBid;
+    signals.mid = (signals.bestBid + signals.bestOffer) / 2;
+    signals.microprice = topSize > 0 ? (signals.bestBid * offerSize + signals.bestOffer * bidSize) / topSize : signals.mid;
+  } else {
+    signals.bestBid = signals.bestOffer = signals.spread = signals.mid = signals.microprice = 0.0;
+  }
+  return true;
+}
+
+#endif // BOOK_SIGNALS_HPP
@@ -0,0 +1,405 @@
+/**
+ * boundedqueue.hpp
+ * Bounded queues between services, with overflow policies, watermark
+ * notifications and occupancy metrics.
+ *
+ * A QueuedListener sits between an upstream service and a slow downstream
+ * listener (risk, historical persistence, ...), and a QueuedConnector sits in
+ * front of a service's OnMessage. Either way the producer only pays for an
+ * enqueue, the consumer drains on its own thread or by polling, and the queue
+ * never grows past its capacity. When it is full the policy decides whether
+ * the producer waits, the oldest event is shed, or the event is merged into a
+ * queued event for the same key.
+ */
+#ifndef BOUNDED_QUEUE_HPP
+#define BOUNDED_QUEUE_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "soa.hpp"
+
+/**
+ * What a full queue does with a new event.
+ * OVERFLOW_BLOCK       the producer waits for space
+ * OVERFLOW_DROP_OLDEST the oldest queued event is discarded
+ * OVERFLOW_CONFLATE    an event replaces the queued event with the same key in
+ *                      place; a new key on a full queue waits like OVERFLOW_BLOCK
+ */
+enum OverflowPolicy { OVERFLOW_BLOCK, OVERFLOW_DROP_OLDEST, OVERFLOW_CONFLATE };
+
+/**
+ * Sizing and policy of a bounded queue. Watermarks of zero default to three
+ * quarters and one quarter of the capacity.
+ */
+struct QueueOptions
+{
+  size_t capacity = 1024;
+  OverflowPolicy policy = OVERFLOW_BLOCK;
+  size_t highWatermark = 0;
+  size_t lowWatermark = 0;
+};
+
+/**
+ * Counters for one queue.
+ */
+struct QueueMetrics
+{
+  uint64_t enqueued = 0;        // events accepted, including conflated ones
+  uint64_t dequeued = 0;        // events handed to the consumer
+  uint64_t dropped = 0;         // events shed by OVERFLOW_DROP_OLDEST
+  uint64_t conflated = 0;       // events merged into an already queued event
+  uint64_t blocked = 0;         // pushes that had to wait for space
+  uint64_t blockedNanos = 0;    // total time producers spent waiting
+  uint64_t highWatermarks = 0;  // times the depth crossed the high watermark
+  size_t depth = 0;
+  size_t maxDepth = 0;
+  size_t capacity = 0;
+};
+
+/**
+ * Notified when a queue's depth crosses its high watermark on the way up and
+ * its low watermark on the way back down. Called on the producer or consumer
+ * thread that caused the crossing, outside the queue lock.
+ */
+class QueuePressureListener
+{
+
+public:
+
+  virtual ~QueuePressureListener() = default;
+
+  virtual void OnHighWatermark(const std::string &queue, size_t depth) = 0;
+
+  virtual void OnLowWatermark(const std::string &queue, size_t depth) = 0;
+};
+
+/**
+ * Thread-safe fixed-capacity ring of values of type V.
+ * Any number of producers and consumers may use it concurrently.
+ */
+template<typename V>
+class BoundedQueue
+{
+
+public:
+
+  // Extracts the conflation key from a value
+  typedef std::function<std::string(const V&)> KeyFunction;
+
+  // ctor for a named queue; OVERFLOW_CONFLATE requires a key function
+  BoundedQueue(const std::string &_name, const QueueOptions &options, KeyFunction _keyFunction = KeyFunction()) :
+    name(_name), policy(options.policy), keyFunction(_keyFunction), slots(std::max<size_t>(options.capacity, 1)),
+    slotKeys(options.policy == OVERFLOW_CONFLATE ? slots.size() : 0), head(0), count(0), closed(false), high(false),
+    pressureListener(nullptr)
+  {
+    if (policy == OVERFLOW_CONFLATE && !keyFunction) throw std::invalid_argument("BoundedQueue: conflation needs a key function");
+    highWatermark = options.highWatermark ? std::min(options.highWatermark, slots.size()) : std::max<size_t>(slots.size() * 3 / 4, 1);
+    lowWatermark = options.lowWatermark ? std::min(options.lowWatermark, highWatermark - 1) : highWatermark / 3;
+    metrics.capacity = slots.size();
+  }
+
+  BoundedQueue(const BoundedQueue&) = delete;
+  BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+  // Set the listener for watermark crossings
+  void SetPressureListener(QueuePressureListener *listener) {
+    std::lock_guard<std::mutex> lock(mutex);
+    pressureListener = listener;
+  }
+
+  // Enqueue a value, applying the overflow policy when full. Returns false
+  // only if the queue has been closed.
+  bool Push(const V &value) { return Enqueue(value); }
+
+  // Enqueue a value the caller hands over, moving it into its slot
+  bool Push(V &&value) { return Enqueue(std::move(value)); }
+
+  // Move up to max values into out, waiting for at least one if wait is set.
+  // Returns the number taken; zero once the queue is closed and empty.
+  size_t PopBatch(std::vector<V> &out, size_t max, bool wait = true) {
+    bool crossedLow = false;
+    size_t taken, depth;
+    QueuePressureListener *listener;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      if (wait) notEmpty.wait(lock, [this]() { return count > 0 || closed; });
+      taken = std::min(count, max);
+      for (size_t i = 0; i < taken; ++i) {
+        out.push_back(std::move(slots[head]));
+        if (policy == OVERFLOW_CONFLATE) {
+          auto it = index.find(slotKeys[head]);
+          if (it != index.end() && it->second == head) index.erase(it);
+        }
+        head = Next(head);
+      }
+      count -= taken;
+      metrics.dequeued += taken;
+      if (high && count <= lowWatermark) {
+        high = false;
+        crossedLow = true;
+      }
+      depth = count;
+      listener = pressureListener;
+    }
+    if (taken) notFull.notify_all();
+    if (crossedLow && listener) listener->OnLowWatermark(name, depth);
+    return taken;
+  }
+
+  // Refuse further pushes and wake every waiting producer and consumer
+  void Close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      closed = true;
+    }
+    notFull.notify_all();
+    notEmpty.notify_all();
+  }
+
+  // Snapshot of the counters
+  QueueMetrics GetMetrics() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    QueueMetrics snapshot = metrics;
+    snapshot.depth = count;
+    return snapshot;
+  }
+
+  const std::string& GetName() const { return name; }
+
+private:
+
+  // Push a copied or moved value; it is assigned into exactly one slot
+  template<typename U>
+  bool Enqueue(U &&value) {
+    bool crossedHigh = false;
+    size_t depth;
+    QueuePressureListener *listener;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      if (closed) return false;
+      std::string key;
+      if (policy == OVERFLOW_CONFLATE) key = keyFunction(value);
+      bool waited = false;
+      auto start = std::chrono::steady_clock::now();
+      for (;;) {
+        // Re-checked after every wait, since another producer may have queued the key meanwhile
+        if (policy == OVERFLOW_CONFLATE) {
+          auto it = index.find(key);
+          if (it != index.end()) {
+            slots[it->second] = std::forward<U>(value);
+            ++metrics.enqueued;
+            ++metrics.conflated;
+            break;
+          }
+        }
+        if (count < slots.size()) break;
+        if (policy == OVERFLOW_DROP_OLDEST) {
+          head = Next(head);
+          --count;
+          ++metrics.dropped;
+          break;
+        }
+        if (!waited) ++metrics.blocked;
+        waited = true;
+        notFull.wait(lock);
+        if (closed) return false;
+      }
+      if (waited) metrics.blockedNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+      if (policy == OVERFLOW_CONFLATE && index.count(key)) return true;
+      size_t slot = (head + count) % slots.size();
+      slots[slot] = std::forward<U>(value);
+      if (policy == OVERFLOW_CONFLATE) {
+        index[key] = slot;
+        slotKeys[slot] = std::move(key);
+      }
+      ++count;
+      ++metrics.enqueued;
+      metrics.maxDepth = std::max(metrics.maxDepth, count);
+      if (!high && count >= highWatermark) {
+        high = true;
+        crossedHigh = true;
+        ++metrics.highWatermarks;
+      }
+      depth = count;
+      listener = pressureListener;
+    }
+    notEmpty.notify_one();
+    if (crossedHigh && listener) listener->OnHighWatermark(name, depth);
+    return true;
+  }
+  std::string name;
+  OverflowPolicy policy;
+  KeyFunction keyFunction;
+  std::vector<V> slots;
+  std::vector<std::string> slotKeys;           // key of each occupied slot when conflating
+  std::unordered_map<std::string, size_t> index; // queued slot for each key when conflating
+  size_t head;
+  size_t count;
+  size_t highWatermark;
+  size_t lowWatermark;
+  bool closed;
+  bool high;
+  QueuePressureListener *pressureListener;
+  QueueMetrics metrics;
+  mutable std::mutex mutex;
+  std::condition_variable notFull;
+  std::condition_variable notEmpty;
+
+  size_t Next(size_t slot) const { return slot + 1 == slots.size() ? 0 : slot + 1; }
+};
+
+/**
+ * Drains a BoundedQueue in batches, either on a worker thread started with
+ * Start() or by polling Drain() from the owner's thread.
+ * Type E is the queued item type.
+ */
+template<typename E>
+class QueueConsumer
+{
+
+public:
+
+  virtual ~QueueConsumer() { Stop(); }
+
+  // Start a worker thread delivering batches of up to batchSize items. onThreadStart,
+  // if given, runs first on the worker, e.g. to pin it with a ThreadTopology.
+  void Start(size_t batchSize = 64, std::function<void()> onThreadStart = std::function<void()>()) {
+    if (worker.joinable()) return;
+    worker = std::thread([this, batchSize, onThreadStart]() {
+      if (onThreadStart) onThreadStart();
+      std::vector<E> batch;
+      while (queue.PopBatch(batch, batchSize, true)) {
+        for (E &item : batch) Deliver(item);
+        batch.clear();
+      }
+    });
+  }
+
+  // Close the queue, let the worker deliver what is left and join it
+  void Stop() {
+    queue.Close();
+    if (worker.joinable()) worker.join();
+  }
+
+  // Deliver up to max queued items on the calling thread without waiting
+  size_t Drain(size_t max = SIZE_MAX) {
+    std::vector<E> batch;
+    size_t delivered = queue.PopBatch(batch, max, false);
+    for (E &item : batch) Deliver(item);
+    return delivered;
+  }
+
+  BoundedQueue<E>& GetQueue() { return queue; }
+  QueueMetrics GetMetrics() const { return queue.GetMetrics(); }
+
+protected:
+
+  QueueConsumer(const std::string &name, const QueueOptions &options, typename BoundedQueue<E>::KeyFunction key) : queue(name, options, key) {}
+
+  // Hand one item to the downstream
+  virtual void Deliver(E &item) = 0;
+
+  BoundedQueue<E> queue;
+
+private:
+  std::thread worker;
+};
+
+/**
+ * An add or update event captured by a QueuedListener.
+ */
+template<typename V>
+struct QueuedEvent
+{
+  V data;
+  bool update;
+};
+
+/**
+ * ServiceListener that queues the upstream service's adds and updates and
+ * replays them into a downstream listener. Register it on the upstream service
+ * in place of the downstream listener. Conflated events keep the latest value
+ * and kind.
+ * Type V is the value type of the upstream service.
+ */
+template<typename V>
+class QueuedListener : public ServiceListener<V>, public QueueConsumer<QueuedEvent<V>>
+{
+
+public:
+
+  // Extracts the conflation key from a value
+  typedef std::string (*KeyFunction)(const V &data);
+
+  // ctor for a listener forwarding into downstream
+  QueuedListener(ServiceListener<V> &_downstream, const std::string &name, const QueueOptions &options, KeyFunction key = nullptr) :
+    QueueConsumer<QueuedEvent<V>>(name, options, EventKey(key)), downstream(_downstream) {}
+
+  ~QueuedListener() { this->Stop(); }
+
+  void ProcessAdd(V &data) override { this->queue.Push(QueuedEvent<V>{ data, false }); }
+
+  void ProcessRemove(V &data) override {}
+
+  void ProcessUpdate(V &data) override { this->queue.Push(QueuedEvent<V>{ data, true }); }
+
+protected:
+
+  void Deliver(QueuedEvent<V> &event) override {
+    SOA_PROBE_LISTENER(&downstream);
+    if (event.update) downstream.ProcessUpdate(event.data);
+    else downstream.ProcessAdd(event.data);
+  }
+
+private:
+  ServiceListener<V> &downstream;
+
+  static typename BoundedQueue<QueuedEvent<V>>::KeyFunction EventKey(KeyFunction key) {
+    if (!key) return typename BoundedQueue<QueuedEvent<V>>::KeyFunction();
+    return [key](const QueuedEvent<V> &event) { return key(event.data); };
+  }
+};
+
+/**
+ * Subscriber Connector that queues published values and feeds them into a
+ * service's OnMessage on the consumer side.
+ * Type K is the service key type and V the value type.
+ */
+template<typename K, typename V>
+class QueuedConnector : public Connector<V>, public QueueConsumer<V>
+{
+
+public:
+
+  // Extracts the conflation key from a value
+  typedef std::string (*KeyFunction)(const V &data);
+
+  // ctor for a connector feeding service
+  QueuedConnector(Service<K, V> &_service, const std::string &name, const QueueOptions &options, KeyFunction key = nullptr) :
+    QueueConsumer<V>(name, options, key ? typename BoundedQueue<V>::KeyFunction(key) : typename BoundedQueue<V>::KeyFunction()), service(_service) {}
+
+  ~QueuedConnector() { this->Stop(); }
+
+  void Publish(V &data) override { this->queue.Push(data); }
+
+  void Publish(V &&data) override { this->queue.Push(std::move(data)); }
+
+protected:
+
+  // The consumer owns its batch, so each value is handed over to the service
+  void Deliver(V &data) override { service.OnMessage(std::move(data)); }
+
+private:
+  Service<K, V> &service;
+};
+
+#endif // BOUNDED_QUEUE_HPP
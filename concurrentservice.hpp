@@ -0,0 +1,225 @@
+/**
+ * concurrentservice.hpp
+ * Thread-safe Service base with per-key lock striping and a copy-on-write
+ * listener list.
+ *
+ * Keys hash onto a fixed number of stripes, each with its own mutex and its
+ * own map, so updates to keys on different stripes never contend. Listener
+ * registration copies the listener registry and publishes the copy atomically,
+ * so dispatch reads it without taking any lock.
+ *
+ * Each stripe also has a writer lock, held across a store and the dispatch of
+ * its notification, so listeners see the updates to a key in the order they
+ * were stored. The map lock is released before dispatch, so readers never
+ * wait on a listener, and the writer lock is recursive, so a listener may
+ * update this service again from the same thread.
+ */
+#ifndef CONCURRENT_SERVICE_HPP
+#define CONCURRENT_SERVICE_HPP
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "soa.hpp"
+#include "positionservice.hpp"
+#include "tradebookingservice.hpp"
+
+/**
+ * Concurrent Service base keyed on K with values V.
+ * Derived classes say how to key a value and build their update operations
+ * on Apply().
+ */
+template<typename K, typename V>
+class ConcurrentService : public Service<K, V>
+{
+
+public:
+
+  // ctor with the number of lock stripes, rounded up to a power of two
+  explicit ConcurrentService(size_t stripeCount = 64) : stripes(RoundUp(stripeCount)), mask(RoundUp(stripeCount) - 1) {
+    listenerLists.emplace_back(new Registry());
+    listeners.store(listenerLists.back().get(), std::memory_order_release);
+  }
+
+  // Get data for a key. The reference stays valid but is not synchronized with
+  // later writers; prefer Read() from threads other than the writer of that key.
+  V& GetData(K key) override {
+    Stripe &stripe = StripeOf(key);
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    auto it = stripe.data.find(key);
+    if (it == stripe.data.end()) throw std::runtime_error("Data not found for key");
+    return it->second;
+  }
+
+  // Get data for a key, or nullptr if there is none, with the same caveat as GetData
+  V* TryGetData(const K &key) noexcept override {
+    Stripe &stripe = StripeOf(key);
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    auto it = stripe.data.find(key);
+    return it == stripe.data.end() ? nullptr : &it->second;
+  }
+
+  // Copy the value for a key into out under its stripe lock; false if absent
+  bool Read(const K &key, V &out) const {
+    const Stripe &stripe = StripeOf(key);
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    auto it = stripe.data.find(key);
+    if (it == stripe.data.end()) return false;
+    out = it->second;
+    return true;
+  }
+
+  // Store or replace a value and notify listeners of the add
+  void OnMessage(V &data) override {
+    SOA_PROBE_SERVICE("OnMessage");
+    const K key = KeyOf(data);
+    Apply(key, [&]() { return data; }, [&](V &value) { value = data; }, [&](V &stored) { NotifyAdd(key, stored); });
+  }
+
+  // Move a handed-over value into the store and notify listeners of the add
+  void OnMessage(V &&data) override {
+    SOA_PROBE_SERVICE("OnMessage");
+    const K key = KeyOf(data);
+    Apply(key, [&]() { return std::move(data); }, [&](V &value) { value = std::move(data); }, [&](V &stored) { NotifyAdd(key, stored); });
+  }
+
+  // Add a listener by publishing a new copy of the listener registry
+  void AddListener(ServiceListener<V> *listener) override {
+    AddListener(listener, ListenerOptions());
+  }
+
+  // Add a listener with a priority and key filter
+  ListenerHandle AddListener(ServiceListener<V> *listener, const ListenerOptions &options) override {
+    ListenerHandle handle = 0;
+    UpdateListeners([&](Registry &registry) { handle = registry.Add(listener, options); return true; });
+    return handle;
+  }
+
+  // Remove a listener registration by publishing a registry without it
+  bool RemoveListener(ListenerHandle handle) override {
+    return UpdateListeners([&](Registry &registry) { return registry.Remove(handle); });
+  }
+
+  // Get the current listeners without locking
+  const vector<ServiceListener<V>*>& GetListeners() const override {
+    return listeners.load(std::memory_order_acquire)->All();
+  }
+
+  // Number of lock stripes
+  size_t GetStripeCount() const { return stripes.size(); }
+
+protected:
+
+  typedef vector<ServiceListener<V>*> ListenerList;
+
+  // Key a value is stored under
+  virtual K KeyOf(const V &data) const = 0;
+
+  // Run mutate on the value for key under its stripe lock, first creating it
+  // from create() if absent, then pass the stored value to notify. notify runs
+  // after the map lock is released but before any later update to the stripe,
+  // so notifications of a key follow the order of its stores.
+  template<typename Create, typename Mutate, typename Notify>
+  void Apply(const K &key, Create create, Mutate mutate, Notify notify) {
+    Stripe &stripe = StripeOf(key);
+    std::lock_guard<std::recursive_mutex> order(stripe.writer);
+    V *stored;
+    {
+      std::lock_guard<std::mutex> lock(stripe.mutex);
+      auto it = stripe.data.find(key);
+      if (it == stripe.data.end()) it = stripe.data.emplace(key, create()).first;
+      mutate(it->second);
+      stored = &it->second;
+    }
+    notify(*stored);
+  }
+
+  // Lock-free view of the listeners interested in a key, for dispatch
+  const ListenerList& Listeners(const K &key) const { return listeners.load(std::memory_order_acquire)->For(key); }
+
+private:
+
+  // One lock stripe, padded so neighbouring mutexes do not share a cache line
+  struct alignas(64) Stripe
+  {
+    mutable std::mutex mutex;     // guards data
+    std::recursive_mutex writer;  // orders stores and their dispatch
+    std::unordered_map<K, V> data;
+  };
+
+  std::vector<Stripe> stripes;
+  size_t mask;
+  typedef ListenerRegistry<V> Registry;
+
+  std::atomic<const Registry*> listeners;
+  std::mutex listenerMutex;
+  std::vector<std::unique_ptr<Registry>> listenerLists;
+
+  // Apply change to a copy of the registry and publish the copy if change returns true
+  template<typename Change>
+  bool UpdateListeners(Change change) {
+    std::lock_guard<std::mutex> lock(listenerMutex);
+    std::unique_ptr<Registry> next(new Registry(*listeners.load(std::memory_order_relaxed)));
+    if (!change(*next)) return false;
+    listeners.store(next.get(), std::memory_order_release);
+    // Superseded registries are kept so that references from GetListeners() stay valid
+    listenerLists.push_back(std::move(next));
+    return true;
+  }
+
+  void NotifyAdd(const K &key, V &stored) {
+    for (auto listener : Listeners(key)) {
+      SOA_PROBE_LISTENER(listener);
+      listener->ProcessAdd(stored);
+    }
+  }
+
+  static size_t RoundUp(size_t n) {
+    size_t power = 1;
+    while (power < n) power <<= 1;
+    return power;
+  }
+
+  Stripe& StripeOf(const K &key) { return stripes[std::hash<K>()(key) & mask]; }
+  const Stripe& StripeOf(const K &key) const { return stripes[std::hash<K>()(key) & mask]; }
+};
+
+/**
+ * Position Service that books trades for different products concurrently.
+ * Keyed on product identifier.
+ * Type T is the product type.
+ */
+template<typename T>
+class ConcurrentPositionService : public ConcurrentService<string, Position<T>>
+{
+
+public:
+
+  explicit ConcurrentPositionService(size_t stripeCount = 64) : ConcurrentService<string, Position<T>>(stripeCount) {}
+
+  // Add a trade to the service; safe to call from any thread
+  void AddTrade(const Trade<T> &trade) {
+    SOA_PROBE_SERVICE("AddTrade");
+    long quantity = trade.GetSide() == BUY ? trade.GetQuantity() : -trade.GetQuantity();
+    auto create = [&]() { return Position<T>(trade.GetProduct()); };
+    auto update = [&](Position<T> &position) { position.UpdatePosition(trade.GetBook(), quantity); };
+    const string &productId = trade.GetProduct().GetProductId();
+    this->Apply(productId, create, update, [&](Position<T> &position) {
+      for (auto listener : this->Listeners(productId)) {
+        SOA_PROBE_LISTENER(listener);
+        listener->ProcessUpdate(position);
+      }
+    });
+  }
+
+protected:
+
+  string KeyOf(const Position<T> &data) const override { return data.GetProduct().GetProductId(); }
+};
+
+#endif // CONCURRENT_SERVICE_HPP
@@ -0,0 +1,280 @@
+/**
+ * eventbus.hpp
+ * Typed event bus connecting services without hand-written bridge listeners.
+ *
+ * Services are attached to the bus and publish every value they add or update
+ * as an event of that value's type. Subscribers bind a member function taking
+ * the event type, e.g. PositionService<T>::AddTrade for Trade<T> events. Each
+ * event type has its own channel holding pending events in contiguous
+ * segments; dispatch drains one channel's whole segment at a time, so a batch
+ * of events runs through the same handlers back to back.
+ *
+ * Every event between services passes through Dispatch(), which makes it the
+ * single place for threading, tracing and flow control across the SOA graph.
+ */
+#ifndef EVENT_BUS_HPP
+#define EVENT_BUS_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <typeinfo>
+#include <vector>
+#include "soa.hpp"
+
+/**
+ * When events published from outside a dispatch are delivered.
+ * BUS_IMMEDIATE drains the bus before the outermost Publish returns, so the
+ * graph behaves synchronously to its callers; events published by handlers are
+ * still queued and dispatched in batches. BUS_DEFERRED queues everything until
+ * the owner calls Dispatch().
+ */
+enum BusDispatchMode { BUS_IMMEDIATE, BUS_DEFERRED };
+
+/**
+ * Handle identifying one subscription, used to unsubscribe it again.
+ * Zero is never a valid handle.
+ */
+typedef uint64_t SubscriptionHandle;
+
+/**
+ * Event and subscriber types of a member function handler void (C::*)(E).
+ */
+template<typename M>
+struct MemberHandlerTraits;
+
+template<typename C, typename R, typename A>
+struct MemberHandlerTraits<R (C::*)(A)>
+{
+  typedef C Class;
+  typedef typename std::decay<A>::type Event;
+};
+
+/**
+ * Dense index for an event type, assigned on first use.
+ */
+inline size_t NextEventTypeIndex() {
+  static std::atomic<size_t> next(0);
+  return next++;
+}
+
+template<typename E>
+size_t EventTypeIndex() {
+  static const size_t index = NextEventTypeIndex();
+  return index;
+}
+
+/**
+ * Type-erased channel interface used by the bus to drain channels in turn.
+ */
+class EventChannelBase
+{
+
+public:
+
+  virtual ~EventChannelBase() {}
+
+  // Deliver every pending event to the subscribers, returning the count delivered
+  virtual size_t Dispatch() = 0;
+
+  // Events waiting for dispatch
+  virtual size_t Pending() const = 0;
+
+  // Drop a subscription; returns false if the handle is not on this channel
+  virtual bool Unsubscribe(SubscriptionHandle handle) = 0;
+};
+
+/**
+ * Pending events and subscribers for one event type E.
+ * Events are appended to one segment while the other is being dispatched, so
+ * handlers may publish more events of the same type without invalidating the
+ * batch in flight. Both segments keep their capacity between batches.
+ */
+template<typename E>
+class EventChannel : public EventChannelBase
+{
+
+public:
+
+  // Handler invoked with the subscriber object and the event
+  typedef void (*Thunk)(void *target, E &event);
+
+  // Queue a copy of an event
+  void Push(const E &event) { pending.push_back(event); }
+
+  // Add a subscriber
+  void Subscribe(SubscriptionHandle handle, void *target, Thunk thunk, const std::type_info &type) {
+    subscribers.push_back(Subscriber{ handle, target, thunk, &type });
+  }
+
+  size_t Dispatch() override {
+    if (pending.empty()) return 0;
+    batch.swap(pending);
+    for (E &event : batch) {
+      for (Subscriber &subscriber : subscribers) {
+#ifdef SOA_INSTRUMENTATION
+        ProbeScope probe(subscriber.probeSlot.Get(*subscriber.type));
+#endif
+        subscriber.thunk(subscriber.target, event);
+      }
+    }
+    size_t delivered = batch.size();
+    batch.clear();
+    return delivered;
+  }
+
+  size_t Pending() const override { return pending.size(); }
+
+  bool Unsubscribe(SubscriptionHandle handle) override {
+    auto it = std::find_if(subscribers.begin(), subscribers.end(), [handle](const Subscriber &s) { return s.handle == handle; });
+    if (it == subscribers.end()) return false;
+    subscribers.erase(it);
+    return true;
+  }
+
+private:
+
+  struct Subscriber
+  {
+    SubscriptionHandle handle;
+    void *target;
+    Thunk thunk;
+    const std::type_info *type;
+#ifdef SOA_INSTRUMENTATION
+    ProbeSlot probeSlot;
+#endif
+  };
+
+  std::vector<E> pending;
+  std::vector<E> batch;
+  std::vector<Subscriber> subscribers;
+};
+
+/**
+ * Bus of typed channels for a single thread.
+ * Subscriptions must not be added or removed from within a handler.
+ */
+class EventBus
+{
+
+public:
+
+  // ctor for a bus with the given dispatch mode
+  explicit EventBus(BusDispatchMode _mode = BUS_IMMEDIATE) : mode(_mode), dispatching(false), nextHandle(1), published(0), dispatched(0) {}
+
+  EventBus(const EventBus&) = delete;
+  EventBus& operator=(const EventBus&) = delete;
+
+  // Bind a member function void C::Method(E&) of a subscriber to events of type E
+  template<auto Method>
+  SubscriptionHandle Subscribe(typename MemberHandlerTraits<decltype(Method)>::Class &subscriber) {
+    typedef MemberHandlerTraits<decltype(Method)> Traits;
+    typedef typename Traits::Class C;
+    typedef typename Traits::Event E;
+    SubscriptionHandle handle = nextHandle++;
+    Channel<E>().Subscribe(handle, &subscriber, [](void *target, E &event) { (static_cast<C*>(target)->*Method)(event); }, typeid(C));
+    return handle;
+  }
+
+  // Remove a subscription; returns false if the handle is unknown
+  bool Unsubscribe(SubscriptionHandle handle) {
+    for (std::unique_ptr<EventChannelBase> &channel : channels) {
+      if (channel && channel->Unsubscribe(handle)) return true;
+    }
+    return false;
+  }
+
+  // Publish an event to the subscribers of its type
+  template<typename E>
+  void Publish(const E &event) {
+    Channel<E>().Push(event);
+    ++published;
+    if (mode == BUS_IMMEDIATE && !dispatching) Dispatch();
+  }
+
+  // Attach a service so that every value it adds or updates is published as an event.
+  // The bus must outlive the service's last notification.
+  template<typename K, typename V>
+  void Attach(Service<K, V> &service) {
+    std::unique_ptr<Publisher<V>> publisher(new Publisher<V>(*this));
+    service.AddListener(publisher.get());
+    publishers.push_back(std::move(publisher));
+  }
+
+  // Drain every channel in batches until no events remain, returning the events delivered.
+  // Calls from within a handler return 0; the outer dispatch picks up their events.
+  size_t Dispatch() {
+    if (dispatching) return 0;
+    dispatching = true;
+    size_t delivered = 0;
+    bool progress = true;
+    while (progress) {
+      progress = false;
+      for (size_t i = 0; i < channels.size(); ++i) {
+        if (!channels[i]) continue;
+        size_t count = channels[i]->Dispatch();
+        if (count) {
+          delivered += count;
+          progress = true;
+        }
+      }
+    }
+    dispatching = false;
+    dispatched += delivered;
+    return delivered;
+  }
+
+  // Events queued but not yet dispatched
+  size_t Pending() const {
+    size_t pending = 0;
+    for (const std::unique_ptr<EventChannelBase> &channel : channels) {
+      if (channel) pending += channel->Pending();
+    }
+    return pending;
+  }
+
+  uint64_t GetPublished() const { return published; }
+  uint64_t GetDispatched() const { return dispatched; }
+
+private:
+
+  // Owned service listener of any value type
+  struct PublisherBase
+  {
+    virtual ~PublisherBase() {}
+  };
+
+  // Forwards a service's adds and updates onto the bus
+  template<typename V>
+  class Publisher : public ServiceListener<V>, public PublisherBase
+  {
+  public:
+    explicit Publisher(EventBus &_bus) : bus(_bus) {}
+    void ProcessAdd(V &data) override { bus.Publish(data); }
+    void ProcessRemove(V &data) override {}
+    void ProcessUpdate(V &data) override { bus.Publish(data); }
+  private:
+    EventBus &bus;
+  };
+
+  // Channel for an event type, created on first use
+  template<typename E>
+  EventChannel<E>& Channel() {
+    size_t index = EventTypeIndex<E>();
+    if (index >= channels.size()) channels.resize(index + 1);
+    if (!channels[index]) channels[index].reset(new EventChannel<E>());
+    return static_cast<EventChannel<E>&>(*channels[index]);
+  }
+
+  BusDispatchMode mode;
+  bool dispatching;
+  SubscriptionHandle nextHandle;
+  uint64_t published;
+  uint64_t dispatched;
+  std::vector<std::unique_ptr<EventChannelBase>> channels;  // indexed by EventTypeIndex
+  std::vector<std::unique_ptr<PublisherBase>> publishers;
+};
+
+#endif // EVENT_BUS_HPP
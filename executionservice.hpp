@@ -8,10 +8,10 @@
 #define EXECUTION_SERVICE_HPP
 
 #include <string>
-#include <map>
 #include <vector>
 #include "soa.hpp"
 #include "marketdataservice.hpp"
+#include "flatstore.hpp"
 
 enum OrderType { FOK, IOC, MARKET, LIMIT, STOP };
 
@@ -29,6 +29,7 @@ public:
   // Constructor for an order
   ExecutionOrder(const T &_product, PricingSide _side, std::string _orderId, OrderType _orderType, double _price, double _visibleQuantity, double _hiddenQuantity, std::string _parentOrderId, bool _isChildOrder) :
     product(_product), side(_side), orderId(_orderId), orderType(_orderType), price(_price), visibleQuantity(_visibleQuantity), hiddenQuantity(_hiddenQuantity), parentOrderId(_parentOrderId), isChildOrder(_isChildOrder) {}
+  ExecutionOrder() : side(BID), orderType(MARKET), price(0.0), visibleQuantity(0.0), hiddenQuantity(0.0), isChildOrder(false) {}
 
   // Get the product
   const T& GetProduct() const { return product; }
@@ -78,25 +79,61 @@ template<typename T>
 class ExecutionService : public Service<std::string, ExecutionOrder<T>>
 {
 public:
+  // Dense index of an entry, stable for the life of the service
+  typedef typename FlatStore<ExecutionOrder<T>>::Handle Handle;
+
+  static constexpr Handle NO_HANDLE = FlatStore<ExecutionOrder<T>>::NO_HANDLE;
+
+  // ctor pre-sizing the execution order store and listener lists
+  explicit ExecutionService(const ServiceCapacity &capacity = ServiceCapacity()) : data(capacity.orders) {
+    listeners.Reserve(capacity.listeners);
+  }
+
+  // Touch every page of the pre-sized store before the open
+  void WarmUp() { data.Warm(); }
+
   // Execute an order on a market
   void ExecuteOrder(const ExecutionOrder<T>& order, Market market) {
-    data[order.GetOrderId()] = order;
+    SOA_PROBE_SERVICE("ExecuteOrder");
+    Executed(data.Upsert(order.GetOrderId(), order), market);
+  }
 
-    // Notify all listeners about the new execution order
-    for (auto& listener : listeners) {
-      listener->ProcessAdd(data[order.GetOrderId()]);
-    }
+  // Execute an order the caller hands over, moving it into the store
+  void ExecuteOrder(ExecutionOrder<T>&& order, Market market) {
+    SOA_PROBE_SERVICE("ExecuteOrder");
+    std::string orderId = order.GetOrderId();
+    Executed(data.Upsert(orderId, std::move(order)), market);
+  }
 
-    // Log the execution order
-    std::cout << "Executed order: " << order.GetOrderId()
-              << " on market: " << MarketToString(market)
-              << " at price: " << order.GetPrice()
-              << " with quantity: " << order.GetVisibleQuantity() << std::endl;
+  // Execute an order constructed in the store from ExecutionOrder<T> ctor arguments
+  template<typename... Args>
+  void EmplaceData(Market market, Args&&... args) {
+    SOA_PROBE_SERVICE("EmplaceData");
+    Executed(data.Emplace([](const ExecutionOrder<T> &order) { return order.GetOrderId(); }, std::forward<Args>(args)...), market);
   }
 
   // Get data on an order by ID
   ExecutionOrder<T>& GetData(std::string key) override {
-    return data.at(key);
+    ExecutionOrder<T> *order = data.Get(key);
+    if (!order) {
+      throw std::runtime_error("ExecutionOrder not found for ID: " + key);
+    }
+    return *order;
+  }
+
+  // Get data by order ID, or nullptr if there is none; never throws
+  ExecutionOrder<T>* TryGetData(const std::string &key) noexcept override {
+    return data.Get(key);
+  }
+
+  // Handle of a key, or NO_HANDLE if nothing has been stored for it
+  Handle GetHandle(const std::string &key) const noexcept {
+    return data.Find(key);
+  }
+
+  // Get data by a handle from GetHandle; never throws
+  ExecutionOrder<T>& GetData(Handle handle) noexcept {
+    return data.At(handle);
   }
 
   // Handle incoming messages (data updates)
@@ -105,19 +142,49 @@ public:
     ExecuteOrder(data, BROKERTEC); // Default market
   }
 
+  // Handle incoming orders a Connector hands over
+  void OnMessage(ExecutionOrder<T>&& data) override {
+    ExecuteOrder(std::move(data), BROKERTEC); // Default market
+  }
+
   // Add a listener to the service
   void AddListener(ServiceListener<ExecutionOrder<T>>* listener) override {
-    listeners.push_back(listener);
+    listeners.Add(listener);
+  }
+
+  // Add a listener with a priority and product filter
+  ListenerHandle AddListener(ServiceListener<ExecutionOrder<T>>* listener, const ListenerOptions &options) override {
+    return listeners.Add(listener, options);
+  }
+
+  // Remove a listener registration
+  bool RemoveListener(ListenerHandle handle) override {
+    return listeners.Remove(handle);
   }
 
   // Get all listeners
   const std::vector<ServiceListener<ExecutionOrder<T>>*>& GetListeners() const override {
-    return listeners;
+    return listeners.All();
   }
 
 private:
-  std::map<std::string, ExecutionOrder<T>> data; // Storage for execution orders
-  std::vector<ServiceListener<ExecutionOrder<T>>*> listeners; // List of listeners
+  FlatStore<ExecutionOrder<T>> data; // Execution orders by order ID
+  ListenerRegistry<ExecutionOrder<T>> listeners; // List of listeners
+
+  // Notify listeners of a stored execution order and log it
+  void Executed(ExecutionOrder<T>& order, Market market) {
+    // Notify all listeners about the new execution order
+    for (auto& listener : listeners.For(order.GetProduct().GetProductId())) {
+      SOA_PROBE_LISTENER(listener);
+      listener->ProcessAdd(order);
+    }
+
+    // Log the execution order
+    std::cout << "Executed order: " << order.GetOrderId()
+              << " on market: " << MarketToString(market)
+              << " at price: " << order.GetPrice()
+              << " with quantity: " << order.GetVisibleQuantity() << std::endl;
+  }
 
   // Utility function to convert Market enum to string
   std::string MarketToString(Market market) const {
@@ -130,4 +197,11 @@ private:
   }
 };
 
+// Instantiated once in instantiations.cpp when building against the soa library
+#ifdef SOA_EXTERN_TEMPLATES
+#include "products.hpp"
+SOA_EXTERN_PRODUCT_TEMPLATE(ExecutionOrder)
+SOA_EXTERN_PRODUCT_TEMPLATE(ExecutionService)
+#endif
+
 #endif // EXECUTION_SERVICE_HPP
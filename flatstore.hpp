@@ -0,0 +1,194 @@
+/**
+ * flatstore.hpp
+ * Keyed value store backing the services, pre-sized from capacity hints.
+ *
+ * Values live in fixed-size chunks of contiguous slots, so a value never moves
+ * once stored and references handed to listeners stay valid as the store
+ * grows. A hash index maps each key to a dense handle. Reserve() allocates the
+ * chunks and index buckets for an expected number of keys up front, and Warm()
+ * writes to every page of that reserved memory so the first orders of the
+ * session do not pay for allocation or page faults.
+ */
+#ifndef FLAT_STORE_HPP
+#define FLAT_STORE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Store of values of type V keyed on string identifiers.
+ * Entries are never erased; a handle stays valid for the life of the store.
+ */
+template<typename V>
+class FlatStore
+{
+
+public:
+
+  // Dense index of an entry, in insertion order
+  typedef uint32_t Handle;
+
+  static constexpr Handle NO_HANDLE = static_cast<Handle>(-1);
+
+  // ctor for a store with room for expectedKeys entries
+  explicit FlatStore(size_t expectedKeys = 0) : last(NO_HANDLE) { Reserve(expectedKeys); }
+
+  FlatStore(const FlatStore&) = delete;
+  FlatStore& operator=(const FlatStore&) = delete;
+
+  ~FlatStore() {
+    for (size_t i = 0; i < keys.size(); ++i) At(static_cast<Handle>(i)).~V();
+  }
+
+  // Make room for at least expectedKeys entries without further allocation
+  void Reserve(size_t expectedKeys) {
+    index.reserve(expectedKeys);
+    keys.reserve(expectedKeys);
+    while (Capacity() < expectedKeys) chunks.emplace_back(new Slot[CHUNK_SIZE]);
+  }
+
+  // Handle of a key, or NO_HANDLE if it has not been stored
+  Handle Find(const std::string &key) const noexcept {
+    auto it = index.find(key);
+    return it == index.end() ? NO_HANDLE : it->second;
+  }
+
+  // Value for a key, or nullptr if it has not been stored
+  V* Get(const std::string &key) noexcept {
+    Handle handle = Find(key);
+    return handle == NO_HANDLE ? nullptr : &At(handle);
+  }
+
+  const V* Get(const std::string &key) const noexcept {
+    Handle handle = Find(key);
+    return handle == NO_HANDLE ? nullptr : &At(handle);
+  }
+
+  // Value at a handle returned by Find
+  V& At(Handle handle) noexcept {
+    return *reinterpret_cast<V*>(&chunks[handle / CHUNK_SIZE][handle % CHUNK_SIZE]);
+  }
+
+  const V& At(Handle handle) const noexcept {
+    return *reinterpret_cast<const V*>(&chunks[handle / CHUNK_SIZE][handle % CHUNK_SIZE]);
+  }
+
+  // Store a value under a key, replacing any previous value, and return the stored value
+  V& Upsert(const std::string &key, const V &value) {
+    return Store(key, [&]() -> const V& { return value; }, [&](V &stored) { stored = value; });
+  }
+
+  // Move a value into the store under a key, replacing any previous value
+  V& Upsert(const std::string &key, V &&value) {
+    return Store(key, [&]() -> V&& { return std::move(value); }, [&](V &stored) { stored = std::move(value); });
+  }
+
+  // Construct a value in place from args and store it under keyOf(value). A new
+  // key keeps the value where it was built; an existing key has it moved over
+  // the previous value.
+  template<typename KeyOf, typename... Args>
+  V& Emplace(KeyOf keyOf, Args&&... args) {
+    Handle handle = static_cast<Handle>(keys.size());
+    if (handle == Capacity()) chunks.emplace_back(new Slot[CHUNK_SIZE]);
+    V *built = new (&chunks[handle / CHUNK_SIZE][handle % CHUNK_SIZE]) V(std::forward<Args>(args)...);
+    std::string key;
+    try {
+      key = keyOf(*built);
+    } catch (...) {
+      built->~V();
+      throw;
+    }
+    auto it = index.find(key);
+    if (it != index.end()) {
+      V &stored = At(it->second);
+      stored = std::move(*built);
+      built->~V();
+      last = it->second;
+      return stored;
+    }
+    keys.push_back(std::move(key));
+    index.emplace(keys.back(), handle);
+    last = handle;
+    return *built;
+  }
+
+  // Construct a value from args under a known key, in place if the key is new
+  // and moved over the previous value otherwise
+  template<typename... Args>
+  V& EmplaceAt(const std::string &key, Args&&... args) {
+    return Store(key, [&]() { return V(std::forward<Args>(args)...); }, [&](V &stored) { stored = V(std::forward<Args>(args)...); });
+  }
+
+  // Value for a key, constructed from create() if the key is new
+  template<typename Create>
+  V& FindOrInsert(const std::string &key, Create create) {
+    return Store(key, create, [](V&) {});
+  }
+
+  // Handle of the entry most recently returned by Upsert, Emplace, EmplaceAt or FindOrInsert
+  Handle LastHandle() const { return last; }
+
+  // Keys in insertion order; the position of a key is its handle
+  const std::vector<std::string>& Keys() const { return keys; }
+
+  size_t Size() const { return keys.size(); }
+
+  // Entries that fit in the allocated chunks
+  size_t Capacity() const { return chunks.size() * CHUNK_SIZE; }
+
+  // Write to every page of the allocated chunks so they are faulted in, on the
+  // calling thread's node, before the first insert
+  void Warm() {
+    for (std::unique_ptr<Slot[]> &chunk : chunks) {
+      volatile char *bytes = reinterpret_cast<volatile char*>(chunk.get());
+      for (size_t offset = 0; offset < sizeof(Slot) * CHUNK_SIZE; offset += PAGE_SIZE_HINT) bytes[offset] = bytes[offset];
+    }
+  }
+
+private:
+
+  static const size_t CHUNK_SIZE = 256;
+  static const size_t PAGE_SIZE_HINT = 4096;
+
+  typedef typename std::aligned_storage<sizeof(V), alignof(V)>::type Slot;
+
+  // Insert from create() if the key is new, otherwise apply update to the stored value.
+  // The key is copied before create() runs, since it may refer into the value being moved.
+  template<typename Create, typename Update>
+  V& Store(const std::string &key, Create create, Update update) {
+    auto it = index.find(key);
+    if (it != index.end()) {
+      V &stored = At(it->second);
+      update(stored);
+      last = it->second;
+      return stored;
+    }
+    Handle handle = static_cast<Handle>(keys.size());
+    if (handle == Capacity()) chunks.emplace_back(new Slot[CHUNK_SIZE]);
+    keys.push_back(key);
+    V *stored;
+    try {
+      stored = new (&chunks[handle / CHUNK_SIZE][handle % CHUNK_SIZE]) V(create());
+    } catch (...) {
+      keys.pop_back();
+      throw;
+    }
+    index.emplace(keys.back(), handle);
+    last = handle;
+    return *stored;
+  }
+
+  std::vector<std::unique_ptr<Slot[]>> chunks;
+  std::vector<std::string> keys;
+  std::unordered_map<std::string, Handle> index;
+  Handle last;
+};
+
+#endif // FLAT_STORE_HPP
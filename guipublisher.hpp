@@ -0,0 +1,229 @@
+/**
+ * guipublisher.hpp
+ * Throttled outbound feed of prices to the traders' GUI.
+ *
+ * A GuiPublisher listens to a PricingService and passes on at most one price
+ * every throttle interval, and only the first maxUpdates of them. Time is read
+ * from ProbeClock, so the throttle costs a TSC read rather than a system call.
+ * A price that passes is copied into a fixed-size record in a preallocated
+ * single-producer ring and the pricing thread moves on; a flusher thread, or
+ * Flush() polled by the owner, formats the records as prices.txt journal lines
+ *
+ *   timestamp,productId,mid,bidOfferSpread
+ *
+ * with the timestamp in nanoseconds since the publisher was created. The
+ * pricing thread never waits: a price arriving while the ring is full is
+ * dropped and counted, as is one whose product ID is longer than
+ * GUI_MAX_PRODUCT_ID and so would not fit a record whole.
+ */
+#ifndef GUI_PUBLISHER_HPP
+#define GUI_PUBLISHER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "soa.hpp"
+#include "pricingservice.hpp"
+
+// Longest product ID a GUI record holds
+const size_t GUI_MAX_PRODUCT_ID = 36;
+
+/**
+ * Throttle and buffer sizing of a GuiPublisher.
+ */
+struct GuiPublisherOptions
+{
+  uint64_t throttleMillis = 300;  // minimum time between prices passed on
+  uint64_t maxUpdates = 100;      // prices passed on before the feed stops; 0 for no limit
+  size_t bufferRecords = 4096;    // ring capacity, rounded up to a power of two
+  uint64_t flushMicros = 1000;    // flusher sleep when the ring is empty
+};
+
+/**
+ * Counts kept by a GuiPublisher.
+ */
+struct GuiPublisherStats
+{
+  uint64_t received = 0;   // prices heard from the PricingService
+  uint64_t published = 0;  // prices written into the ring
+  uint64_t throttled = 0;  // prices inside the throttle interval of the last one published
+  uint64_t capped = 0;     // prices after maxUpdates had been published
+  uint64_t dropped = 0;    // prices that found the ring full or had too long a product ID
+  uint64_t written = 0;    // lines flushed to the file
+};
+
+/**
+ * PricingService listener feeding a throttled price file for the GUI.
+ * Type T is the product type.
+ */
+template<typename T>
+class GuiPublisher : public ServiceListener<Price<T>>
+{
+
+public:
+
+  // ctor opening the GUI file for writing, truncating any existing file
+  GuiPublisher(const std::string &path, const GuiPublisherOptions &_options = GuiPublisherOptions()) :
+    options(_options), file(std::fopen(path.c_str(), "w")), buffer(1 << 16), records(RingSize(_options.bufferRecords)),
+    mask(records.size() - 1), head(0), tail(0), running(false) {
+    if (!file) throw std::runtime_error("Unable to open GUI file: " + path);
+    std::setvbuf(file, buffer.data(), _IOFBF, buffer.size());
+    nanosPerTick = ProbeClock::NanosPerTick();
+    throttleTicks = static_cast<uint64_t>(options.throttleMillis * 1e6 / nanosPerTick);
+    start = ProbeClock::Now();
+    lastPublished = 0;
+    anyPublished = false;
+  }
+
+  ~GuiPublisher() {
+    Stop();
+    std::fclose(file);
+  }
+
+  GuiPublisher(const GuiPublisher&) = delete;
+  GuiPublisher& operator=(const GuiPublisher&) = delete;
+
+  void ProcessAdd(Price<T> &data) override { ProcessUpdate(data); }
+
+  void ProcessRemove(Price<T> &) override {}
+
+  // Pass a price on unless it is throttled, capped or finds the ring full
+  void ProcessUpdate(Price<T> &data) override {
+    SOA_PROBE_SERVICE("ProcessUpdate");
+    Count(received);
+    const uint64_t publishedSoFar = published.load(std::memory_order_relaxed);
+    if (options.maxUpdates && publishedSoFar >= options.maxUpdates) {
+      Count(capped);
+      return;
+    }
+    const uint64_t now = ProbeClock::Now();
+    if (anyPublished && now - lastPublished < throttleTicks) {
+      Count(throttled);
+      return;
+    }
+    const string &productId = data.GetProduct().GetProductId();
+    const uint64_t at = head.load(std::memory_order_relaxed);
+    if (productId.size() > GUI_MAX_PRODUCT_ID || at - tail.load(std::memory_order_acquire) == records.size()) {
+      Count(dropped);
+      return;
+    }
+    GuiRecord &record = records[at & mask];
+    record.timestamp = static_cast<uint64_t>((now - start) * nanosPerTick);
+    record.mid = data.GetMid();
+    record.bidOfferSpread = data.GetBidOfferSpread();
+    record.productIdLength = static_cast<uint32_t>(productId.size());
+    std::memcpy(record.productId, productId.data(), record.productIdLength);
+    head.store(at + 1, std::memory_order_release);
+    published.store(publishedSoFar + 1, std::memory_order_relaxed);
+    lastPublished = now;
+    anyPublished = true;
+  }
+
+  // Start a flusher thread writing records out as they arrive. onThreadStart,
+  // if given, runs first on the flusher, e.g. to pin it with a ThreadTopology.
+  void Start(std::function<void()> onThreadStart = std::function<void()>()) {
+    if (flusher.joinable()) return;
+    running.store(true, std::memory_order_relaxed);
+    flusher = std::thread([this, onThreadStart]() {
+      if (onThreadStart) onThreadStart();
+      while (running.load(std::memory_order_acquire)) {
+        if (!Flush()) std::this_thread::sleep_for(std::chrono::microseconds(options.flushMicros));
+      }
+      Flush();
+    });
+  }
+
+  // Stop the flusher thread once it has written everything published so far
+  void Stop() {
+    running.store(false, std::memory_order_release);
+    if (flusher.joinable()) flusher.join();
+    Flush();
+  }
+
+  // Write out every record in the ring and flush the file; returns the lines
+  // written. Call from the flusher, or from the owner when it is not running.
+  size_t Flush() {
+    const uint64_t to = head.load(std::memory_order_acquire);
+    uint64_t from = tail.load(std::memory_order_relaxed);
+    const size_t lines = static_cast<size_t>(to - from);
+    if (!lines) return 0;
+    for (; from != to; ++from) {
+      const GuiRecord &record = records[from & mask];
+      std::fprintf(file, "%llu,%.*s,%.8f,%.8f\n", static_cast<unsigned long long>(record.timestamp), static_cast<int>(record.productIdLength),
+                   record.productId, record.mid, record.bidOfferSpread);
+      tail.store(from + 1, std::memory_order_release);
+    }
+    std::fflush(file);
+    written.fetch_add(lines, std::memory_order_relaxed);
+    return lines;
+  }
+
+  // Snapshot of the counters; safe from any thread
+  GuiPublisherStats GetStats() const {
+    GuiPublisherStats stats;
+    stats.received = received.load(std::memory_order_relaxed);
+    stats.published = published.load(std::memory_order_relaxed);
+    stats.throttled = throttled.load(std::memory_order_relaxed);
+    stats.capped = capped.load(std::memory_order_relaxed);
+    stats.dropped = dropped.load(std::memory_order_relaxed);
+    stats.written = written.load(std::memory_order_relaxed);
+    return stats;
+  }
+
+  // Get the throttle and buffer sizing
+  const GuiPublisherOptions& GetOptions() const { return options; }
+
+private:
+
+  // One price passed on, as copied by the pricing thread
+  struct alignas(64) GuiRecord
+  {
+    uint64_t timestamp;
+    double mid;
+    double bidOfferSpread;
+    uint32_t productIdLength;
+    char productId[GUI_MAX_PRODUCT_ID];  // longer IDs are refused, never truncated
+  };
+
+  GuiPublisherOptions options;
+  std::FILE *file;
+  std::vector<char> buffer;
+  std::vector<GuiRecord> records;
+  const uint64_t mask;
+  alignas(64) std::atomic<uint64_t> head;  // next record the pricing thread writes
+  alignas(64) std::atomic<uint64_t> tail;  // next record the flusher writes out
+  alignas(64) std::atomic<uint64_t> received{0};
+  std::atomic<uint64_t> published{0};
+  std::atomic<uint64_t> throttled{0};
+  std::atomic<uint64_t> capped{0};
+  std::atomic<uint64_t> dropped{0};
+  std::atomic<uint64_t> written{0};
+  double nanosPerTick;
+  uint64_t throttleTicks;
+  uint64_t start;
+  uint64_t lastPublished;
+  bool anyPublished;
+  std::atomic<bool> running;
+  std::thread flusher;
+
+  // Bump a counter owned by the pricing thread without a locked instruction
+  static void Count(std::atomic<uint64_t> &counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+
+  static size_t RingSize(size_t requested) {
+    size_t size = 1;
+    while (size < requested) size <<= 1;
+    return size;
+  }
+};
+
+#endif // GUI_PUBLISHER_HPP
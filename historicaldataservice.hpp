@@ -8,10 +8,11 @@
 #define HISTORICAL_DATA_SERVICE_HPP
 
 #include <string>
-#include <map>
 #include <vector>
 #include <iostream>
+#include <stdexcept>
 #include "soa.hpp"
+#include "flatstore.hpp"
 
 /**
  * Service for processing and persisting historical data to a persistent store.
@@ -24,30 +25,61 @@ class HistoricalDataService : public Service<std::string, T>
 
 public:
 
-  // Constructor
-  HistoricalDataService() {}
+  // Dense index of an entry, stable for the life of the service
+  typedef typename FlatStore<T>::Handle Handle;
+
+  static constexpr Handle NO_HANDLE = FlatStore<T>::NO_HANDLE;
+
+  // ctor pre-sizing the store for the expected number of persist keys
+  explicit HistoricalDataService(size_t expectedKeys = 0, size_t expectedListeners = 0) : dataStore(expectedKeys) {
+    listeners.Reserve(expectedListeners);
+  }
+
+  // Touch every page of the pre-sized store before the open
+  void WarmUp() { dataStore.Warm(); }
 
   // Persist data to a store
   void PersistData(std::string persistKey, const T& data) {
+    SOA_PROBE_SERVICE("PersistData");
     // Store the data
-    dataStore[persistKey] = data;
+    Persisted(persistKey, dataStore.Upsert(persistKey, data));
+  }
 
-    // Notify all listeners
-    for (auto& listener : listeners) {
-      listener->ProcessAdd(dataStore[persistKey]);
-    }
+  // Persist data the caller hands over, moving it into the store
+  void PersistData(std::string persistKey, T&& data) {
+    SOA_PROBE_SERVICE("PersistData");
+    Persisted(persistKey, dataStore.Upsert(persistKey, std::move(data)));
+  }
 
-    // Log persistence
-    std::cout << "Persisted data for key: " << persistKey << std::endl;
+  // Persist data constructed in the store from T's ctor arguments
+  template<typename... Args>
+  void EmplaceData(std::string persistKey, Args&&... args) {
+    SOA_PROBE_SERVICE("EmplaceData");
+    Persisted(persistKey, dataStore.EmplaceAt(persistKey, std::forward<Args>(args)...));
   }
 
   // Get data by key
   T& GetData(std::string key) override {
-    if (dataStore.find(key) != dataStore.end()) {
-      return dataStore[key];
-    } else {
+    T *stored = dataStore.Get(key);
+    if (!stored) {
       throw std::runtime_error("Data not found for key: " + key);
     }
+    return *stored;
+  }
+
+  // Get data by key, or nullptr if there is none; never throws
+  T* TryGetData(const std::string &key) noexcept override {
+    return dataStore.Get(key);
+  }
+
+  // Handle of a key, or NO_HANDLE if nothing has been stored for it
+  Handle GetHandle(const std::string &key) const noexcept {
+    return dataStore.Find(key);
+  }
+
+  // Get data by a handle from GetHandle; never throws
+  T& GetData(Handle handle) noexcept {
+    return dataStore.At(handle);
   }
 
   // OnMessage callback (not typically used for historical data but can be overridden)
@@ -57,19 +89,45 @@ public:
     PersistData(key, data);
   }
 
+  // Data a Connector hands over takes the copying OnMessage above; persist by
+  // key with PersistData(key, T&&) to move it into the store
+  using Service<std::string, T>::OnMessage;
+
   // Add a listener to the service
   void AddListener(ServiceListener<T>* listener) override {
-    listeners.push_back(listener);
+    listeners.Add(listener);
+  }
+
+  // Add a listener with a priority and product filter
+  ListenerHandle AddListener(ServiceListener<T>* listener, const ListenerOptions &options) override {
+    return listeners.Add(listener, options);
+  }
+
+  // Remove a listener registration
+  bool RemoveListener(ListenerHandle handle) override {
+    return listeners.Remove(handle);
   }
 
   // Get all listeners
   const std::vector<ServiceListener<T>*>& GetListeners() const override {
-    return listeners;
+    return listeners.All();
   }
 
 private:
-  std::map<std::string, T> dataStore; // Map to store data by key
-  std::vector<ServiceListener<T>*> listeners; // Listeners to notify on persistence
+  FlatStore<T> dataStore; // Persisted data by key
+  ListenerRegistry<T> listeners; // Listeners to notify on persistence
+
+  // Notify listeners of stored data and log it
+  void Persisted(const std::string &persistKey, T &stored) {
+    // Notify all listeners
+    for (auto& listener : listeners.For(persistKey)) {
+      SOA_PROBE_LISTENER(listener);
+      listener->ProcessAdd(stored);
+    }
+
+    // Log persistence
+    std::cout << "Persisted data for key: " << persistKey << std::endl;
+  }
 };
 
 #endif // HISTORICAL_DATA_SERVICE_HPP
@@ -7,7 +7,9 @@
 #ifndef INQUIRY_SERVICE_HPP
 #define INQUIRY_SERVICE_HPP
 
+#include <stdexcept>
 #include "soa.hpp"
+#include "flatstore.hpp"
 #include "tradebookingservice.hpp"
 
 // Various inquiry states
@@ -26,6 +28,7 @@ public:
   // ctor for an inquiry
   Inquiry(std::string _inquiryId, const T &_product, Side _side, long _quantity, double _price, InquiryState _state) :
     inquiryId(_inquiryId), product(_product), side(_side), quantity(_quantity), price(_price), state(_state) {}
+  Inquiry() : side(BUY), quantity(0), price(0.0), state(RECEIVED) {}
 
   // Get the inquiry ID
   const std::string& GetInquiryId() const { return inquiryId; }
@@ -72,62 +75,124 @@ class InquiryService : public Service<std::string, Inquiry<T>>
 
 public:
 
+  // Dense index of an entry, stable for the life of the service
+  typedef typename FlatStore<Inquiry<T>>::Handle Handle;
+
+  static constexpr Handle NO_HANDLE = FlatStore<Inquiry<T>>::NO_HANDLE;
+
+  // ctor pre-sizing the inquiry store and listener lists
+  explicit InquiryService(const ServiceCapacity &capacity = ServiceCapacity()) : dataStore(capacity.inquiries) {
+    listeners.Reserve(capacity.listeners);
+  }
+
+  // Touch every page of the pre-sized store before the open
+  void WarmUp() { dataStore.Warm(); }
+
   // Send a quote back to the client
   void SendQuote(const std::string &inquiryId, double price) {
-    if (dataStore.find(inquiryId) == dataStore.end()) {
-      throw std::runtime_error("Inquiry not found for ID: " + inquiryId);
-    }
-
-    auto& inquiry = dataStore[inquiryId];
+    SOA_PROBE_SERVICE("SendQuote");
+    auto& inquiry = GetData(inquiryId);
     inquiry.SetPrice(price);
     inquiry.SetState(QUOTED);
-    for (auto& listener : listeners) {
+    for (auto& listener : listeners.For(inquiry.GetProduct().GetProductId())) {
+      SOA_PROBE_LISTENER(listener);
       listener->ProcessUpdate(inquiry);
     }
   }
 
   // Reject an inquiry from the client
   void RejectInquiry(const std::string &inquiryId) {
-    if (dataStore.find(inquiryId) == dataStore.end()) {
-      throw std::runtime_error("Inquiry not found for ID: " + inquiryId);
-    }
-
-    auto& inquiry = dataStore[inquiryId];
+    SOA_PROBE_SERVICE("RejectInquiry");
+    auto& inquiry = GetData(inquiryId);
     inquiry.SetState(REJECTED);
-    for (auto& listener : listeners) {
+    for (auto& listener : listeners.For(inquiry.GetProduct().GetProductId())) {
+      SOA_PROBE_LISTENER(listener);
       listener->ProcessUpdate(inquiry);
     }
   }
 
   // Add an inquiry to the service
   void OnMessage(Inquiry<T>& inquiry) override {
-    dataStore[inquiry.GetInquiryId()] = inquiry;
-    for (auto& listener : listeners) {
-      listener->ProcessAdd(inquiry);
-    }
+    SOA_PROBE_SERVICE("OnMessage");
+    NotifyAdd(dataStore.Upsert(inquiry.GetInquiryId(), inquiry));
+  }
+
+  // Add an inquiry a Connector hands over, moving it into the store
+  void OnMessage(Inquiry<T>&& inquiry) override {
+    SOA_PROBE_SERVICE("OnMessage");
+    std::string inquiryId = inquiry.GetInquiryId();
+    NotifyAdd(dataStore.Upsert(inquiryId, std::move(inquiry)));
+  }
+
+  // Add an inquiry constructed in the store from Inquiry<T> ctor arguments
+  template<typename... Args>
+  void EmplaceData(Args&&... args) {
+    SOA_PROBE_SERVICE("EmplaceData");
+    NotifyAdd(dataStore.Emplace([](const Inquiry<T> &inquiry) { return inquiry.GetInquiryId(); }, std::forward<Args>(args)...));
   }
 
   // Get data by inquiry ID
   Inquiry<T>& GetData(std::string inquiryId) override {
-    if (dataStore.find(inquiryId) == dataStore.end()) {
+    Inquiry<T> *inquiry = dataStore.Get(inquiryId);
+    if (!inquiry) {
       throw std::runtime_error("Inquiry not found for ID: " + inquiryId);
     }
-    return dataStore[inquiryId];
+    return *inquiry;
+  }
+
+  // Get data by inquiry ID, or nullptr if there is none; never throws
+  Inquiry<T>* TryGetData(const std::string &inquiryId) noexcept override {
+    return dataStore.Get(inquiryId);
+  }
+
+  // Handle of a key, or NO_HANDLE if nothing has been stored for it
+  Handle GetHandle(const std::string &inquiryId) const noexcept {
+    return dataStore.Find(inquiryId);
+  }
+
+  // Get data by a handle from GetHandle; never throws
+  Inquiry<T>& GetData(Handle handle) noexcept {
+    return dataStore.At(handle);
   }
 
   // Add a listener to the service
   void AddListener(ServiceListener<Inquiry<T>>* listener) override {
-    listeners.push_back(listener);
+    listeners.Add(listener);
+  }
+
+  // Add a listener with a priority and product filter
+  ListenerHandle AddListener(ServiceListener<Inquiry<T>>* listener, const ListenerOptions &options) override {
+    return listeners.Add(listener, options);
+  }
+
+  // Remove a listener registration
+  bool RemoveListener(ListenerHandle handle) override {
+    return listeners.Remove(handle);
   }
 
   // Get all listeners
   const std::vector<ServiceListener<Inquiry<T>>*>& GetListeners() const override {
-    return listeners;
+    return listeners.All();
   }
 
 private:
-  std::map<std::string, Inquiry<T>> dataStore; // Map to store inquiries by ID
-  std::vector<ServiceListener<Inquiry<T>>*> listeners; // Listeners to notify
+  FlatStore<Inquiry<T>> dataStore; // Inquiries by inquiry ID
+  ListenerRegistry<Inquiry<T>> listeners; // Listeners to notify
+
+  // Notify the listeners for the inquiry's product of a stored inquiry
+  void NotifyAdd(Inquiry<T> &stored) {
+    for (auto& listener : listeners.For(stored.GetProduct().GetProductId())) {
+      SOA_PROBE_LISTENER(listener);
+      listener->ProcessAdd(stored);
+    }
+  }
 };
 
+// Instantiated once in instantiations.cpp when building against the soa library
+#ifdef SOA_EXTERN_TEMPLATES
+#include "products.hpp"
+SOA_EXTERN_PRODUCT_TEMPLATE(Inquiry)
+SOA_EXTERN_PRODUCT_TEMPLATE(InquiryService)
+#endif
+
 #endif // INQUIRY_SERVICE_HPP
@@ -0,0 +1,37 @@
+/**
+ * instantiations.cpp
+ * The single explicit instantiation of every service template for Bond and
+ * IRSwap, and of the Bond pipeline. Every other translation unit sees these
+ * as extern templates (see SOA_EXTERN_PRODUCT_TEMPLATE in soa.hpp).
+ */
+#include "products.hpp"
+#include "pipeline.hpp"
+
+#define SOA_INSTANTIATE_PRODUCT_TEMPLATE(Template) \
+  template class Template<Bond>; \
+  template class Template<IRSwap>;
+
+SOA_INSTANTIATE_PRODUCT_TEMPLATE(OrderBook)
+SOA_INSTANTIATE_PRODUCT_TEMPLATE(MarketDataService)
+SOA_INSTANTIATE_PRODUCT_TEMPLATE(Price)
+SOA_INSTANTIATE_PRODUCT_TEMPLATE(PricingService)
+SOA_INSTANTIATE_PRODUCT_TEMPLATE(PriceStream)
+SOA_INSTANTIATE_PRODUCT_TEMPLATE(StreamingService)
+SOA_INSTANTIATE_PRODUCT_TEMPLATE(ExecutionOrder)
+SOA_INSTANTIATE_PRODUCT_TEMPLATE(ExecutionService)
+SOA_INSTANTIATE_PRODUCT_TEMPLATE(Trade)
+SOA_INSTANTIATE_PRODUCT_TEMPLATE(TradeBookingService)
+SOA_INSTANTIATE_PRODUCT_TEMPLATE(Position)
+SOA_INSTANTIATE_PRODUCT_TEMPLATE(PositionService)
+SOA_INSTANTIATE_PRODUCT_TEMPLATE(PV01)
+SOA_INSTANTIATE_PRODUCT_TEMPLATE(BucketedSector)
+SOA_INSTANTIATE_PRODUCT_TEMPLATE(RiskService)
+SOA_INSTANTIATE_PRODUCT_TEMPLATE(Inquiry)
+SOA_INSTANTIATE_PRODUCT_TEMPLATE(InquiryService)
+
+template class HistoricalDataService<Position<Bond>>;
+template class HistoricalDataService<PV01<Bond>>;
+template class HistoricalDataService<ExecutionOrder<Bond>>;
+template class HistoricalDataService<PriceStream<Bond>>;
+template class HistoricalDataService<Inquiry<Bond>>;
+template class TradingPipeline<Bond>;
@@ -0,0 +1,468 @@
+/**
+ * instrumentation.hpp
+ * Opt-in latency probes for service entry points and listener callbacks.
+ *
+ * Build with SOA_INSTRUMENTATION defined to enable. Otherwise the probe
+ * macros expand to nothing and ServiceListener carries no extra state.
+ *
+ * Each probe times its scope with the CPU timestamp counter and records the
+ * elapsed ticks into a log-linear (HDR-style) histogram owned by the calling
+ * thread, so recording never takes a lock. ProbeSnapshot() merges every
+ * thread's histograms into nanosecond percentiles.
+ */
+#ifndef INSTRUMENTATION_HPP
+#define INSTRUMENTATION_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <typeinfo>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#if defined(__GNUG__)
+#include <cxxabi.h>
+#endif
+
+/**
+ * Log-linear histogram of non-negative integer samples.
+ * Values below 32 get their own bucket; above that each power of two is split
+ * into 32 linear sub-buckets, bounding the relative error to about 3%.
+ */
+class LatencyHistogram
+{
+
+public:
+
+  static const int SUB_BUCKET_BITS = 5;
+  static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+  static const int BUCKETS = SUB_BUCKETS + (64 - SUB_BUCKET_BITS) * SUB_BUCKETS;
+
+  LatencyHistogram() : counts(BUCKETS, 0), total(0), sum(0), minimum(UINT64_MAX), maximum(0) {}
+
+  // Bucket index for a value
+  static int BucketOf(uint64_t value) {
+    if (value < static_cast<uint64_t>(SUB_BUCKETS)) return static_cast<int>(value);
+    int exponent = 63 - __builtin_clzll(value);
+    int mantissa = static_cast<int>((value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+    return SUB_BUCKETS + (exponent - SUB_BUCKET_BITS) * SUB_BUCKETS + mantissa;
+  }
+
+  // Smallest value that falls into a bucket
+  static uint64_t LowerBound(int bucket) {
+    if (bucket < SUB_BUCKETS) return bucket;
+    int exponent = (bucket - SUB_BUCKETS) / SUB_BUCKETS + SUB_BUCKET_BITS;
+    uint64_t mantissa = (bucket - SUB_BUCKETS) % SUB_BUCKETS;
+    return (1ULL << exponent) | (mantissa << (exponent - SUB_BUCKET_BITS));
+  }
+
+  // Width of a bucket
+  static uint64_t Width(int bucket) {
+    if (bucket < SUB_BUCKETS) return 1;
+    int exponent = (bucket - SUB_BUCKETS) / SUB_BUCKETS + SUB_BUCKET_BITS;
+    return 1ULL << (exponent - SUB_BUCKET_BITS);
+  }
+
+  // Record one sample
+  void Record(uint64_t value) { Add(BucketOf(value), 1, value, value, value); }
+
+  // Add a pre-bucketed count, used when merging
+  void Add(int bucket, uint64_t count, uint64_t valueSum, uint64_t valueMin, uint64_t valueMax) {
+    if (count == 0) return;
+    counts[bucket] += count;
+    total += count;
+    sum += valueSum;
+    minimum = std::min(minimum, valueMin);
+    maximum = std::max(maximum, valueMax);
+  }
+
+  // Merge another histogram into this one
+  void Merge(const LatencyHistogram &other) {
+    for (int i = 0; i < BUCKETS; ++i) counts[i] += other.counts[i];
+    total += other.total;
+    sum += other.sum;
+    minimum = std::min(minimum, other.minimum);
+    maximum = std::max(maximum, other.maximum);
+  }
+
+  // Value at a quantile in [0, 1], reported as the midpoint of its bucket
+  uint64_t ValueAt(double quantile) const {
+    if (total == 0) return 0;
+    uint64_t rank = static_cast<uint64_t>(quantile * total);
+    if (rank >= total) rank = total - 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; ++i) {
+      seen += counts[i];
+      if (seen > rank) return std::min(maximum, std::max(minimum, LowerBound(i) + Width(i) / 2));
+    }
+    return maximum;
+  }
+
+  uint64_t GetCount() const { return total; }
+  uint64_t GetSum() const { return sum; }
+  uint64_t GetMin() const { return total ? minimum : 0; }
+  uint64_t GetMax() const { return maximum; }
+  uint64_t GetBucketCount(int bucket) const { return counts[bucket]; }
+
+private:
+  std::vector<uint64_t> counts;
+  uint64_t total;
+  uint64_t sum;
+  uint64_t minimum;
+  uint64_t maximum;
+};
+
+/**
+ * Cheap monotonic tick source: rdtsc on x86, steady_clock nanoseconds elsewhere.
+ */
+class ProbeClock
+{
+
+public:
+
+  // Current tick count
+  static uint64_t Now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+  }
+
+  // Nanoseconds per tick, calibrated once against steady_clock
+  static double NanosPerTick() {
+    static const double ratio = Calibrate();
+    return ratio;
+  }
+
+private:
+
+  static double Calibrate() {
+#if defined(__x86_64__) || defined(__i386__)
+    auto wallStart = std::chrono::steady_clock::now();
+    uint64_t tickStart = Now();
+    while (std::chrono::steady_clock::now() - wallStart < std::chrono::milliseconds(10)) {}
+    double nanos = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - wallStart).count();
+    uint64_t ticks = Now() - tickStart;
+    return ticks ? nanos / ticks : 1.0;
+#else
+    return 1.0;
+#endif
+  }
+};
+
+// What a probe is attached to
+enum ProbeKind { PROBE_SERVICE, PROBE_LISTENER };
+
+/**
+ * Single-writer histogram owned by one thread. Buckets are relaxed atomics so
+ * that a snapshot taken from another thread is race-free without slowing the
+ * owner down.
+ */
+class ProbeHistogram
+{
+
+public:
+
+  ProbeHistogram() : counts(new std::atomic<uint64_t>[LatencyHistogram::BUCKETS]), sum(0), minimum(UINT64_MAX), maximum(0) {
+    Clear();
+  }
+
+  // Zero every count in place. Safe from any thread: a sample the owner is
+  // recording at the same moment may survive the clear, but memory stays valid.
+  void Clear() {
+    for (int i = 0; i < LatencyHistogram::BUCKETS; ++i) counts[i].store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    minimum.store(UINT64_MAX, std::memory_order_relaxed);
+    maximum.store(0, std::memory_order_relaxed);
+  }
+
+  // Record one sample; only ever called by the owning thread
+  void Record(uint64_t ticks) {
+    std::atomic<uint64_t> &count = counts[LatencyHistogram::BucketOf(ticks)];
+    count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    sum.store(sum.load(std::memory_order_relaxed) + ticks, std::memory_order_relaxed);
+    if (ticks < minimum.load(std::memory_order_relaxed)) minimum.store(ticks, std::memory_order_relaxed);
+    if (ticks > maximum.load(std::memory_order_relaxed)) maximum.store(ticks, std::memory_order_relaxed);
+  }
+
+  // Merge the current contents into a plain histogram
+  void MergeInto(LatencyHistogram &histogram) const {
+    uint64_t valueSum = sum.load(std::memory_order_relaxed);
+    uint64_t valueMin = minimum.load(std::memory_order_relaxed);
+    uint64_t valueMax = maximum.load(std::memory_order_relaxed);
+    bool first = true;
+    for (int i = 0; i < LatencyHistogram::BUCKETS; ++i) {
+      uint64_t count = counts[i].load(std::memory_order_relaxed);
+      if (count == 0) continue;
+      histogram.Add(i, count, first ? valueSum : 0, valueMin, valueMax);
+      first = false;
+    }
+  }
+
+private:
+  std::unique_ptr<std::atomic<uint64_t>[]> counts;
+  std::atomic<uint64_t> sum;
+  std::atomic<uint64_t> minimum;
+  std::atomic<uint64_t> maximum;
+};
+
+/**
+ * Latency statistics for one probe, merged across threads and in nanoseconds.
+ */
+struct ProbeStats
+{
+  std::string name;
+  ProbeKind kind;
+  uint64_t count;
+  double minNs;
+  double p50Ns;
+  double p99Ns;
+  double p999Ns;
+  double maxNs;
+  double meanNs;
+  LatencyHistogram ticks;
+};
+
+class ProbeTable;
+
+/**
+ * Process-wide registry of probe names and of every thread's ProbeTable.
+ */
+class ProbeRegistry
+{
+
+public:
+
+  static ProbeRegistry& Instance() {
+    static ProbeRegistry registry;
+    return registry;
+  }
+
+  // Register a probe on a service entry point
+  int RegisterService(const std::type_info &serviceType, const std::string &entryPoint) {
+    return Register(Demangle(serviceType) + "::" + entryPoint, PROBE_SERVICE);
+  }
+
+  // Register a probe on one listener instance
+  int RegisterListener(const std::type_info &listenerType) {
+    return Register(Demangle(listenerType), PROBE_LISTENER);
+  }
+
+  // Merge all threads' histograms into per-probe statistics
+  std::vector<ProbeStats> Snapshot();
+
+  // Clear every recorded sample
+  void Reset();
+
+private:
+  friend class ProbeTable;
+
+  struct ProbeInfo
+  {
+    std::string name;
+    ProbeKind kind;
+  };
+
+  std::mutex mutex;
+  std::vector<ProbeInfo> probes;
+  std::vector<ProbeTable*> tables;
+  std::vector<LatencyHistogram> retired;
+
+  int Register(const std::string &name, ProbeKind kind) {
+    std::lock_guard<std::mutex> lock(mutex);
+    probes.push_back(ProbeInfo{ name, kind });
+    retired.emplace_back();
+    return static_cast<int>(probes.size() - 1);
+  }
+
+  static std::string Demangle(const std::type_info &type) {
+#if defined(__GNUG__)
+    int status = 0;
+    char *demangled = abi::__cxa_demangle(type.name(), nullptr, nullptr, &status);
+    if (status == 0 && demangled) {
+      std::string name(demangled);
+      std::free(demangled);
+      return name;
+    }
+#endif
+    return type.name();
+  }
+};
+
+/**
+ * One thread's histograms, indexed by probe id. Grown only by the owning
+ * thread and only under the registry lock, so snapshots can walk it safely.
+ */
+class ProbeTable
+{
+
+public:
+
+  ProbeTable() {
+    ProbeRegistry &registry = ProbeRegistry::Instance();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.tables.push_back(this);
+  }
+
+  // Fold this thread's samples into the registry before the thread goes away
+  ~ProbeTable() {
+    ProbeRegistry &registry = ProbeRegistry::Instance();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (size_t id = 0; id < histograms.size(); ++id) {
+      if (histograms[id]) histograms[id]->MergeInto(registry.retired[id]);
+    }
+    registry.tables.erase(std::find(registry.tables.begin(), registry.tables.end(), this));
+  }
+
+  // Record a sample for a probe
+  void Record(int id, uint64_t ticks) {
+    if (static_cast<size_t>(id) >= histograms.size() || !histograms[id]) Grow(id);
+    histograms[id]->Record(ticks);
+  }
+
+  // The calling thread's table
+  static ProbeTable& Local() {
+    thread_local ProbeTable table;
+    return table;
+  }
+
+private:
+  friend class ProbeRegistry;
+
+  std::vector<std::unique_ptr<ProbeHistogram>> histograms;
+
+  void Grow(int id) {
+    std::lock_guard<std::mutex> lock(ProbeRegistry::Instance().mutex);
+    if (static_cast<size_t>(id) >= histograms.size()) histograms.resize(id + 1);
+    histograms[id].reset(new ProbeHistogram());
+  }
+};
+
+inline std::vector<ProbeStats> ProbeRegistry::Snapshot() {
+  double nanosPerTick = ProbeClock::NanosPerTick();
+  std::lock_guard<std::mutex> lock(mutex);
+  std::vector<ProbeStats> stats;
+  for (size_t id = 0; id < probes.size(); ++id) {
+    LatencyHistogram merged = retired[id];
+    for (ProbeTable *table : tables) {
+      if (id < table->histograms.size() && table->histograms[id]) table->histograms[id]->MergeInto(merged);
+    }
+    if (merged.GetCount() == 0) continue;
+    ProbeStats probe{ probes[id].name, probes[id].kind, merged.GetCount(),
+      merged.GetMin() * nanosPerTick, merged.ValueAt(0.50) * nanosPerTick, merged.ValueAt(0.99) * nanosPerTick,
+      merged.ValueAt(0.999) * nanosPerTick, merged.GetMax() * nanosPerTick,
+      static_cast<double>(merged.GetSum()) / merged.GetCount() * nanosPerTick, merged };
+    stats.push_back(probe);
+  }
+  return stats;
+}
+
+inline void ProbeRegistry::Reset() {
+  std::lock_guard<std::mutex> lock(mutex);
+  for (LatencyHistogram &histogram : retired) histogram = LatencyHistogram();
+  for (ProbeTable *table : tables) {
+    for (std::unique_ptr<ProbeHistogram> &histogram : table->histograms) {
+      // Owners record without the lock, so histograms are cleared rather than replaced
+      if (histogram) histogram->Clear();
+    }
+  }
+}
+
+/**
+ * Times its own lifetime and records the result against a probe id.
+ */
+class ProbeScope
+{
+
+public:
+
+  explicit ProbeScope(int _id) : id(_id), start(ProbeClock::Now()) {}
+
+  ~ProbeScope() { ProbeTable::Local().Record(id, ProbeClock::Now() - start); }
+
+  ProbeScope(const ProbeScope&) = delete;
+  ProbeScope& operator=(const ProbeScope&) = delete;
+
+private:
+  int id;
+  uint64_t start;
+};
+
+/**
+ * Per-listener probe id, registered lazily on first dispatch.
+ * Copies start unregistered so that a copied listener gets its own histogram.
+ */
+class ProbeSlot
+{
+
+public:
+
+  ProbeSlot() : id(-1) {}
+  ProbeSlot(const ProbeSlot&) : id(-1) {}
+  ProbeSlot& operator=(const ProbeSlot&) { return *this; }
+
+  // Probe id for a listener, registering it on first use
+  int Get(const std::type_info &listenerType) {
+    int current = id.load(std::memory_order_acquire);
+    if (current >= 0) return current;
+    int registered = ProbeRegistry::Instance().RegisterListener(listenerType);
+    if (id.compare_exchange_strong(current, registered, std::memory_order_acq_rel)) return registered;
+    return current;
+  }
+
+private:
+  std::atomic<int> id;
+};
+
+// Merged statistics for every probe that has recorded at least one sample
+inline std::vector<ProbeStats> ProbeSnapshot() {
+  return ProbeRegistry::Instance().Snapshot();
+}
+
+// Write a probe snapshot as a JSON array
+inline void DumpProbes(std::ostream &out, const std::vector<ProbeStats> &stats) {
+  out << "[\n";
+  for (size_t i = 0; i < stats.size(); ++i) {
+    const ProbeStats &s = stats[i];
+    out << "  {\"name\": \"" << s.name << "\", \"kind\": \"" << (s.kind == PROBE_SERVICE ? "service" : "listener")
+        << "\", \"count\": " << s.count << ", \"latency_ns\": {\"min\": " << s.minNs << ", \"p50\": " << s.p50Ns
+        << ", \"p99\": " << s.p99Ns << ", \"p99.9\": " << s.p999Ns << ", \"max\": " << s.maxNs << ", \"mean\": " << s.meanNs << "}}"
+        << (i + 1 < stats.size() ? ",\n" : "\n");
+  }
+  out << "]\n";
+}
+
+#define SOA_PROBE_CONCAT_INNER(a, b) a##b
+#define SOA_PROBE_CONCAT(a, b) SOA_PROBE_CONCAT_INNER(a, b)
+
+#ifdef SOA_INSTRUMENTATION
+
+// Time the rest of the enclosing service entry point
+#define SOA_PROBE_SERVICE(entryPoint) \
+  static const int SOA_PROBE_CONCAT(soaProbeId, __LINE__) = \
+    ProbeRegistry::Instance().RegisterService(typeid(typename std::remove_reference<decltype(*this)>::type), entryPoint); \
+  ProbeScope SOA_PROBE_CONCAT(soaProbeScope, __LINE__)(SOA_PROBE_CONCAT(soaProbeId, __LINE__))
+
+// Time the rest of the enclosing scope against a listener's histogram
+#define SOA_PROBE_LISTENER(listener) \
+  ProbeScope SOA_PROBE_CONCAT(soaProbeScope, __LINE__)((listener)->probeSlot.Get(typeid(*(listener))))
+
+#else
+
+#define SOA_PROBE_SERVICE(entryPoint) ((void)0)
+#define SOA_PROBE_LISTENER(listener) ((void)0)
+
+#endif // SOA_INSTRUMENTATION
+
+#endif // INSTRUMENTATION_HPP
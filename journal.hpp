@@ -0,0 +1,312 @@
+/**
+ * journal.hpp
+ * Text journal formats for recorded order books, prices, trades and inquiries.
+ *
+ * Each journal is a plain text file with one comma-separated event per line,
+ * prefixed by the event timestamp in nanoseconds since the start of the session:
+ *
+ *   marketdata.txt  timestamp,productId,depth,bidPrice,bidQuantity,...,offerPrice,offerQuantity,...
+ *   prices.txt      timestamp,productId,mid,bidOfferSpread
+ *   trades.txt      timestamp,productId,tradeId,price,book,quantity,side
+ *   inquiries.txt   timestamp,inquiryId,productId,side,quantity,price,state
+ *
+ * A journal may instead be written as a block journal (blockcompression.hpp)
+ * named with BLOCK_JOURNAL_SUFFIX appended, holding the same lines compressed
+ * in blocks with a timestamp index for seeking.
+ */
+#ifndef JOURNAL_HPP
+#define JOURNAL_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "blockcompression.hpp"
+#include "products.hpp"
+#include "marketdataservice.hpp"
+#include "pricingservice.hpp"
+#include "tradebookingservice.hpp"
+#include "inquiryservice.hpp"
+
+// File names of the four journals within a journal directory
+const char* const MARKET_DATA_JOURNAL = "marketdata.txt";
+const char* const PRICE_JOURNAL = "prices.txt";
+const char* const TRADE_JOURNAL = "trades.txt";
+const char* const INQUIRY_JOURNAL = "inquiries.txt";
+
+// How a journal is stored: plain text, or text lines in indexed compressed blocks
+enum JournalFormat { JOURNAL_TEXT, JOURNAL_BLOCKS };
+
+// Path of a journal within a directory; block journals add BLOCK_JOURNAL_SUFFIX to the name
+inline std::string JournalPath(const std::string &directory, const char *name, JournalFormat format = JOURNAL_TEXT) {
+  return directory + "/" + name + (format == JOURNAL_BLOCKS ? BLOCK_JOURNAL_SUFFIX : "");
+}
+
+// Kinds of recorded or generated event, one per journal
+enum TickType { TICK_ORDER_BOOK, TICK_PRICE, TICK_TRADE, TICK_INQUIRY };
+
+/**
+ * Services that generated or replayed events are pushed into. Any of them may
+ * be null, in which case events of that type are dropped.
+ */
+struct TickSinks
+{
+  Service<string, OrderBook<Bond>> *marketData = nullptr;
+  Service<string, Price<Bond>> *pricing = nullptr;
+  Service<string, Trade<Bond>> *tradeBooking = nullptr;
+  Service<string, Inquiry<Bond>> *inquiry = nullptr;
+};
+
+/**
+ * Appends journal lines to a file, either as text through a large stdio
+ * buffer or into the compressed blocks of a block journal.
+ */
+class JournalWriter
+{
+
+public:
+
+  // ctor opening the journal for writing, truncating any existing file
+  explicit JournalWriter(const std::string &_path, JournalFormat format = JOURNAL_TEXT) : path(_path), file(nullptr) {
+    if (format == JOURNAL_BLOCKS) {
+      blocks.reset(new BlockJournalWriter(path));
+      return;
+    }
+    file = std::fopen(path.c_str(), "w");
+    if (!file) throw std::runtime_error("Unable to open journal: " + path);
+    buffer.resize(1 << 20);
+    std::setvbuf(file, buffer.data(), _IOFBF, buffer.size());
+  }
+
+  // dtor closing the journal; call Close first to see a failed write as an exception
+  ~JournalWriter() {
+    try {
+      Close();
+    } catch (const std::runtime_error&) {
+    }
+    if (file) std::fclose(file);
+  }
+
+  JournalWriter(const JournalWriter&) = delete;
+  JournalWriter& operator=(const JournalWriter&) = delete;
+
+  // Write an order book
+  template<typename T>
+  void Write(uint64_t timestamp, const OrderBook<T> &orderBook) {
+    const vector<Order> &bids = orderBook.GetBidStack();
+    const vector<Order> &offers = orderBook.GetOfferStack();
+    line.clear();
+    Format("%llu,%s,%zu", static_cast<unsigned long long>(timestamp), orderBook.GetProduct().GetProductId().c_str(), bids.size());
+    for (const Order &order : bids) Format(",%.8f,%ld", order.GetPrice(), order.GetQuantity());
+    for (const Order &order : offers) Format(",%.8f,%ld", order.GetPrice(), order.GetQuantity());
+    WriteLine(timestamp);
+  }
+
+  // Write a price
+  template<typename T>
+  void Write(uint64_t timestamp, const Price<T> &price) {
+    line.clear();
+    Format("%llu,%s,%.8f,%.8f", static_cast<unsigned long long>(timestamp), price.GetProduct().GetProductId().c_str(), price.GetMid(), price.GetBidOfferSpread());
+    WriteLine(timestamp);
+  }
+
+  // Write a trade
+  template<typename T>
+  void Write(uint64_t timestamp, const Trade<T> &trade) {
+    line.clear();
+    Format("%llu,%s,%s,%.8f,%s,%ld,%s", static_cast<unsigned long long>(timestamp), trade.GetProduct().GetProductId().c_str(),
+      trade.GetTradeId().c_str(), trade.GetPrice(), trade.GetBook().c_str(), trade.GetQuantity(), trade.GetSide() == BUY ? "BUY" : "SELL");
+    WriteLine(timestamp);
+  }
+
+  // Write an inquiry
+  template<typename T>
+  void Write(uint64_t timestamp, const Inquiry<T> &inquiry) {
+    line.clear();
+    Format("%llu,%s,%s,%s,%ld,%.8f,%d", static_cast<unsigned long long>(timestamp), inquiry.GetInquiryId().c_str(),
+      inquiry.GetProduct().GetProductId().c_str(), inquiry.GetSide() == BUY ? "BUY" : "SELL", inquiry.GetQuantity(), inquiry.GetPrice(), static_cast<int>(inquiry.GetState()));
+    WriteLine(timestamp);
+  }
+
+  // Write out everything appended so far, throwing if the file refuses it
+  void Close() {
+    if (blocks) blocks->Close();
+    else if (std::fflush(file) != 0) throw std::runtime_error("Unable to write journal: " + path);
+  }
+
+private:
+  std::string path;
+  std::FILE *file;
+  std::vector<char> buffer;  // stdio buffer, text journals only
+  std::unique_ptr<BlockJournalWriter> blocks;
+  std::string line;
+
+  // Append formatted fields to the line being built
+  template<typename... Args>
+  void Format(const char *format, Args... args) {
+    const size_t size = line.size();
+    line.resize(size + 128);
+    int written = std::snprintf(&line[size], 128, format, args...);
+    if (written >= 128) {
+      line.resize(size + written + 1);
+      std::snprintf(&line[size], written + 1, format, args...);
+    }
+    line.resize(size + written);
+  }
+
+  void WriteLine(uint64_t timestamp) {
+    if (blocks) {
+      blocks->AppendLine(timestamp, line.data(), line.size());
+    } else {
+      line.push_back('\n');
+      if (std::fwrite(line.data(), 1, line.size(), file) != line.size()) throw std::runtime_error("Unable to write journal: " + path);
+    }
+  }
+};
+
+/**
+ * Splits one journal line into comma-separated fields without copying it.
+ */
+class JournalFields
+{
+
+public:
+
+  explicit JournalFields(const std::string &_line) : line(_line.c_str()), end(_line.c_str() + _line.size()) {}
+
+  // Next field as a string
+  std::string NextString() {
+    const char *start = line;
+    const char *comma = static_cast<const char*>(std::memchr(line, ',', end - line));
+    const char *stop = comma ? comma : end;
+    line = comma ? comma + 1 : end;
+    return std::string(start, stop);
+  }
+
+  // Next field as a double
+  double NextDouble() {
+    char *stop;
+    double value = std::strtod(line, &stop);
+    Advance(stop);
+    return value;
+  }
+
+  // Next field as a signed integer
+  long NextLong() {
+    char *stop;
+    long value = std::strtol(line, &stop, 10);
+    Advance(stop);
+    return value;
+  }
+
+  // Next field as an unsigned 64-bit integer
+  uint64_t NextUnsigned() {
+    char *stop;
+    uint64_t value = std::strtoull(line, &stop, 10);
+    Advance(stop);
+    return value;
+  }
+
+private:
+  const char *line;
+  const char *end;
+
+  void Advance(const char *stop) {
+    if (stop == line) throw std::runtime_error("Malformed journal field");
+    line = (stop < end && *stop == ',') ? stop + 1 : stop;
+  }
+};
+
+/**
+ * Reads journal lines back into service objects, resolving product identifiers
+ * against a known product universe.
+ */
+class JournalParser
+{
+
+public:
+
+  // ctor for a parser over the given products
+  explicit JournalParser(const std::vector<Bond> &products) {
+    for (const Bond &bond : products) bonds[bond.GetProductId()] = bond;
+  }
+
+  // Leading timestamp of any journal line
+  static uint64_t Timestamp(const std::string &line) {
+    return std::strtoull(line.c_str(), nullptr, 10);
+  }
+
+  // Parse a marketdata.txt line
+  OrderBook<Bond> ParseOrderBook(const std::string &line) const {
+    JournalFields fields(line);
+    fields.NextUnsigned();
+    const Bond &bond = Lookup(fields.NextString());
+    long depth = fields.NextLong();
+    // Every level takes four fields, so a depth the line cannot hold is corrupt
+    if (depth < 0 || static_cast<size_t>(depth) > line.size() / 4) throw std::runtime_error("Malformed journal field");
+    vector<Order> bids, offers;
+    bids.reserve(depth);
+    offers.reserve(depth);
+    for (long level = 0; level < depth; ++level) {
+      double price = fields.NextDouble();
+      bids.push_back(Order(price, fields.NextLong(), BID));
+    }
+    for (long level = 0; level < depth; ++level) {
+      double price = fields.NextDouble();
+      offers.push_back(Order(price, fields.NextLong(), OFFER));
+    }
+    return OrderBook<Bond>(bond, bids, offers);
+  }
+
+  // Parse a prices.txt line
+  Price<Bond> ParsePrice(const std::string &line) const {
+    JournalFields fields(line);
+    fields.NextUnsigned();
+    const Bond &bond = Lookup(fields.NextString());
+    double mid = fields.NextDouble();
+    return Price<Bond>(bond, mid, fields.NextDouble());
+  }
+
+  // Parse a trades.txt line
+  Trade<Bond> ParseTrade(const std::string &line) const {
+    JournalFields fields(line);
+    fields.NextUnsigned();
+    const Bond &bond = Lookup(fields.NextString());
+    std::string tradeId = fields.NextString();
+    double price = fields.NextDouble();
+    std::string book = fields.NextString();
+    long quantity = fields.NextLong();
+    Side side = fields.NextString() == "BUY" ? BUY : SELL;
+    return Trade<Bond>(bond, tradeId, price, book, quantity, side);
+  }
+
+  // Parse an inquiries.txt line
+  Inquiry<Bond> ParseInquiry(const std::string &line) const {
+    JournalFields fields(line);
+    fields.NextUnsigned();
+    std::string inquiryId = fields.NextString();
+    const Bond &bond = Lookup(fields.NextString());
+    Side side = fields.NextString() == "BUY" ? BUY : SELL;
+    long quantity = fields.NextLong();
+    double price = fields.NextDouble();
+    InquiryState state = static_cast<InquiryState>(fields.NextLong());
+    return Inquiry<Bond>(inquiryId, bond, side, quantity, price, state);
+  }
+
+private:
+  std::unordered_map<std::string, Bond> bonds;
+
+  const Bond& Lookup(const std::string &productId) const {
+    auto it = bonds.find(productId);
+    if (it == bonds.end()) throw std::runtime_error("Unknown product in journal: " + productId);
+    return it->second;
+  }
+};
+
+#endif // JOURNAL_HPP
@@ -0,0 +1,249 @@
+/**
+ * marketdatafeed.hpp
+ * Sequenced incremental market data with gap detection and snapshot recovery.
+ *
+ * An incremental feed sends one BookUpdate per price level change instead of
+ * a full order book, numbered per product from 1. MarketDataFeedHandler
+ * applies updates to a MarketDataService strictly in sequence: duplicates are
+ * dropped, and updates arriving ahead of a missing one are buffered until it
+ * turns up. Once more than the reorder window are waiting, or a heartbeat
+ * shows that an update was lost, the handler publishes a SnapshotRequest
+ * through a Connector. The BookSnapshot answering it replaces the book,
+ * buffered updates it already covers are discarded and the rest applied. A
+ * book is never updated out of order or across a gap.
+ */
+#ifndef MARKET_DATA_FEED_HPP
+#define MARKET_DATA_FEED_HPP
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include "soa.hpp"
+#include "flatstore.hpp"
+#include "marketdataservice.hpp"
+
+/**
+ * Change to one price level of a product's order book. A zero quantity removes
+ * the level. Type T is the product type.
+ */
+template<typename T>
+class BookUpdate
+{
+
+public:
+
+  // ctor for an update
+  BookUpdate(const T &_product, uint64_t _sequence, PricingSide _side, double _price, long _quantity) :
+    product(_product), sequence(_sequence), side(_side), price(_price), quantity(_quantity) {}
+  BookUpdate() = default;
+
+  // Get the product
+  const T& GetProduct() const { return product; }
+
+  // Get the per-product sequence number
+  uint64_t GetSequence() const { return sequence; }
+
+  // Get the side of the level
+  PricingSide GetSide() const { return side; }
+
+  // Get the price of the level
+  double GetPrice() const { return price; }
+
+  // Get the new quantity at the level
+  long GetQuantity() const { return quantity; }
+
+private:
+  T product;
+  uint64_t sequence = 0;
+  PricingSide side = BID;
+  double price = 0.0;
+  long quantity = 0;
+};
+
+/**
+ * Full order book of a product as of a sequence number, sent in answer to a
+ * SnapshotRequest. Type T is the product type.
+ */
+template<typename T>
+class BookSnapshot
+{
+
+public:
+
+  // ctor for a snapshot; a book passed as a temporary is moved in
+  BookSnapshot(OrderBook<T> _orderBook, uint64_t _sequence) : orderBook(std::move(_orderBook)), sequence(_sequence) {}
+  BookSnapshot() = default;
+
+  // Get the order book
+  const OrderBook<T>& GetOrderBook() const { return orderBook; }
+  OrderBook<T>& GetOrderBook() { return orderBook; }
+
+  // Get the sequence number of the last update the book includes
+  uint64_t GetSequence() const { return sequence; }
+
+private:
+  OrderBook<T> orderBook;
+  uint64_t sequence = 0;
+};
+
+/**
+ * Request for a full order book of a product, published when its incremental
+ * updates cannot be applied.
+ */
+struct SnapshotRequest
+{
+  std::string productId;
+  uint64_t lastSequence;   // last update applied to the book
+};
+
+/**
+ * Gap handling options of a MarketDataFeedHandler.
+ */
+struct FeedOptions
+{
+  size_t reorderWindow = 64;   // updates buffered behind a gap before requesting a snapshot
+};
+
+/**
+ * Counts of what a MarketDataFeedHandler did with the messages it received.
+ */
+struct FeedStats
+{
+  uint64_t applied = 0;           // updates applied to a book
+  uint64_t duplicates = 0;        // updates dropped as already applied or buffered
+  uint64_t buffered = 0;          // updates held back behind a gap
+  uint64_t gaps = 0;              // updates arriving ahead of sequence with none buffered
+  uint64_t snapshotRequests = 0;  // snapshot requests published
+  uint64_t snapshots = 0;         // snapshots applied
+  uint64_t staleSnapshots = 0;    // snapshots older than the book, ignored
+};
+
+/**
+ * Applies a sequenced incremental feed to a MarketDataService and recovers
+ * from gaps with snapshots requested through a Connector. Call from the market
+ * data thread. The connector may answer a request synchronously by calling
+ * OnSnapshot from its Publish.
+ * Type T is the product type.
+ */
+template<typename T>
+class MarketDataFeedHandler
+{
+
+public:
+
+  // ctor for a handler feeding a service and requesting snapshots through a connector
+  MarketDataFeedHandler(MarketDataService<T> &_service, Connector<SnapshotRequest> &_recovery, const FeedOptions &_options = FeedOptions(), size_t expectedProducts = 0) :
+    service(_service), recovery(_recovery), options(_options), feeds(expectedProducts) {}
+
+  // Incremental update from the feed
+  void OnUpdate(const BookUpdate<T> &update) {
+    const string &productId = update.GetProduct().GetProductId();
+    ProductFeed &feed = FeedOf(productId);
+    const uint64_t sequence = update.GetSequence();
+    if (sequence < feed.next) {
+      ++stats.duplicates;
+    } else if (sequence > feed.next) {
+      Buffer(productId, feed, update);
+    } else {
+      Apply(feed, update);
+      Drain(feed);
+    }
+  }
+
+  // Snapshot from the recovery connector; replaces the book unless it is older
+  void OnSnapshot(BookSnapshot<T> snapshot) {
+    const string productId = snapshot.GetOrderBook().GetProduct().GetProductId();
+    ProductFeed &feed = FeedOf(productId);
+    feed.recovering = false;
+    if (snapshot.GetSequence() + 1 < feed.next) {
+      ++stats.staleSnapshots;
+    } else {
+      ++stats.snapshots;
+      feed.next = snapshot.GetSequence() + 1;
+      service.OnMessage(std::move(snapshot.GetOrderBook()));
+      Drain(feed);
+    }
+    if (!feed.pending.empty() && feed.pending.size() > options.reorderWindow) RequestSnapshot(productId);
+  }
+
+  // Heartbeat carrying the sequence number of the last update sent for a
+  // product; recovers at once if any of them is missing
+  void OnHeartbeat(const string &productId, uint64_t lastSequence) {
+    ProductFeed &feed = FeedOf(productId);
+    if (lastSequence >= feed.next && !feed.recovering) RequestSnapshot(productId);
+  }
+
+  // Request a snapshot of a product, unless one is already outstanding
+  void RequestSnapshot(const string &productId) {
+    ProductFeed &feed = FeedOf(productId);
+    if (feed.recovering) return;
+    feed.recovering = true;
+    ++stats.snapshotRequests;
+    SnapshotRequest request{ productId, feed.next - 1 };
+    recovery.Publish(request);
+  }
+
+  // Sequence number of the last update applied to a product's book
+  uint64_t GetSequence(const string &productId) const {
+    const ProductFeed *feed = feeds.Get(productId);
+    return feed ? feed->next - 1 : 0;
+  }
+
+  // Whether a snapshot of a product has been requested and not yet received
+  bool IsRecovering(const string &productId) const {
+    const ProductFeed *feed = feeds.Get(productId);
+    return feed && feed->recovering;
+  }
+
+  // Get the message counts so far
+  const FeedStats& GetStats() const { return stats; }
+
+private:
+
+  // Sequencing state of one product
+  struct ProductFeed
+  {
+    uint64_t next = 1;                           // sequence number expected next
+    bool recovering = false;                     // snapshot requested
+    std::map<uint64_t, BookUpdate<T>> pending;   // updates behind a gap, by sequence number
+  };
+
+  MarketDataService<T> &service;
+  Connector<SnapshotRequest> &recovery;
+  FeedOptions options;
+  FlatStore<ProductFeed> feeds;   // by product ID
+  FeedStats stats;
+
+  ProductFeed& FeedOf(const string &productId) {
+    return feeds.FindOrInsert(productId, []() { return ProductFeed(); });
+  }
+
+  void Apply(ProductFeed &feed, const BookUpdate<T> &update) {
+    service.OnLevelUpdate(update.GetProduct(), update.GetSide(), update.GetPrice(), update.GetQuantity());
+    ++stats.applied;
+    ++feed.next;
+  }
+
+  // Hold an update back until the gap before it is filled
+  void Buffer(const string &productId, ProductFeed &feed, const BookUpdate<T> &update) {
+    if (!feed.pending.emplace(update.GetSequence(), update).second) {
+      ++stats.duplicates;
+      return;
+    }
+    ++stats.buffered;
+    if (feed.pending.size() == 1) ++stats.gaps;
+    if (feed.pending.size() > options.reorderWindow) RequestSnapshot(productId);
+  }
+
+  // Apply buffered updates that have become next in sequence, dropping those
+  // already covered
+  void Drain(ProductFeed &feed) {
+    while (!feed.pending.empty() && feed.pending.begin()->first <= feed.next) {
+      auto first = feed.pending.begin();
+      if (first->first == feed.next) Apply(feed, first->second);
+      feed.pending.erase(first);
+    }
+  }
+};
+
+#endif // MARKET_DATA_FEED_HPP
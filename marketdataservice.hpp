@@ -9,10 +9,13 @@
 
 #include <string>
 #include <vector>
-#include <map>
 #include <stdexcept>
+#include <cstring>
 #include <iostream>
 #include "soa.hpp"
+#include "flatstore.hpp"
+#include "seqlockarray.hpp"
+#include "booksignals.hpp"
 
 using namespace std;
 
@@ -29,6 +32,7 @@ public:
 
   // Constructor for an order
   Order(double _price, long _quantity, PricingSide _side) : price(_price), quantity(_quantity), side(_side) {}
+  Order() : price(0.0), quantity(0), side(BID) {}
 
   // Get the price on the order
   double GetPrice() const { return price; }
@@ -55,6 +59,7 @@ public:
 
   // Constructor for bid/offer
   BidOffer(const Order &_bidOrder, const Order &_offerOrder) : bidOrder(_bidOrder), offerOrder(_offerOrder) {}
+  BidOffer() = default;
 
   // Get the bid order
   const Order& GetBidOrder() const { return bidOrder; }
@@ -77,8 +82,9 @@ class OrderBook
 
 public:
 
-  // Constructor for the order book
-  OrderBook(const T &_product, const vector<Order> &_bidStack, const vector<Order> &_offerStack) : product(_product), bidStack(_bidStack), offerStack(_offerStack) {}
+  // Constructor for the order book; stacks passed as temporaries are moved in
+  OrderBook(const T &_product, vector<Order> _bidStack, vector<Order> _offerStack) : product(_product), bidStack(std::move(_bidStack)), offerStack(std::move(_offerStack)) {}
+  OrderBook() = default;
 
   // Get the product
   const T& GetProduct() const { return product; }
@@ -89,6 +95,19 @@ public:
   // Get the offer stack
   const vector<Order>& GetOfferStack() const { return offerStack; }
 
+  // Set the quantity at a price level on one side, adding the level if it is
+  // new and removing it if the quantity is zero
+  void SetLevel(PricingSide side, double price, long quantity) {
+    vector<Order> &stack = side == BID ? bidStack : offerStack;
+    for (auto it = stack.begin(); it != stack.end(); ++it) {
+      if (it->GetPrice() != price) continue;
+      if (quantity) *it = Order(price, quantity, side);
+      else stack.erase(it);
+      return;
+    }
+    if (quantity) stack.push_back(Order(price, quantity, side));
+  }
+
 private:
   T product;
   vector<Order> bidStack;
@@ -98,6 +117,12 @@ private:
 /**
  * Market Data Service which distributes market data.
  * Keyed on product identifier.
+ * The best bid and offer of each product is computed once when its order book
+ * is stored and cached in a dense array indexed by product handle. Lookups by
+ * handle are a single seqlocked array read and may run on any thread while
+ * the market data thread keeps storing books. The book's depth signals (see
+ * booksignals.hpp) are maintained and published the same way, and signal
+ * listeners hear about each product whose top levels changed.
  * Type T is the product type.
  */
 template<typename T>
@@ -106,61 +131,233 @@ class MarketDataService : public Service<string, OrderBook<T>>
 
 public:
 
-  // Get the best bid/offer order
-  const BidOffer& GetBestBidOffer(const string &productId) {
-    if (dataStore.find(productId) == dataStore.end()) {
+  // Dense index of a product's order book, stable for the life of the service
+  typedef typename FlatStore<OrderBook<T>>::Handle ProductHandle;
+
+  static constexpr ProductHandle NO_PRODUCT = FlatStore<OrderBook<T>>::NO_HANDLE;
+
+  // ctor pre-sizing the order book store, top of book cache and listener lists
+  explicit MarketDataService(const ServiceCapacity &capacity = ServiceCapacity()) :
+    dataStore(capacity.products), bestBidOffers(capacity.products), signals(capacity.products) {
+    listeners.Reserve(capacity.listeners);
+    signalListeners.Reserve(capacity.listeners);
+    signalState.reserve(capacity.products);
+  }
+
+  // Touch every page of the pre-sized store before the open
+  void WarmUp() {
+    dataStore.Warm();
+    bestBidOffers.Warm();
+    signals.Warm();
+  }
+
+  // Handle of a product, or NO_PRODUCT if no order book has been stored for it.
+  // Call from the market data thread; the handle may then be used on any thread.
+  ProductHandle GetProductHandle(const string &productId) const noexcept {
+    return dataStore.Find(productId);
+  }
+
+  // Get the cached best bid/offer for a product
+  BidOffer GetBestBidOffer(const string &productId) const {
+    ProductHandle handle = dataStore.Find(productId);
+    if (handle == NO_PRODUCT) {
         throw runtime_error("OrderBook not found for product ID: " + productId);
     }
+    return bestBidOffers.Load(handle);
+  }
 
-    auto& orderBook = dataStore[productId];
-    const Order& bestBid = orderBook.GetBidStack().front();
-    const Order& bestOffer = orderBook.GetOfferStack().front();
-    bestBidOffer = BidOffer(bestBid, bestOffer);
-    return bestBidOffer;
+  // Get the cached best bid/offer for a product handle; safe from any thread
+  BidOffer GetBestBidOffer(ProductHandle handle) const {
+    if (handle >= bestBidOffers.Size()) {
+        throw runtime_error("OrderBook not found for product handle: " + to_string(handle));
+    }
+    return bestBidOffers.Load(handle);
   }
 
-  // Aggregate the order book
-  const OrderBook<T>& AggregateDepth(const string &productId) {
-    if (dataStore.find(productId) == dataStore.end()) {
+  // Get the depth signals for a product
+  BookSignals GetSignals(const string &productId) const {
+    ProductHandle handle = dataStore.Find(productId);
+    if (handle == NO_PRODUCT) {
         throw runtime_error("OrderBook not found for product ID: " + productId);
     }
+    return signals.Load(handle);
+  }
+
+  // Get the depth signals for a product handle; safe from any thread
+  BookSignals GetSignals(ProductHandle handle) const {
+    if (handle >= signals.Size()) {
+        throw runtime_error("OrderBook not found for product handle: " + to_string(handle));
+    }
+    return signals.Load(handle);
+  }
 
-    return dataStore[productId];
+  // Add a listener notified with a product's signals whenever its top levels change
+  ListenerHandle AddSignalListener(ServiceListener<BookSignals>* listener, const ListenerOptions &options = ListenerOptions()) {
+    return signalListeners.Add(listener, options);
+  }
+
+  // Remove a signal listener registration
+  bool RemoveSignalListener(ListenerHandle handle) {
+    return signalListeners.Remove(handle);
+  }
+
+  // Aggregate the order book
+  const OrderBook<T>& AggregateDepth(const string &productId) {
+    return GetData(productId);
   }
 
   // Add a listener to the service
   void AddListener(ServiceListener<OrderBook<T>>* listener) override {
-    listeners.push_back(listener);
+    listeners.Add(listener);
+  }
+
+  // Add a listener with a priority and product filter
+  ListenerHandle AddListener(ServiceListener<OrderBook<T>>* listener, const ListenerOptions &options) override {
+    return listeners.Add(listener, options);
+  }
+
+  // Remove a listener registration
+  bool RemoveListener(ListenerHandle handle) override {
+    return listeners.Remove(handle);
   }
 
   // Get all listeners
   const vector<ServiceListener<OrderBook<T>>*>& GetListeners() const override {
-    return listeners;
+    return listeners.All();
   }
 
   // OnMessage callback for receiving market data updates
   void OnMessage(OrderBook<T>& data) override {
+    SOA_PROBE_SERVICE("OnMessage");
     string productId = data.GetProduct().GetProductId();
-    dataStore[productId] = data;
+    NotifyAdd(productId, CacheTopOfBook(dataStore.Upsert(productId, data)));
+  }
 
-    // Notify all listeners
-    for (auto& listener : listeners) {
-        listener->ProcessAdd(data);
-    }
+  // OnMessage callback for order books a Connector hands over, moved into the store
+  void OnMessage(OrderBook<T>&& data) override {
+    SOA_PROBE_SERVICE("OnMessage");
+    string productId = data.GetProduct().GetProductId();
+    NotifyAdd(productId, CacheTopOfBook(dataStore.Upsert(productId, std::move(data))));
+  }
+
+  // Store an order book constructed in place from OrderBook<T> ctor arguments
+  template<typename... Args>
+  void EmplaceData(Args&&... args) {
+    SOA_PROBE_SERVICE("EmplaceData");
+    OrderBook<T> &stored = CacheTopOfBook(dataStore.Emplace([](const OrderBook<T> &orderBook) { return orderBook.GetProduct().GetProductId(); }, std::forward<Args>(args)...));
+    NotifyAdd(stored.GetProduct().GetProductId(), stored);
+  }
+
+  // Apply a change to one price level of a product's order book, starting from
+  // an empty book for a new product, and notify listeners as for a full book
+  void OnLevelUpdate(const T &product, PricingSide side, double price, long quantity) {
+    SOA_PROBE_SERVICE("OnLevelUpdate");
+    const string &productId = product.GetProductId();
+    OrderBook<T> &stored = dataStore.FindOrInsert(productId, [&]() { return OrderBook<T>(product, vector<Order>(), vector<Order>()); });
+    stored.SetLevel(side, price, quantity);
+    NotifyAdd(productId, CacheTopOfBook(stored));
   }
 
   // Get data by product ID
   OrderBook<T>& GetData(string productId) override {
-    if (dataStore.find(productId) == dataStore.end()) {
+    OrderBook<T> *orderBook = dataStore.Get(productId);
+    if (!orderBook) {
         throw runtime_error("OrderBook not found for product ID: " + productId);
     }
-    return dataStore[productId];
+    return *orderBook;
+  }
+
+  // Get data by product ID, or nullptr if there is none; never throws
+  OrderBook<T>* TryGetData(const string &productId) noexcept override {
+    return dataStore.Get(productId);
+  }
+
+  // Get data by a handle from GetProductHandle; never throws. Call from the
+  // market data thread.
+  OrderBook<T>& GetData(ProductHandle handle) noexcept {
+    return dataStore.At(handle);
   }
 
 private:
-  map<string, OrderBook<T>> dataStore; // Map to store order books by product ID
-  vector<ServiceListener<OrderBook<T>>*> listeners; // Listeners to notify on updates
-  BidOffer bestBidOffer;
+  FlatStore<OrderBook<T>> dataStore; // Order books by product ID
+  ListenerRegistry<OrderBook<T>> listeners; // Listeners to notify on updates
+  SeqLockArray<BidOffer> bestBidOffers; // Top of book by product handle
+  SeqLockArray<BookSignals> signals; // Depth signals by product handle
+  ListenerRegistry<BookSignals> signalListeners; // Listeners to notify on signal changes
+
+  // Writer-side signal state of one product
+  struct SignalState
+  {
+    BookLevels levels;
+    BookSignals signals;
+  };
+
+  vector<SignalState> signalState; // by product handle
+
+  // Recompute the top of book and signals of the order book just stored.
+  // Stacks are not assumed sorted: the best bid is the highest bid price and
+  // the best offer the lowest offer price, the first such order on ties. An
+  // empty side caches an empty order.
+  OrderBook<T>& CacheTopOfBook(OrderBook<T> &stored) {
+    const ProductHandle handle = dataStore.LastHandle();
+    BookLevels levels = {};
+    levels.bidLevels = BestLevels(stored.GetBidStack(), true, levels.bidPrice, levels.bidSize);
+    levels.offerLevels = BestLevels(stored.GetOfferStack(), false, levels.offerPrice, levels.offerSize);
+    Order bestBid = levels.bidLevels ? Order(levels.bidPrice[0], levels.bidSize[0], BID) : Order(0.0, 0, BID);
+    Order bestOffer = levels.offerLevels ? Order(levels.offerPrice[0], levels.offerSize[0], OFFER) : Order(0.0, 0, OFFER);
+    bestBidOffers.Store(handle, BidOffer(bestBid, bestOffer));
+
+    if (handle == signalState.size()) {
+      signalState.push_back(SignalState());
+      std::memset(&signalState.back(), 0, sizeof(SignalState));
+      signalState.back().signals.product = handle;
+    }
+    SignalState &state = signalState[handle];
+    if (UpdateBookSignals(levels, state.levels, state.signals)) {
+      state.levels = levels;
+      signals.Store(handle, state.signals);
+      for (auto& listener : signalListeners.For(stored.GetProduct().GetProductId())) {
+        SOA_PROBE_LISTENER(listener);
+        listener->ProcessUpdate(state.signals);
+      }
+    }
+    return stored;
+  }
+
+  // Sort the best SIGNAL_LEVELS orders of a side into price and size arrays,
+  // best first and in stack order among equal prices. Returns the levels filled.
+  static int BestLevels(const vector<Order> &orders, bool bids, double *price, int64_t *size) {
+    int count = 0;
+    for (const Order &order : orders) {
+      const double orderPrice = order.GetPrice();
+      int at = count;
+      while (at > 0 && (bids ? orderPrice > price[at - 1] : orderPrice < price[at - 1])) --at;
+      if (at == SIGNAL_LEVELS) continue;
+      for (int i = count < SIGNAL_LEVELS ? count : SIGNAL_LEVELS - 1; i > at; --i) {
+        price[i] = price[i - 1];
+        size[i] = size[i - 1];
+      }
+      price[at] = orderPrice;
+      size[at] = order.GetQuantity();
+      if (count < SIGNAL_LEVELS) ++count;
+    }
+    return count;
+  }
+
+  // Notify the listeners for a product of a stored order book
+  void NotifyAdd(const string &productId, OrderBook<T> &stored) {
+    for (auto& listener : listeners.For(productId)) {
+        SOA_PROBE_LISTENER(listener);
+        listener->ProcessAdd(stored);
+    }
+  }
 };
 
+// Instantiated once in instantiations.cpp when building against the soa library
+#ifdef SOA_EXTERN_TEMPLATES
+#include "products.hpp"
+SOA_EXTERN_PRODUCT_TEMPLATE(OrderBook)
+SOA_EXTERN_PRODUCT_TEMPLATE(MarketDataService)
+#endif
+
 #endif // MARKET_DATA_SERVICE_HPP
@@ -0,0 +1,358 @@
+/**
+ * pipeline.hpp
+ * Defines the listeners that bridge one service into the next and a
+ * TradingPipeline that wires the full service graph together over an
+ * EventBus.
+ *
+ * Market data drives executions, executions are booked as trades, trades
+ * roll into positions and positions into risk. Prices drive the streaming
+ * service and inquiries are quoted as they arrive. Every terminal stage is
+ * persisted through a HistoricalDataService.
+ */
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include <string>
+#include "soa.hpp"
+#include "eventbus.hpp"
+#include "marketdataservice.hpp"
+#include "pricingservice.hpp"
+#include "streamingservice.hpp"
+#include "executionservice.hpp"
+#include "tradebookingservice.hpp"
+#include "positionservice.hpp"
+#include "riskservice.hpp"
+#include "inquiryservice.hpp"
+#include "historicaldataservice.hpp"
+
+/**
+ * Crosses the spread on every order book update and sends the resulting
+ * order to the ExecutionService, alternating between hitting the bid and
+ * lifting the offer.
+ * Type T is the product type.
+ */
+template<typename T>
+class MarketDataExecutionListener : public ServiceListener<OrderBook<T>>
+{
+
+public:
+
+  // ctor for the listener
+  MarketDataExecutionListener(MarketDataService<T> &_marketDataService, ExecutionService<T> &_executionService) :
+    marketDataService(_marketDataService), executionService(_executionService), orderCount(0) {}
+
+  void ProcessAdd(OrderBook<T> &data) override {
+    const BidOffer &bidOffer = marketDataService.GetBestBidOffer(data.GetProduct().GetProductId());
+    bool hitBid = (orderCount % 2) == 0;
+    const Order &order = hitBid ? bidOffer.GetBidOrder() : bidOffer.GetOfferOrder();
+    ExecutionOrder<T> executionOrder(data.GetProduct(), hitBid ? BID : OFFER, "ALGO" + std::to_string(++orderCount), MARKET, order.GetPrice(), order.GetQuantity(), 0.0, "", false);
+    executionService.ExecuteOrder(std::move(executionOrder), BROKERTEC);
+  }
+
+  void ProcessRemove(OrderBook<T> &data) override {}
+
+  void ProcessUpdate(OrderBook<T> &data) override { ProcessAdd(data); }
+
+private:
+  MarketDataService<T> &marketDataService;
+  ExecutionService<T> &executionService;
+  long orderCount;
+};
+
+/**
+ * Books every execution as a trade, cycling through books TRSY1, TRSY2 and TRSY3.
+ * Type T is the product type.
+ */
+template<typename T>
+class ExecutionTradeBookingListener : public ServiceListener<ExecutionOrder<T>>
+{
+
+public:
+
+  // ctor for the listener
+  ExecutionTradeBookingListener(TradeBookingService<T> &_tradeBookingService) : tradeBookingService(_tradeBookingService), tradeCount(0) {}
+
+  void ProcessAdd(ExecutionOrder<T> &data) override {
+    static const std::string books[] = { "TRSY1", "TRSY2", "TRSY3" };
+    Side side = data.GetSide() == BID ? SELL : BUY;
+    long quantity = static_cast<long>(data.GetVisibleQuantity() + data.GetHiddenQuantity());
+    Trade<T> trade(data.GetProduct(), data.GetOrderId(), data.GetPrice(), books[tradeCount++ % 3], quantity, side);
+    tradeBookingService.BookTrade(std::move(trade));
+  }
+
+  void ProcessRemove(ExecutionOrder<T> &data) override {}
+
+  void ProcessUpdate(ExecutionOrder<T> &data) override {}
+
+private:
+  TradeBookingService<T> &tradeBookingService;
+  long tradeCount;
+};
+
+/**
+ * Feeds booked trades into the PositionService.
+ * Type T is the product type.
+ */
+template<typename T>
+class TradePositionListener : public ServiceListener<Trade<T>>
+{
+
+public:
+
+  // ctor for the listener
+  TradePositionListener(PositionService<T> &_positionService) : positionService(_positionService) {}
+
+  void ProcessAdd(Trade<T> &data) override { positionService.AddTrade(data); }
+
+  void ProcessRemove(Trade<T> &data) override {}
+
+  void ProcessUpdate(Trade<T> &data) override {}
+
+private:
+  PositionService<T> &positionService;
+};
+
+/**
+ * Feeds position updates into the RiskService.
+ * Type T is the product type.
+ */
+template<typename T>
+class PositionRiskListener : public ServiceListener<Position<T>>
+{
+
+public:
+
+  // ctor for the listener
+  PositionRiskListener(RiskService<T> &_riskService) : riskService(_riskService) {}
+
+  void ProcessAdd(Position<T> &data) override { riskService.AddPosition(data); }
+
+  void ProcessRemove(Position<T> &data) override {}
+
+  void ProcessUpdate(Position<T> &data) override { riskService.AddPosition(data); }
+
+private:
+  RiskService<T> &riskService;
+};
+
+/**
+ * Turns internal prices into two-way price streams on the StreamingService.
+ * Type T is the product type.
+ */
+template<typename T>
+class PriceStreamingListener : public ServiceListener<Price<T>>
+{
+
+public:
+
+  // ctor for the listener
+  PriceStreamingListener(StreamingService<T> &_streamingService, long _visibleQuantity = 1000000, long _hiddenQuantity = 2000000) :
+    streamingService(_streamingService), visibleQuantity(_visibleQuantity), hiddenQuantity(_hiddenQuantity) {}
+
+  void ProcessAdd(Price<T> &data) override {
+    double halfSpread = data.GetBidOfferSpread() / 2.0;
+    PriceStreamOrder bidOrder(data.GetMid() - halfSpread, visibleQuantity, hiddenQuantity, BID);
+    PriceStreamOrder offerOrder(data.GetMid() + halfSpread, visibleQuantity, hiddenQuantity, OFFER);
+    streamingService.PublishPrice(PriceStream<T>(data.GetProduct(), bidOrder, offerOrder));
+  }
+
+  void ProcessRemove(Price<T> &data) override {}
+
+  void ProcessUpdate(Price<T> &data) override { ProcessAdd(data); }
+
+private:
+  StreamingService<T> &streamingService;
+  long visibleQuantity;
+  long hiddenQuantity;
+};
+
+/**
+ * Quotes every newly received inquiry back to the client at a fixed price.
+ * Type T is the product type.
+ */
+template<typename T>
+class InquiryQuoteListener : public ServiceListener<Inquiry<T>>
+{
+
+public:
+
+  // ctor for the listener
+  InquiryQuoteListener(InquiryService<T> &_inquiryService, double _quotePrice = 100.0) : inquiryService(_inquiryService), quotePrice(_quotePrice) {}
+
+  void ProcessAdd(Inquiry<T> &data) override {
+    if (data.GetState() == RECEIVED) {
+      inquiryService.SendQuote(data.GetInquiryId(), quotePrice);
+    }
+  }
+
+  void ProcessRemove(Inquiry<T> &data) override {}
+
+  void ProcessUpdate(Inquiry<T> &data) override {}
+
+private:
+  InquiryService<T> &inquiryService;
+  double quotePrice;
+};
+
+/**
+ * Persists every add and update on a service into a HistoricalDataService.
+ * Type V is the value type of the upstream service.
+ */
+template<typename V>
+class HistoricalDataListener : public ServiceListener<V>
+{
+
+public:
+
+  // Extracts the persistence key from a value
+  typedef std::string (*KeyFunction)(const V &data);
+
+  // ctor for the listener
+  HistoricalDataListener(HistoricalDataService<V> &_historicalDataService, KeyFunction _keyFunction) :
+    historicalDataService(_historicalDataService), keyFunction(_keyFunction) {}
+
+  void ProcessAdd(V &data) override { historicalDataService.PersistData(keyFunction(data), data); }
+
+  void ProcessRemove(V &data) override {}
+
+  void ProcessUpdate(V &data) override { historicalDataService.PersistData(keyFunction(data), data); }
+
+private:
+  HistoricalDataService<V> &historicalDataService;
+  KeyFunction keyFunction;
+};
+
+// Persistence key for values keyed on their product
+template<typename V>
+std::string ProductPersistKey(const V &data) { return data.GetProduct().GetProductId(); }
+
+// Persistence key for execution orders
+template<typename T>
+std::string ExecutionPersistKey(const ExecutionOrder<T> &data) { return data.GetOrderId(); }
+
+// Persistence key for inquiries
+template<typename T>
+std::string InquiryPersistKey(const Inquiry<T> &data) { return data.GetInquiryId(); }
+
+/**
+ * The full service graph for a product type with all bridges registered.
+ * Connectors push data in through marketData, pricing and inquiry.
+ * Every service publishes onto the bus, and the downstream services and
+ * bridges subscribe to the event types they consume.
+ * Type T is the product type.
+ */
+template<typename T>
+class TradingPipeline
+{
+
+public:
+
+  // ctor wiring every service to its downstream subscribers, with stores pre-sized from capacity
+  explicit TradingPipeline(BusDispatchMode mode = BUS_IMMEDIATE, const ServiceCapacity &capacity = ServiceCapacity()) :
+    bus(mode),
+    marketData(capacity),
+    pricing(capacity),
+    streaming(capacity),
+    execution(capacity),
+    tradeBooking(capacity),
+    position(capacity),
+    risk(capacity),
+    inquiry(capacity),
+    positionHistory(capacity.products),
+    riskHistory(capacity.products),
+    executionHistory(capacity.orders),
+    streamingHistory(capacity.products),
+    inquiryHistory(capacity.inquiries),
+    marketDataExecution(marketData, execution),
+    executionTradeBooking(tradeBooking),
+    priceStreaming(streaming),
+    inquiryQuote(inquiry),
+    positionPersist(positionHistory, &ProductPersistKey<Position<T>>),
+    riskPersist(riskHistory, &ProductPersistKey<PV01<T>>),
+    executionPersist(executionHistory, &ExecutionPersistKey<T>),
+    streamingPersist(streamingHistory, &ProductPersistKey<PriceStream<T>>),
+    inquiryPersist(inquiryHistory, &InquiryPersistKey<T>)
+  {
+    bus.Attach(marketData);
+    bus.Attach(pricing);
+    bus.Attach(streaming);
+    bus.Attach(execution);
+    bus.Attach(tradeBooking);
+    bus.Attach(position);
+    bus.Attach(risk);
+    bus.Attach(inquiry);
+
+    bus.Subscribe<&MarketDataExecutionListener<T>::ProcessAdd>(marketDataExecution);
+    bus.Subscribe<&ExecutionTradeBookingListener<T>::ProcessAdd>(executionTradeBooking);
+    bus.Subscribe<&HistoricalDataListener<ExecutionOrder<T>>::ProcessUpdate>(executionPersist);
+    bus.Subscribe<&PositionService<T>::AddTrade>(position);
+    bus.Subscribe<&RiskService<T>::AddPosition>(risk);
+    bus.Subscribe<&HistoricalDataListener<Position<T>>::ProcessUpdate>(positionPersist);
+    bus.Subscribe<&HistoricalDataListener<PV01<T>>::ProcessUpdate>(riskPersist);
+    bus.Subscribe<&PriceStreamingListener<T>::ProcessAdd>(priceStreaming);
+    bus.Subscribe<&HistoricalDataListener<PriceStream<T>>::ProcessUpdate>(streamingPersist);
+    bus.Subscribe<&InquiryQuoteListener<T>::ProcessAdd>(inquiryQuote);
+    bus.Subscribe<&HistoricalDataListener<Inquiry<T>>::ProcessUpdate>(inquiryPersist);
+  }
+
+  // Touch every pre-sized store before the open
+  void WarmUp() {
+    marketData.WarmUp();
+    pricing.WarmUp();
+    streaming.WarmUp();
+    execution.WarmUp();
+    tradeBooking.WarmUp();
+    position.WarmUp();
+    risk.WarmUp();
+    inquiry.WarmUp();
+    positionHistory.WarmUp();
+    riskHistory.WarmUp();
+    executionHistory.WarmUp();
+    streamingHistory.WarmUp();
+    inquiryHistory.WarmUp();
+  }
+
+  TradingPipeline(const TradingPipeline&) = delete;
+  TradingPipeline& operator=(const TradingPipeline&) = delete;
+
+  // Declared first so that it outlives the services publishing onto it
+  EventBus bus;
+
+  MarketDataService<T> marketData;
+  PricingService<T> pricing;
+  StreamingService<T> streaming;
+  ExecutionService<T> execution;
+  TradeBookingService<T> tradeBooking;
+  PositionService<T> position;
+  RiskService<T> risk;
+  InquiryService<T> inquiry;
+  HistoricalDataService<Position<T>> positionHistory;
+  HistoricalDataService<PV01<T>> riskHistory;
+  HistoricalDataService<ExecutionOrder<T>> executionHistory;
+  HistoricalDataService<PriceStream<T>> streamingHistory;
+  HistoricalDataService<Inquiry<T>> inquiryHistory;
+
+private:
+  MarketDataExecutionListener<T> marketDataExecution;
+  ExecutionTradeBookingListener<T> executionTradeBooking;
+  PriceStreamingListener<T> priceStreaming;
+  InquiryQuoteListener<T> inquiryQuote;
+  HistoricalDataListener<Position<T>> positionPersist;
+  HistoricalDataListener<PV01<T>> riskPersist;
+  HistoricalDataListener<ExecutionOrder<T>> executionPersist;
+  HistoricalDataListener<PriceStream<T>> streamingPersist;
+  HistoricalDataListener<Inquiry<T>> inquiryPersist;
+};
+
+// Instantiated once in instantiations.cpp when building against the soa library
+#ifdef SOA_EXTERN_TEMPLATES
+#include "products.hpp"
+extern template class HistoricalDataService<Position<Bond>>;
+extern template class HistoricalDataService<PV01<Bond>>;
+extern template class HistoricalDataService<ExecutionOrder<Bond>>;
+extern template class HistoricalDataService<PriceStream<Bond>>;
+extern template class HistoricalDataService<Inquiry<Bond>>;
+extern template class TradingPipeline<Bond>;
+#endif
+
+#endif // PIPELINE_HPP
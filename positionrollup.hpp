@@ -0,0 +1,215 @@
+/**
+ * positionrollup.hpp
+ * Live position totals rolled up along a hierarchy of groupings, such as desk,
+ * ticker and maturity bucket.
+ *
+ * Each level of the hierarchy maps a product and book to a key. The keys of a
+ * product's position in a book pick out one path from the root of the tree to
+ * a leaf, and every node on that path holds the net position of everything
+ * below it. A change in a position adds to the nodes on its path only, so
+ * each trade touches depth + 1 nodes and any node's total is read in O(1).
+ * The path of a product and book is resolved once and cached by leaf.
+ *
+ * Listeners are notified with each node whose total changed, filtered by node
+ * path (the keys from the root joined with '/').
+ */
+#ifndef POSITION_ROLLUP_HPP
+#define POSITION_ROLLUP_HPP
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "soa.hpp"
+#include "flatstore.hpp"
+#include "products.hpp"
+
+/**
+ * One level of a rollup hierarchy: a name and the key a product's position in
+ * a book rolls up into at that level.
+ * Type T is the product type.
+ */
+template<typename T>
+struct RollupLevel
+{
+  std::string name;
+  std::function<std::string(const T &product, const std::string &book)> key;
+};
+
+/**
+ * A node of a rollup tree and the net position below it.
+ */
+struct RollupNode
+{
+  std::string path;                // keys from the root joined with '/'; empty for the root
+  std::string key;                 // key of the node at its level
+  uint32_t depth;                  // 0 for the root, level index + 1 otherwise
+  uint32_t parent;                 // handle of the parent; the root is its own parent
+  long position;                   // net position of everything below the node
+  uint64_t updates;                // position changes rolled into the node
+  std::vector<uint32_t> children;  // handles of the child nodes in creation order
+};
+
+/**
+ * Rollup tree of positions along a fixed list of levels.
+ * Type T is the product type.
+ */
+template<typename T>
+class PositionRollup
+{
+
+public:
+
+  // Dense index of a node, stable for the life of the rollup
+  typedef FlatStore<RollupNode>::Handle NodeHandle;
+
+  static constexpr NodeHandle ROOT = 0;
+  static constexpr NodeHandle NO_NODE = FlatStore<RollupNode>::NO_HANDLE;
+
+  // ctor for a rollup along levels, pre-sized for the expected number of
+  // nodes and of distinct product and book pairs
+  explicit PositionRollup(std::vector<RollupLevel<T>> _levels, size_t expectedNodes = 0, size_t expectedLeaves = 0) :
+    levels(std::move(_levels)), nodes(expectedNodes + 1) {
+    leaves.reserve(expectedLeaves);
+    nodes.EmplaceAt("", RollupNode{ "", "", 0, ROOT, 0, 0, {} });
+  }
+
+  PositionRollup(const PositionRollup&) = delete;
+  PositionRollup& operator=(const PositionRollup&) = delete;
+
+  // Roll up a change in a product's position in a book. productHandle is the
+  // product's dense handle in the PositionService that owns the positions.
+  void Apply(const T &product, uint32_t productHandle, const std::string &book, long quantity) {
+    SOA_PROBE_SERVICE("Apply");
+    const NodeHandle leaf = LeafOf(product, productHandle, book);
+    for (NodeHandle node = leaf;; node = nodes.At(node).parent) {
+      RollupNode &rollupNode = nodes.At(node);
+      rollupNode.position += quantity;
+      ++rollupNode.updates;
+      if (node == ROOT) break;
+    }
+    if (listeners.Empty()) return;
+    for (NodeHandle node = leaf;; node = nodes.At(node).parent) {
+      RollupNode &rollupNode = nodes.At(node);
+      for (auto &listener : listeners.For(rollupNode.path)) {
+        SOA_PROBE_LISTENER(listener);
+        listener->ProcessUpdate(rollupNode);
+      }
+      if (node == ROOT) break;
+    }
+  }
+
+  // Handle of the node at a path, or NO_NODE if nothing has rolled up into it
+  NodeHandle Find(const std::string &path) const noexcept {
+    return nodes.Find(path);
+  }
+
+  // Get the node at a handle from Find
+  const RollupNode& GetNode(NodeHandle handle) const noexcept {
+    return nodes.At(handle);
+  }
+
+  // Net position of the node at a handle from Find
+  long GetPosition(NodeHandle handle) const noexcept {
+    return nodes.At(handle).position;
+  }
+
+  // Net position of the node at a path
+  long GetPosition(const std::string &path) const {
+    const RollupNode *node = nodes.Get(path);
+    if (!node) {
+      throw std::runtime_error("Rollup node not found for path: " + path);
+    }
+    return node->position;
+  }
+
+  // Get the levels of the hierarchy, root excluded
+  const std::vector<RollupLevel<T>>& GetLevels() const { return levels; }
+
+  // Number of nodes, root included
+  size_t Size() const { return nodes.Size(); }
+
+  // Add a listener notified with every node whose total changes; filter keys are node paths
+  ListenerHandle AddListener(ServiceListener<RollupNode> *listener, const ListenerOptions &options = ListenerOptions()) {
+    return listeners.Add(listener, options);
+  }
+
+  // Remove a listener registration
+  bool RemoveListener(ListenerHandle handle) {
+    return listeners.Remove(handle);
+  }
+
+private:
+  std::vector<RollupLevel<T>> levels;
+  FlatStore<RollupNode> nodes;                            // by path
+  std::unordered_map<std::string, uint32_t> books;        // dense book IDs
+  std::unordered_map<uint64_t, NodeHandle> leaves;        // by product handle and book ID
+  ListenerRegistry<RollupNode> listeners;
+
+  // Leaf of a product and book, creating the nodes of its path on first use
+  NodeHandle LeafOf(const T &product, uint32_t productHandle, const std::string &book) {
+    auto knownBook = books.find(book);
+    const uint32_t bookId = knownBook != books.end() ? knownBook->second : books.emplace(book, static_cast<uint32_t>(books.size())).first->second;
+    const uint64_t leafKey = static_cast<uint64_t>(productHandle) << 32 | bookId;
+    auto it = leaves.find(leafKey);
+    if (it != leaves.end()) return it->second;
+
+    NodeHandle node = ROOT;
+    std::string path;
+    for (size_t level = 0; level < levels.size(); ++level) {
+      std::string key = levels[level].key(product, book);
+      std::string childPath = level ? path + '/' + key : key;
+      NodeHandle child = nodes.Find(childPath);
+      if (child == NO_NODE) {
+        nodes.EmplaceAt(childPath, RollupNode{ childPath, key, static_cast<uint32_t>(level + 1), node, 0, 0, {} });
+        child = nodes.LastHandle();
+        nodes.At(node).children.push_back(child);
+      }
+      node = child;
+      path = std::move(childPath);
+    }
+    leaves.emplace(leafKey, node);
+    return node;
+  }
+};
+
+// Level keyed on the desk a book belongs to; books without a desk roll up under their own name
+template<typename T>
+RollupLevel<T> DeskLevel(const std::map<std::string, std::string> &deskOfBook) {
+  return RollupLevel<T>{ "desk", [deskOfBook](const T&, const std::string &book) {
+    auto it = deskOfBook.find(book);
+    return it == deskOfBook.end() ? book : it->second;
+  } };
+}
+
+// Level keyed on the book itself
+template<typename T>
+RollupLevel<T> BookLevel() {
+  return RollupLevel<T>{ "book", [](const T&, const std::string &book) { return book; } };
+}
+
+// Level keyed on the product's ticker
+template<typename T>
+RollupLevel<T> TickerLevel() {
+  return RollupLevel<T>{ "ticker", [](const T &product, const std::string&) { return product.GetTicker(); } };
+}
+
+// Level keyed on the product's time to maturity as of a date, bucketed at
+// whole-year boundaries: boundaries { 2, 5, 10 } gives 0-2Y, 2-5Y, 5-10Y and 10Y+
+template<typename T>
+RollupLevel<T> MaturityBucketLevel(const date &asOf, const std::vector<int> &boundaries) {
+  return RollupLevel<T>{ "maturity", [asOf, boundaries](const T &product, const std::string&) {
+    const double years = (product.GetMaturityDate() - asOf).days() / 365.25;
+    int lower = 0;
+    for (int boundary : boundaries) {
+      if (years < boundary) return std::to_string(lower) + "-" + std::to_string(boundary) + "Y";
+      lower = boundary;
+    }
+    return std::to_string(lower) + "Y+";
+  } };
+}
+
+#endif // POSITION_ROLLUP_HPP
@@ -9,8 +9,14 @@
 
 #include <string>
 #include <map>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
 #include "soa.hpp"
+#include "flatstore.hpp"
 #include "tradebookingservice.hpp"
+#include "positionrollup.hpp"
+#include "tradebatch.hpp"
 
 using namespace std;
 
@@ -26,6 +32,7 @@ public:
 
   // Constructor for a position
   Position(const T &_product);
+  Position();
 
   // Get the product
   const T& GetProduct() const;
@@ -36,6 +43,9 @@ public:
   // Get the aggregate position across all books
   long GetAggregatePosition();
 
+  // Get the position quantity of every book
+  const map<string, long>& GetPositions() const;
+
   // Update the position for a specific book
   void UpdatePosition(const string &book, long quantity);
 
@@ -47,6 +57,8 @@ private:
 /**
  * Position Service to manage positions across multiple books and securities.
  * Keyed on product identifier.
+ * Every change in a position is also rolled up into the PositionRollup trees
+ * added to the service (see positionrollup.hpp).
  * Type T is the product type.
  */
 template<typename T>
@@ -55,53 +67,254 @@ class PositionService : public Service<string, Position<T>>
 
 public:
 
+  // Dense index of a product's entry, stable for the life of the service
+  typedef typename FlatStore<Position<T>>::Handle ProductHandle;
+
+  static constexpr ProductHandle NO_PRODUCT = FlatStore<Position<T>>::NO_HANDLE;
+
+  // ctor pre-sizing the position store and listener lists
+  explicit PositionService(const ServiceCapacity &capacity = ServiceCapacity()) : dataStore(capacity.products) {
+    listeners.Reserve(capacity.listeners);
+  }
+
+  // Touch every page of the pre-sized store before the open
+  void WarmUp() { dataStore.Warm(); }
+
   // Add a trade to the service
-  void AddTrade(const Trade<T> &trade) override {
+  void AddTrade(const Trade<T> &trade) {
+    SOA_PROBE_SERVICE("AddTrade");
     string productId = trade.GetProduct().GetProductId();
 
-    // Create a new position if it doesn't exist
-    if (dataStore.find(productId) == dataStore.end()) {
-      dataStore[productId] = Position<T>(trade.GetProduct());
-    }
-
-    // Update the position for the product
-    Position<T>& position = dataStore[productId];
-    position.UpdatePosition(trade.GetBook(), trade.GetSide() == BUY ? trade.GetQuantity() : -trade.GetQuantity());
+    // Create a new position if it doesn't exist, then update it for the product
+    Position<T>& position = dataStore.FindOrInsert(productId, [&]() { return Position<T>(trade.GetProduct()); });
+    const long quantity = trade.GetSide() == BUY ? trade.GetQuantity() : -trade.GetQuantity();
+    position.UpdatePosition(trade.GetBook(), quantity);
+    for (PositionRollup<T> *rollup : rollups) rollup->Apply(trade.GetProduct(), dataStore.LastHandle(), trade.GetBook(), quantity);
 
     // Notify listeners about the updated position
-    for (auto& listener : listeners) {
+    for (auto& listener : listeners.For(productId)) {
+      SOA_PROBE_LISTENER(listener);
       listener->ProcessUpdate(position);
     }
   }
 
+  // Add a batch of trades, such as an end of day trade file. Quantities are
+  // grouped by product and book and summed, each group is applied to its
+  // position and rollups once, and listeners hear once about every position
+  // the batch touched. Positions end up as if each trade were added in turn.
+  void AddTrades(const vector<Trade<T>> &trades) {
+    AddTrades(trades.begin(), trades.end());
+  }
+
+  // Add the batch of trades in [first, last)
+  template<typename Iterator>
+  void AddTrades(Iterator first, Iterator last) {
+    SOA_PROBE_SERVICE("AddTrades");
+    batch.keys.clear();
+    batch.bookIds.clear();
+    batch.quantities.clear();
+
+    // Resolve every trade to its product handle and book ID; trade files are
+    // usually grouped, so a repeat of the previous product or book skips the
+    // lookup. The previous ones are compared through owned copies, since an
+    // iterator may hand out each trade by value.
+    ProductHandle handle = NO_PRODUCT;
+    uint32_t bookId = 0;
+    for (; first != last; ++first) {
+      const Trade<T> &trade = *first;
+      const string &productId = trade.GetProduct().GetProductId();
+      if (handle == NO_PRODUCT || productId != batch.productId) {
+        batch.productId = productId;
+        dataStore.FindOrInsert(productId, [&]() { return Position<T>(trade.GetProduct()); });
+        handle = dataStore.LastHandle();
+      }
+      const string &book = trade.GetBook();
+      if (batch.keys.empty() || book != batch.books[bookId]) {
+        auto known = batch.bookIndex.find(book);
+        if (known == batch.bookIndex.end()) {
+          known = batch.bookIndex.emplace(book, static_cast<uint32_t>(batch.books.size())).first;
+          batch.books.push_back(book);
+        }
+        bookId = known->second;
+      }
+      batch.keys.push_back(handle);
+      batch.bookIds.push_back(bookId);
+      batch.quantities.push_back(trade.GetSide() == BUY ? trade.GetQuantity() : -trade.GetQuantity());
+    }
+    if (batch.keys.empty()) return;
+
+    // Group by product, then book
+    const int bookBits = KeyBits(batch.books.size() - 1);
+    for (size_t i = 0; i < batch.keys.size(); ++i) batch.keys[i] = batch.keys[i] << bookBits | batch.bookIds[i];
+    RadixSortByKey(batch.keys, batch.quantities, KeyBits(static_cast<uint64_t>(dataStore.Size() - 1) << bookBits | ((uint64_t(1) << bookBits) - 1)),
+                   batch.keyScratch, batch.quantityScratch);
+
+    const uint64_t bookMask = (uint64_t(1) << bookBits) - 1;
+    ProductHandle touched = NO_PRODUCT;
+    for (size_t begin = 0, end = 0; begin < batch.keys.size(); begin = end) {
+      const uint64_t key = batch.keys[begin];
+      while (end < batch.keys.size() && batch.keys[end] == key) ++end;
+      const long quantity = SumQuantities(&batch.quantities[begin], end - begin);
+      const ProductHandle product = static_cast<ProductHandle>(key >> bookBits);
+      const string &groupBook = batch.books[key & bookMask];
+      if (product != touched && touched != NO_PRODUCT) NotifyUpdate(dataStore.At(touched));
+      touched = product;
+      Position<T> &position = dataStore.At(product);
+      position.UpdatePosition(groupBook, quantity);
+      if (quantity) for (PositionRollup<T> *rollup : rollups) rollup->Apply(position.GetProduct(), product, groupBook, quantity);
+    }
+    NotifyUpdate(dataStore.At(touched));
+  }
+
+  // OnMessage callback for positions pushed by a Connector
+  void OnMessage(Position<T> &data) override {
+    SOA_PROBE_SERVICE("OnMessage");
+    string productId = data.GetProduct().GetProductId();
+    map<string, long> before = PositionsBefore(productId);
+    NotifyUpdate(RollUpReplaced(before, dataStore.Upsert(productId, data)));
+  }
+
+  // OnMessage callback for positions a Connector hands over, moved into the store
+  void OnMessage(Position<T> &&data) override {
+    SOA_PROBE_SERVICE("OnMessage");
+    string productId = data.GetProduct().GetProductId();
+    map<string, long> before = PositionsBefore(productId);
+    NotifyUpdate(RollUpReplaced(before, dataStore.Upsert(productId, std::move(data))));
+  }
+
+  // Store a position constructed in place from Position<T> ctor arguments
+  template<typename... Args>
+  void EmplaceData(Args&&... args) {
+    SOA_PROBE_SERVICE("EmplaceData");
+    // A replaced position is diffed against the new one, so it must be seen first
+    if (!rollups.empty()) return OnMessage(Position<T>(std::forward<Args>(args)...));
+    NotifyUpdate(dataStore.Emplace([](const Position<T> &position) { return position.GetProduct().GetProductId(); }, std::forward<Args>(args)...));
+  }
+
   // Get data for a specific product
   Position<T>& GetData(string productId) override {
-    if (dataStore.find(productId) != dataStore.end()) {
-      return dataStore[productId];
-    } else {
+    Position<T> *position = dataStore.Get(productId);
+    if (!position) {
       throw runtime_error("Position not found for product ID: " + productId);
     }
+    return *position;
+  }
+
+  // Get data by product ID, or nullptr if there is none; never throws
+  Position<T>* TryGetData(const string &productId) noexcept override {
+    return dataStore.Get(productId);
+  }
+
+  // Handle of a product, or NO_PRODUCT if nothing has been stored for it
+  ProductHandle GetProductHandle(const string &productId) const noexcept {
+    return dataStore.Find(productId);
+  }
+
+  // Get data by a handle from GetProductHandle; never throws
+  Position<T>& GetData(ProductHandle handle) noexcept {
+    return dataStore.At(handle);
+  }
+
+  // Roll every position change up into a rollup from now on, seeding it with
+  // the current positions. The rollup must outlive its registration.
+  void AddRollup(PositionRollup<T> &rollup) {
+    for (size_t handle = 0; handle < dataStore.Size(); ++handle) {
+      const Position<T> &position = dataStore.At(static_cast<ProductHandle>(handle));
+      for (const auto &entry : position.GetPositions()) {
+        if (entry.second) rollup.Apply(position.GetProduct(), static_cast<uint32_t>(handle), entry.first, entry.second);
+      }
+    }
+    rollups.push_back(&rollup);
+  }
+
+  // Stop rolling positions up into a rollup; returns false if it was not added
+  bool RemoveRollup(PositionRollup<T> &rollup) {
+    auto it = find(rollups.begin(), rollups.end(), &rollup);
+    if (it == rollups.end()) return false;
+    rollups.erase(it);
+    return true;
   }
 
   // Add a listener to the service
   void AddListener(ServiceListener<Position<T>>* listener) override {
-    listeners.push_back(listener);
+    listeners.Add(listener);
+  }
+
+  // Add a listener with a priority and product filter
+  ListenerHandle AddListener(ServiceListener<Position<T>>* listener, const ListenerOptions &options) override {
+    return listeners.Add(listener, options);
+  }
+
+  // Remove a listener registration
+  bool RemoveListener(ListenerHandle handle) override {
+    return listeners.Remove(handle);
   }
 
   // Get all listeners
   const vector<ServiceListener<Position<T>>*>& GetListeners() const override {
-    return listeners;
+    return listeners.All();
   }
 
 private:
-  map<string, Position<T>> dataStore; // Map to store positions by product ID
-  vector<ServiceListener<Position<T>>*> listeners; // Listeners to notify on updates
+  FlatStore<Position<T>> dataStore; // Positions by product ID
+  ListenerRegistry<Position<T>> listeners; // Listeners to notify on updates
+  vector<PositionRollup<T>*> rollups; // Rollups to maintain on every change
+
+  // Working arrays of AddTrades, kept between batches to avoid reallocating
+  struct TradeBatch
+  {
+    vector<uint64_t> keys;               // product handle, then product and book key
+    vector<uint64_t> keyScratch;
+    vector<uint32_t> bookIds;
+    vector<int64_t> quantities;          // signed, parallel to keys
+    vector<int64_t> quantityScratch;
+    vector<string> books;                // by book ID
+    unordered_map<string, uint32_t> bookIndex;
+    string productId;                    // product of the previous trade
+  };
+
+  TradeBatch batch;
+
+  // Book positions of a product about to be replaced, if any rollup needs them
+  map<string, long> PositionsBefore(const string &productId) const {
+    const Position<T> *before = rollups.empty() ? nullptr : dataStore.Get(productId);
+    return before ? before->GetPositions() : map<string, long>();
+  }
+
+  // Roll up the change from the replaced book positions to the stored position
+  Position<T>& RollUpReplaced(const map<string, long> &before, Position<T> &stored) {
+    if (rollups.empty()) return stored;
+    const uint32_t handle = dataStore.LastHandle();
+    const map<string, long> &after = stored.GetPositions();
+    for (const auto &entry : after) {
+      auto previous = before.find(entry.first);
+      long change = entry.second - (previous == before.end() ? 0 : previous->second);
+      if (change) for (PositionRollup<T> *rollup : rollups) rollup->Apply(stored.GetProduct(), handle, entry.first, change);
+    }
+    for (const auto &entry : before) {
+      if (entry.second && !after.count(entry.first)) {
+        for (PositionRollup<T> *rollup : rollups) rollup->Apply(stored.GetProduct(), handle, entry.first, -entry.second);
+      }
+    }
+    return stored;
+  }
+
+  // Notify the listeners for the position's product of a stored position
+  void NotifyUpdate(Position<T> &stored) {
+    for (auto& listener : listeners.For(stored.GetProduct().GetProductId())) {
+      SOA_PROBE_LISTENER(listener);
+      listener->ProcessUpdate(stored);
+    }
+  }
 };
 
 // Implementation of Position class methods
 template<typename T>
 Position<T>::Position(const T &_product) : product(_product) {}
 
+template<typename T>
+Position<T>::Position() {}
+
 template<typename T>
 const T& Position<T>::GetProduct() const {
   return product;
@@ -121,9 +334,21 @@ long Position<T>::GetAggregatePosition() {
   return aggregate;
 }
 
+template<typename T>
+const map<string, long>& Position<T>::GetPositions() const {
+  return positions;
+}
+
 template<typename T>
 void Position<T>::UpdatePosition(const string &book, long quantity) {
   positions[book] += quantity;
 }
 
+// Instantiated once in instantiations.cpp when building against the soa library
+#ifdef SOA_EXTERN_TEMPLATES
+#include "products.hpp"
+SOA_EXTERN_PRODUCT_TEMPLATE(Position)
+SOA_EXTERN_PRODUCT_TEMPLATE(PositionService)
+#endif
+
 #endif // POSITION_SERVICE_HPP
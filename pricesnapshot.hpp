@@ -0,0 +1,117 @@
+/**
+ * pricesnapshot.hpp
+ * Latest mid and bid/offer spread of every product in dense arrays, for
+ * consumers that read the whole universe at once.
+ *
+ * Products are grouped in blocks of BLOCK_SIZE, each holding the block's mids
+ * and spreads in two contiguous arrays, and the blocks are the values of a
+ * SeqLockArray. A store updates one product's mid and spread in place under
+ * its block's sequence number, and a reader copies whole blocks with
+ * sequential loads into plain vectors it can then run vectorized loops over.
+ * A whole-universe copy therefore never tears a mid from its spread and only
+ * ever retries one block.
+ *
+ * A version counter is bumped on every store. A copy reports whether the
+ * version held still while it was taken, in which case it is a consistent
+ * cut of all products; readers that need one retry until it is.
+ */
+#ifndef PRICE_SNAPSHOT_HPP
+#define PRICE_SNAPSHOT_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include "seqlockarray.hpp"
+
+/**
+ * A copy of every product's mid and spread, indexed by product handle.
+ */
+struct PriceSnapshot
+{
+  std::vector<double> mids;
+  std::vector<double> bidOfferSpreads;
+  uint64_t version = 0;     // stores made before the copy started
+  bool consistent = false;  // no store landed while the copy was taken
+};
+
+/**
+ * Dense, block-seqlocked mids and spreads by product handle.
+ * Store and Reserve are for the single writer thread; Copy, Version and Size
+ * for any thread.
+ */
+class PriceSnapshotArray
+{
+
+public:
+
+  static const size_t BLOCK_SIZE = 64;
+
+  // ctor reserving room for expectedSize products
+  explicit PriceSnapshotArray(size_t expectedSize = 0) : blocks(BlocksFor(expectedSize)), size(0), version(0) {}
+
+  PriceSnapshotArray(const PriceSnapshotArray&) = delete;
+  PriceSnapshotArray& operator=(const PriceSnapshotArray&) = delete;
+
+  // Allocate room for at least expectedSize products
+  void Reserve(size_t expectedSize) { blocks.Reserve(BlocksFor(expectedSize)); }
+
+  // Store the price at a product handle; index may be at most Size(), which appends
+  void Store(size_t index, double mid, double bidOfferSpread) {
+    size_t current = size.load(std::memory_order_relaxed);
+    if (index > current) throw std::out_of_range("PriceSnapshotArray: store past the end");
+    const size_t slot = index % BLOCK_SIZE;
+    blocks.Update(index / BLOCK_SIZE, [&](const SeqLockArray<PriceBlock>::FieldWriter &store) {
+      store(offsetof(PriceBlock, mids) + slot * sizeof(double), mid);
+      store(offsetof(PriceBlock, bidOfferSpreads) + slot * sizeof(double), bidOfferSpread);
+    });
+    if (index == current) size.store(current + 1, std::memory_order_release);
+    version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  // Copy every product's price into snapshot, reusing its vectors. Returns
+  // whether the copy is a consistent cut of all products.
+  bool Copy(PriceSnapshot &snapshot) const {
+    snapshot.version = version.load(std::memory_order_acquire);
+    const size_t count = Size();
+    snapshot.mids.resize(count);
+    snapshot.bidOfferSpreads.resize(count);
+    for (size_t first = 0; first < count; first += BLOCK_SIZE) {
+      const PriceBlock block = blocks.Load(first / BLOCK_SIZE);
+      const size_t products = count - first < BLOCK_SIZE ? count - first : BLOCK_SIZE;
+      std::memcpy(snapshot.mids.data() + first, block.mids, products * sizeof(double));
+      std::memcpy(snapshot.bidOfferSpreads.data() + first, block.bidOfferSpreads, products * sizeof(double));
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    snapshot.consistent = version.load(std::memory_order_relaxed) == snapshot.version;
+    return snapshot.consistent;
+  }
+
+  // Stores made so far; unchanged means every price is as last copied
+  uint64_t Version() const { return version.load(std::memory_order_acquire); }
+
+  // Number of products stored; handles below it may be copied
+  size_t Size() const { return size.load(std::memory_order_acquire); }
+
+  // Write to every page of the reserved blocks so they are faulted in before use
+  void Warm() { blocks.Warm(); }
+
+private:
+
+  // Prices of one block of products
+  struct PriceBlock
+  {
+    double mids[BLOCK_SIZE];
+    double bidOfferSpreads[BLOCK_SIZE];
+  };
+
+  static size_t BlocksFor(size_t products) { return (products + BLOCK_SIZE - 1) / BLOCK_SIZE; }
+
+  SeqLockArray<PriceBlock> blocks;
+  std::atomic<size_t> size;
+  alignas(64) std::atomic<uint64_t> version;
+};
+
+#endif // PRICE_SNAPSHOT_HPP
@@ -0,0 +1,134 @@
+/**
+ * pricingengine.hpp
+ * Derives internal prices from market data.
+ *
+ * The PricingEngine listens to the depth signals of a MarketDataService, which
+ * are published whenever the top levels of a product's book change, and turns
+ * the best bid and offer into a mid and bid/offer spread: the mid is moved by
+ * a skew, and the spread is tightened and floored at a minimum spread, all in
+ * 1/256ths. A price is published to the PricingService only when its mid or
+ * spread has moved at least a tick from the last price published for the
+ * product. The first price of a product is stored through PublishPrice; every
+ * later one is written over it in place through UpdatePrice, so steady state
+ * updates do not allocate.
+ */
+#ifndef PRICING_ENGINE_HPP
+#define PRICING_ENGINE_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "soa.hpp"
+#include "booksignals.hpp"
+#include "marketdataservice.hpp"
+#include "pricingservice.hpp"
+
+/**
+ * How the PricingEngine derives prices from the best bid and offer. Every
+ * field is in 1/256ths.
+ */
+struct PricingOptions
+{
+  double skew = 0.0;           // added to the mid of the book
+  double tightening = 0.0;     // taken off the spread of the book
+  double minimumSpread = 1.0;  // floor of the published spread
+  double tick = 1.0;           // smallest move of mid or spread that is published
+};
+
+/**
+ * Counts kept by a PricingEngine.
+ */
+struct PricingStats
+{
+  uint64_t ticks = 0;      // signal updates received
+  uint64_t published = 0;  // prices published
+  uint64_t unchanged = 0;  // ticks that moved mid and spread by less than a tick
+  uint64_t oneSided = 0;   // ticks with an empty side, which are not priced
+};
+
+/**
+ * Prices products from the top of their books in a MarketDataService.
+ * Type T is the product type.
+ */
+template<typename T>
+class PricingEngine : public ServiceListener<BookSignals>
+{
+
+public:
+
+  // ctor registering the engine for the signals of every product in
+  // marketData, pre-sized for the expected number of products
+  PricingEngine(MarketDataService<T> &_marketData, PricingService<T> &_pricing, const PricingOptions &_options = PricingOptions(), size_t expectedProducts = 0) :
+    marketData(_marketData), pricing(_pricing), options(_options) {
+    quotes.reserve(expectedProducts);
+    registration = marketData.AddSignalListener(this);
+  }
+
+  ~PricingEngine() { marketData.RemoveSignalListener(registration); }
+
+  PricingEngine(const PricingEngine&) = delete;
+  PricingEngine& operator=(const PricingEngine&) = delete;
+
+  void ProcessAdd(BookSignals &data) override { ProcessUpdate(data); }
+
+  void ProcessRemove(BookSignals &) override {}
+
+  // Price the product of a signal update, publishing if it moved a tick
+  void ProcessUpdate(BookSignals &data) override {
+    SOA_PROBE_SERVICE("ProcessUpdate");
+    ++stats.ticks;
+    if (!data.bidLevels || !data.offerLevels) {
+      ++stats.oneSided;
+      return;
+    }
+    const double mid = data.mid + options.skew / 256.0;
+    const double spread = std::max(data.spread - options.tightening / 256.0, options.minimumSpread / 256.0);
+    if (data.product >= quotes.size()) quotes.resize(data.product + 1);
+    Quote &quote = quotes[data.product];
+    if (quote.price == PricingService<T>::NO_PRODUCT) {
+      const T &product = marketData.GetData(data.product).GetProduct();
+      pricing.PublishPrice(Price<T>(product, mid, spread));
+      quote.price = pricing.GetProductHandle(product.GetProductId());
+    } else if (Moved(mid, quote.mid) || Moved(spread, quote.spread)) {
+      pricing.UpdatePrice(quote.price, mid, spread);
+    } else {
+      ++stats.unchanged;
+      return;
+    }
+    quote.mid = mid;
+    quote.spread = spread;
+    ++stats.published;
+  }
+
+  // Get the options prices are derived with
+  const PricingOptions& GetOptions() const { return options; }
+
+  // Get the counts of ticks seen and prices published
+  const PricingStats& GetStats() const { return stats; }
+
+private:
+
+  // Last price published for a product
+  struct Quote
+  {
+    typename PricingService<T>::ProductHandle price = PricingService<T>::NO_PRODUCT;
+    double mid = 0.0;
+    double spread = 0.0;
+  };
+
+  MarketDataService<T> &marketData;
+  PricingService<T> &pricing;
+  PricingOptions options;
+  PricingStats stats;
+  std::vector<Quote> quotes; // by market data product handle
+  ListenerHandle registration;
+
+  // Whether a value moved at least a tick from the last one published, with
+  // room for rounding in prices that sit on the 1/256 grid
+  bool Moved(double value, double published) const {
+    return std::fabs(value - published) >= options.tick / 256.0 * (1.0 - 1e-9);
+  }
+};
+
+#endif // PRICING_ENGINE_HPP
@@ -8,7 +8,10 @@
 #define PRICING_SERVICE_HPP
 
 #include <string>
+#include <stdexcept>
 #include "soa.hpp"
+#include "flatstore.hpp"
+#include "pricesnapshot.hpp"
 
 /**
  * A price object consisting of mid and bid/offer spread.
@@ -22,6 +25,7 @@ public:
 
   // Constructor for a price
   Price(const T &_product, double _mid, double _bidOfferSpread);
+  Price();
 
   // Get the product
   const T& GetProduct() const;
@@ -32,8 +36,11 @@ public:
   // Get the bid/offer spread around the mid
   double GetBidOfferSpread() const;
 
+  // Set the mid price and bid/offer spread
+  void Set(double _mid, double _bidOfferSpread);
+
 private:
-  const T& product;
+  T product;
   double mid;
   double bidOfferSpread;
 };
@@ -41,6 +48,9 @@ private:
 /**
  * Pricing Service managing mid prices and bid/offers.
  * Keyed on product identifier.
+ * The latest mid and spread of every product are also kept in dense arrays by
+ * product handle (see pricesnapshot.hpp), which consumers needing every price
+ * at once copy from any thread with GetPriceSnapshot.
  * Type T is the product type.
  */
 template<typename T>
@@ -49,39 +59,142 @@ class PricingService : public Service<string, Price<T>>
 
 public:
 
+  // Dense index of a product's entry, stable for the life of the service
+  typedef typename FlatStore<Price<T>>::Handle ProductHandle;
+
+  static constexpr ProductHandle NO_PRODUCT = FlatStore<Price<T>>::NO_HANDLE;
+
+  // ctor pre-sizing the price store and listener lists
+  explicit PricingService(const ServiceCapacity &capacity = ServiceCapacity()) : dataStore(capacity.products), snapshot(capacity.products) {
+    listeners.Reserve(capacity.listeners);
+  }
+
+  // Touch every page of the pre-sized store before the open
+  void WarmUp() {
+    dataStore.Warm();
+    snapshot.Warm();
+  }
+
   // Publish a price to the service
   void PublishPrice(const Price<T> &price) {
+    SOA_PROBE_SERVICE("PublishPrice");
     string productId = price.GetProduct().GetProductId();
-    dataStore[productId] = price;
+    NotifyAdd(productId, Snap(dataStore.Upsert(productId, price)));
+  }
+
+  // Publish a price the caller hands over, moving it into the store
+  void PublishPrice(Price<T> &&price) {
+    SOA_PROBE_SERVICE("PublishPrice");
+    string productId = price.GetProduct().GetProductId();
+    NotifyAdd(productId, Snap(dataStore.Upsert(productId, std::move(price))));
+  }
 
-    // Notify all listeners
-    for (auto &listener : listeners) {
-      listener->ProcessAdd(price);
+  // Publish a price constructed in the store from Price<T> ctor arguments
+  template<typename... Args>
+  void EmplaceData(Args&&... args) {
+    SOA_PROBE_SERVICE("EmplaceData");
+    Price<T> &stored = Snap(dataStore.Emplace([](const Price<T> &price) { return price.GetProduct().GetProductId(); }, std::forward<Args>(args)...));
+    NotifyAdd(stored.GetProduct().GetProductId(), stored);
+  }
+
+  // OnMessage callback for prices pushed by a Connector
+  void OnMessage(Price<T> &data) override {
+    PublishPrice(data);
+  }
+
+  // OnMessage callback for prices a Connector hands over
+  void OnMessage(Price<T> &&data) override {
+    PublishPrice(std::move(data));
+  }
+
+  // Change the stored price of a product handle in place and notify listeners
+  // with an update; never allocates
+  void UpdatePrice(ProductHandle handle, double mid, double bidOfferSpread) {
+    SOA_PROBE_SERVICE("UpdatePrice");
+    Price<T> &stored = dataStore.At(handle);
+    stored.Set(mid, bidOfferSpread);
+    snapshot.Store(handle, mid, bidOfferSpread);
+    for (auto &listener : listeners.For(stored.GetProduct().GetProductId())) {
+      SOA_PROBE_LISTENER(listener);
+      listener->ProcessUpdate(stored);
     }
   }
 
   // Get data for a specific product
   Price<T>& GetData(string productId) override {
-    if (dataStore.find(productId) != dataStore.end()) {
-      return dataStore[productId];
-    } else {
+    Price<T> *price = dataStore.Get(productId);
+    if (!price) {
       throw runtime_error("Price not found for product ID: " + productId);
     }
+    return *price;
+  }
+
+  // Get data by product ID, or nullptr if there is none; never throws
+  Price<T>* TryGetData(const string &productId) noexcept override {
+    return dataStore.Get(productId);
+  }
+
+  // Handle of a product, or NO_PRODUCT if nothing has been stored for it
+  ProductHandle GetProductHandle(const string &productId) const noexcept {
+    return dataStore.Find(productId);
+  }
+
+  // Get data by a handle from GetProductHandle; never throws
+  Price<T>& GetData(ProductHandle handle) noexcept {
+    return dataStore.At(handle);
+  }
+
+  // Copy the latest mid and spread of every product, indexed by product
+  // handle, into copy; reuses its vectors. Safe from any thread. Returns
+  // whether the copy is a consistent cut of all products.
+  bool GetPriceSnapshot(PriceSnapshot &copy) const {
+    return snapshot.Copy(copy);
+  }
+
+  // Prices stored so far; a consumer seeing it unchanged may skip a snapshot.
+  // Safe from any thread.
+  uint64_t GetPriceVersion() const {
+    return snapshot.Version();
   }
 
   // Add a listener to the service
   void AddListener(ServiceListener<Price<T>>* listener) override {
-    listeners.push_back(listener);
+    listeners.Add(listener);
+  }
+
+  // Add a listener with a priority and product filter
+  ListenerHandle AddListener(ServiceListener<Price<T>>* listener, const ListenerOptions &options) override {
+    return listeners.Add(listener, options);
+  }
+
+  // Remove a listener registration
+  bool RemoveListener(ListenerHandle handle) override {
+    return listeners.Remove(handle);
   }
 
   // Get all listeners
   const vector<ServiceListener<Price<T>>*>& GetListeners() const override {
-    return listeners;
+    return listeners.All();
   }
 
 private:
-  map<string, Price<T>> dataStore; // Map to store prices by product ID
-  vector<ServiceListener<Price<T>>*> listeners; // Listeners to notify on updates
+  FlatStore<Price<T>> dataStore; // Prices by product ID
+  ListenerRegistry<Price<T>> listeners; // Listeners to notify on updates
+  PriceSnapshotArray snapshot; // Mids and spreads by product handle
+
+  // Copy the price just stored into the snapshot arrays
+  Price<T>& Snap(Price<T> &stored) {
+    snapshot.Store(dataStore.LastHandle(), stored.GetMid(), stored.GetBidOfferSpread());
+    return stored;
+  }
+
+  // Notify the listeners for a product of a stored price
+  void NotifyAdd(const string &productId, Price<T> &stored) {
+    for (auto &listener : listeners.For(productId)) {
+      SOA_PROBE_LISTENER(listener);
+      listener->ProcessAdd(stored);
+    }
+  }
 };
 
 // Implementation of Price class methods
@@ -89,6 +202,9 @@ template<typename T>
 Price<T>::Price(const T &_product, double _mid, double _bidOfferSpread) :
   product(_product), mid(_mid), bidOfferSpread(_bidOfferSpread) {}
 
+template<typename T>
+Price<T>::Price() : mid(0.0), bidOfferSpread(0.0) {}
+
 template<typename T>
 const T& Price<T>::GetProduct() const {
   return product;
@@ -104,4 +220,17 @@ double Price<T>::GetBidOfferSpread() const {
   return bidOfferSpread;
 }
 
+template<typename T>
+void Price<T>::Set(double _mid, double _bidOfferSpread) {
+  mid = _mid;
+  bidOfferSpread = _bidOfferSpread;
+}
+
+// Instantiated once in instantiations.cpp when building against the soa library
+#ifdef SOA_EXTERN_TEMPLATES
+#include "products.hpp"
+SOA_EXTERN_PRODUCT_TEMPLATE(Price)
+SOA_EXTERN_PRODUCT_TEMPLATE(PricingService)
+#endif
+
 #endif // PRICING_SERVICE_HPP
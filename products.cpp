@@ -0,0 +1,83 @@
+/**
+ * products.cpp
+ * Output and string conversions for the Bond and Interest Rate Swap products.
+ */
+#include "products.hpp"
+
+ostream& operator<<(ostream &output, const Bond &bond) {
+  output << bond.ticker << " " << bond.coupon << " " << bond.GetMaturityDate();
+  return output;
+}
+
+ostream& operator<<(ostream &output, const IRSwap &swap) {
+  output << "fixedDayCount:" << swap.ToString(swap.GetFixedLegDayCountConvention()) << " floatingDayCount:" << swap.ToString(swap.GetFloatingLegDayCountConvention()) << " paymentFreq:" << swap.ToString(swap.GetFixedLegPaymentFrequency()) << " " << swap.ToString(swap.GetFloatingIndexTenor()) << swap.ToString(swap.GetFloatingIndex()) << " effective:" << swap.GetEffectiveDate() << " termination:" << swap.GetTerminationDate() << " " << swap.ToString(swap.GetCurrency()) << " " << swap.GetTermYears() << "yrs " << swap.ToString(swap.GetSwapType()) << " " << swap.ToString(swap.GetSwapLegType());
+  return output;
+}
+
+string IRSwap::ToString(DayCountConvention dayCountConvention) const {
+  switch (dayCountConvention) {
+  case THIRTY_THREE_SIXTY: return "30/360";
+  case ACT_THREE_SIXTY: return "Act/360";
+  default: return "";
+  }
+}
+
+string IRSwap::ToString(PaymentFrequency paymentFrequency) const {
+  switch (paymentFrequency) {
+  case QUARTERLY: return "Quarterly";
+  case SEMI_ANNUAL: return "Semi-Annual";
+  case ANNUAL: return "Annual";
+  default: return "";
+  }
+}
+
+string IRSwap::ToString(FloatingIndex floatingIndex) const {
+  switch (floatingIndex) {
+  case LIBOR: return "LIBOR";
+  case EURIBOR: return "EURIBOR";
+  default: return "";
+  }
+}
+
+string IRSwap::ToString(FloatingIndexTenor floatingIndexTenor) const
+{ 
+  switch(floatingIndexTenor) {
+  case TENOR_1M: return "1m";
+  case TENOR_3M: return "3m";
+  case TENOR_6M: return "6m";
+  case TENOR_12M: return "12m";
+  default: return "";
+  }
+}
+
+string IRSwap::ToString(Currency currency) const
+{ 
+  switch(currency) {
+  case USD: return "USD";
+  case EUR: return "EUR";
+  case GBP: return "GBP";
+  default: return "";
+  }
+}
+
+string IRSwap::ToString(SwapType swapType) const
+{ 
+  switch(swapType) {
+  case STANDARD: return "Standard";
+  case FORWARD: return "Forward";
+  case IMM: return "IMM";
+  case MAC: return "MAC";
+  case BASIS: return "Basis";
+  default: return "";
+  }
+}
+
+string IRSwap::ToString(SwapLegType swapLegType) const
+{ 
+  switch(swapLegType) {
+  case OUTRIGHT: return "Outright";
+  case CURVE: return "Curve";
+  case FLY: return "Fly";
+  default: return "";
+  }
+}
@@ -0,0 +1,198 @@
+/**
+ * replayengine.hpp
+ * Replays recorded journals through the services with their original timing.
+ *
+ * Each journal is read sequentially and the journals are merged into a single
+ * timestamp-ordered stream with a k-way heap merge. Events are injected through
+ * the matching Service::OnMessage callback, either paced at a multiple of the
+ * recorded inter-arrival times or as fast as possible.
+ *
+ * Block journals are read a block at a time. A replay starting part way through
+ * a session seeks them through their index, decompressing only the blocks from
+ * the start time onwards; text journals skip the earlier lines.
+ */
+#ifndef REPLAY_ENGINE_HPP
+#define REPLAY_ENGINE_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "journal.hpp"
+
+// Replay as fast as possible, ignoring recorded timing
+const double REPLAY_MAX_SPEED = 0.0;
+
+/**
+ * Outcome of a replay run.
+ */
+struct ReplayStats
+{
+  uint64_t events = 0;
+  uint64_t eventsByType[4] = { 0, 0, 0, 0 };
+  double seconds = 0.0;           // wall time spent replaying
+  uint64_t recordedNanos = 0;     // span between first and last recorded timestamp
+  uint64_t maxLagNanos = 0;       // worst delay of an injection behind its schedule
+
+  // Achieved injection rate
+  double EventsPerSecond() const { return seconds > 0.0 ? events / seconds : 0.0; }
+};
+
+/**
+ * Replay driver over a set of journals.
+ */
+class ReplayEngine
+{
+
+public:
+
+  // ctor for an engine resolving products against the given universe
+  ReplayEngine(const std::vector<Bond> &products, const TickSinks &_sinks) : parser(products), sinks(_sinks), startTimestamp(0) {}
+
+  // Add a journal of the given event type; a path ending in BLOCK_JOURNAL_SUFFIX is read as a block journal
+  void AddJournal(TickType type, const std::string &path) {
+    const size_t suffix = std::strlen(BLOCK_JOURNAL_SUFFIX);
+    const bool compressed = path.size() >= suffix && path.compare(path.size() - suffix, suffix, BLOCK_JOURNAL_SUFFIX) == 0;
+    std::unique_ptr<Cursor> cursor(new Cursor(type, path, compressed));
+    if (!compressed && !cursor->stream) throw std::runtime_error("Unable to open journal: " + path);
+    cursors.push_back(std::move(cursor));
+  }
+
+  // Add whichever of the four standard journals exist in a directory, preferring text over block journals
+  void AddJournals(const std::string &directory) {
+    const TickType types[] = { TICK_ORDER_BOOK, TICK_PRICE, TICK_TRADE, TICK_INQUIRY };
+    const char* const names[] = { MARKET_DATA_JOURNAL, PRICE_JOURNAL, TRADE_JOURNAL, INQUIRY_JOURNAL };
+    for (int i = 0; i < 4; ++i) {
+      std::string path = JournalPath(directory, names[i], JOURNAL_TEXT);
+      std::string blockPath = JournalPath(directory, names[i], JOURNAL_BLOCKS);
+      if (std::ifstream(path)) AddJournal(types[i], path);
+      else if (std::ifstream(blockPath)) AddJournal(types[i], blockPath);
+    }
+  }
+
+  // Skip events recorded before timestamp on the next Run
+  void SetStart(uint64_t timestamp) { startTimestamp = timestamp; }
+
+  // Replay every journal to the end. speed is a multiple of recorded time (1x, 10x, ...)
+  // or REPLAY_MAX_SPEED to inject without pacing.
+  ReplayStats Run(double speed) {
+    typedef std::chrono::steady_clock Clock;
+    ReplayStats stats;
+    std::priority_queue<HeapEntry, std::vector<HeapEntry>, std::greater<HeapEntry>> heap;
+    for (size_t i = 0; i < cursors.size(); ++i) {
+      if (cursors[i]->Start(startTimestamp)) heap.push(HeapEntry{ cursors[i]->timestamp, i });
+    }
+    if (heap.empty()) return stats;
+
+    const uint64_t firstTimestamp = heap.top().timestamp;
+    uint64_t lastTimestamp = firstTimestamp;
+    const Clock::time_point start = Clock::now();
+    while (!heap.empty()) {
+      HeapEntry next = heap.top();
+      heap.pop();
+      Cursor &cursor = *cursors[next.cursor];
+
+      if (speed > 0.0) {
+        Clock::time_point due = start + std::chrono::nanoseconds(static_cast<int64_t>((next.timestamp - firstTimestamp) / speed));
+        Clock::time_point now = Clock::now();
+        if (now < due) {
+          // Sleep through long gaps, spin through the last stretch for accuracy
+          if (due - now > std::chrono::milliseconds(2)) std::this_thread::sleep_for(due - now - std::chrono::milliseconds(1));
+          while (Clock::now() < due) {}
+        } else {
+          uint64_t lag = std::chrono::duration_cast<std::chrono::nanoseconds>(now - due).count();
+          if (lag > stats.maxLagNanos) stats.maxLagNanos = lag;
+        }
+      }
+
+      Inject(cursor.type, cursor.line);
+      ++stats.events;
+      ++stats.eventsByType[cursor.type];
+      lastTimestamp = next.timestamp;
+      if (cursor.Advance()) heap.push(HeapEntry{ cursor.timestamp, next.cursor });
+    }
+    stats.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    stats.recordedNanos = lastTimestamp - firstTimestamp;
+    return stats;
+  }
+
+private:
+
+  // Read position within one journal
+  struct Cursor
+  {
+    Cursor(TickType _type, const std::string &path, bool compressed) : type(_type), timestamp(0) {
+      if (compressed) blocks.reset(new BlockJournalReader(path));
+      else stream.open(path);
+    }
+
+    // Load the first line stamped at or after from, returning false if there is none
+    bool Start(uint64_t from) {
+      if (blocks) blocks->Seek(from);
+      while (Advance()) {
+        if (timestamp >= from) return true;
+      }
+      return false;
+    }
+
+    // Load the next non-empty line, returning false at end of file
+    bool Advance() {
+      while (blocks ? blocks->NextLine(line) : static_cast<bool>(std::getline(stream, line))) {
+        if (line.empty()) continue;
+        uint64_t next = JournalParser::Timestamp(line);
+        if (next < timestamp) throw std::runtime_error("Journal timestamps out of order: " + line);
+        timestamp = next;
+        return true;
+      }
+      return false;
+    }
+
+    TickType type;
+    std::ifstream stream;
+    std::unique_ptr<BlockJournalReader> blocks;
+    std::string line;
+    uint64_t timestamp;
+  };
+
+  // Heap entry ordered by timestamp, then by journal for a stable merge
+  struct HeapEntry
+  {
+    uint64_t timestamp;
+    size_t cursor;
+
+    bool operator>(const HeapEntry &other) const {
+      return timestamp != other.timestamp ? timestamp > other.timestamp : cursor > other.cursor;
+    }
+  };
+
+  JournalParser parser;
+  TickSinks sinks;
+  std::vector<std::unique_ptr<Cursor>> cursors;
+  uint64_t startTimestamp;
+
+  void Inject(TickType type, const std::string &line) {
+    switch (type) {
+    case TICK_ORDER_BOOK:
+      if (sinks.marketData) { OrderBook<Bond> orderBook = parser.ParseOrderBook(line); sinks.marketData->OnMessage(std::move(orderBook)); }
+      break;
+    case TICK_PRICE:
+      if (sinks.pricing) { Price<Bond> price = parser.ParsePrice(line); sinks.pricing->OnMessage(std::move(price)); }
+      break;
+    case TICK_TRADE:
+      if (sinks.tradeBooking) { Trade<Bond> trade = parser.ParseTrade(line); sinks.tradeBooking->OnMessage(std::move(trade)); }
+      break;
+    case TICK_INQUIRY:
+      if (sinks.inquiry) { Inquiry<Bond> inquiry = parser.ParseInquiry(line); sinks.inquiry->OnMessage(std::move(inquiry)); }
+      break;
+    }
+  }
+};
+
+#endif // REPLAY_ENGINE_HPP
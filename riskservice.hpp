@@ -9,7 +9,7 @@
 
 #include "soa.hpp"
 #include "positionservice.hpp"
-#include <unordered_map>
+#include "flatstore.hpp"
 #include <iostream>
 #include <stdexcept>
 
@@ -25,6 +25,7 @@ public:
 
   // ctor for a PV01 value
   PV01(const T &_product, double _pv01, long _quantity);
+  PV01();
 
   // Get the product on this PV01 value
   const T& GetProduct() const;
@@ -82,20 +83,30 @@ class RiskService : public Service<std::string, PV01<T>>
 
 public:
 
+  // Dense index of a product's entry, stable for the life of the service
+  typedef typename FlatStore<PV01<T>>::Handle ProductHandle;
+
+  static constexpr ProductHandle NO_PRODUCT = FlatStore<PV01<T>>::NO_HANDLE;
+
+  // ctor pre-sizing the PV01 store and listener lists
+  explicit RiskService(const ServiceCapacity &capacity = ServiceCapacity()) : data(capacity.products) {
+    listeners.Reserve(capacity.listeners);
+  }
+
+  // Touch every page of the pre-sized store before the open
+  void WarmUp() { data.Warm(); }
+
   // Add a position that the service will risk
-  void AddPosition(Position<T> &position) override {
+  void AddPosition(Position<T> &position) {
+    SOA_PROBE_SERVICE("AddPosition");
     std::string productId = position.GetProduct().GetProductId();
     long aggregatePosition = position.GetAggregatePosition();
 
-    if (data.find(productId) == data.end()) {
-      data[productId] = PV01<T>(position.GetProduct(), 0.01, aggregatePosition);
-    } else {
-      data[productId].UpdateQuantity(aggregatePosition);
-    }
-
-    PV01<T> &pv01 = data[productId];
+    PV01<T> &pv01 = data.FindOrInsert(productId, [&]() { return PV01<T>(position.GetProduct(), 0.01, aggregatePosition); });
+    pv01.UpdateQuantity(aggregatePosition);
 
-    for (auto &listener : listeners) {
+    for (auto &listener : listeners.For(productId)) {
+      SOA_PROBE_LISTENER(listener);
       listener->ProcessUpdate(pv01);
     }
   }
@@ -107,10 +118,11 @@ public:
 
     for (const auto &product : sector.GetProducts()) {
       std::string productId = product.GetProductId();
-      if (data.find(productId) == data.end()) {
+      const PV01<T> *found = data.Get(productId);
+      if (!found) {
         throw std::runtime_error("Product not found in RiskService: " + productId);
       }
-      const PV01<T> &pv01 = data.at(productId);
+      const PV01<T> &pv01 = *found;
       totalPv01 += pv01.GetPV01() * pv01.GetQuantity();
       totalQuantity += pv01.GetQuantity();
     }
@@ -119,33 +131,89 @@ public:
   }
 
   // Get data by product ID
-  PV01<T>& GetData(const std::string& productId) override {
-    if (data.find(productId) != data.end()) {
-      return data[productId];
-    } else {
+  PV01<T>& GetData(std::string productId) override {
+    PV01<T> *pv01 = data.Get(productId);
+    if (!pv01) {
       throw std::runtime_error("PV01 not found for product ID: " + productId);
     }
+    return *pv01;
+  }
+
+  // Get data by product ID, or nullptr if there is none; never throws
+  PV01<T>* TryGetData(const std::string &productId) noexcept override {
+    return data.Get(productId);
+  }
+
+  // Handle of a product, or NO_PRODUCT if nothing has been stored for it
+  ProductHandle GetProductHandle(const std::string &productId) const noexcept {
+    return data.Find(productId);
+  }
+
+  // Get data by a handle from GetProductHandle; never throws
+  PV01<T>& GetData(ProductHandle handle) noexcept {
+    return data.At(handle);
+  }
+
+  // OnMessage callback for PV01 values pushed by a Connector
+  void OnMessage(PV01<T> &value) override {
+    SOA_PROBE_SERVICE("OnMessage");
+    NotifyUpdate(data.Upsert(value.GetProduct().GetProductId(), value));
+  }
+
+  // OnMessage callback for PV01 values a Connector hands over, moved into the store
+  void OnMessage(PV01<T> &&value) override {
+    SOA_PROBE_SERVICE("OnMessage");
+    std::string productId = value.GetProduct().GetProductId();
+    NotifyUpdate(data.Upsert(productId, std::move(value)));
+  }
+
+  // Store a PV01 value constructed in place from PV01<T> ctor arguments
+  template<typename... Args>
+  void EmplaceData(Args&&... args) {
+    SOA_PROBE_SERVICE("EmplaceData");
+    NotifyUpdate(data.Emplace([](const PV01<T> &pv01) { return pv01.GetProduct().GetProductId(); }, std::forward<Args>(args)...));
   }
 
   // Add a listener to the service
   void AddListener(ServiceListener<PV01<T>>* listener) override {
-    listeners.push_back(listener);
+    listeners.Add(listener);
+  }
+
+  // Add a listener with a priority and product filter
+  ListenerHandle AddListener(ServiceListener<PV01<T>>* listener, const ListenerOptions &options) override {
+    return listeners.Add(listener, options);
+  }
+
+  // Remove a listener registration
+  bool RemoveListener(ListenerHandle handle) override {
+    return listeners.Remove(handle);
   }
 
   // Get all listeners
   const std::vector<ServiceListener<PV01<T>>*>& GetListeners() const override {
-    return listeners;
+    return listeners.All();
   }
 
 private:
-  std::unordered_map<std::string, PV01<T>> data; // Map to store PV01 values by product ID
-  std::vector<ServiceListener<PV01<T>>*> listeners; // Listeners to notify on updates
+  FlatStore<PV01<T>> data; // PV01 values by product ID
+  ListenerRegistry<PV01<T>> listeners; // Listeners to notify on updates
+
+  // Notify the listeners for the product of a stored PV01 value
+  void NotifyUpdate(PV01<T> &stored) {
+    for (auto &listener : listeners.For(stored.GetProduct().GetProductId())) {
+      SOA_PROBE_LISTENER(listener);
+      listener->ProcessUpdate(stored);
+    }
+  }
 };
 
 // Implementation of PV01 methods
 template<typename T>
 PV01<T>::PV01(const T &_product, double _pv01, long _quantity) : product(_product), pv01(_pv01), quantity(_quantity) {}
 
+template<typename T>
+PV01<T>::PV01() : pv01(0.0), quantity(0) {}
+
 template<typename T>
 const T& PV01<T>::GetProduct() const {
   return product;
@@ -180,4 +248,12 @@ const std::string& BucketedSector<T>::GetName() const {
   return name;
 }
 
+// Instantiated once in instantiations.cpp when building against the soa library
+#ifdef SOA_EXTERN_TEMPLATES
+#include "products.hpp"
+SOA_EXTERN_PRODUCT_TEMPLATE(PV01)
+SOA_EXTERN_PRODUCT_TEMPLATE(BucketedSector)
+SOA_EXTERN_PRODUCT_TEMPLATE(RiskService)
+#endif
+
 #endif
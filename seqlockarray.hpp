@@ -0,0 +1,185 @@
+/**
+ * seqlockarray.hpp
+ * Dense array of small values that one writer updates while other threads read.
+ *
+ * Each slot pairs a value with a sequence number. The writer makes the number
+ * odd, stores the value and makes it even again; a reader copies the value and
+ * retries if the number was odd or changed while it copied. Readers never
+ * block the writer and never take a lock. Values are stored as atomic words,
+ * so the copying itself is race free.
+ *
+ * Slots are cache line aligned so that readers of one slot do not contend with
+ * writes to its neighbours. Storage grows in chunks that are never moved, so a
+ * reader may look at any index below Size() while the writer appends.
+ *
+ * A value may also be a block of many small records, such as the prices of a
+ * run of products; Update then stores some of its fields in place under one
+ * sequence bump, and Load copies the whole block consistently.
+ */
+#ifndef SEQLOCK_ARRAY_HPP
+#define SEQLOCK_ARRAY_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Seqlocked slots of a trivially copyable type V, indexed densely from zero.
+ * Store, Update and Reserve are for the single writer thread; Load and Size for any thread.
+ */
+template<typename V>
+class SeqLockArray
+{
+
+  static_assert(std::is_trivially_copyable<V>::value, "SeqLockArray needs a trivially copyable value type");
+
+public:
+
+  // ctor reserving slots for expectedSize values
+  explicit SeqLockArray(size_t expectedSize = 0) : size(0) {
+    for (size_t i = 0; i < MAX_CHUNKS; ++i) chunks[i].store(nullptr, std::memory_order_relaxed);
+    Reserve(expectedSize);
+  }
+
+  SeqLockArray(const SeqLockArray&) = delete;
+  SeqLockArray& operator=(const SeqLockArray&) = delete;
+
+  // Allocate slots for at least expectedSize values
+  void Reserve(size_t expectedSize) {
+    while (owned.size() * CHUNK_SIZE < expectedSize) AddChunk();
+  }
+
+  class FieldWriter;
+
+  // Store the value at index; index may be at most Size(), which appends
+  void Store(size_t index, const V &value) {
+    uint64_t words[WORDS] = {};
+    std::memcpy(words, &value, sizeof(V));
+    Write(index, [&](Slot &slot) {
+      for (size_t i = 0; i < WORDS; ++i) slot.words[i].store(words[i], std::memory_order_relaxed);
+    });
+  }
+
+  // Store some fields of the value at index in place, through the FieldWriter
+  // passed to fields; the rest keep their values, or zero for an appended slot.
+  // Readers see all of the fields change at once. fields is called twice: first
+  // to check every field lies within V, then to store them.
+  template<typename Fields>
+  void Update(size_t index, Fields fields) {
+    fields(FieldWriter(nullptr));
+    Write(index, [&](Slot &slot) { fields(FieldWriter(&slot)); });
+  }
+
+  // Consistent copy of the value at an index below Size()
+  V Load(size_t index) const {
+    const Slot &slot = SlotAt(index);
+    V value;
+    char *bytes = reinterpret_cast<char*>(&value);
+    for (;;) {
+      uint64_t before = slot.sequence.load(std::memory_order_acquire);
+      if (!(before & 1)) {
+        // Words go straight into the value, so large block values are copied once
+        for (size_t i = 0; i < WORDS; ++i) {
+          uint64_t word = slot.words[i].load(std::memory_order_relaxed);
+          std::memcpy(bytes + i * sizeof(uint64_t), &word, i + 1 < WORDS ? sizeof(uint64_t) : sizeof(V) - i * sizeof(uint64_t));
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) == before) break;
+      }
+      // The writer was mid-store; let it finish if it shares this core
+      std::this_thread::yield();
+    }
+    return value;
+  }
+
+  // Number of values stored; indices below it may be loaded
+  size_t Size() const { return size.load(std::memory_order_acquire); }
+
+  // Write to every page of the reserved slots so they are faulted in before use
+  void Warm() {
+    for (std::unique_ptr<Slot[]> &chunk : owned) {
+      for (size_t i = 0; i < CHUNK_SIZE; ++i) chunk[i].sequence.fetch_add(0, std::memory_order_relaxed);
+    }
+  }
+
+private:
+
+  static const size_t MAX_CHUNKS = 4096;
+  static const size_t WORDS = (sizeof(V) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+  struct alignas(64) Slot
+  {
+    std::atomic<uint64_t> sequence{0};
+    std::atomic<uint64_t> words[WORDS] = {};
+  };
+
+  // Slots per chunk; fewer for values too large for 256 to fit in 64KB
+  static const size_t CHUNK_SIZE = sizeof(Slot) * 256 <= 65536 ? 256 : 16;
+
+  // Run write on the slot at index between making its sequence odd and even
+  // again. write must not throw, or the slot would stay odd and stall readers.
+  template<typename WriteSlot>
+  void Write(size_t index, WriteSlot write) {
+    size_t current = size.load(std::memory_order_relaxed);
+    if (index > current) throw std::out_of_range("SeqLockArray: store past the end");
+    if (index / CHUNK_SIZE >= owned.size()) AddChunk();
+    Slot &slot = SlotAt(index);
+    uint64_t sequence = slot.sequence.load(std::memory_order_relaxed);
+    slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    write(slot);
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+    if (index == current) size.store(current + 1, std::memory_order_release);
+  }
+
+  Slot& SlotAt(size_t index) { return chunks[index / CHUNK_SIZE].load(std::memory_order_acquire)[index % CHUNK_SIZE]; }
+  const Slot& SlotAt(size_t index) const { return chunks[index / CHUNK_SIZE].load(std::memory_order_acquire)[index % CHUNK_SIZE]; }
+
+  void AddChunk() {
+    if (owned.size() == MAX_CHUNKS) throw std::length_error("SeqLockArray: capacity exhausted");
+    owned.emplace_back(new Slot[CHUNK_SIZE]);
+    chunks[owned.size() - 1].store(owned.back().get(), std::memory_order_release);
+  }
+
+  std::atomic<Slot*> chunks[MAX_CHUNKS];     // published chunk directory; never moves
+  std::atomic<size_t> size;
+  std::vector<std::unique_ptr<Slot[]>> owned;  // writer only
+};
+
+/**
+ * Stores fields of one slot's value during SeqLockArray::Update. A field must
+ * start on a word boundary of V and fill whole words. A writer without a slot
+ * only checks its fields, throwing before Update touches the sequence.
+ */
+template<typename V>
+class SeqLockArray<V>::FieldWriter
+{
+
+public:
+
+  explicit FieldWriter(Slot *_slot) : slot(_slot) {}
+
+  // Store field at a byte offset within V, such as offsetof(V, member)
+  template<typename F>
+  void operator()(size_t offset, const F &field) const {
+    static_assert(std::is_trivially_copyable<F>::value && sizeof(F) % sizeof(uint64_t) == 0, "SeqLockArray fields fill whole words");
+    if (!slot) {
+      if (offset % sizeof(uint64_t) || offset + sizeof(F) > WORDS * sizeof(uint64_t)) throw std::out_of_range("SeqLockArray: field outside the value");
+      return;
+    }
+    uint64_t words[sizeof(F) / sizeof(uint64_t)];
+    std::memcpy(words, &field, sizeof(F));
+    for (size_t i = 0; i < sizeof(F) / sizeof(uint64_t); ++i) slot->words[offset / sizeof(uint64_t) + i].store(words[i], std::memory_order_relaxed);
+  }
+
+private:
+  Slot *slot;  // null to check fields only
+};
+
+#endif // SEQLOCK_ARRAY_HPP
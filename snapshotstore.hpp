@@ -0,0 +1,380 @@
+/**
+ * snapshotstore.hpp
+ * Lock-free consistent snapshots of service data with epoch-based reclamation.
+ *
+ * Service GetData returns references into containers the writer thread keeps
+ * mutating, so other threads cannot safely read them. A VersionedStore instead
+ * holds immutable versions of a value: the writer builds the next version off
+ * to the side and publishes it with one atomic pointer swap, and readers pin
+ * the current epoch and read whichever version was current when they looked.
+ * Superseded versions are reclaimed once every reader pinned before the swap
+ * has finished, and their storage is reused for later versions.
+ *
+ * RiskSnapshotPublisher uses this to give reporting threads a consistent view
+ * of positions, PV01 and prices across the three services.
+ */
+#ifndef SNAPSHOT_STORE_HPP
+#define SNAPSHOT_STORE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "soa.hpp"
+#include "positionservice.hpp"
+#include "riskservice.hpp"
+#include "pricingservice.hpp"
+
+/**
+ * Process-wide epoch domain. Each reader thread owns one slot in which it
+ * publishes the epoch it pinned, or zero while it is not reading.
+ */
+class EpochDomain
+{
+
+public:
+
+  static const int MAX_THREADS = 256;
+
+  static EpochDomain& Instance() {
+    static EpochDomain domain;
+    return domain;
+  }
+
+  // Current global epoch
+  uint64_t Current() const { return epoch.load(std::memory_order_seq_cst); }
+
+  // Advance the global epoch, returning the epoch that was current before
+  uint64_t Advance() { return epoch.fetch_add(1, std::memory_order_seq_cst); }
+
+  // Oldest epoch pinned by any reader, or UINT64_MAX if nobody is reading
+  uint64_t OldestPinned() const {
+    uint64_t oldest = UINT64_MAX;
+    for (int i = 0; i < MAX_THREADS; ++i) {
+      uint64_t pinned = slots[i].epoch.load(std::memory_order_seq_cst);
+      if (pinned != 0 && pinned < oldest) oldest = pinned;
+    }
+    return oldest;
+  }
+
+  // Pin the current epoch for the calling thread; nested pins are counted
+  void Pin() {
+    ThreadSlot &slot = LocalSlot();
+    if (slot.depth++ == 0) slots[slot.index].epoch.store(epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+  }
+
+  // Release the calling thread's pin
+  void Unpin() {
+    ThreadSlot &slot = LocalSlot();
+    if (--slot.depth == 0) slots[slot.index].epoch.store(0, std::memory_order_release);
+  }
+
+private:
+
+  // Cache-line sized reader slot so readers never share a line
+  struct alignas(64) Slot
+  {
+    std::atomic<uint64_t> epoch{0};
+    std::atomic<bool> owned{false};
+  };
+
+  // The calling thread's claim on a slot, released when the thread exits
+  struct ThreadSlot
+  {
+    int index;
+    int depth;
+
+    ThreadSlot() : index(EpochDomain::Instance().Claim()), depth(0) {}
+    ~ThreadSlot() { EpochDomain::Instance().Release(index); }
+  };
+
+  std::atomic<uint64_t> epoch{1};
+  Slot slots[MAX_THREADS];
+
+  static ThreadSlot& LocalSlot() {
+    thread_local ThreadSlot slot;
+    return slot;
+  }
+
+  int Claim() {
+    for (int i = 0; i < MAX_THREADS; ++i) {
+      bool expected = false;
+      if (!slots[i].owned.load(std::memory_order_relaxed) && slots[i].owned.compare_exchange_strong(expected, true)) return i;
+    }
+    throw std::runtime_error("EpochDomain: too many reader threads");
+  }
+
+  void Release(int index) {
+    slots[index].epoch.store(0, std::memory_order_release);
+    slots[index].owned.store(false, std::memory_order_release);
+  }
+};
+
+/**
+ * RAII pin of the current epoch for the calling thread.
+ * Must be destroyed on the thread that created it.
+ */
+class EpochGuard
+{
+
+public:
+
+  EpochGuard() : active(true) { EpochDomain::Instance().Pin(); }
+
+  ~EpochGuard() { if (active) EpochDomain::Instance().Unpin(); }
+
+  EpochGuard(EpochGuard &&other) : active(other.active) { other.active = false; }
+
+  EpochGuard(const EpochGuard&) = delete;
+  EpochGuard& operator=(const EpochGuard&) = delete;
+  EpochGuard& operator=(EpochGuard&&) = delete;
+
+private:
+  bool active;
+};
+
+/**
+ * Single-writer store of immutable versions of a value of type V.
+ * Any number of threads may Read() concurrently with the writer's Publish().
+ */
+template<typename V>
+class VersionedStore
+{
+
+  struct Node;
+
+public:
+
+  /**
+   * A pinned, read-only view of one version. Holds the epoch pin for its
+   * lifetime, so keep it short-lived and on one thread.
+   */
+  class Snapshot
+  {
+
+  public:
+
+    const V& operator*() const { return node->value; }
+    const V* operator->() const { return &node->value; }
+
+    // Version number of this snapshot; increases by one per Publish
+    uint64_t Version() const { return node->version; }
+
+  private:
+    friend class VersionedStore;
+
+    Snapshot(EpochGuard &&_guard, const Node *_node) : guard(std::move(_guard)), node(_node) {}
+
+    EpochGuard guard;
+    const Node *node;
+  };
+
+  // ctor publishing an initial version
+  explicit VersionedStore(const V &initial = V()) : current(new Node{ initial, 0, 0 }) {}
+
+  // Destroy every version; no reader may hold a Snapshot at this point
+  ~VersionedStore() {
+    delete current.load();
+    for (Node *node : retired) delete node;
+    for (Node *node : free) delete node;
+  }
+
+  VersionedStore(const VersionedStore&) = delete;
+  VersionedStore& operator=(const VersionedStore&) = delete;
+
+  // Pin the epoch and take the current version
+  Snapshot Read() const {
+    EpochGuard guard;
+    return Snapshot(std::move(guard), current.load(std::memory_order_seq_cst));
+  }
+
+  // Publish a new version copied from value. Called by the writer thread only.
+  void Publish(const V &value) {
+    Node *next = Allocate();
+    next->value = value;
+    Node *previous = current.load(std::memory_order_relaxed);
+    next->version = previous->version + 1;
+    current.store(next, std::memory_order_seq_cst);
+    previous->retireEpoch = EpochDomain::Instance().Advance();
+    retired.push_back(previous);
+    Reclaim();
+  }
+
+  // Move retired versions no reader can still see onto the free list
+  size_t Reclaim() {
+    uint64_t oldest = EpochDomain::Instance().OldestPinned();
+    size_t reclaimed = 0;
+    for (size_t i = 0; i < retired.size();) {
+      if (retired[i]->retireEpoch < oldest) {
+        free.push_back(retired[i]);
+        retired[i] = retired.back();
+        retired.pop_back();
+        ++reclaimed;
+      } else {
+        ++i;
+      }
+    }
+    return reclaimed;
+  }
+
+  // Versions retired but still potentially visible to a reader
+  size_t PendingReclaim() const { return retired.size(); }
+
+private:
+
+  struct Node
+  {
+    V value;
+    uint64_t version;
+    uint64_t retireEpoch;
+  };
+
+  std::atomic<Node*> current;
+  std::vector<Node*> retired;  // writer only
+  std::vector<Node*> free;     // writer only; recycled so steady state publishes don't allocate
+
+  Node* Allocate() {
+    if (free.empty()) return new Node{ V(), 0, 0 };
+    Node *node = free.back();
+    free.pop_back();
+    return node;
+  }
+};
+
+/**
+ * Risk view of one product at a point in time.
+ */
+struct ProductRiskRow
+{
+  long position = 0;       // aggregate position across books
+  double pv01 = 0.0;       // PV01 per unit
+  long riskQuantity = 0;   // quantity the PV01 was last computed for
+  double mid = 0.0;
+  double bidOfferSpread = 0.0;
+};
+
+/**
+ * Consistent positions, PV01 and prices for every product seen so far.
+ */
+struct RiskSnapshot
+{
+  std::vector<std::string> productIds;
+  std::vector<ProductRiskRow> rows;  // parallel to productIds
+
+  // Row for a product, or nullptr if the product has not been seen
+  const ProductRiskRow* Find(const std::string &productId) const {
+    for (size_t i = 0; i < productIds.size(); ++i) {
+      if (productIds[i] == productId) return &rows[i];
+    }
+    return nullptr;
+  }
+};
+
+/**
+ * Listens to the Position, Risk and Pricing services on the writer thread and
+ * publishes RiskSnapshots for reporting threads.
+ *
+ * Updates are staged into a working copy and only become visible on Commit(),
+ * so the writer commits once its event has run through every service and
+ * readers never see a position without its matching PV01.
+ * Type T is the product type.
+ */
+template<typename T>
+class RiskSnapshotPublisher
+{
+
+public:
+
+  // ctor registering listeners on the three services
+  RiskSnapshotPublisher(PositionService<T> &positionService, RiskService<T> &riskService, PricingService<T> &pricingService) :
+    positionListener(*this), riskListener(*this), priceListener(*this), dirty(false)
+  {
+    positionService.AddListener(&positionListener);
+    riskService.AddListener(&riskListener);
+    pricingService.AddListener(&priceListener);
+  }
+
+  RiskSnapshotPublisher(const RiskSnapshotPublisher&) = delete;
+  RiskSnapshotPublisher& operator=(const RiskSnapshotPublisher&) = delete;
+
+  // Publish staged updates, if any. Writer thread only.
+  void Commit() {
+    if (!dirty) return;
+    store.Publish(working);
+    dirty = false;
+  }
+
+  // Take a consistent snapshot. Safe from any thread.
+  typename VersionedStore<RiskSnapshot>::Snapshot Read() const { return store.Read(); }
+
+  // The underlying store, for reclamation statistics
+  const VersionedStore<RiskSnapshot>& GetStore() const { return store; }
+
+private:
+
+  class PositionListener : public ServiceListener<Position<T>>
+  {
+  public:
+    explicit PositionListener(RiskSnapshotPublisher &_publisher) : publisher(_publisher) {}
+    void ProcessAdd(Position<T> &data) override { ProcessUpdate(data); }
+    void ProcessRemove(Position<T> &data) override {}
+    void ProcessUpdate(Position<T> &data) override { publisher.Row(data.GetProduct().GetProductId()).position = data.GetAggregatePosition(); }
+  private:
+    RiskSnapshotPublisher &publisher;
+  };
+
+  class RiskListener : public ServiceListener<PV01<T>>
+  {
+  public:
+    explicit RiskListener(RiskSnapshotPublisher &_publisher) : publisher(_publisher) {}
+    void ProcessAdd(PV01<T> &data) override { ProcessUpdate(data); }
+    void ProcessRemove(PV01<T> &data) override {}
+    void ProcessUpdate(PV01<T> &data) override {
+      ProductRiskRow &row = publisher.Row(data.GetProduct().GetProductId());
+      row.pv01 = data.GetPV01();
+      row.riskQuantity = data.GetQuantity();
+    }
+  private:
+    RiskSnapshotPublisher &publisher;
+  };
+
+  class PriceListener : public ServiceListener<Price<T>>
+  {
+  public:
+    explicit PriceListener(RiskSnapshotPublisher &_publisher) : publisher(_publisher) {}
+    void ProcessAdd(Price<T> &data) override { ProcessUpdate(data); }
+    void ProcessRemove(Price<T> &data) override {}
+    void ProcessUpdate(Price<T> &data) override {
+      ProductRiskRow &row = publisher.Row(data.GetProduct().GetProductId());
+      row.mid = data.GetMid();
+      row.bidOfferSpread = data.GetBidOfferSpread();
+    }
+  private:
+    RiskSnapshotPublisher &publisher;
+  };
+
+  PositionListener positionListener;
+  RiskListener riskListener;
+  PriceListener priceListener;
+  VersionedStore<RiskSnapshot> store;
+  RiskSnapshot working;
+  std::unordered_map<std::string, size_t> rowIndex;
+  bool dirty;
+
+  // Working row for a product, created on first sight; marks the working copy dirty
+  ProductRiskRow& Row(const std::string &productId) {
+    dirty = true;
+    auto it = rowIndex.find(productId);
+    if (it != rowIndex.end()) return working.rows[it->second];
+    rowIndex[productId] = working.rows.size();
+    working.productIds.push_back(productId);
+    working.rows.emplace_back();
+    return working.rows.back();
+  }
+};
+
+#endif // SNAPSHOT_STORE_HPP
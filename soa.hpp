@@ -7,6 +7,11 @@
 
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include "instrumentation.hpp"
 using namespace std;
 
 /**
@@ -28,6 +33,130 @@ public:
 
   // Listener callback to process an update event on the Service
   virtual void ProcessUpdate(V &data) = 0;
+
+#ifdef SOA_INSTRUMENTATION
+  // Histogram slot used by SOA_PROBE_LISTENER when dispatching to this listener
+  ProbeSlot probeSlot;
+#endif
+};
+
+/**
+ * Handle identifying one listener registration, used to remove it again.
+ * Zero is never a valid handle.
+ */
+typedef uint64_t ListenerHandle;
+
+/**
+ * Options for a listener registration.
+ * Listeners with a higher priority are notified first; equal priorities are
+ * notified in registration order. A listener with no filter keys receives
+ * every event, otherwise only events for the listed keys (product identifiers).
+ */
+struct ListenerOptions {
+  int priority = 0;
+  vector<string> keys;
+};
+
+/**
+ * Expected sizes a Service pre-allocates for at construction, so the stores do
+ * not grow while the session is running. Each service uses the hints that
+ * match its key: products, trade IDs, order IDs or inquiry IDs. Zero means no
+ * pre-allocation.
+ */
+struct ServiceCapacity {
+  size_t products = 0;
+  size_t trades = 0;
+  size_t orders = 0;
+  size_t inquiries = 0;
+  size_t listeners = 0;
+};
+
+/**
+ * Listener registrations for a Service.
+ * Filters are resolved into per-key listener lists when listeners are added or
+ * removed, so dispatching an event for a key is one lookup and then touches only
+ * the listeners interested in it.
+ * Listeners must not be added or removed from within a dispatch on the same Service.
+ */
+template<typename V>
+class ListenerRegistry {
+public:
+  ListenerRegistry() : nextHandle(1) {}
+
+  // Register a listener, returning a handle for Remove
+  ListenerHandle Add(ServiceListener<V> *listener, const ListenerOptions &options = ListenerOptions()) {
+    Registration registration{ nextHandle++, listener, options.priority, options.keys };
+    registrations.push_back(registration);
+    Rebuild();
+    return registration.handle;
+  }
+
+  // Remove a registration; returns false if the handle is unknown
+  bool Remove(ListenerHandle handle) {
+    auto it = find_if(registrations.begin(), registrations.end(), [handle](const Registration &r) { return r.handle == handle; });
+    if (it == registrations.end()) return false;
+    registrations.erase(it);
+    Rebuild();
+    return true;
+  }
+
+  // Every registered listener in notification order, regardless of filters
+  const vector<ServiceListener<V>*>& All() const { return all; }
+
+  // Listeners interested in events for a key, in notification order
+  const vector<ServiceListener<V>*>& For(const string &key) const {
+    if (byKey.empty()) return unfiltered;
+    auto it = byKey.find(key);
+    return it == byKey.end() ? unfiltered : it->second;
+  }
+
+  bool Empty() const { return registrations.empty(); }
+
+  // Make room for expectedListeners registrations without reallocating the lists
+  void Reserve(size_t expectedListeners) {
+    registrations.reserve(expectedListeners);
+    all.reserve(expectedListeners);
+    unfiltered.reserve(expectedListeners);
+  }
+
+private:
+  struct Registration {
+    ListenerHandle handle;
+    ServiceListener<V> *listener;
+    int priority;
+    vector<string> keys;
+  };
+
+  vector<Registration> registrations;  // kept sorted by notification order
+  vector<ServiceListener<V>*> all;
+  vector<ServiceListener<V>*> unfiltered;
+  unordered_map<string, vector<ServiceListener<V>*>> byKey;
+  ListenerHandle nextHandle;
+
+  void Rebuild() {
+    // Handles increase with registration, so they break priority ties in registration order
+    stable_sort(registrations.begin(), registrations.end(), [](const Registration &a, const Registration &b) {
+      return a.priority != b.priority ? a.priority > b.priority : a.handle < b.handle;
+    });
+    all.clear();
+    unfiltered.clear();
+    byKey.clear();
+    for (const Registration &registration : registrations) {
+      for (const string &key : registration.keys) byKey[key];
+    }
+    for (const Registration &registration : registrations) {
+      all.push_back(registration.listener);
+      if (registration.keys.empty()) {
+        unfiltered.push_back(registration.listener);
+        for (auto &entry : byKey) entry.second.push_back(registration.listener);
+      } else {
+        for (const string &key : registration.keys) {
+          vector<ServiceListener<V>*> &list = byKey[key];
+          if (list.empty() || list.back() != registration.listener) list.push_back(registration.listener);
+        }
+      }
+    }
+  }
 };
 
 /**
@@ -40,15 +169,36 @@ public:
   // Virtual destructor for proper cleanup
   virtual ~Service() = default;
 
-  // Get data on our service given a key
+  // Get data on our service given a key; throws if there is none
   virtual V& GetData(K key) = 0;
 
+  // Get data given a key, or nullptr if there is none. Services override this
+  // with a lookup that neither allocates nor throws; the fallback goes through
+  // GetData and pays for the exception on a miss.
+  virtual V* TryGetData(const K &key) noexcept {
+    try {
+      return &GetData(key);
+    } catch (...) {
+      return nullptr;
+    }
+  }
+
   // The callback that a Connector should invoke for any new or updated data
   virtual void OnMessage(V &data) = 0;
 
+  // The callback for data the Connector hands over; services that store it move it
+  // into their store. Falls back to copying through OnMessage(V&).
+  virtual void OnMessage(V &&data) { OnMessage(data); }
+
   // Add a listener to the Service for callbacks on add, remove, and update events
   virtual void AddListener(ServiceListener<V> *listener) = 0;
 
+  // Add a listener with a priority and optional key filter, returning a handle for RemoveListener
+  virtual ListenerHandle AddListener(ServiceListener<V> *listener, const ListenerOptions &options) = 0;
+
+  // Remove a listener registration; returns false if the handle is unknown
+  virtual bool RemoveListener(ListenerHandle handle) = 0;
+
   // Get all listeners on the Service
   virtual const vector<ServiceListener<V>*>& GetListeners() const = 0;
 };
@@ -69,6 +219,19 @@ public:
 
   // Publish data to the Connector
   virtual void Publish(V &data) = 0;
+
+  // Publish data the caller no longer needs; falls back to Publish(V&)
+  virtual void Publish(V &&data) { Publish(data); }
 };
 
+/**
+ * Declares the Bond and IRSwap instantiations of a product template extern, so
+ * translation units use the single copy compiled into the soa library instead
+ * of instantiating their own. Service headers apply it when SOA_EXTERN_TEMPLATES
+ * is defined, which linking the soa CMake target does.
+ */
+#define SOA_EXTERN_PRODUCT_TEMPLATE(Template) \
+  extern template class Template<Bond>; \
+  extern template class Template<IRSwap>;
+
 #endif // SOA_HPP
@@ -6,7 +6,7 @@
 
 #include "soa.hpp"
 #include "marketdataservice.hpp"
-#include <map>
+#include "flatstore.hpp"
 #include <vector>
 #include <string>
 #include <stdexcept>
@@ -18,6 +18,7 @@ class PriceStreamOrder {
 public:
   // Constructor for a PriceStreamOrder
   PriceStreamOrder(double _price, long _visibleQuantity, long _hiddenQuantity, PricingSide _side);
+  PriceStreamOrder();
 
   // Getters
   PricingSide GetSide() const;
@@ -41,6 +42,7 @@ class PriceStream {
 public:
   // Constructor
   PriceStream(const T &_product, const PriceStreamOrder &_bidOrder, const PriceStreamOrder &_offerOrder);
+  PriceStream();
 
   // Getters
   const T& GetProduct() const;
@@ -61,58 +63,130 @@ private:
 template<typename T>
 class StreamingService : public Service<std::string, PriceStream<T>> {
 public:
+  // Dense index of a product's entry, stable for the life of the service
+  typedef typename FlatStore<PriceStream<T>>::Handle ProductHandle;
+
+  static constexpr ProductHandle NO_PRODUCT = FlatStore<PriceStream<T>>::NO_HANDLE;
+
+  // ctor pre-sizing the price stream store and listener lists
+  explicit StreamingService(const ServiceCapacity &capacity = ServiceCapacity()) : dataStore(capacity.products) {
+    listeners.Reserve(capacity.listeners);
+  }
+
+  // Touch every page of the pre-sized store before the open
+  void WarmUp() { dataStore.Warm(); }
+
   // Publish two-way prices
   void PublishPrice(const PriceStream<T>& priceStream) {
+    SOA_PROBE_SERVICE("PublishPrice");
     const std::string& productId = priceStream.GetProduct().GetProductId();
-    dataStore[productId] = priceStream;
+    NotifyAdd(productId, dataStore.Upsert(productId, priceStream));
+  }
 
-    // Notify all listeners
-    for (auto &listener : listeners) {
-      listener->ProcessAdd(priceStream);
-    }
+  // Publish two-way prices the caller hands over, moving them into the store
+  void PublishPrice(PriceStream<T>&& priceStream) {
+    SOA_PROBE_SERVICE("PublishPrice");
+    std::string productId = priceStream.GetProduct().GetProductId();
+    NotifyAdd(productId, dataStore.Upsert(productId, std::move(priceStream)));
+  }
+
+  // Publish two-way prices constructed in the store from PriceStream<T> ctor arguments
+  template<typename... Args>
+  void EmplaceData(Args&&... args) {
+    SOA_PROBE_SERVICE("EmplaceData");
+    PriceStream<T> &stored = dataStore.Emplace([](const PriceStream<T> &priceStream) { return priceStream.GetProduct().GetProductId(); }, std::forward<Args>(args)...);
+    NotifyAdd(stored.GetProduct().GetProductId(), stored);
+  }
+
+  // OnMessage callback for price streams pushed by a Connector
+  void OnMessage(PriceStream<T> &data) override {
+    PublishPrice(data);
+  }
+
+  // OnMessage callback for price streams a Connector hands over
+  void OnMessage(PriceStream<T> &&data) override {
+    PublishPrice(std::move(data));
   }
 
   // Get data for a specific product
   PriceStream<T>& GetData(std::string productId) override {
-    if (dataStore.find(productId) != dataStore.end()) {
-      return dataStore[productId];
-    } else {
+    PriceStream<T> *priceStream = dataStore.Get(productId);
+    if (!priceStream) {
       throw std::runtime_error("PriceStream not found for product ID: " + productId);
     }
+    return *priceStream;
+  }
+
+  // Get data by product ID, or nullptr if there is none; never throws
+  PriceStream<T>* TryGetData(const std::string &productId) noexcept override {
+    return dataStore.Get(productId);
+  }
+
+  // Handle of a product, or NO_PRODUCT if nothing has been stored for it
+  ProductHandle GetProductHandle(const std::string &productId) const noexcept {
+    return dataStore.Find(productId);
+  }
+
+  // Get data by a handle from GetProductHandle; never throws
+  PriceStream<T>& GetData(ProductHandle handle) noexcept {
+    return dataStore.At(handle);
   }
 
   // Add a listener to the service
   void AddListener(ServiceListener<PriceStream<T>>* listener) override {
-    listeners.push_back(listener);
+    listeners.Add(listener);
+  }
+
+  // Add a listener with a priority and product filter
+  ListenerHandle AddListener(ServiceListener<PriceStream<T>>* listener, const ListenerOptions &options) override {
+    return listeners.Add(listener, options);
+  }
+
+  // Remove a listener registration
+  bool RemoveListener(ListenerHandle handle) override {
+    return listeners.Remove(handle);
   }
 
   // Get all listeners
   const std::vector<ServiceListener<PriceStream<T>>*>& GetListeners() const override {
-    return listeners;
+    return listeners.All();
   }
 
 private:
-  std::map<std::string, PriceStream<T>> dataStore; // Map to store price streams by product ID
-  std::vector<ServiceListener<PriceStream<T>>*> listeners; // Listeners to notify on updates
+  FlatStore<PriceStream<T>> dataStore; // Price streams by product ID
+  ListenerRegistry<PriceStream<T>> listeners; // Listeners to notify on updates
+
+  // Notify the listeners for a product of a stored price stream
+  void NotifyAdd(const std::string &productId, PriceStream<T> &stored) {
+    for (auto &listener : listeners.For(productId)) {
+      SOA_PROBE_LISTENER(listener);
+      listener->ProcessAdd(stored);
+    }
+  }
 };
 
 // Implementation of PriceStreamOrder
-PriceStreamOrder::PriceStreamOrder(double _price, long _visibleQuantity, long _hiddenQuantity, PricingSide _side)
+inline PriceStreamOrder::PriceStreamOrder(double _price, long _visibleQuantity, long _hiddenQuantity, PricingSide _side)
   : price(_price), visibleQuantity(_visibleQuantity), hiddenQuantity(_hiddenQuantity), side(_side) {}
 
-PricingSide PriceStreamOrder::GetSide() const { return side; }
+inline PriceStreamOrder::PriceStreamOrder() : price(0.0), visibleQuantity(0), hiddenQuantity(0), side(BID) {}
+
+inline PricingSide PriceStreamOrder::GetSide() const { return side; }
 
-double PriceStreamOrder::GetPrice() const { return price; }
+inline double PriceStreamOrder::GetPrice() const { return price; }
 
-long PriceStreamOrder::GetVisibleQuantity() const { return visibleQuantity; }
+inline long PriceStreamOrder::GetVisibleQuantity() const { return visibleQuantity; }
 
-long PriceStreamOrder::GetHiddenQuantity() const { return hiddenQuantity; }
+inline long PriceStreamOrder::GetHiddenQuantity() const { return hiddenQuantity; }
 
 // Implementation of PriceStream
 template<typename T>
 PriceStream<T>::PriceStream(const T &_product, const PriceStreamOrder &_bidOrder, const PriceStreamOrder &_offerOrder)
   : product(_product), bidOrder(_bidOrder), offerOrder(_offerOrder) {}
 
+template<typename T>
+PriceStream<T>::PriceStream() {}
+
 template<typename T>
 const T& PriceStream<T>::GetProduct() const { return product; }
 
@@ -122,4 +196,11 @@ const PriceStreamOrder& PriceStream<T>::GetBidOrder() const { return bidOrder; }
 template<typename T>
 const PriceStreamOrder& PriceStream<T>::GetOfferOrder() const { return offerOrder; }
 
+// Instantiated once in instantiations.cpp when building against the soa library
+#ifdef SOA_EXTERN_TEMPLATES
+#include "products.hpp"
+SOA_EXTERN_PRODUCT_TEMPLATE(PriceStream)
+SOA_EXTERN_PRODUCT_TEMPLATE(StreamingService)
+#endif
+
 #endif // STREAMING_SERVICE_HPP
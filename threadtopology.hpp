@@ -0,0 +1,230 @@
+/**
+ * threadtopology.hpp
+ * Placement of named service threads on cores and NUMA nodes.
+ *
+ * A ThreadTopology maps thread names ("marketdata", "execution", "risk", ...)
+ * to CPUs, read from a spec such as "marketdata=2,execution=3,risk=4-7" or the
+ * SOA_THREAD_TOPOLOGY environment variable. Threads pin themselves by name
+ * when they start. Memory placement relies on the kernel's first-touch policy:
+ * stores and queues constructed through ConstructOn() or touched with
+ * FirstTouch() from the pinned thread get their pages on that thread's node.
+ *
+ * Pinning is Linux only; elsewhere, and for names with no assignment, threads
+ * run unpinned and the placement report says so.
+ */
+#ifndef THREAD_TOPOLOGY_HPP
+#define THREAD_TOPOLOGY_HPP
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Where a named thread asked to run and where it actually ended up.
+ */
+struct ThreadPlacement
+{
+  std::string name;
+  std::vector<int> cpus;   // requested CPU set; empty means unpinned
+  bool pinned = false;     // whether the affinity call succeeded
+  int cpu = -1;            // CPU observed after pinning
+  int node = -1;           // NUMA node of that CPU
+};
+
+/**
+ * Machine layout and named thread assignments.
+ */
+class ThreadTopology
+{
+
+public:
+
+  // ctor reading assignments from a spec "name=cpu[,name=first-last ...]"
+  explicit ThreadTopology(const std::string &spec = "") {
+    LoadNodes();
+    Parse(spec);
+  }
+
+  // Topology configured from the SOA_THREAD_TOPOLOGY environment variable
+  static ThreadTopology FromEnvironment() {
+    const char *spec = std::getenv("SOA_THREAD_TOPOLOGY");
+    return ThreadTopology(spec ? spec : "");
+  }
+
+  // Assign a thread name to a set of CPUs, replacing any earlier assignment
+  void Assign(const std::string &name, const std::vector<int> &cpus) { assignments[name] = cpus; }
+
+  // CPUs assigned to a thread name; empty if unassigned
+  std::vector<int> CpusFor(const std::string &name) const {
+    auto it = assignments.find(name);
+    return it == assignments.end() ? std::vector<int>() : it->second;
+  }
+
+  // Online CPUs on this machine
+  static int CpuCount() {
+#if defined(__linux__)
+    return static_cast<int>(sysconf(_SC_NPROCESSORS_ONLN));
+#else
+    return static_cast<int>(std::thread::hardware_concurrency());
+#endif
+  }
+
+  // NUMA node of a CPU, or 0 if the machine does not expose one
+  int NodeOf(int cpu) const {
+    auto it = cpuNodes.find(cpu);
+    return it == cpuNodes.end() ? 0 : it->second;
+  }
+
+  // Pin the calling thread to the CPUs assigned to name and record the placement
+  ThreadPlacement PinCurrentThread(const std::string &name) {
+    ThreadPlacement placement;
+    placement.name = name;
+    placement.cpus = CpusFor(name);
+#if defined(__linux__)
+    if (!placement.cpus.empty()) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      for (int cpu : placement.cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+      }
+      placement.pinned = pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+      // The new mask takes effect on the next reschedule
+      if (placement.pinned) sched_yield();
+    }
+    placement.cpu = sched_getcpu();
+#endif
+    placement.node = placement.cpu >= 0 ? NodeOf(placement.cpu) : -1;
+    Record(placement);
+    return placement;
+  }
+
+  // Start a thread that pins itself to name's CPUs before running fn
+  std::thread Launch(const std::string &name, std::function<void()> fn) {
+    return std::thread([this, name, fn]() {
+      PinCurrentThread(name);
+      fn();
+    });
+  }
+
+  // Run fn to completion on a thread placed like name, so memory it first
+  // touches is allocated on that thread's node
+  void RunOn(const std::string &name, const std::function<void()> &fn) {
+    std::thread thread = Launch(name, [&]() { fn(); });
+    thread.join();
+  }
+
+  // Construct an object on a thread placed like name; its constructor's
+  // allocations land on that thread's node
+  template<typename T, typename... Args>
+  std::unique_ptr<T> ConstructOn(const std::string &name, Args&&... args) {
+    std::unique_ptr<T> object;
+    RunOn(name, [&]() { object.reset(new T(std::forward<Args>(args)...)); });
+    return object;
+  }
+
+  // Write to every page of a buffer from the calling thread so that untouched
+  // pages are allocated on its node
+  static void FirstTouch(void *data, size_t bytes) {
+    volatile char *bytesPtr = static_cast<volatile char*>(data);
+    for (size_t offset = 0; offset < bytes; offset += PAGE_SIZE_HINT) bytesPtr[offset] = bytesPtr[offset];
+  }
+
+  // Placements recorded so far, in the order threads pinned themselves
+  std::vector<ThreadPlacement> GetPlacements() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return placements;
+  }
+
+  // Write the machine layout, the assignments and every recorded placement
+  void Report(std::ostream &out) const {
+    std::set<int> nodes;
+    for (auto &entry : cpuNodes) nodes.insert(entry.second);
+    out << "Thread topology: " << CpuCount() << " CPUs, " << std::max<size_t>(nodes.size(), 1) << " NUMA node(s)\n";
+    for (auto &entry : assignments) out << "  " << entry.first << " -> cpus " << CpuList(entry.second) << "\n";
+    for (const ThreadPlacement &placement : GetPlacements()) {
+      out << "  " << placement.name << ": ";
+      if (placement.cpus.empty()) out << "unpinned";
+      else out << (placement.pinned ? "pinned to " : "pin FAILED for ") << CpuList(placement.cpus);
+      out << ", running on cpu " << placement.cpu << " node " << placement.node << "\n";
+    }
+  }
+
+private:
+
+  static const size_t PAGE_SIZE_HINT = 4096;
+
+  std::map<std::string, std::vector<int>> assignments;
+  std::map<int, int> cpuNodes;
+  mutable std::mutex mutex;
+  std::vector<ThreadPlacement> placements;
+
+  void Record(const ThreadPlacement &placement) {
+    std::lock_guard<std::mutex> lock(mutex);
+    placements.push_back(placement);
+  }
+
+  // Parse "name=cpu,name=first-last,..."; a name may repeat to add CPUs
+  void Parse(const std::string &spec) {
+    std::stringstream entries(spec);
+    std::string entry;
+    while (std::getline(entries, entry, ',')) {
+      if (entry.empty()) continue;
+      size_t equals = entry.find('=');
+      if (equals == std::string::npos) throw std::invalid_argument("ThreadTopology: expected name=cpus in '" + entry + "'");
+      std::vector<int> &cpus = assignments[entry.substr(0, equals)];
+      for (int cpu : ParseCpuList(entry.substr(equals + 1))) cpus.push_back(cpu);
+    }
+  }
+
+  // Parse a kernel style CPU list "0-3,8" (commas) or "0-3" (single range)
+  static std::vector<int> ParseCpuList(const std::string &list) {
+    std::vector<int> cpus;
+    std::stringstream ranges(list);
+    std::string range;
+    while (std::getline(ranges, range, ',')) {
+      if (range.empty()) continue;
+      size_t dash = range.find('-');
+      int first = std::stoi(range.substr(0, dash));
+      int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+      for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+    }
+    return cpus;
+  }
+
+  static std::string CpuList(const std::vector<int> &cpus) {
+    std::string list;
+    for (size_t i = 0; i < cpus.size(); ++i) list += (i ? "," : "") + std::to_string(cpus[i]);
+    return list;
+  }
+
+  // Map CPUs to nodes from sysfs; machines without it are treated as one node
+  void LoadNodes() {
+    for (int node = 0; node < 64; ++node) {
+      std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+      if (!file) continue;
+      std::string list;
+      std::getline(file, list);
+      for (int cpu : ParseCpuList(list)) cpuNodes[cpu] = node;
+    }
+  }
+};
+
+#endif // THREAD_TOPOLOGY_HPP
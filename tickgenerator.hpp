@@ -0,0 +1,255 @@
+/**
+ * tickgenerator.hpp
+ * Deterministic synthetic market data, prices, trades and inquiries for the
+ * seven on-the-run Treasuries.
+ *
+ * The generator emits compact TickEvent records without allocating, so the raw
+ * event rate is limited only by arithmetic. Events are turned into service
+ * objects on demand, written to journals, or pushed straight into services.
+ * The same seed and configuration always reproduce the same event sequence.
+ */
+#ifndef TICK_GENERATOR_HPP
+#define TICK_GENERATOR_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "products.hpp"
+#include "marketdataservice.hpp"
+#include "pricingservice.hpp"
+#include "tradebookingservice.hpp"
+#include "inquiryservice.hpp"
+#include "journal.hpp"
+
+// The seven on-the-run Treasuries: 2Y, 3Y, 5Y, 7Y, 10Y, 20Y and 30Y
+inline std::vector<Bond> OnTheRunTreasuries() {
+  return {
+    Bond("9128283H1", CUSIP, "US2Y", 0.01750f, date(2019, Nov, 30)),
+    Bond("9128283L2", CUSIP, "US3Y", 0.01875f, date(2020, Dec, 15)),
+    Bond("912828M80", CUSIP, "US5Y", 0.02000f, date(2022, Nov, 30)),
+    Bond("9128283J7", CUSIP, "US7Y", 0.02125f, date(2024, Nov, 30)),
+    Bond("9128283F5", CUSIP, "US10Y", 0.02250f, date(2027, Dec, 15)),
+    Bond("912810TW8", CUSIP, "US20Y", 0.02500f, date(2037, Dec, 15)),
+    Bond("912810RZ3", CUSIP, "US30Y", 0.02750f, date(2047, Dec, 15))
+  };
+}
+
+// Books that generated trades are allocated across
+const char* const TRADING_BOOKS[] = { "TRSY1", "TRSY2", "TRSY3" };
+
+/**
+ * One generated event. Plain data so that generation never allocates.
+ */
+struct TickEvent
+{
+  uint64_t timestamp;   // nanoseconds since the start of the session
+  uint64_t sequence;    // position in the generated stream
+  TickType type;
+  int product;          // index into the product universe
+  double mid;
+  double spread;        // top of book spread, or bid/offer spread for prices
+  long quantity;
+  Side side;
+  int book;             // index into TRADING_BOOKS
+};
+
+/**
+ * Configuration for a TickGenerator.
+ */
+struct TickGeneratorConfig
+{
+  uint64_t seed = 9815;
+  double eventsPerSecond = 1000000.0;  // simulated arrival rate used for timestamps
+  int depth = 5;                       // levels per side of each order book
+  // Relative frequency of each event type
+  int orderBookWeight = 8;
+  int priceWeight = 4;
+  int tradeWeight = 1;
+  int inquiryWeight = 1;
+};
+
+/**
+ * Seeded generator of TickEvents.
+ *
+ * Per product, order book spreads walk 1/128 -> 1/64 -> 3/128 -> 1/32 and back,
+ * price spreads alternate between 1/128 and 1/64, and mids oscillate between
+ * 99 and 101 in 1/256 steps. Trades alternate sides, cycle through the three
+ * books and sizes of 1MM to 5MM. Inquiries cycle sizes the same way.
+ */
+class TickGenerator
+{
+
+public:
+
+  // ctor for a generator over the given products
+  TickGenerator(const std::vector<Bond> &_products, const TickGeneratorConfig &_config = TickGeneratorConfig()) :
+    products(_products), config(_config), states(_products.size()), state(_config.seed ? _config.seed : 1), sequence(0), timestamp(0)
+  {
+    totalWeight = config.orderBookWeight + config.priceWeight + config.tradeWeight + config.inquiryWeight;
+    meanInterval = 1e9 / config.eventsPerSecond;
+    for (size_t i = 0; i < states.size(); ++i) {
+      states[i].midStep = static_cast<int>(Random() % 512);
+      states[i].spreadStep = static_cast<int>(Random() % 6);
+    }
+  }
+
+  // Generate the next event
+  TickEvent Next() {
+    uint64_t random = Random();
+    TickEvent event;
+    // Inter-arrival times are uniform on [0.5, 1.5) of the mean interval
+    timestamp += static_cast<uint64_t>(meanInterval * (0.5 + (random >> 11) * (1.0 / 9007199254740992.0)));
+    event.timestamp = timestamp;
+    event.sequence = sequence++;
+    event.product = static_cast<int>((random & 0xffff) % products.size());
+    event.type = TypeOf(static_cast<int>(((random >> 16) & 0xffff) % totalWeight));
+
+    ProductState &productState = states[event.product];
+    int midStep = productState.midStep < 512 ? productState.midStep : 1024 - productState.midStep;
+    event.mid = 99.0 + midStep / 256.0;
+    event.quantity = 1000000L * (1 + static_cast<long>(event.sequence % 5));
+    event.side = (event.sequence & 1) ? SELL : BUY;
+    event.book = static_cast<int>(event.sequence % 3);
+    switch (event.type) {
+    case TICK_ORDER_BOOK: {
+      static const int spreadSteps[] = { 1, 2, 3, 4, 3, 2 };
+      event.spread = spreadSteps[productState.spreadStep] / 128.0;
+      productState.spreadStep = (productState.spreadStep + 1) % 6;
+      productState.midStep = (productState.midStep + 1) % 1024;
+      break;
+    }
+    case TICK_PRICE:
+      event.spread = (event.sequence & 2) ? 1.0 / 64.0 : 1.0 / 128.0;
+      break;
+    default:
+      event.spread = 0.0;
+      break;
+    }
+    return event;
+  }
+
+  // Build the order book for an order book event
+  OrderBook<Bond> ToOrderBook(const TickEvent &event) const {
+    std::vector<Order> bids, offers;
+    bids.reserve(config.depth);
+    offers.reserve(config.depth);
+    for (int level = 0; level < config.depth; ++level) {
+      double offset = event.spread / 2.0 + level / 128.0;
+      long quantity = 10000000L * (level + 1);
+      bids.push_back(Order(event.mid - offset, quantity, BID));
+      offers.push_back(Order(event.mid + offset, quantity, OFFER));
+    }
+    return OrderBook<Bond>(products[event.product], bids, offers);
+  }
+
+  // Build the price for a price event
+  Price<Bond> ToPrice(const TickEvent &event) const {
+    return Price<Bond>(products[event.product], event.mid, event.spread);
+  }
+
+  // Build the trade for a trade event; buys trade at 99, sells at 100
+  Trade<Bond> ToTrade(const TickEvent &event) const {
+    return Trade<Bond>(products[event.product], "T" + std::to_string(event.sequence), event.side == BUY ? 99.0 : 100.0,
+      TRADING_BOOKS[event.book], event.quantity, event.side);
+  }
+
+  // Build the inquiry for an inquiry event
+  Inquiry<Bond> ToInquiry(const TickEvent &event) const {
+    return Inquiry<Bond>("I" + std::to_string(event.sequence), products[event.product], event.side, event.quantity, 0.0, RECEIVED);
+  }
+
+  // Products this generator draws from
+  const std::vector<Bond>& GetProducts() const { return products; }
+
+private:
+  struct ProductState
+  {
+    int midStep = 0;     // position in a 1024 step up-and-down cycle over [99, 101]
+    int spreadStep = 0;  // position in the order book spread cycle
+  };
+
+  std::vector<Bond> products;
+  TickGeneratorConfig config;
+  std::vector<ProductState> states;
+  uint64_t state;
+  uint64_t sequence;
+  uint64_t timestamp;
+  int totalWeight;
+  double meanInterval;
+
+  // xorshift64* step
+  uint64_t Random() {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 2685821657736338717ULL;
+  }
+
+  TickType TypeOf(int draw) const {
+    if (draw < config.orderBookWeight) return TICK_ORDER_BOOK;
+    draw -= config.orderBookWeight;
+    if (draw < config.priceWeight) return TICK_PRICE;
+    draw -= config.priceWeight;
+    if (draw < config.tradeWeight) return TICK_TRADE;
+    return TICK_INQUIRY;
+  }
+};
+
+/**
+ * Push count generated events into the sinks through their OnMessage callbacks.
+ * With eventsPerSecond > 0 the calls are paced to that wall-clock rate,
+ * otherwise they run as fast as possible. Returns the elapsed wall time in seconds.
+ */
+inline double DriveTicks(TickGenerator &generator, uint64_t count, const TickSinks &sinks, double eventsPerSecond = 0.0) {
+  typedef std::chrono::steady_clock Clock;
+  Clock::time_point start = Clock::now();
+  for (uint64_t i = 0; i < count; ++i) {
+    if (eventsPerSecond > 0.0) {
+      Clock::time_point due = start + std::chrono::nanoseconds(static_cast<int64_t>(i * 1e9 / eventsPerSecond));
+      while (Clock::now() < due) {}
+    }
+    TickEvent event = generator.Next();
+    switch (event.type) {
+    case TICK_ORDER_BOOK:
+      if (sinks.marketData) { OrderBook<Bond> orderBook = generator.ToOrderBook(event); sinks.marketData->OnMessage(std::move(orderBook)); }
+      break;
+    case TICK_PRICE:
+      if (sinks.pricing) { Price<Bond> price = generator.ToPrice(event); sinks.pricing->OnMessage(std::move(price)); }
+      break;
+    case TICK_TRADE:
+      if (sinks.tradeBooking) { Trade<Bond> trade = generator.ToTrade(event); sinks.tradeBooking->OnMessage(std::move(trade)); }
+      break;
+    case TICK_INQUIRY:
+      if (sinks.inquiry) { Inquiry<Bond> inquiry = generator.ToInquiry(event); sinks.inquiry->OnMessage(std::move(inquiry)); }
+      break;
+    }
+  }
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+/**
+ * Write count generated events into the four journals under a directory,
+ * as text or as block journals.
+ */
+inline void WriteTickJournals(TickGenerator &generator, uint64_t count, const std::string &directory, JournalFormat format = JOURNAL_TEXT) {
+  JournalWriter marketData(JournalPath(directory, MARKET_DATA_JOURNAL, format), format);
+  JournalWriter prices(JournalPath(directory, PRICE_JOURNAL, format), format);
+  JournalWriter trades(JournalPath(directory, TRADE_JOURNAL, format), format);
+  JournalWriter inquiries(JournalPath(directory, INQUIRY_JOURNAL, format), format);
+  for (uint64_t i = 0; i < count; ++i) {
+    TickEvent event = generator.Next();
+    switch (event.type) {
+    case TICK_ORDER_BOOK: marketData.Write(event.timestamp, generator.ToOrderBook(event)); break;
+    case TICK_PRICE: prices.Write(event.timestamp, generator.ToPrice(event)); break;
+    case TICK_TRADE: trades.Write(event.timestamp, generator.ToTrade(event)); break;
+    case TICK_INQUIRY: inquiries.Write(event.timestamp, generator.ToInquiry(event)); break;
+    }
+  }
+  marketData.Close();
+  prices.Close();
+  trades.Close();
+  inquiries.Close();
+}
+
+#endif // TICK_GENERATOR_HPP
@@ -0,0 +1,448 @@
+/**
+ * timeseries.hpp
+ * Append-only, compressed, columnar history of prices, risk and other values
+ * over the trading day.
+ *
+ * A TimeSeriesStore keeps one series per product handle, each a timestamp
+ * column and a fixed number of double value columns. Points are appended in
+ * time order into chunks of up to CHUNK_POINTS points. Within a chunk the
+ * timestamps are stored as zigzagged deltas of deltas, which are a single bit
+ * for regularly spaced points, and every value column with Gorilla-style XOR
+ * encoding against the previous value in the column, a single bit when the
+ * value repeats and only the changed middle bits otherwise. Each chunk starts
+ * its encoding afresh and records its first and last timestamps, so a range
+ * query decodes only the chunks it overlaps.
+ *
+ * PriceHistoryListener and RiskHistoryListener feed a store from a
+ * PricingService and a RiskService.
+ */
+#ifndef TIME_SERIES_HPP
+#define TIME_SERIES_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "soa.hpp"
+#include "pricingservice.hpp"
+#include "riskservice.hpp"
+
+/**
+ * The points of a series in a time range, one vector per column.
+ */
+struct TimeSeriesColumns
+{
+  std::vector<uint64_t> timestamps;
+  std::vector<std::vector<double>> values;  // by column, parallel to timestamps
+};
+
+/**
+ * One downsampling bucket of a value column.
+ */
+struct TimeSeriesBar
+{
+  uint64_t start;  // timestamp the bucket starts at
+  double open;     // first value in the bucket
+  double high;
+  double low;
+  double close;    // last value in the bucket
+  uint32_t count;  // points in the bucket
+};
+
+/**
+ * Compressed time series of a fixed set of value columns by series handle.
+ */
+class TimeSeriesStore
+{
+
+public:
+
+  // Points per chunk; a chunk is the unit of encoding and of range skipping
+  static const uint32_t CHUNK_POINTS = 1024;
+
+  // ctor for a store with the named value columns, pre-sized for the expected number of series
+  explicit TimeSeriesStore(std::vector<std::string> _columns, size_t expectedSeries = 0) : columns(std::move(_columns)) {
+    if (columns.empty()) throw std::invalid_argument("TimeSeriesStore needs at least one value column");
+    series.reserve(expectedSeries);
+  }
+
+  // Append a point of one value per column to a series. Series handles are
+  // dense from zero; a new handle creates the series and any below it.
+  // Timestamps within a series must not go backwards.
+  void Append(uint32_t handle, uint64_t timestamp, const double *values) {
+    if (handle >= series.size()) series.resize(handle + 1);
+    Series &target = series[handle];
+    if (target.points && timestamp < target.lastTimestamp) {
+      throw std::runtime_error("Time series point out of order for series: " + std::to_string(handle));
+    }
+    if (target.chunks.empty() || target.chunks.back().count == CHUNK_POINTS) {
+      if (!target.chunks.empty()) target.chunks.back().bits.shrink_to_fit();
+      target.chunks.emplace_back();
+      target.chunks.back().firstTimestamp = timestamp;
+      target.previousValues.assign(columns.size(), 0);
+      target.previousLeading.assign(columns.size(), 0xff);
+      target.previousTrailing.assign(columns.size(), 0);
+    }
+    Chunk &chunk = target.chunks.back();
+    BitWriter writer(chunk.bits, chunk.bitCount);
+    if (!chunk.count) {
+      writer.Write(timestamp, 64);
+      for (size_t column = 0; column < columns.size(); ++column) {
+        target.previousValues[column] = Bits(values[column]);
+        writer.Write(target.previousValues[column], 64);
+      }
+      target.previousDelta = 0;
+    } else {
+      const uint64_t delta = timestamp - chunk.lastTimestamp;
+      WriteDeltaOfDelta(writer, static_cast<int64_t>(delta - target.previousDelta));
+      target.previousDelta = delta;
+      for (size_t column = 0; column < columns.size(); ++column) {
+        WriteXor(writer, target, column, Bits(values[column]));
+      }
+    }
+    chunk.bitCount = writer.BitCount();
+    chunk.lastTimestamp = timestamp;
+    ++chunk.count;
+    target.lastTimestamp = timestamp;
+    ++target.points;
+    ++points;
+  }
+
+  // Call fn(timestamp, values) for every point of a series in [from, to), in time order
+  template<typename F>
+  void Scan(uint32_t handle, uint64_t from, uint64_t to, F fn) const {
+    if (handle >= series.size()) return;
+    std::vector<double> values(columns.size());
+    std::vector<uint64_t> previous(columns.size());
+    std::vector<uint8_t> leading(columns.size()), trailing(columns.size());
+    for (const Chunk &chunk : series[handle].chunks) {
+      if (chunk.lastTimestamp < from) continue;
+      if (chunk.firstTimestamp >= to) break;
+      BitReader reader(chunk.bits);
+      uint64_t timestamp = reader.Read(64);
+      uint64_t delta = 0;
+      for (size_t column = 0; column < columns.size(); ++column) {
+        previous[column] = reader.Read(64);
+        leading[column] = 0xff;
+        trailing[column] = 0;
+      }
+      for (uint32_t point = 0;; ) {
+        if (timestamp >= to) return;
+        if (timestamp >= from) {
+          for (size_t column = 0; column < columns.size(); ++column) values[column] = Value(previous[column]);
+          fn(timestamp, values.data());
+        }
+        if (++point == chunk.count) break;
+        delta += static_cast<uint64_t>(ReadDeltaOfDelta(reader));
+        timestamp += delta;
+        for (size_t column = 0; column < columns.size(); ++column) {
+          previous[column] = ReadXor(reader, previous[column], leading[column], trailing[column]);
+        }
+      }
+    }
+  }
+
+  // Points of a series in [from, to), decoded into columns; reuses out's vectors
+  void Range(uint32_t handle, uint64_t from, uint64_t to, TimeSeriesColumns &out) const {
+    out.timestamps.clear();
+    out.values.resize(columns.size());
+    for (std::vector<double> &column : out.values) column.clear();
+    Scan(handle, from, to, [&](uint64_t timestamp, const double *values) {
+      out.timestamps.push_back(timestamp);
+      for (size_t column = 0; column < columns.size(); ++column) out.values[column].push_back(values[column]);
+    });
+  }
+
+  // One bar per bucketNanos-wide bucket of a value column in [from, to) that
+  // holds any points; buckets are aligned to from. Reuses out.
+  void Downsample(uint32_t handle, size_t column, uint64_t from, uint64_t to, uint64_t bucketNanos, std::vector<TimeSeriesBar> &out) const {
+    if (column >= columns.size()) throw std::out_of_range("Time series column out of range: " + std::to_string(column));
+    if (!bucketNanos) throw std::invalid_argument("Time series buckets must be at least a nanosecond wide");
+    out.clear();
+    Scan(handle, from, to, [&](uint64_t timestamp, const double *values) {
+      const uint64_t start = from + (timestamp - from) / bucketNanos * bucketNanos;
+      const double value = values[column];
+      if (out.empty() || out.back().start != start) {
+        out.push_back(TimeSeriesBar{ start, value, value, value, value, 0 });
+      }
+      TimeSeriesBar &bar = out.back();
+      bar.high = std::max(bar.high, value);
+      bar.low = std::min(bar.low, value);
+      bar.close = value;
+      ++bar.count;
+    });
+  }
+
+  // Get the names of the value columns
+  const std::vector<std::string>& GetColumns() const { return columns; }
+
+  // Number of series, including empty ones below the highest handle appended to
+  size_t SeriesCount() const { return series.size(); }
+
+  // Points in one series
+  uint64_t Points(uint32_t handle) const { return handle < series.size() ? series[handle].points : 0; }
+
+  // Points in every series
+  uint64_t Points() const { return points; }
+
+  // Bytes of encoded points
+  size_t EncodedBytes() const {
+    size_t bytes = 0;
+    for (const Series &entry : series) {
+      for (const Chunk &chunk : entry.chunks) bytes += (chunk.bitCount + 7) / 8;
+    }
+    return bytes;
+  }
+
+  // Bytes held by the store, chunk and series bookkeeping and unused capacity included
+  size_t MemoryBytes() const {
+    size_t bytes = sizeof(*this) + series.capacity() * sizeof(Series);
+    for (const Series &entry : series) {
+      bytes += entry.chunks.capacity() * sizeof(Chunk) + entry.previousValues.capacity() * sizeof(uint64_t) + entry.previousLeading.capacity() * 2;
+      for (const Chunk &chunk : entry.chunks) bytes += chunk.bits.capacity() * sizeof(uint64_t);
+    }
+    return bytes;
+  }
+
+private:
+
+  // Up to CHUNK_POINTS points of one series, encoded
+  struct Chunk
+  {
+    std::vector<uint64_t> bits;
+    uint64_t bitCount = 0;
+    uint64_t firstTimestamp = 0;
+    uint64_t lastTimestamp = 0;
+    uint32_t count = 0;
+  };
+
+  // The chunks of one series and the encoder state of its last chunk
+  struct Series
+  {
+    std::vector<Chunk> chunks;
+    uint64_t points = 0;
+    uint64_t lastTimestamp = 0;
+    uint64_t previousDelta = 0;
+    std::vector<uint64_t> previousValues;   // by column, as bits
+    std::vector<uint8_t> previousLeading;   // leading zeros of the last XOR written; 0xff before any
+    std::vector<uint8_t> previousTrailing;
+  };
+
+  // Appends bits most significant first to a vector of words
+  class BitWriter
+  {
+  public:
+    BitWriter(std::vector<uint64_t> &_words, uint64_t _bitCount) : words(_words), bitCount(_bitCount) {}
+
+    // Write the low count bits of value, 1 <= count <= 64
+    void Write(uint64_t value, unsigned count) {
+      if (count < 64) value &= (uint64_t(1) << count) - 1;
+      const unsigned used = static_cast<unsigned>(bitCount % 64);
+      if (!used) words.push_back(0);
+      const unsigned room = 64 - used;
+      if (count <= room) {
+        words.back() |= value << (room - count);
+      } else {
+        words.back() |= value >> (count - room);
+        words.push_back(value << (64 - (count - room)));
+      }
+      bitCount += count;
+    }
+
+    uint64_t BitCount() const { return bitCount; }
+
+  private:
+    std::vector<uint64_t> &words;
+    uint64_t bitCount;
+  };
+
+  // Reads bits back in the order a BitWriter wrote them
+  class BitReader
+  {
+  public:
+    explicit BitReader(const std::vector<uint64_t> &_words) : words(_words.data()), position(0) {}
+
+    // Read count bits, 1 <= count <= 64
+    uint64_t Read(unsigned count) {
+      const uint64_t word = position / 64;
+      const unsigned used = static_cast<unsigned>(position % 64);
+      const unsigned room = 64 - used;
+      uint64_t value;
+      if (count <= room) {
+        value = (words[word] << used) >> (64 - count);
+      } else {
+        value = (words[word] << used) >> used << (count - room) | words[word + 1] >> (64 - (count - room));
+      }
+      position += count;
+      return count < 64 ? value & ((uint64_t(1) << count) - 1) : value;
+    }
+
+    bool ReadBit() { return Read(1) != 0; }
+
+  private:
+    const uint64_t *words;
+    uint64_t position;
+  };
+
+  std::vector<std::string> columns;
+  std::vector<Series> series; // by handle
+  uint64_t points = 0;
+
+  static uint64_t Bits(double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+  }
+
+  static double Value(uint64_t bits) {
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+  // Delta of delta as '0' for zero, '10' and 16 bits, '110' and 32 bits or '111' and 64 bits, zigzagged
+  static void WriteDeltaOfDelta(BitWriter &writer, int64_t deltaOfDelta) {
+    const uint64_t zigzag = static_cast<uint64_t>(deltaOfDelta) << 1 ^ static_cast<uint64_t>(deltaOfDelta >> 63);
+    if (!zigzag) {
+      writer.Write(0, 1);
+    } else if (zigzag < (uint64_t(1) << 16)) {
+      writer.Write(0x2, 2);
+      writer.Write(zigzag, 16);
+    } else if (zigzag < (uint64_t(1) << 32)) {
+      writer.Write(0x6, 3);
+      writer.Write(zigzag, 32);
+    } else {
+      writer.Write(0x7, 3);
+      writer.Write(zigzag, 64);
+    }
+  }
+
+  static int64_t ReadDeltaOfDelta(BitReader &reader) {
+    uint64_t zigzag;
+    if (!reader.ReadBit()) return 0;
+    if (!reader.ReadBit()) zigzag = reader.Read(16);
+    else if (!reader.ReadBit()) zigzag = reader.Read(32);
+    else zigzag = reader.Read(64);
+    return static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+  }
+
+  // Value as its XOR with the previous one in the column: '0' if equal; '10'
+  // and the meaningful bits if they fit the previous leading and trailing
+  // zeros; otherwise '11', 6 bits of leading zeros, 6 bits of meaningful
+  // length (64 written as 0) and the meaningful bits
+  static void WriteXor(BitWriter &writer, Series &target, size_t column, uint64_t bits) {
+    const uint64_t xored = bits ^ target.previousValues[column];
+    target.previousValues[column] = bits;
+    if (!xored) {
+      writer.Write(0, 1);
+      return;
+    }
+    const unsigned leading = static_cast<unsigned>(__builtin_clzll(xored));
+    const unsigned trailing = static_cast<unsigned>(__builtin_ctzll(xored));
+    uint8_t &previousLeading = target.previousLeading[column];
+    uint8_t &previousTrailing = target.previousTrailing[column];
+    if (previousLeading != 0xff && leading >= previousLeading && trailing >= previousTrailing) {
+      writer.Write(0x2, 2);
+      writer.Write(xored >> previousTrailing, 64 - previousLeading - previousTrailing);
+      return;
+    }
+    const unsigned length = 64 - leading - trailing;
+    writer.Write(0x3, 2);
+    writer.Write(leading, 6);
+    writer.Write(length & 63, 6);
+    writer.Write(xored >> trailing, length);
+    previousLeading = static_cast<uint8_t>(leading);
+    previousTrailing = static_cast<uint8_t>(trailing);
+  }
+
+  static uint64_t ReadXor(BitReader &reader, uint64_t previous, uint8_t &leading, uint8_t &trailing) {
+    if (!reader.ReadBit()) return previous;
+    if (reader.ReadBit()) {
+      leading = static_cast<uint8_t>(reader.Read(6));
+      unsigned length = static_cast<unsigned>(reader.Read(6));
+      if (!length) length = 64;
+      trailing = static_cast<uint8_t>(64 - leading - length);
+    }
+    return previous ^ reader.Read(64 - leading - trailing) << trailing;
+  }
+};
+
+// Nanoseconds on the steady clock, the default timestamp of history listeners
+inline uint64_t SteadyClockNanos() {
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+/**
+ * Records every price a PricingService publishes into a TimeSeriesStore with
+ * columns mid and bidOfferSpread, one series per product handle.
+ * Type T is the product type.
+ */
+template<typename T>
+class PriceHistoryListener : public ServiceListener<Price<T>>
+{
+
+public:
+
+  // Timestamp of a point being recorded
+  typedef uint64_t (*Clock)();
+
+  // ctor for a listener recording prices from pricing into history
+  PriceHistoryListener(PricingService<T> &_pricing, TimeSeriesStore &_history, Clock _clock = &SteadyClockNanos) :
+    pricing(_pricing), history(_history), clock(_clock) {
+    if (history.GetColumns().size() != 2) throw std::invalid_argument("Price history needs mid and bidOfferSpread columns");
+  }
+
+  void ProcessAdd(Price<T> &data) override { ProcessUpdate(data); }
+
+  void ProcessRemove(Price<T> &) override {}
+
+  void ProcessUpdate(Price<T> &data) override {
+    const double values[] = { data.GetMid(), data.GetBidOfferSpread() };
+    history.Append(pricing.GetProductHandle(data.GetProduct().GetProductId()), clock(), values);
+  }
+
+private:
+  PricingService<T> &pricing;
+  TimeSeriesStore &history;
+  Clock clock;
+};
+
+/**
+ * Records every PV01 value a RiskService publishes into a TimeSeriesStore
+ * with columns pv01 and quantity, one series per product handle.
+ * Type T is the product type.
+ */
+template<typename T>
+class RiskHistoryListener : public ServiceListener<PV01<T>>
+{
+
+public:
+
+  // Timestamp of a point being recorded
+  typedef uint64_t (*Clock)();
+
+  // ctor for a listener recording risk from risk into history
+  RiskHistoryListener(RiskService<T> &_risk, TimeSeriesStore &_history, Clock _clock = &SteadyClockNanos) :
+    risk(_risk), history(_history), clock(_clock) {
+    if (history.GetColumns().size() != 2) throw std::invalid_argument("Risk history needs pv01 and quantity columns");
+  }
+
+  void ProcessAdd(PV01<T> &data) override { ProcessUpdate(data); }
+
+  void ProcessRemove(PV01<T> &) override {}
+
+  void ProcessUpdate(PV01<T> &data) override {
+    const double values[] = { data.GetPV01(), static_cast<double>(data.GetQuantity()) };
+    history.Append(risk.GetProductHandle(data.GetProduct().GetProductId()), clock(), values);
+  }
+
+private:
+  RiskService<T> &risk;
+  TimeSeriesStore &history;
+  Clock clock;
+};
+
+#endif // TIME_SERIES_HPP
@@ -0,0 +1,86 @@
+/**
+ * tradebatch.hpp
+ * Sorting and reduction kernels for applying trades in batches.
+ *
+ * A batch of trades is turned into parallel arrays of integer keys (product
+ * handle and book) and signed quantities. RadixSortByKey groups equal keys
+ * together with a stable LSD radix sort that moves both arrays, and
+ * SumQuantities reduces each group's contiguous quantities, two lanes at a
+ * time where SSE2 is available.
+ */
+#ifndef TRADE_BATCH_HPP
+#define TRADE_BATCH_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Sum of count quantities, one element at a time
+inline int64_t SumQuantitiesScalar(const int64_t *quantities, size_t count) {
+  int64_t total = 0;
+  for (size_t i = 0; i < count; ++i) total += quantities[i];
+  return total;
+}
+
+// Sum of count quantities, four per step in two vector accumulators where SSE2 is available
+inline int64_t SumQuantities(const int64_t *quantities, size_t count) {
+#if defined(__SSE2__)
+  size_t i = 0;
+  __m128i first = _mm_setzero_si128(), second = _mm_setzero_si128();
+  for (; i + 4 <= count; i += 4) {
+    first = _mm_add_epi64(first, _mm_loadu_si128(reinterpret_cast<const __m128i*>(quantities + i)));
+    second = _mm_add_epi64(second, _mm_loadu_si128(reinterpret_cast<const __m128i*>(quantities + i + 2)));
+  }
+  first = _mm_add_epi64(first, second);
+  first = _mm_add_epi64(first, _mm_shuffle_epi32(first, _MM_SHUFFLE(1, 0, 3, 2)));
+  int64_t total;
+  _mm_storel_epi64(reinterpret_cast<__m128i*>(&total), first);
+  return total + SumQuantitiesScalar(quantities + i, count - i);
+#else
+  return SumQuantitiesScalar(quantities, count);
+#endif
+}
+
+// Stable sort of keys ascending, moving quantities with them, for keys below
+// 2^keyBits. keyScratch and quantityScratch are resized and used as the
+// second buffer of each pass.
+inline void RadixSortByKey(std::vector<uint64_t> &keys, std::vector<int64_t> &quantities, int keyBits,
+                           std::vector<uint64_t> &keyScratch, std::vector<int64_t> &quantityScratch) {
+  const int DIGIT_BITS = 11;
+  const size_t BUCKETS = size_t(1) << DIGIT_BITS;
+  const size_t count = keys.size();
+  keyScratch.resize(count);
+  quantityScratch.resize(count);
+  std::vector<size_t> offsets(BUCKETS);
+  for (int shift = 0; shift < keyBits; shift += DIGIT_BITS) {
+    std::fill(offsets.begin(), offsets.end(), 0);
+    for (size_t i = 0; i < count; ++i) ++offsets[(keys[i] >> shift) & (BUCKETS - 1)];
+    size_t start = 0;
+    for (size_t bucket = 0; bucket < BUCKETS; ++bucket) {
+      size_t size = offsets[bucket];
+      offsets[bucket] = start;
+      start += size;
+    }
+    for (size_t i = 0; i < count; ++i) {
+      size_t to = offsets[(keys[i] >> shift) & (BUCKETS - 1)]++;
+      keyScratch[to] = keys[i];
+      quantityScratch[to] = quantities[i];
+    }
+    keys.swap(keyScratch);
+    quantities.swap(quantityScratch);
+  }
+}
+
+// Number of bits needed to hold every key up to maxKey
+inline int KeyBits(uint64_t maxKey) {
+  int bits = 0;
+  while (bits < 64 && (maxKey >> bits)) ++bits;
+  return bits;
+}
+
+#endif // TRADE_BATCH_HPP
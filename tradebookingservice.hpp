@@ -5,7 +5,7 @@
 #define TRADE_BOOKING_SERVICE_HPP
 
 #include "soa.hpp"
-#include <map>
+#include "flatstore.hpp"
 #include <vector>
 #include <string>
 #include <stdexcept>
@@ -23,6 +23,7 @@ public:
   // Constructor for a Trade
   Trade(const T &_product, std::string _tradeId, double _price, std::string _book, long _quantity, Side _side)
     : product(_product), tradeId(_tradeId), price(_price), book(_book), quantity(_quantity), side(_side) {}
+  Trade() : price(0.0), quantity(0), side(BUY) {}
 
   // Getters
   const T& GetProduct() const { return product; }
@@ -49,39 +50,112 @@ private:
 template<typename T>
 class TradeBookingService : public Service<std::string, Trade<T>> {
 public:
+  // Dense index of an entry, stable for the life of the service
+  typedef typename FlatStore<Trade<T>>::Handle Handle;
+
+  static constexpr Handle NO_HANDLE = FlatStore<Trade<T>>::NO_HANDLE;
+
+  // ctor pre-sizing the trade store and listener lists
+  explicit TradeBookingService(const ServiceCapacity &capacity = ServiceCapacity()) : dataStore(capacity.trades) {
+    listeners.Reserve(capacity.listeners);
+  }
+
+  // Touch every page of the pre-sized store before the open
+  void WarmUp() { dataStore.Warm(); }
+
   // Book the trade
   void BookTrade(const Trade<T> &trade) {
+    SOA_PROBE_SERVICE("BookTrade");
     const std::string& tradeId = trade.GetTradeId();
-    dataStore[tradeId] = trade;
+    NotifyAdd(dataStore.Upsert(tradeId, trade));
+  }
 
-    // Notify all listeners
-    for (auto &listener : listeners) {
-      listener->ProcessAdd(trade);
-    }
+  // Book a trade the caller hands over, moving it into the store
+  void BookTrade(Trade<T> &&trade) {
+    SOA_PROBE_SERVICE("BookTrade");
+    std::string tradeId = trade.GetTradeId();
+    NotifyAdd(dataStore.Upsert(tradeId, std::move(trade)));
+  }
+
+  // Book a trade constructed in the store from Trade<T> ctor arguments
+  template<typename... Args>
+  void EmplaceData(Args&&... args) {
+    SOA_PROBE_SERVICE("EmplaceData");
+    NotifyAdd(dataStore.Emplace([](const Trade<T> &trade) { return trade.GetTradeId(); }, std::forward<Args>(args)...));
+  }
+
+  // OnMessage callback for trades pushed by a Connector
+  void OnMessage(Trade<T> &data) override {
+    BookTrade(data);
+  }
+
+  // OnMessage callback for trades a Connector hands over
+  void OnMessage(Trade<T> &&data) override {
+    BookTrade(std::move(data));
   }
 
   // Get data for a specific trade ID
   Trade<T>& GetData(std::string tradeId) override {
-    if (dataStore.find(tradeId) != dataStore.end()) {
-      return dataStore[tradeId];
-    } else {
+    Trade<T> *trade = dataStore.Get(tradeId);
+    if (!trade) {
       throw std::runtime_error("Trade not found for ID: " + tradeId);
     }
+    return *trade;
+  }
+
+  // Get data by trade ID, or nullptr if there is none; never throws
+  Trade<T>* TryGetData(const std::string &tradeId) noexcept override {
+    return dataStore.Get(tradeId);
+  }
+
+  // Handle of a key, or NO_HANDLE if nothing has been stored for it
+  Handle GetHandle(const std::string &tradeId) const noexcept {
+    return dataStore.Find(tradeId);
+  }
+
+  // Get data by a handle from GetHandle; never throws
+  Trade<T>& GetData(Handle handle) noexcept {
+    return dataStore.At(handle);
   }
 
   // Add a listener to the service
   void AddListener(ServiceListener<Trade<T>>* listener) override {
-    listeners.push_back(listener);
+    listeners.Add(listener);
+  }
+
+  // Add a listener with a priority and product filter
+  ListenerHandle AddListener(ServiceListener<Trade<T>>* listener, const ListenerOptions &options) override {
+    return listeners.Add(listener, options);
+  }
+
+  // Remove a listener registration
+  bool RemoveListener(ListenerHandle handle) override {
+    return listeners.Remove(handle);
   }
 
   // Get all listeners
   const std::vector<ServiceListener<Trade<T>>*>& GetListeners() const override {
-    return listeners;
+    return listeners.All();
   }
 
 private:
-  std::map<std::string, Trade<T>> dataStore; // Map to store trades by trade ID
-  std::vector<ServiceListener<Trade<T>>*> listeners; // Listeners to notify on updates
+  FlatStore<Trade<T>> dataStore; // Trades by trade ID
+  ListenerRegistry<Trade<T>> listeners; // Listeners to notify on updates
+
+  // Notify the listeners for the trade's product of a stored trade
+  void NotifyAdd(Trade<T> &stored) {
+    for (auto &listener : listeners.For(stored.GetProduct().GetProductId())) {
+      SOA_PROBE_LISTENER(listener);
+      listener->ProcessAdd(stored);
+    }
+  }
 };
 
+// Instantiated once in instantiations.cpp when building against the soa library
+#ifdef SOA_EXTERN_TEMPLATES
+#include "products.hpp"
+SOA_EXTERN_PRODUCT_TEMPLATE(Trade)
+SOA_EXTERN_PRODUCT_TEMPLATE(TradeBookingService)
+#endif
+
 #endif // TRADE_BOOKING_SERVICE_HPP